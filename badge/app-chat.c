@@ -278,8 +278,9 @@ static void chat_event (OrchardAppContext *context,
 			    "%s WANTS TO CHAT!",
 			    config->name);
 
-			radioSend (&KRADIO1, p->netid, RADIO_PROTOCOL_SHOUT,
-			    strlen (p->txbuf) + 1, p->txbuf);
+			radioSendAsync (&KRADIO1, p->netid,
+			    RADIO_PROTOCOL_SHOUT, strlen (p->txbuf) + 1,
+			    p->txbuf, NULL, NULL);
 
 			p->listitems[0] = "Type @ or press button to exit";
 			memset (p->txbuf, 0, sizeof(p->txbuf));
@@ -298,9 +299,10 @@ static void chat_event (OrchardAppContext *context,
 				orchardAppExit ();
 			} else {
 				p->txbuf[uiContext->selected] = 0x0;
-				radioSend (&KRADIO1, p->netid,
+				radioSendAsync (&KRADIO1, p->netid,
 				    RADIO_PROTOCOL_CHAT,
-				    uiContext->selected + 1, p->txbuf);
+				    uiContext->selected + 1, p->txbuf,
+				    NULL, NULL);
 				memset (p->txbuf, 0, sizeof(p->txbuf));
 				p->uiCtx.total =  KW01_PKT_PAYLOADLEN - 1;
 				/* Tell the keyboard UI to redraw */
@@ -7,8 +7,9 @@
 #include "pit_lld.h"
 #include "pit_reg.h"
 
+#include "dtmf.h"
+
 #include <stdint.h>
-#include <math.h>
 #include <string.h>
 
 typedef struct dialer_button {
@@ -101,43 +102,11 @@ typedef struct _DHandles {
 
 } DHandles;
 
-static double fast_sin(double x)
-{
-	const double PI	=  3.14159265358979323846264338327950288;
-	const double INVPI =  0.31830988618379067153776752674502872;
-	const double A	 =  0.00735246819687011731341356165096815;
-	const double B	 = -0.16528911397014738207016302002888890;
-	const double C	 =  0.99969198629596757779830113868360584;
-
-	int32_t k;
-	double x2;
-
-	/* find offset of x from the range -pi/2 to pi/2 */
-	k = round (INVPI * x);
-
-	/* bring x into range */
-	x -= k * PI;
-
-	/* calculate sine */
-	x2 = x * x;
-	x = x*(C + x2*(B + A*x2));
-
-	/* if x is in an odd pi count we must flip */
-	if (k % 2) x = -x;
-
-	return x;
-}
-
 void
 tonePlay (GWidgetObject * w, uint8_t b, uint32_t duration)
 {
 	uint32_t i;
-	double fract1;
-	double fract2;
-	double point1;
-	double point2;
-	double result;
-	double pi;
+	DTMF_TONE t;
 	uint16_t * buf;
 	uint16_t freqa;
 	uint16_t freqb;
@@ -146,26 +115,25 @@ tonePlay (GWidgetObject * w, uint8_t b, uint32_t duration)
 	freqa = buttons[b].button_freq_a;
 	freqb = buttons[b].button_freq_b;
 
-	if (freqa == 0 && freqa == 0)
+	if (freqa == 0 && freqb == 0)
 		return;
 
 	samples = buttons[b].button_samples;
 
 	buf = chHeapAlloc (NULL, samples * sizeof(uint16_t));
 
-	pi = (3.14159265358979323846264338327950288 * 2);
-
-	fract1 = (double)(pi)/(double)(DIALER_SAMPLERATE/freqa);
-	fract2 = (double)(pi)/(double)(DIALER_SAMPLERATE/freqb);
+	/*
+	 * The sample counts in the button table hold a whole number
+	 * of cycles of each tone once its period is rounded down to a
+	 * whole number of samples, so the buffer can be played over
+	 * and over without a click. Run the oscillators at exactly
+	 * those periods.
+	 */
 
-	for (i = 0; i < samples; i++) {
-		point1 = fract1 * i;
-		result = 2047 + (fast_sin (point1) * 2047);
-		point2 = fract2 * i;
-		result += 2047 + (fast_sin (point2) * 2047);
-		result /= 2.0;
-		buf[i] = (uint16_t)round (result);
-	}
+	dtmfToneInit (&t, freqa, freqb, DIALER_SAMPLERATE, DTMF_LEVEL_MAX);
+	t.dt_step[0] = ((uint64_t)1 << 32) / (DIALER_SAMPLERATE / freqa);
+	t.dt_step[1] = ((uint64_t)1 << 32) / (DIALER_SAMPLERATE / freqb);
+	dtmfToneGen (&t, buf, samples);
 
 	pitEnable (&PIT1, 1);
 
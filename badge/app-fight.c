@@ -51,6 +51,20 @@ static KW01_PKT pending_enemy_pkt;
 static peer current_enemy;                    // current enemy we are attacking/talking to
 static RoundState rr;
 
+/*
+ * Opcodes we couldn't send because the protocol's window was full.
+ * They go out in order from the frame tick once there's room.
+ */
+static uint8_t pending_ops[PROTO_WINDOW];
+static uint8_t pending_op_count = 0;
+
+/*
+ * A fightpkt has to fit in a protocol message. It does with the short
+ * enums arm-none-eabi uses by default, but not if player_type is int
+ * sized, and then msgSend() would refuse every packet.
+ */
+typedef char fightpkt_fits_in_proto_mtu[sizeof(fightpkt) <= PROTO_MTU ? 1 : -1];
+
 extern systime_t char_reset_at;
 extern void ledShowHP(void);
 
@@ -165,6 +179,7 @@ static void state_idle_enter(void) {
 
   config->in_combat = 0;
   pending_enemy_netid = 0;
+  pending_op_count = 0;
 
   ledSetFunction(fxlist[config->led_pattern].function);
 }
@@ -1130,15 +1145,16 @@ static void state_show_results_tick() {
     show_damage();
     
     // play one sound in frame 1, either a hard clank, soft clank, or random hit sound
+    // these are mixed in as effects so they don't cut off the announcer
     if ((rr.theirattack & ATTACK_ISCRIT) || (rr.ourattack & ATTACK_ISCRIT)) {
       // crit
-      dacPlay("fight/clank2.raw");
+      dacVoicePlay("fight/clank2.raw", DAC_GAIN_UNITY);
     } else { 
       if (rr.match == true) { 
-        dacPlay("fight/clank1.raw");
+        dacVoicePlay("fight/clank1.raw", DAC_GAIN_UNITY);
       } else {
         vary_play(p->tmp, "fight/hit", 3);
-        dacPlay(p->tmp);
+        dacVoicePlay(p->tmp, DAC_GAIN_UNITY);
       }
     }
   }
@@ -1738,6 +1754,7 @@ static void fight_start(OrchardAppContext *context) {
 
   /* set packet size */
   p->proto->mtu = sizeof(fightpkt);
+  pending_op_count = 0;
   
   last_ui_time = chVTGetSystemTime();
   orchardAppTimer(context, FRAME_INTERVAL_US, true);
@@ -1802,15 +1819,13 @@ static void state_approval_wait_enter(void) {
   dacPlay("fight/loop1.raw");
 }
 
-static void sendGamePacket(uint8_t opcode) {
+static int gamePacketSend(uint8_t opcode) {
   // sends a game packet to current_enemy
   userconfig *config;
   OrchardAppContext *context = instance.context;
   FightHandles *p = instance.context->priv;
   fightpkt packet;
-#ifdef DEBUG_FIGHT_NETWORK
   int res;
-#endif /* DEBUG_FIGHT_NETWORK */
   
   config = getConfig();
   memset (&packet, 0, sizeof(fightpkt));
@@ -1844,12 +1859,36 @@ static void sendGamePacket(uint8_t opcode) {
   res = msgSend(context, &packet);
 
   if (res == -1) {
-    chprintf(stream, "transmit fail. packet too big / xmit busy?\r\n");
+    chprintf(stream, "transmit fail. window full, will retry\r\n");
   }
 #else
-  msgSend(context, &packet);
+  res = msgSend(context, &packet);
 #endif /* DEBUG_FIGHT_NETWORK */
 
+  return res;
+}
+
+static void sendGamePacket(uint8_t opcode) {
+  // nothing goes ahead of what's already waiting
+  if (pending_op_count == 0 && gamePacketSend(opcode) == 0)
+    return;
+
+  if (pending_op_count == PROTO_WINDOW) {
+    chprintf(stream, "FIGHT: enemy isn't acknowledging, opcode 0x%x lost\r\n",
+             opcode);
+    return;
+  }
+
+  pending_ops[pending_op_count++] = opcode;
+}
+
+static void sendPending(void) {
+  while (pending_op_count != 0) {
+    if (gamePacketSend(pending_ops[0]) != 0)
+      return;
+    pending_op_count--;
+    memmove(pending_ops, pending_ops + 1, pending_op_count);
+  }
 }
 
 static void start_fight(OrchardAppContext *context) {
@@ -1923,6 +1962,7 @@ static void fight_event(OrchardAppContext *context,
       fight_funcs[current_fight_state].tick();
 
     tickHandle(context);
+    sendPending();
     if (countdown > 0) {
       // our time reference is based on elapsed time. We will init if need be.
       if (last_tick_time != 0) { 
@@ -2227,7 +2267,7 @@ static void fightRadioEventHandler(KW01_PKT * pkt) {
   userconfig *config = getConfig();
   PACKET * proto;
   
-  /* this code runs in the MAIN thread, it runs along side our thread */
+  /* this code runs in the radio's RX thread, it runs along side our thread */
   /* everything else runs in the app's thread */
 
   /* peek inside the packet and see if it's bound for us */
@@ -2247,11 +2287,13 @@ static void fightRadioEventHandler(KW01_PKT * pkt) {
   }
 
   if (pkt->kw01_hdr.kw01_prot == RADIO_PROTOCOL_FIGHT) {   
-    if (( (fp->opcode == OP_BATTLE_REQ) || (fp->opcode == OP_GRANT) ) &&
+    /* a bare ACK has no opcode to look at */
+    if ((proto->prot_msg & PROTO_SYN) &&
+        ( (fp->opcode == OP_BATTLE_REQ) || (fp->opcode == OP_GRANT) ) &&
         config->in_combat == 0) {
       // stash this packet away for replay.
       pending_enemy_netid = pkt->kw01_hdr.kw01_src;  
-      memcpy(&pending_enemy_pkt, proto, sizeof(KW01_PKT));
+      memcpy(&pending_enemy_pkt, pkt, sizeof(KW01_PKT));
 
       if (instance.app != orchardAppByName("Fight")) {
         // not in app - switch over. 
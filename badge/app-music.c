@@ -34,11 +34,13 @@
 #include "orchard-ui.h"
 #include "dac_lld.h"
 #include "pit_lld.h"
+#include "led.h"
 
 #include "ff.h"
 #include "ffconf.h"
 
-#include "fix_fft.h"
+#include "rfft.h"
+#include "resume.h"
 
 #include "src/gdisp/gdisp_driver.h"
 
@@ -49,14 +51,73 @@
 
 #define BACKGROUND HTML2COLOR(0x470b67)
 
+/*
+ * Touching the left or right edge of the screen skips back or forward
+ * this many seconds. Songs interrupted at least MUSIC_RESUME_SECS in
+ * are resumed from where they stopped the next time they're played.
+ */
+
+#define MUSIC_SEEK_SECS		10
+#define MUSIC_RESUME_SECS	30
+#define MUSIC_CLMT_SIZE		16
+
+/* The spectrum display is taken from this many samples of each buffer */
+
+#define MUSIC_FFT_LOG2		7
+#define MUSIC_FFT_POINTS	(1 << MUSIC_FFT_LOG2)
+
+/*
+ * The analyzer groups the FFT bins into MUSIC_BANDS bands, spaced
+ * logarithmically from the lowest bin to the highest, and draws each
+ * band as a column MUSIC_COL_WIDTH pixels wide and up to MUSIC_ROWS
+ * tall. Columns jump up to a new level but fall back at most
+ * MUSIC_BAR_DECAY rows per buffer. A marker holds each column's peak
+ * for MUSIC_PEAK_HOLD buffers and then sinks MUSIC_PEAK_DECAY rows per
+ * buffer. At 48 buffers a second, that's about half a second of hold.
+ */
+
+#define MUSIC_BANDS		20
+#define MUSIC_COL_PITCH		(320 / MUSIC_BANDS)
+#define MUSIC_COL_WIDTH		(MUSIC_COL_PITCH - 4)
+#define MUSIC_ROWS		128
+#define MUSIC_BAR_DECAY		6
+#define MUSIC_PEAK_HOLD		24
+#define MUSIC_PEAK_DECAY	2
+#define MUSIC_PEAK_ROWS		2
+
+/* Number of file blocks in x seconds of a song recorded at rate Hz */
+
+#define MUSIC_BLOCKS(x, rate)	((FSIZE_t)(x) * (rate) / DAC_SAMPLES)
+
+/* What's on the screen for one band of the analyzer */
+
+typedef struct _MusicBand {
+	uint8_t			bar;
+	uint8_t			peak;
+	uint8_t			hold;
+} MusicBand;
+
 typedef struct _MusicHandles {
 	char **			listitems;
 	int			itemcnt;
 	OrchardUiContext	uiCtx;
-	short			in[128];
-	short			out[128];
+	int16_t			fft[MUSIC_FFT_POINTS];
+	uint16_t		mag[MUSIC_FFT_POINTS / 2];
+	MusicBand		band[MUSIC_BANDS];
 } MusicHandles;
 
+/*
+ * First FFT bin of each band, and the end of the last one. The lowest
+ * bands are one bin (72Hz) wide, since a 128 point FFT can't resolve
+ * anything finer; above that each band is about 1.2 times as wide as
+ * the one below it.
+ */
+
+static const uint8_t music_bands[MUSIC_BANDS + 1] = {
+	1, 2, 3, 4, 5, 6, 7, 8, 9, 11, 13, 15, 18, 21, 25, 29, 34, 40,
+	47, 55, MUSIC_FFT_POINTS / 2
+};
+
 static uint32_t
 music_init(OrchardAppContext *context)
 {
@@ -127,43 +188,175 @@ music_start (OrchardAppContext *context)
 	return;
 }
 
+/******************************************************************************
+*
+* columnColor - work out the color of one row of an analyzer column
+*
+* Rows are counted up from the bottom of the screen, starting at 1. The
+* bar's color depends only on the row, so that any part of it can be
+* redrawn without touching the rest.
+*
+* RETURNS: the color for row <y> of a column showing <b>
+*/
+
+static color_t
+columnColor (int y, const MusicBand * b)
+{
+	if (y <= b->bar) {
+		if (y < 32)
+			return (Lime);
+		if (y < 64)
+			return (Yellow);
+		return (Red);
+	}
+
+	if (b->peak > b->bar && y <= b->peak &&
+	    y > b->peak - MUSIC_PEAK_ROWS)
+		return (White);
+
+	return (BACKGROUND);
+}
+
+/******************************************************************************
+*
+* columnDraw - update one column of the analyzer on the screen
+*
+* This function compares what column <col> shows now, <old>, with what
+* it should show, <new>, and only sends the rows that differ to the
+* display. Each run of changed rows is drawn in a window of its own,
+* so a column whose bar grew a little while its peak marker sank
+* costs two small windows rather than the whole column. Most columns
+* change by only a few rows from one buffer to the next, which leaves
+* the SPI bus free for the SD card most of the time.
+*
+* RETURNS: N/A
+*/
+
 static void
-columnDraw (int col, short amp, int erase)
+columnDraw (int col, const MusicBand * old, const MusicBand * new)
 {
+	int top;
+	int lo;
+	int hi;
 	int x;
 	int y;
 
-	/* Clamp the amplitude at 128 pixels */
+	/* Nothing above the highest of the two can have changed. */
+
+	top = old->bar;
+	if (old->peak > top)
+		top = old->peak;
+	if (new->bar > top)
+		top = new->bar;
+	if (new->peak > top)
+		top = new->peak;
+
+	y = 1;
+	while (y <= top) {
+		while (y <= top && columnColor (y, old) == columnColor (y, new))
+			y++;
+		if (y > top)
+			break;
+		lo = y;
+		while (y <= top && columnColor (y, old) != columnColor (y, new))
+			y++;
+		hi = y - 1;
+
+		/* Set up the drawing aperture, top row first */
+
+		GDISP->p.x = (col * MUSIC_COL_PITCH) + 2;
+		GDISP->p.y = 240 - hi;
+		GDISP->p.cx = MUSIC_COL_WIDTH;
+		GDISP->p.cy = hi - lo + 1;
+
+		gdisp_lld_write_start (GDISP);
+		for (y = hi; y >= lo; y--) {
+			GDISP->p.color = columnColor (y, new);
+			for (x = 0; x < MUSIC_COL_WIDTH; x++)
+				gdisp_lld_write_color (GDISP);
+		}
+		gdisp_lld_write_stop (GDISP);
 
-	if (amp > 128)
-		amp = 128;
+		y = hi + 1;
+	}
 
-	/* Set up the drawing aperture */
+	return;
+}
+
+/******************************************************************************
+*
+* spectrumUpdate - run the analyzer over a buffer of samples
+*
+* This function takes the spectrum of the first MUSIC_FFT_POINTS samples
+* in <buf>, finds the loudest bin in each band and moves each column's
+* bar and peak marker towards it, redrawing only what changed. The bars
+* are also folded down to one level per LED and handed to the "Audio"
+* LED pattern, which never makes us wait.
+*
+* RETURNS: N/A
+*/
+
+static void
+spectrumUpdate (MusicHandles * p, const uint16_t * buf)
+{
+	MusicBand * b;
+	MusicBand n;
+	uint16_t level;
+	uint8_t leds[LEDS_COUNT];
+	int i;
+	int j;
 
-	GDISP->p.x = col * 5;
-	GDISP->p.y = 240 - amp;
-	GDISP->p.cx = 4;
-	GDISP->p.cy = amp;
+	for (i = 0; i < MUSIC_FFT_POINTS; i++)
+		p->fft[i] = buf[i] << 2;
 
-	/* Now draw the column */
+	rfft (p->fft, MUSIC_FFT_LOG2);
+	rfftMag (p->fft, p->mag, MUSIC_FFT_LOG2);
 
-	gdisp_lld_write_start (GDISP);
-	for (y = amp; y > 0; y--) {
-		if (erase)
-			GDISP->p.color = BACKGROUND;
-		else {
-			if (y >= 0 && y < 32)
-				GDISP->p.color = Lime;
-			if (y >= 32 && y < 64)
-				GDISP->p.color = Yellow;
-			if (y >= 64 && y <= 128)
-				GDISP->p.color = Red;
+	for (i = 0; i < MUSIC_BANDS; i++) {
+		b = &p->band[i];
+
+		level = 0;
+		for (j = music_bands[i]; j < music_bands[i + 1]; j++) {
+			if (p->mag[j] > level)
+				level = p->mag[j];
 		}
-		for (x = 0; x < 4; x++) {
-			gdisp_lld_write_color (GDISP);
+		level >>= 3;
+		if (level > MUSIC_ROWS)
+			level = MUSIC_ROWS;
+
+		n = *b;
+		if (level >= n.bar)
+			n.bar = level;
+		else if (n.bar - level > MUSIC_BAR_DECAY)
+			n.bar -= MUSIC_BAR_DECAY;
+		else
+			n.bar = level;
+
+		if (n.bar >= n.peak) {
+			n.peak = n.bar;
+			n.hold = MUSIC_PEAK_HOLD;
+		} else if (n.hold != 0)
+			n.hold--;
+		else if (n.peak - n.bar > MUSIC_PEAK_DECAY)
+			n.peak -= MUSIC_PEAK_DECAY;
+		else
+			n.peak = n.bar;
+
+		columnDraw (i, b, &n);
+		*b = n;
+	}
+
+	for (i = 0; i < LEDS_COUNT; i++) {
+		level = 0;
+		for (j = (i * MUSIC_BANDS) / LEDS_COUNT;
+		    j < ((i + 1) * MUSIC_BANDS) / LEDS_COUNT; j++) {
+			if (p->band[j].bar > level)
+				level = p->band[j].bar;
 		}
+		leds[i] = (level * 255) / MUSIC_ROWS;
 	}
-	gdisp_lld_write_stop (GDISP);
+
+	ledAudioLevels (leds);
 
 	return;
 }
@@ -172,28 +365,93 @@ static int
 musicPlay (MusicHandles * p, char * fname)
 {
 	FIL f;
-	int i;
 	uint16_t * buf;
-	uint16_t * dacBuf;
 	UINT br;
-	short b;
 	GEventMouse * me = NULL;
 	GSourceHandle gs;
 	GListener gl;
+	DWORD clmt[MUSIC_CLMT_SIZE];
+	FSIZE_t data;
+	FSIZE_t pos;
+	FSIZE_t start;
+	UINT bpb;
+	int codec;
+	uint16_t rate;
+	DAC_RESAMPLER * rs = NULL;
 
 	dacPlay (NULL);
 
 	if (f_open (&f, fname, FA_READ) != FR_OK)
 		return (0);
 
+	/*
+	 * Map the file's clusters so that skipping around doesn't
+	 * have to walk the FAT chain, then check what kind of samples
+	 * the file holds. Songs may be stored as raw 12-bit samples or
+	 * as ADPCM blocks: either way, each block of DAC_SAMPLES
+	 * samples takes up a fixed number of bytes in the file. Songs
+	 * recorded at some other rate than the DAC's are resampled as
+	 * they're read, so positions are always counted in file blocks.
+	 */
+
+	clmt[0] = MUSIC_CLMT_SIZE;
+	f.cltbl = clmt;
+	if (f_lseek (&f, CREATE_LINKMAP) != FR_OK)
+		f.cltbl = NULL;
+
+	codec = dacFileFormat (&f, &rate);
+	if (codec == -1) {
+		f_close (&f);
+		return (0);
+	}
+
+	if (rate != DAC_SAMPLERATE) {
+		rs = chHeapAlloc (NULL, sizeof(DAC_RESAMPLER));
+		if (rs == NULL) {
+			f_close (&f);
+			return (0);
+		}
+		dacResampleInit (rs, rate);
+	}
+
+	data = f_tell (&f);
+	bpb = DAC_BLOCK_BYTES(codec);
+
+	/*
+	 * Resume from where we stopped last time, if we saved a
+	 * position. Positions are kept in samples and always land
+	 * on a buffer boundary.
+	 */
+
+	start = resumeGet (fname) / DAC_SAMPLES;
+	if (data + start * bpb >= f_size (&f))
+		start = 0;
+	f_lseek (&f, data + start * bpb);
+
+	/*
+	 * Use the DAC's own buffer pointer, like the video player
+	 * does, so the DAC thread can tell the DAC is taken and
+	 * won't start any sound effects over the top of us.
+	 */
+
 	dacBuf = chHeapAlloc (NULL,
 	    (DAC_SAMPLES * sizeof(uint16_t)) * 2);
+	if (dacBuf == NULL) {
+		if (rs != NULL)
+			chHeapFree (rs);
+		f_close (&f);
+		return (0);
+	}
+
+	/* The screen was just cleared, so all the columns are empty. */
+
+	memset (p->band, 0, sizeof(p->band));
 
 	pitEnable (&PIT1, 1);
 
 	buf = dacBuf;
 
-	f_read (&f, buf, DAC_SAMPLES * sizeof(uint16_t), &br);
+	dacFileResample (&f, codec, rs, buf, &br);
 
 	gs = ginputGetMouse (0);
 	geventListenerInit (&gl);
@@ -201,31 +459,15 @@ musicPlay (MusicHandles * p, char * fname)
 
 	while (1) {
 
-		dacSamplesPlay (buf, DAC_SAMPLES);
-
-		for (i = 1; i < 63; i++) {
-			b = p->in[i];
-			columnDraw (i, b, 1);
-		}
-
-		for (i = 0; i < 128; i++)
-			p->in[i] = buf[i] << 2;
-
-		fix_fft (p->in, p->out, 7, 0);
-
-		for (i = 1; i < 63; i++) {
-			b = abs(p->in[i]);
-			b >>= 3;
-			p->in[i] = b;
-			columnDraw (i, b, 0);
-		}
+		dacSamplesPlay (buf, br);
+		spectrumUpdate (p, buf);
 
 		if (buf == dacBuf)
 			buf += DAC_SAMPLES;
 		else
 			buf = dacBuf;
 
-		f_read (&f, buf, DAC_SAMPLES * sizeof(uint16_t), &br);
+		dacFileResample (&f, codec, rs, buf, &br);
 
 		dacSamplesWait ();
 
@@ -233,14 +475,49 @@ musicPlay (MusicHandles * p, char * fname)
 			break;
 
 		me = (GEventMouse *)geventEventWait(&gl, 0);
-		if (me != NULL && me->type == GEVENT_TOUCH)
+		if (me == NULL || me->type != GEVENT_TOUCH)
+			continue;
+
+		/*
+		 * A touch at either edge of the screen skips back or
+		 * forward. Anywhere else stops playback. The buffer we
+		 * just read is simply played at the new position.
+		 */
+
+		pos = (f_tell (&f) - data) / bpb;
+		if (me->x < gdispGetWidth () / 4)
+			pos = pos > MUSIC_BLOCKS(MUSIC_SEEK_SECS, rate) ?
+			    pos - MUSIC_BLOCKS(MUSIC_SEEK_SECS, rate) : 0;
+		else if (me->x >= gdispGetWidth () - gdispGetWidth () / 4)
+			pos += MUSIC_BLOCKS(MUSIC_SEEK_SECS, rate);
+		else
 			break;
 
+		me = NULL;
+		if (data + pos * bpb >= f_size (&f))
+			break;
+		f_lseek (&f, data + pos * bpb);
+		if (rs != NULL)
+			dacResampleInit (rs, rate);
 	}
 
+	/*
+	 * Remember where we stopped if the user interrupted us far
+	 * enough into the song, otherwise start over next time.
+	 */
+
+	pos = (f_tell (&f) - data) / bpb;
+	if (me != NULL && pos >= MUSIC_BLOCKS(MUSIC_RESUME_SECS, rate))
+		resumeSave (fname, pos * DAC_SAMPLES);
+	else if (start != 0)
+		resumeSave (fname, 0);
+
 	f_close (&f);
 	pitDisable (&PIT1, 1);
 	chHeapFree (dacBuf);
+	dacBuf = NULL;
+	if (rs != NULL)
+		chHeapFree (rs);
 
 	geventDetachSource (&gl, NULL);
 
@@ -98,10 +98,10 @@ static void shout_event (OrchardAppContext *context,
 			/* Terminate UI */
 			/* Send the message */
 
-			radioSend (&KRADIO1, RADIO_BROADCAST_ADDRESS,
+			radioSendAsync (&KRADIO1, RADIO_BROADCAST_ADDRESS,
 			    RADIO_PROTOCOL_SHOUT,
 			    keyboardUiContext->selected + 1,
-			    keyboardUiContext->itemlist[1]);
+			    keyboardUiContext->itemlist[1], NULL, NULL);
 
 			/* Display a confirmation message */
                         screen_alert_draw(true, "SHOUT SENT");
@@ -33,6 +33,7 @@
 #include "orchard-app.h"
 #include "orchard-ui.h"
 #include "video_lld.h"
+#include "resume.h"
 #include "dac_lld.h"
 
 #include "ff.h"
@@ -41,6 +42,13 @@
 
 #include <string.h>
 
+/*
+ * Only remember where we stopped if we were at least this far into
+ * the video, so that short clips always start from the beginning.
+ */
+
+#define VIDEO_RESUME_SECS	30
+
 typedef struct _VideoHandles {
 	char **			listitems;
 	int			itemcnt;
@@ -69,7 +77,8 @@ video_start (OrchardAppContext *context)
 	while (1) {
 		if (f_readdir (&d, &info) != FR_OK || info.fname[0] == 0)
 			break;
-		if (strstr (info.fname, ".VID") != NULL)
+		if (strstr (info.fname, ".VID") != NULL &&
+		    videoCheck (info.fname) == 0)
 			i++;
 	}
 
@@ -97,7 +106,8 @@ video_start (OrchardAppContext *context)
 	while (1) {
 		if (f_readdir (&d, &info) != FR_OK || info.fname[0] == 0)
 			break;
-		if (strstr (info.fname, ".VID") != NULL) {
+		if (strstr (info.fname, ".VID") != NULL &&
+		    videoCheck (info.fname) == 0) {
 			p->listitems[i] =
 			    chHeapAlloc (NULL, strlen (info.fname) + 1);
 			memset (p->listitems[i], 0, strlen (info.fname) + 1);
@@ -125,6 +135,9 @@ video_event(OrchardAppContext *context, const OrchardAppEvent *event)
 	VideoHandles * p;
 	userconfig *config;
 	int lastpat;
+	char * name;
+	uint32_t pos;
+	int r;
 
 	p = context->priv;
 	ui = context->instance->ui;
@@ -157,7 +170,22 @@ video_event(OrchardAppContext *context, const OrchardAppEvent *event)
 		lastpat = config->led_pattern;
 		config->led_pattern = 0;
 		ledSetFunction(NULL);
-		if (videoPlay (p->listitems[uiContext->selected + 1]) != 0)
+
+		/*
+		 * Pick up where we left off last time, and remember
+		 * where we stopped if the user interrupts us partway
+		 * through a long video.
+		 */
+
+		name = p->listitems[uiContext->selected + 1];
+		pos = resumeGet (name);
+		r = videoWinPlayAt (name, 0, 0, pos);
+		if (r != 0 && videoStats.vs_pos >=
+		    videoStats.vs_fps * VIDEO_RESUME_SECS)
+			resumeSave (name, videoStats.vs_pos);
+		else if (pos != 0)
+			resumeSave (name, 0);
+		if (r != 0)
 			dacPlay ("click.raw");
 		config->led_pattern = lastpat;
 		effectsStart();
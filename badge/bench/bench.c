@@ -0,0 +1,1137 @@
+/*
+ * Host media benchmark
+ *
+ * This runs the badge's own video and DAC playback code (video_lld.c and
+ * dac_lld.c) on the host, against a FAT image standing in for the SD
+ * card, and reports how playback went. Files named on the command line
+ * are copied into the image under their 8.3 names and then played in
+ * order: .vid files with videoPlay(), anything else as a sound file
+ * with dacPlay(). With -e, each sound file is also mixed in over itself
+ * as sound effects, to time the DAC mixer.
+ *
+ * With -R, the sample rate converter is timed by itself, at each quality
+ * level, converting a test tone from a few common rates. Along with the
+ * time per output sample, we report how close the output comes to the
+ * same tone generated at DAC_SAMPLERATE.
+ *
+ * With -F, the real-input FFT the spectrum displays use (ext/rfft) is
+ * timed against fix_fft(), which it replaced, at each size from 64 to
+ * 512 points, and both are checked against a floating point DFT of the
+ * same input.
+ *
+ * With -D, the fixed point DTMF generator and decoder (dtmf.c) are
+ * checked. Each digit is generated and compared against an exact two
+ * tone signal, and timed against the soft-float sine the dialer used
+ * to use. Then strings of digits, at several rates and levels, with
+ * noise and twist, are decoded and must come back exactly, while
+ * single tones, chords and noise must decode to nothing. The run
+ * fails if any of them don't.
+ *
+ * With -T, radioSend() is timed against a register model of the radio
+ * (see radio.c and host_radio.c), and the SPI transactions, interrupts
+ * and caller CPU time each frame costs are reported.
+ *
+ * With -G, the media regression checks in regress.c are run against the
+ * golden files in the given directory, or with -W, the golden files are
+ * written. "make check" does this with the files in golden/.
+ *
+ * The SD card and the display share a model of the SPI bus (see
+ * host_hw.c), so the numbers reflect the badge's I/O limits. CPU time is
+ * the host's, not scaled down to the 48MHz Cortex-M0+, so the draw cycle
+ * counts are only good for comparing one change against another.
+ *
+ * The audio hash and the frame hash for each run depend only on the
+ * file contents and what the code decoded, as long as nothing was
+ * dropped, so they can be used to check that a change didn't alter
+ * the output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <math.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "userconfig.h"
+
+#include "ff.h"
+
+#include "dac_lld.h"
+#include "video_lld.h"
+#include "fix_fft.h"
+#include "rfft.h"
+#include "dtmf.h"
+
+#include "host.h"
+
+#define DEFAULT_SPIHZ	12000000
+#define DEFAULT_READLAT	200
+#define DEFAULT_SPC	64
+#define DEFAULT_IMAGE	"bench.img"
+
+#define COPY_BUF	16384
+
+/* Resampler test: a tone of RS_TONE Hz, RS_SECS seconds long, RS_RUNS times */
+
+#define RS_TONE		1000
+#define RS_LEVEL	1500
+#define RS_SECS		2
+#define RS_RUNS		20
+#define RS_MAXRATE	22050
+
+/* FFT test: sizes from 2^FFT_LOG2_MIN points up, each run FFT_RUNS times */
+
+#define FFT_LOG2_MIN	6
+#define FFT_RUNS	20000
+
+/* DTMF test: digits and gaps of DTMF_MS ms, timed over DTMF_SECS seconds */
+
+#define DTMF_MS		60
+#define DTMF_SECS	10
+#define DTMF_DIALER	29700
+
+static userconfig config;
+static FATFS fs;
+static int effects;
+static const char * codecs[VID_CODECS] = { "raw", "delta", "pal8" };
+
+userconfig *
+getConfig (void)
+{
+	return (&config);
+}
+
+static void
+usage (const char * prog)
+{
+	fprintf (stderr, "Usage: %s [-s spi_hz] [-l read_latency_us] "
+	    "[-c cluster_sectors]\n"
+	    "       [-i card.img] [-o frame.rgb] [-a audio.raw] "
+	    "[-e effects] [-q quality] [-S] [-R] [-F] [-D]\n"
+	    "       [-T frames] [-P fights] [-G golden_dir [-W]] "
+	    "[file ...]\n", prog);
+	fprintf (stderr, "  -s  SPI bus clock, 0 for no bus timing "
+	    "(default %u)\n", DEFAULT_SPIHZ);
+	fprintf (stderr, "  -l  SD card latency per read command "
+	    "(default %u)\n", DEFAULT_READLAT);
+	fprintf (stderr, "  -c  sectors per cluster for a new image "
+	    "(default %u)\n", DEFAULT_SPC);
+	fprintf (stderr, "  -i  play from an existing image instead of "
+	    "building %s\n", DEFAULT_IMAGE);
+	fprintf (stderr, "  -o  save the last frame drawn (raw RGB565)\n");
+	fprintf (stderr, "  -a  save the samples written to the DAC\n");
+	fprintf (stderr, "  -e  play sounds as up to %d effects over "
+	    "themselves too\n", DAC_VOICES - 1);
+	fprintf (stderr, "  -q  resampling quality, 0 to %d (default %d)\n",
+	    DAC_RESAMPLE_CUBIC, DAC_RESAMPLE_DEFAULT);
+	fprintf (stderr, "  -S  stop each SD card read command when it's "
+	    "done\n");
+	fprintf (stderr, "  -R  time the resampler by itself\n");
+	fprintf (stderr, "  -F  time the spectrum FFT against fix_fft()\n");
+	fprintf (stderr, "  -D  check the DTMF generator and decoder\n");
+	fprintf (stderr, "  -T  time sending this many radio frames of "
+	    "each size\n");
+	fprintf (stderr, "  -P  play this many fights at each rate of "
+	    "frame loss\n");
+	fprintf (stderr, "  -G  run the media regression checks against "
+	    "the golden files\n");
+	fprintf (stderr, "  -W  write the golden files instead\n");
+	exit (1);
+}
+
+/*
+ * Turn a host path into the 8.3 name it gets on the image: the base
+ * name, upper case, with the name cut to 8 characters and the
+ * extension to 3.
+ */
+
+static void
+dosName (const char * path, char * name)
+{
+	const char * base;
+	const char * dot;
+	int i;
+
+	base = strrchr (path, '/');
+	base = base == NULL ? path : base + 1;
+	dot = strrchr (base, '.');
+
+	for (i = 0; base[i] != '\0' && base + i != dot && i < 8; i++)
+		*name++ = toupper ((unsigned char)base[i]);
+
+	if (dot != NULL && dot[1] != '\0') {
+		*name++ = '.';
+		for (i = 1; dot[i] != '\0' && i < 4; i++)
+			*name++ = toupper ((unsigned char)dot[i]);
+	}
+
+	*name = '\0';
+
+	return;
+}
+
+static int
+copyIn (const char * path, const char * name)
+{
+	FILE * in;
+	FIL f;
+	UINT bw;
+	size_t n;
+	char * buf;
+	int r = 0;
+
+	in = fopen (path, "r");
+	if (in == NULL) {
+		perror (path);
+		return (-1);
+	}
+
+	if (f_open (&f, name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+		fprintf (stderr, "can't create %s on the image\n", name);
+		fclose (in);
+		return (-1);
+	}
+
+	buf = malloc (COPY_BUF);
+
+	while ((n = fread (buf, 1, COPY_BUF, in)) > 0) {
+		if (f_write (&f, buf, n, &bw) != FR_OK || bw != n) {
+			fprintf (stderr, "image full writing %s\n", name);
+			r = -1;
+			break;
+		}
+	}
+
+	free (buf);
+	f_close (&f);
+	fclose (in);
+
+	return (r);
+}
+
+/*
+ * Work out an image size that holds all the files, with some room to
+ * spare, and that makes a valid FAT16 volume with <spc> sector clusters.
+ */
+
+static uint32_t
+imageSize (int argc, char ** argv, int spc)
+{
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	FILE * f;
+	int i;
+
+	total = 0;
+	for (i = 0; i < argc; i++) {
+		f = fopen (argv[i], "r");
+		if (f == NULL)
+			continue;
+		fseek (f, 0, SEEK_END);
+		/* Round each file up to a whole cluster */
+		total += ((ftell (f) / (spc * 512)) + 1) * (spc * 512);
+		fclose (f);
+	}
+
+	total += total / 8;
+	min = (uint64_t)4200 * spc * 512;
+	max = (uint64_t)65000 * spc * 512;
+
+	if (total < min)
+		total = min;
+	if (total > max || total > 0xFFFFFFFFULL - 65536)
+		return (0);
+
+	return ((uint32_t)total);
+}
+
+/*
+ * CPU time used by the whole process, to show how much of the run the
+ * playback threads spent busy rather than blocked.
+ */
+
+static uint64_t
+cpuNanos (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return (((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec);
+}
+
+static void
+reportCpu (uint64_t cpu, uint64_t ns)
+{
+	printf ("host CPU time    : %llu ms (%llu%% of the run)\n",
+	    (unsigned long long)(cpu / 1000000),
+	    ns ? (unsigned long long)((cpu * 100) / ns) : 0ULL);
+
+	return;
+}
+
+static void
+reportBus (uint64_t ns)
+{
+	printf ("bus time         : %llu ms display, %llu ms SD card "
+	    "(%llu%% busy)\n",
+	    (unsigned long long)(hostStats.hs_dispns / 1000000),
+	    (unsigned long long)(hostStats.hs_diskns / 1000000),
+	    ns ? (unsigned long long)(((hostStats.hs_dispns +
+	    hostStats.hs_diskns) * 100) / ns) : 0ULL);
+	printf ("bus waits        : %llu ms\n",
+	    (unsigned long long)(hostStats.hs_waitns / 1000000));
+	printf ("SD card reads    : %u reads, %u commands, %llu sectors "
+	    "(%u.%02u per command)\n", hostStats.hs_reads, hostStats.hs_cmds,
+	    (unsigned long long)hostStats.hs_sectors,
+	    hostStats.hs_cmds ? (unsigned)(hostStats.hs_sectors /
+	    hostStats.hs_cmds) : 0, hostStats.hs_cmds ?
+	    (unsigned)(((hostStats.hs_sectors * 100) / hostStats.hs_cmds) %
+	    100) : 0);
+	if (hostStats.hs_diskns != 0)
+		printf ("SD card rate     : %llu bytes/sec\n",
+		    (unsigned long long)((hostStats.hs_sectors * 512 *
+		    1000000000ULL) / hostStats.hs_diskns));
+	printf ("peak heap        : %u bytes\n", hostStats.hs_heappeak);
+
+	return;
+}
+
+static void
+reportAudio (void)
+{
+	printf ("audio samples    : %llu of %llu ticks (%llu ticks empty)\n",
+	    (unsigned long long)hostStats.hs_samples,
+	    (unsigned long long)hostStats.hs_ticks,
+	    (unsigned long long)hostStats.hs_empty);
+	printf ("audio hash       : %016llx\n",
+	    (unsigned long long)hostStats.hs_audiohash);
+
+	return;
+}
+
+static int
+benchVideo (char * name)
+{
+	VID_STATS * s;
+	uint64_t cpu;
+	uint64_t t;
+	uint32_t fps;
+	int r;
+
+	cpu = cpuNanos ();
+	t = hostNanos ();
+	r = videoPlay (name);
+	t = hostNanos () - t;
+	cpu = cpuNanos () - cpu;
+
+	/* Let the DAC finish whatever audio was queued. */
+
+	dacSamplesWait ();
+
+	s = &videoStats;
+
+	printf ("%s:\n", name);
+	if (r != 0 || s->vs_frames == 0 || s->vs_ticks == 0) {
+		printf ("playback failed\n");
+		return (-1);
+	}
+
+	fps = (uint32_t)(((uint64_t)s->vs_frames * 100 *
+	    CH_CFG_ST_FREQUENCY) / s->vs_ticks);
+
+	printf ("codec            : %s\n", codecs[s->vs_codec]);
+	printf ("frames played    : %u (%u fps encoded)\n",
+	    s->vs_frames, s->vs_fps);
+	printf ("achieved rate    : %u.%02u fps\n", fps / 100, fps % 100);
+	printf ("bytes per frame  : %u\n", s->vs_bytes / s->vs_frames);
+	printf ("draw time/frame  : %llu us (%llu us waiting for DMA)\n",
+	    (unsigned long long)((s->vs_blitcyc /
+	    (KINETIS_SYSCLK_FREQUENCY / 1000000)) / s->vs_frames),
+	    (unsigned long long)((s->vs_dmacyc /
+	    (KINETIS_SYSCLK_FREQUENCY / 1000000)) / s->vs_frames));
+	printf ("reader waits     : %u (display bound)\n", s->vs_stalls);
+	printf ("renderer waits   : %u (SD card bound)\n", s->vs_underruns);
+	printf ("chunks dropped   : %u of %u (%u held back)\n",
+	    s->vs_dropped, s->vs_chunks, s->vs_held);
+	printf ("audio ran dry    : %u times\n", s->vs_late);
+	reportAudio ();
+	reportBus (t);
+	reportCpu (cpu, t);
+	printf ("frame hash       : %016llx\n",
+	    (unsigned long long)hostFrameHash ());
+
+	return (0);
+}
+
+/*
+ * CPU time used by just this thread, for timing code that runs in it.
+ */
+
+static uint64_t
+threadNanos (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec);
+}
+
+/*
+ * Run one test tone through the resampler the way dacFileResample()
+ * does, a file block at a time, and return the output's signal to
+ * noise ratio against the ideal tone. The time taken and the number of
+ * samples produced are added to <ns> and <outcnt>.
+ */
+
+static double
+resampleRun (uint16_t rate, const uint16_t * in, UINT incnt,
+    uint16_t * out, uint64_t * ns, uint64_t * outcnt)
+{
+	DAC_RESAMPLER rs;
+	double step;
+	double sig;
+	double err;
+	double d;
+	uint64_t t;
+	UINT used;
+	UINT pos;
+	UINT n;
+	UINT i;
+
+	dacResampleInit (&rs, rate);
+
+	t = threadNanos ();
+	pos = 0;
+	n = 0;
+	while (pos < incnt) {
+		used = incnt - pos;
+		if (used > DAC_SAMPLES)
+			used = DAC_SAMPLES;
+		n += dacResample (&rs, in + pos, &used, out + n,
+		    (incnt * 2) - n);
+		pos += used;
+	}
+	*ns += threadNanos () - t;
+	*outcnt += n;
+
+	/*
+	 * Output sample i comes from i * rs_step samples into the input.
+	 * Compare against that exact point, so the tiny pitch error from
+	 * rounding the step doesn't swamp the interpolation error.
+	 */
+
+	step = (double)rs.rs_step / 65536.0;
+	sig = err = 0;
+	for (i = 4; i < n; i++) {
+		d = RS_LEVEL * sin (2 * M_PI * RS_TONE * i * step / rate);
+		sig += d * d;
+		d = (double)out[i] - (2048 + d);
+		err += d * d;
+	}
+
+	return (err == 0 ? 99.0 : 10.0 * log10 (sig / err));
+}
+
+static int
+benchResample (void)
+{
+	static const uint16_t rates[] = { 8000, 11025, 16000, RS_MAXRATE };
+	static const char * names[] = { "nearest", "linear", "cubic" };
+	uint16_t * in;
+	uint16_t * out;
+	uint64_t outcnt;
+	uint64_t ns;
+	double snr;
+	UINT incnt;
+	unsigned int q;
+	unsigned int r;
+	UINT i;
+	int j;
+
+	in = malloc (RS_MAXRATE * RS_SECS * sizeof(uint16_t));
+	out = malloc (RS_MAXRATE * RS_SECS * 2 * sizeof(uint16_t));
+
+	printf ("%d Hz tone resampled to %d Hz:\n", RS_TONE, DAC_SAMPLERATE);
+	printf ("%-8s %6s %12s %9s\n", "quality", "rate", "ns/sample",
+	    "SNR (dB)");
+
+	for (q = 0; q <= DAC_RESAMPLE_CUBIC; q++) {
+		dacResampleQuality (q);
+		for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+			incnt = rates[r] * RS_SECS;
+			for (i = 0; i < incnt; i++)
+				in[i] = lrint (2048 + RS_LEVEL *
+				    sin (2 * M_PI * RS_TONE * i / rates[r]));
+			ns = 0;
+			outcnt = 0;
+			snr = 0;
+			for (j = 0; j < RS_RUNS; j++)
+				snr = resampleRun (rates[r], in, incnt, out,
+				    &ns, &outcnt);
+			printf ("%-8s %6u %12.1f %9.1f\n", names[q], rates[r],
+			    (double)ns / outcnt, snr);
+		}
+	}
+
+	dacResampleQuality (DAC_RESAMPLE_DEFAULT);
+
+	free (in);
+	free (out);
+
+	return (0);
+}
+
+/*
+ * Compare bins 0 to N/2 of an FFT's output against the exact DFT in
+ * <re> and <im>, and return the largest error, with the RMS error in
+ * <rms>. The <get> callback picks bin k out of the FFT's output.
+ */
+
+static double
+fftError (const double * re, const double * im, int n,
+    void (*get)(const int16_t *, int, int, double *, double *),
+    const int16_t * out, double * rms)
+{
+	double emax;
+	double sum;
+	double r;
+	double i;
+	double e;
+	int k;
+
+	emax = sum = 0;
+	for (k = 0; k <= n / 2; k++) {
+		get (out, n, k, &r, &i);
+		e = hypot (r - re[k], i - im[k]);
+		if (e > emax)
+			emax = e;
+		sum += e * e;
+	}
+	*rms = sqrt (sum / ((n / 2) + 1));
+
+	return (emax);
+}
+
+static void
+rfftBin (const int16_t * x, int n, int k, double * re, double * im)
+{
+	if (k == 0 || k == n / 2) {
+		*re = x[k == 0 ? 0 : 1];
+		*im = 0;
+	} else {
+		*re = x[2 * k];
+		*im = x[(2 * k) + 1];
+	}
+	return;
+}
+
+static void
+fixfftBin (const int16_t * x, int n, int k, double * re, double * im)
+{
+	*re = x[k];
+	*im = x[n + k];
+	return;
+}
+
+static int
+benchFft (void)
+{
+	static int16_t in[RFFT_MAX];
+	static int16_t x[RFFT_MAX * 2];
+	static uint16_t mag[RFFT_MAX / 2];
+	double re[(RFFT_MAX / 2) + 1];
+	double im[(RFFT_MAX / 2) + 1];
+	double rerr;
+	double ferr;
+	double rrms;
+	double frms;
+	double merr;
+	double d;
+	uint64_t rns;
+	uint64_t fns;
+	uint64_t t;
+	int n;
+	int m;
+	int i;
+	int j;
+
+	printf ("%5s %10s %10s %13s %13s %9s\n", "points", "rfft ns",
+	    "fix_fft ns", "rfft err", "fix_fft err", "mag err");
+
+	for (m = FFT_LOG2_MIN; m <= RFFT_LOG2_MAX; m++) {
+		n = 1 << m;
+
+		/* Two tones between bins, some DC and a little noise. */
+
+		srand (m);
+		for (i = 0; i < n; i++)
+			in[i] = lrint (500 +
+			    12000 * sin (2 * M_PI * 5.3 * i / n) +
+			    8000 * cos (2 * M_PI * (n / 3.7) * i / n) +
+			    (rand () % 2000) - 1000);
+
+		for (j = 0; j <= n / 2; j++) {
+			re[j] = im[j] = 0;
+			for (i = 0; i < n; i++) {
+				re[j] += in[i] * cos (2 * M_PI * j * i / n);
+				im[j] -= in[i] * sin (2 * M_PI * j * i / n);
+			}
+			re[j] /= n;
+			im[j] /= n;
+		}
+
+		/* fix_fft() takes them as complex, with no imaginary part. */
+
+		t = threadNanos ();
+		for (j = 0; j < FFT_RUNS; j++) {
+			memcpy (x, in, n * sizeof(int16_t));
+			memset (x + n, 0, n * sizeof(int16_t));
+			fix_fft (x, x + n, m, 0);
+		}
+		fns = threadNanos () - t;
+		ferr = fftError (re, im, n, fixfftBin, x, &frms);
+
+		t = threadNanos ();
+		for (j = 0; j < FFT_RUNS; j++) {
+			memcpy (x, in, n * sizeof(int16_t));
+			rfft (x, m);
+		}
+		rns = threadNanos () - t;
+		rerr = fftError (re, im, n, rfftBin, x, &rrms);
+
+		/* Worst error of the magnitude estimate on the larger bins */
+
+		rfftMag (x, mag, m);
+		merr = 0;
+		for (j = 1; j < n / 2; j++) {
+			d = hypot (x[2 * j], x[(2 * j) + 1]);
+			if (d >= 256 && fabs (mag[j] - d) / d > merr)
+				merr = fabs (mag[j] - d) / d;
+		}
+
+		printf ("%5d %10.0f %10.0f %6.2f/%-6.2f %6.2f/%-6.2f %8.1f%%\n",
+		    n, (double)rns / FFT_RUNS, (double)fns / FFT_RUNS,
+		    rerr, rrms, ferr, frms, merr * 100);
+	}
+
+	printf ("Errors are the largest/RMS difference per bin from an "
+	    "exact DFT, in LSBs.\n");
+
+	return (0);
+}
+
+/*
+ * The double precision sine approximation the dialer used to use, to
+ * time the fixed point generator against.
+ */
+
+static double
+fast_sin (double x)
+{
+	const double PI	=  3.14159265358979323846264338327950288;
+	const double INVPI =  0.31830988618379067153776752674502872;
+	const double A	 =  0.00735246819687011731341356165096815;
+	const double B	 = -0.16528911397014738207016302002888890;
+	const double C	 =  0.99969198629596757779830113868360584;
+	int32_t k;
+	double x2;
+
+	k = round (INVPI * x);
+	x -= k * PI;
+	x2 = x * x;
+	x = x * (C + x2 * (B + A * x2));
+	if (k % 2)
+		x = -x;
+
+	return (x);
+}
+
+/*
+ * Make <digits> into a signal at <rate>, DTMF_MS of each digit and then
+ * DTMF_MS of quiet, with the column tone <twist> dB louder than the row
+ * tone and <noise> peak to peak of white noise mixed in. A digit of '+'
+ * stands for a single 1000Hz tone and '!' for a chord of three DTMF
+ * tones, which the decoder must ignore.
+ *
+ * RETURNS: the number of samples made
+ */
+
+static UINT
+dtmfSignal (const char * digits, uint32_t rate, uint16_t level, int twist,
+    int noise, uint16_t * out)
+{
+	DTMF_TONE row;
+	DTMF_TONE col;
+	DTMF_TONE extra;
+	uint16_t a[DAC_SAMPLES];
+	uint16_t b[DAC_SAMPLES];
+	uint16_t c[DAC_SAMPLES];
+	uint16_t rl;
+	uint16_t cl;
+	UINT len;
+	UINT cnt;
+	UINT n;
+	UINT i;
+	int v;
+	int k;
+
+	/* Each generator makes a single tone, so both can be set. */
+
+	rl = lrint (level / (1 + pow (10, twist / 20.0)));
+	cl = level - rl;
+	len = (rate * DTMF_MS) / 1000;
+	cnt = 0;
+
+	for (; *digits != '\0'; digits++) {
+		memset (&extra, 0, sizeof(extra));
+		if (*digits == '+') {
+			dtmfToneInit (&row, 1000, 1000, rate, level);
+			dtmfToneInit (&col, 0, 0, rate, 0);
+		} else if (*digits == '!') {
+			dtmfToneInit (&row, 697, 697, rate, level / 3);
+			dtmfToneInit (&col, 1336, 1336, rate, level / 3);
+			dtmfToneInit (&extra, 852, 852, rate, level / 3);
+		} else {
+			k = strchr (dtmfDigits, *digits) - dtmfDigits;
+			dtmfToneInit (&row, dtmfFreqs[k / DTMF_COLS],
+			    dtmfFreqs[k / DTMF_COLS], rate, rl);
+			dtmfToneInit (&col, dtmfFreqs[DTMF_ROWS + (k % DTMF_COLS)],
+			    dtmfFreqs[DTMF_ROWS + (k % DTMF_COLS)], rate, cl);
+		}
+
+		for (i = 0; i < len * 2; i += n) {
+			n = (len * 2) - i;
+			if (n > DAC_SAMPLES)
+				n = DAC_SAMPLES;
+			dtmfToneGen (&row, a, n);
+			dtmfToneGen (&col, b, n);
+			dtmfToneGen (&extra, c, n);
+			for (k = 0; k < (int)n; k++) {
+				v = DTMF_MIDPOINT;
+				if (i + k < len)
+					v += a[k] + b[k] + c[k] -
+					    (3 * DTMF_MIDPOINT);
+				if (noise != 0)
+					v += (rand () % noise) - (noise / 2);
+				out[cnt++] = v < 0 ? 0 : v > 4095 ? 4095 : v;
+			}
+		}
+	}
+
+	return (cnt);
+}
+
+/*
+ * Decode <cnt> samples at <rate> into <digits>, feeding the decoder a
+ * buffer of DAC_SAMPLES at a time the way a recorder would. The time
+ * taken is added to <ns>.
+ */
+
+static void
+dtmfDecode (const uint16_t * in, UINT cnt, uint32_t rate, char * digits,
+    uint64_t * ns)
+{
+	DTMF_DETECT d;
+	uint32_t used;
+	uint64_t t;
+	UINT pos;
+	UINT n;
+	char c;
+
+	dtmfDetectInit (&d, rate);
+
+	t = threadNanos ();
+	for (pos = 0; pos < cnt; pos += n) {
+		n = cnt - pos;
+		if (n > DAC_SAMPLES)
+			n = DAC_SAMPLES;
+		used = n;
+		c = dtmfDetect (&d, in + pos, &used);
+		if (c != '\0')
+			*digits++ = c;
+		n = used;
+	}
+	*ns += threadNanos () - t;
+	*digits = '\0';
+
+	return;
+}
+
+static int
+benchDtmf (void)
+{
+	static const uint32_t rates[] = { 8000, DAC_SAMPLERATE, 11025 };
+	static const struct {
+		const char *	name;
+		const char *	digits;
+		const char *	expect;
+		uint16_t	level;
+		int		twist;
+		int		noise;
+	} tests[] = {
+		{ "all digits", "123A456B789C*0#D", NULL, 1024, 0, 0 },
+		{ "quiet", "5551212", NULL, 150, 0, 0 },
+		{ "too quiet", "5551212", "", 20, 0, 0 },
+		{ "noisy", "8675309", NULL, 1024, 0, 400 },
+		{ "twist +4dB", "#D*0", NULL, 1024, 3, 100 },
+		{ "twist -8dB", "#D*0", NULL, 1024, -7, 100 },
+		{ "repeats", "1122", NULL, 1024, 0, 100 },
+		{ "talk-off", "+!+!", "", 1024, 0, 100 },
+		{ "mixed", "4+!2", "42", 1024, 0, 100 },
+	};
+	DTMF_TONE t;
+	uint16_t * buf;
+	char got[64];
+	const char * expect;
+	uint64_t ns;
+	uint64_t dns;
+	uint64_t dcnt;
+	double sig;
+	double err;
+	double worst;
+	double d;
+	double fa;
+	double fb;
+	UINT cnt;
+	UINT i;
+	unsigned int r;
+	unsigned int k;
+	int fails;
+
+	buf = malloc (DTMF_DIALER * DTMF_SECS * sizeof(uint16_t));
+	fails = 0;
+
+	/* Generator accuracy and speed */
+
+	worst = 99;
+	for (k = 0; dtmfDigits[k] != '\0'; k++) {
+		dtmfDigitTone (&t, dtmfDigits[k], DAC_SAMPLERATE,
+		    DTMF_LEVEL_MAX);
+		dtmfToneGen (&t, buf, DAC_SAMPLERATE);
+		fa = dtmfFreqs[k / DTMF_COLS];
+		fb = dtmfFreqs[DTMF_ROWS + (k % DTMF_COLS)];
+		sig = err = 0;
+		for (i = 0; i < DAC_SAMPLERATE; i++) {
+			d = (DTMF_LEVEL_MAX / 2.0) *
+			    (sin (2 * M_PI * fa * i / DAC_SAMPLERATE) +
+			    sin (2 * M_PI * fb * i / DAC_SAMPLERATE));
+			sig += d * d;
+			d = (double)buf[i] - (DTMF_MIDPOINT + d);
+			err += d * d;
+		}
+		d = 10.0 * log10 (sig / err);
+		if (d < worst)
+			worst = d;
+	}
+
+	cnt = DTMF_DIALER * DTMF_SECS;
+	ns = threadNanos ();
+	dtmfToneInit (&t, 1209, 697, DTMF_DIALER, DTMF_LEVEL_MAX);
+	dtmfToneGen (&t, buf, cnt);
+	ns = threadNanos () - ns;
+	printf ("DTMF generator: %.1f ns/sample, worst SNR %.1f dB\n",
+	    (double)ns / cnt, worst);
+
+	ns = threadNanos ();
+	fa = (2 * M_PI) / (DTMF_DIALER / 1209);
+	fb = (2 * M_PI) / (DTMF_DIALER / 697);
+	for (i = 0; i < cnt; i++)
+		buf[i] = lrint ((2047 + (fast_sin (fa * i) * 2047) +
+		    2047 + (fast_sin (fb * i) * 2047)) / 2.0);
+	ns = threadNanos () - ns;
+	printf ("old fast_sin(): %.1f ns/sample\n\n", (double)ns / cnt);
+
+	/* Decoding */
+
+	printf ("%-12s %6s %-18s %-18s %s\n", "test", "rate", "sent", "decoded",
+	    "");
+
+	dns = dcnt = 0;
+	srand (1);
+	for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+		for (k = 0; k < sizeof(tests) / sizeof(tests[0]); k++) {
+			cnt = dtmfSignal (tests[k].digits, rates[r],
+			    tests[k].level, tests[k].twist, tests[k].noise,
+			    buf);
+			dtmfDecode (buf, cnt, rates[r], got, &dns);
+			dcnt += cnt;
+			expect = tests[k].expect;
+			if (expect == NULL)
+				expect = tests[k].digits;
+			if (strcmp (got, expect) != 0)
+				fails++;
+			printf ("%-12s %6u %-18s %-18s %s\n", tests[k].name,
+			    rates[r], tests[k].digits, got,
+			    strcmp (got, expect) == 0 ? "ok" : "FAILED");
+		}
+	}
+
+	printf ("DTMF decoder: %.1f ns/sample\n", (double)dns / dcnt);
+
+	free (buf);
+
+	return (fails);
+}
+
+static int
+benchSound (char * name)
+{
+	uint64_t cpu;
+	uint64_t t;
+	int i;
+
+	/*
+	 * Each copy plays at a share of full volume, so the mix comes out
+	 * at about the level of the file. The effects start a little after
+	 * the file, so the audio hash varies from run to run with -e.
+	 */
+
+	dacVoiceGain (0, DAC_GAIN_UNITY / (effects + 1));
+
+	cpu = cpuNanos ();
+	t = hostNanos ();
+	dacPlay (name);
+	for (i = 0; i < effects; i++) {
+		if (dacVoicePlay (name, DAC_GAIN_UNITY / (effects + 1)) == -1)
+			printf ("no voice for effect %d\n", i + 1);
+	}
+	dacWait ();
+	t = hostNanos () - t;
+	cpu = cpuNanos () - cpu;
+
+	printf ("%s:\n", name);
+	if (hostStats.hs_samples == 0) {
+		printf ("playback failed\n");
+		return (-1);
+	}
+
+	printf ("play time        : %llu ms (%llu ms of samples)\n",
+	    (unsigned long long)(t / 1000000),
+	    (unsigned long long)((hostStats.hs_samples * 1000) /
+	    DAC_SAMPLERATE));
+	reportAudio ();
+	reportBus (t);
+	reportCpu (cpu, t);
+
+	return (0);
+}
+
+int
+main (int argc, char ** argv)
+{
+	char ** names;
+	char * image = NULL;
+	char * frame = NULL;
+	char * audio = NULL;
+	char * golden = NULL;
+	const char * ext;
+	uint32_t size;
+	int spc = DEFAULT_SPC;
+	int resample = 0;
+	int fft = 0;
+	int dtmf = 0;
+	int radio = 0;
+	int fights = 0;
+	int update = 0;
+	int errs = 0;
+	int ch;
+	int i;
+
+	hostBus.hb_spihz = DEFAULT_SPIHZ;
+	hostBus.hb_readlat = DEFAULT_READLAT * 1000;
+	hostBus.hb_stream = 1;
+
+	while ((ch = getopt (argc, argv, "s:l:c:i:o:a:e:q:SRFDT:P:G:W")) != -1) {
+		switch (ch) {
+		case 's':
+			hostBus.hb_spihz = strtoul (optarg, NULL, 0);
+			break;
+		case 'l':
+			hostBus.hb_readlat = strtoul (optarg, NULL, 0) * 1000;
+			break;
+		case 'c':
+			spc = atoi (optarg);
+			if (spc < 1 || spc > 128 || (spc & (spc - 1)))
+				usage (argv[0]);
+			break;
+		case 'i':
+			image = optarg;
+			break;
+		case 'o':
+			frame = optarg;
+			break;
+		case 'a':
+			audio = optarg;
+			break;
+		case 'e':
+			effects = atoi (optarg);
+			if (effects < 0 || effects >= DAC_VOICES)
+				usage (argv[0]);
+			break;
+		case 'q':
+			dacResampleQuality (atoi (optarg));
+			break;
+		case 'S':
+			hostBus.hb_stream = 0;
+			break;
+		case 'R':
+			resample = 1;
+			break;
+		case 'F':
+			fft = 1;
+			break;
+		case 'D':
+			dtmf = 1;
+			break;
+		case 'T':
+			radio = atoi (optarg);
+			if (radio < 1)
+				usage (argv[0]);
+			break;
+		case 'P':
+			fights = atoi (optarg);
+			if (fights < 1)
+				usage (argv[0]);
+			break;
+		case 'G':
+			golden = optarg;
+			break;
+		case 'W':
+			update = 1;
+			break;
+		default:
+			usage (argv[0]);
+			break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if ((argc == 0 && resample == 0 && fft == 0 && dtmf == 0 &&
+	    radio == 0 && fights == 0 && golden == NULL) ||
+	    (update && golden == NULL))
+		usage (argv[-optind]);
+
+	hostOsInit ();
+
+	if (resample) {
+		errs += benchResample () != 0;
+		if (argc == 0 && fft == 0 && dtmf == 0 && radio == 0 &&
+		    fights == 0 && golden == NULL)
+			exit (errs ? 1 : 0);
+		printf ("\n");
+	}
+	if (fft) {
+		errs += benchFft () != 0;
+		if (argc == 0 && dtmf == 0 && radio == 0 && fights == 0 &&
+		    golden == NULL)
+			exit (errs ? 1 : 0);
+		printf ("\n");
+	}
+	if (dtmf) {
+		errs += benchDtmf () != 0;
+		if (argc == 0 && radio == 0 && fights == 0 &&
+		    golden == NULL)
+			exit (errs ? 1 : 0);
+		printf ("\n");
+	}
+	if (radio) {
+		errs += benchRadio (radio) != 0;
+		if (argc == 0 && fights == 0 && golden == NULL)
+			exit (errs ? 1 : 0);
+		printf ("\n");
+	}
+	if (fights) {
+		errs += benchFight (fights) != 0;
+		if (argc == 0 && golden == NULL)
+			exit (errs ? 1 : 0);
+		printf ("\n");
+	}
+	if (hostHwInit () != 0)
+		exit (1);
+
+	config.sound_enabled = 1;
+
+	/*
+	 * With an existing image the files are already on it, so the
+	 * names are used as they are. Otherwise build a fresh image
+	 * and copy the files onto it.
+	 */
+
+	names = calloc (argc, sizeof(char *));
+
+	if (image != NULL) {
+		if (hostDiskOpen (image) != 0)
+			exit (1);
+		for (i = 0; i < argc; i++)
+			names[i] = argv[i];
+	} else {
+		size = imageSize (argc, argv, spc);
+		if (size == 0) {
+			fprintf (stderr, "files too big for a FAT16 image "
+			    "with %d sector clusters\n", spc);
+			exit (1);
+		}
+		if (hostDiskCreate (DEFAULT_IMAGE, size, spc) != 0)
+			exit (1);
+	}
+
+	if (f_mount (&fs, "0:", 1) != FR_OK) {
+		fprintf (stderr, "can't mount the image\n");
+		exit (1);
+	}
+
+	if (image == NULL) {
+		for (i = 0; i < argc; i++) {
+			names[i] = malloc (13);
+			dosName (argv[i], names[i]);
+			if (copyIn (argv[i], names[i]) != 0)
+				exit (1);
+		}
+	}
+
+	dacStart (&DAC1);
+
+	if (golden != NULL) {
+		errs += benchRegress (golden, update) != 0;
+		printf ("\n");
+	}
+
+	for (i = 0; i < argc; i++) {
+		hostHwReset ();
+		ext = strrchr (names[i], '.');
+		if (ext != NULL && strcasecmp (ext, ".vid") == 0)
+			errs += benchVideo (names[i]) != 0;
+		else
+			errs += benchSound (names[i]) != 0;
+		printf ("\n");
+	}
+
+	if (frame != NULL && hostFrameSave (frame) != 0) {
+		perror (frame);
+		errs++;
+	}
+
+	if (audio != NULL && hostAudioSave (audio) != 0) {
+		perror (audio);
+		errs++;
+	}
+
+	f_mount (NULL, "0:", 0);
+	hostDiskClose ();
+
+	printf ("Note: CPU time is the host's, not a 48MHz Cortex-M0+.\n");
+
+	exit (errs ? 1 : 0);
+}
@@ -0,0 +1,427 @@
+/*
+ * Fight protocol checks for the host media benchmark
+ *
+ * With -P <fights>, two badges play that many fights against each other
+ * through proto.c, at each of a few rates of frame loss. proto.c is
+ * built by itself (see include/fight.h) with radioSendAsync() turned
+ * into linkSend(), which puts each frame on a model of the air: frames
+ * go out one at a time at 50Kbps, taking as long as the radio takes to
+ * send them, and a share of them never arrive. The link thread hands
+ * the ones that do to the other badge's rxHandle(), and the tick thread
+ * calls tickHandle() for both on the fight app's frame interval.
+ *
+ * In each turn one badge sends FIGHT_MSGS messages, its move and its
+ * state, and once the other has both it sends its own. We report how
+ * long turns took, from the first send until the other side had the
+ * whole turn, and how many messages were sent again, how many
+ * duplicates were thrown away and how many frames went out, per fight.
+ * A fight fails if it stalls, if any message arrives out of order or
+ * twice, or if not every message has been acknowledged at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fight.h"
+#include "radio_lld.h"
+#include "proto.h"
+
+#include "host.h"
+
+#define FIGHT_TURNS	10
+#define FIGHT_MSGS	2
+
+/* The fight app's frame interval, FRAME_INTERVAL_US */
+
+#define FIGHT_TICK_NS	66666000ULL
+
+/* How long to wait for a turn before calling the fight stalled */
+
+#define FIGHT_STALL	MS2ST(20000)
+
+#define FIGHT_BITRATE	50000
+
+#define NETID_A		0x0A0A0A0A
+#define NETID_B		0x0B0B0B0B
+
+typedef struct fight_msg {
+	int32_t		fm_id;		/* turn * FIGHT_MSGS + n */
+	uint64_t	fm_start;	/* when the turn was sent */
+} FIGHT_MSG;
+
+typedef struct fight_frame {
+	struct fight_frame *	ff_next;
+	uint64_t		ff_due;
+	KW01_PKT		ff_pkt;
+} FIGHT_FRAME;
+
+typedef struct fight_side {
+	OrchardAppContext	fs_ctx;
+	FightHandles		fs_fh;
+	ProtoHandles		fs_ph;
+	uint32_t		fs_netid;
+	int32_t			fs_next;	/* next message expected */
+	uint32_t		fs_acks;
+} FIGHT_SIDE;
+
+static const int fightLoss[] = { 0, 10, 25 };
+
+static FIGHT_SIDE sides[2];
+
+/* Stands in for each badge's app thread */
+
+static pthread_mutex_t fightlock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t linklock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t linkcond = PTHREAD_COND_INITIALIZER;
+static FIGHT_FRAME * linkhead;
+static FIGHT_FRAME * linktail;
+static uint64_t airfree;
+static unsigned int linkseed;
+static int linkloss;
+static uint32_t linkframes;
+static uint32_t linklost;
+
+static semaphore_t turndone;
+static int turns;
+static int errors;
+static uint64_t lat;
+static uint64_t latmax;
+
+static FIGHT_SIDE *
+sideByNetid (uint32_t netid)
+{
+	return (netid == NETID_A ? &sides[0] : &sides[1]);
+}
+
+/*
+ * How long a frame with <len> bytes of payload is on the air: preamble,
+ * sync word, length byte, header and payload padded out to whole AES
+ * blocks, and CRC.
+ */
+
+static uint64_t
+linkAirtime (uint8_t len)
+{
+	uint32_t bytes;
+
+	bytes = 3 + 6 + 1 + ((KW01_PKT_HDRLEN + len + 15) & ~15) + 2;
+
+	return (((uint64_t)bytes * 8 * 1000000000ULL) / FIGHT_BITRATE);
+}
+
+/******************************************************************************
+*
+* linkSend - proto.c's radioSendAsync()
+*
+* RETURNS: 0
+*/
+
+int
+linkSend (RADIODriver * radio, kw01_dst_t dest, kw01_proto_t prot,
+    uint8_t len, const void * payload, KW01_TX_FUNC cb, void * arg)
+{
+	FIGHT_FRAME * f;
+	uint64_t now;
+
+	(void)radio;
+
+	f = calloc (1, sizeof(FIGHT_FRAME));
+	f->ff_pkt.kw01_hdr.kw01_dst = dest;
+	f->ff_pkt.kw01_hdr.kw01_src = dest == NETID_A ? NETID_B : NETID_A;
+	f->ff_pkt.kw01_hdr.kw01_prot = prot;
+	f->ff_pkt.kw01_length = len;
+	memcpy (f->ff_pkt.kw01_payload, payload, len);
+
+	pthread_mutex_lock (&linklock);
+
+	now = hostNanos ();
+	if (airfree < now)
+		airfree = now;
+	airfree += linkAirtime (len);
+	f->ff_due = airfree;
+	linkframes++;
+
+	if ((int)(rand_r (&linkseed) % 100) < linkloss) {
+		linklost++;
+		free (f);
+	} else {
+		if (linkhead == NULL)
+			linkhead = f;
+		else
+			linktail->ff_next = f;
+		linktail = f;
+		pthread_cond_signal (&linkcond);
+	}
+
+	pthread_mutex_unlock (&linklock);
+
+	if (cb != NULL)
+		cb (0, arg);
+
+	return (0);
+}
+
+static
+THD_FUNCTION(linkThread, arg)
+{
+	FIGHT_FRAME * f;
+
+	(void)arg;
+
+	hostSimExempt ();
+
+	while (1) {
+		pthread_mutex_lock (&linklock);
+		while (linkhead == NULL)
+			pthread_cond_wait (&linkcond, &linklock);
+		f = linkhead;
+		pthread_mutex_unlock (&linklock);
+
+		hostSleepUntil (f->ff_due);
+
+		pthread_mutex_lock (&linklock);
+		linkhead = f->ff_next;
+		if (linkhead == NULL)
+			linktail = NULL;
+		pthread_mutex_unlock (&linklock);
+
+		pthread_mutex_lock (&fightlock);
+		rxHandle (&sideByNetid (f->ff_pkt.kw01_hdr.kw01_dst)->fs_ctx,
+		    &f->ff_pkt);
+		pthread_mutex_unlock (&fightlock);
+
+		free (f);
+	}
+
+	/* NOTREACHED */
+	return;
+}
+
+static
+THD_FUNCTION(tickThread, arg)
+{
+	uint64_t next;
+
+	(void)arg;
+
+	hostSimExempt ();
+
+	next = hostNanos ();
+
+	while (1) {
+		next += FIGHT_TICK_NS;
+		hostSleepUntil (next);
+
+		pthread_mutex_lock (&fightlock);
+		tickHandle (&sides[0].fs_ctx);
+		tickHandle (&sides[1].fs_ctx);
+		pthread_mutex_unlock (&fightlock);
+	}
+
+	/* NOTREACHED */
+	return;
+}
+
+/* Send turn <turn> from <s>. Called with fightlock held. */
+
+static void
+turnSend (FIGHT_SIDE * s, int turn)
+{
+	FIGHT_MSG m;
+	int i;
+
+	m.fm_start = hostNanos ();
+	for (i = 0; i < FIGHT_MSGS; i++) {
+		m.fm_id = turn * FIGHT_MSGS + i;
+		if (msgSend (&s->fs_ctx, &m) != 0)
+			errors++;
+	}
+
+	return;
+}
+
+static void
+fightRecv (KW01_PKT * pkt)
+{
+	FIGHT_SIDE * s;
+	PACKET * proto;
+	FIGHT_MSG m;
+	uint64_t t;
+	int turn;
+
+	s = sideByNetid (pkt->kw01_hdr.kw01_dst);
+	proto = (PACKET *)pkt->kw01_payload;
+	memcpy (&m, proto->prot_payload, sizeof(m));
+
+	if (m.fm_id != s->fs_next) {
+		errors++;
+		return;
+	}
+
+	s->fs_next++;
+
+	if ((m.fm_id % FIGHT_MSGS) != FIGHT_MSGS - 1)
+		return;
+
+	/* That's the whole turn: answer it, unless the fight's over. */
+
+	t = hostNanos () - m.fm_start;
+	lat += t;
+	if (t > latmax)
+		latmax = t;
+
+	turn = m.fm_id / FIGHT_MSGS;
+	s->fs_next = (turn + 2) * FIGHT_MSGS;
+	turns++;
+
+	if (turn + 1 < FIGHT_TURNS)
+		turnSend (s, turn + 1);
+
+	chSemSignal (&turndone);
+
+	return;
+}
+
+static void
+fightAck (KW01_PKT * pkt)
+{
+	sideByNetid (pkt->kw01_hdr.kw01_dst)->fs_acks++;
+	return;
+}
+
+/*
+ * Play one fight. Returns 0 if it finished and everything was
+ * acknowledged.
+ */
+
+static int
+fightPlay (uint32_t * sent, uint32_t * resent, uint32_t * dups)
+{
+	FIGHT_SIDE * s;
+	int empty;
+	int i;
+
+	pthread_mutex_lock (&fightlock);
+
+	for (i = 0; i < 2; i++) {
+		s = &sides[i];
+		memset (s, 0, sizeof(*s));
+		s->fs_netid = i == 0 ? NETID_A : NETID_B;
+		s->fs_fh.proto = &s->fs_ph;
+		s->fs_ctx.priv = &s->fs_fh;
+		protoInit (&s->fs_ctx);
+		s->fs_ph.netid = i == 0 ? NETID_B : NETID_A;
+		s->fs_ph.mtu = sizeof(FIGHT_MSG);
+		s->fs_ph.cb_recv = fightRecv;
+		s->fs_ph.cb_ack = fightAck;
+		s->fs_next = i == 0 ? FIGHT_MSGS : 0;
+	}
+
+	chSemReset (&turndone, 0);
+	turns = 0;
+	turnSend (&sides[0], 0);
+
+	pthread_mutex_unlock (&fightlock);
+
+	for (i = 0; i < FIGHT_TURNS; i++) {
+		if (chSemWaitTimeout (&turndone, FIGHT_STALL) != MSG_OK)
+			return (-1);
+	}
+
+	/* Wait for the last ACKs. */
+
+	for (i = 0; i < 100; i++) {
+		pthread_mutex_lock (&linklock);
+		empty = linkhead == NULL;
+		pthread_mutex_unlock (&linklock);
+		pthread_mutex_lock (&fightlock);
+		empty = empty && msgReceived (&sides[0].fs_ctx) == 0 &&
+		    msgReceived (&sides[1].fs_ctx) == 0;
+		pthread_mutex_unlock (&fightlock);
+		if (empty)
+			break;
+		chThdSleep (MS2ST(50));
+	}
+
+	/* Let any stray retransmission land before the next fight. */
+
+	chThdSleep (MS2ST(100));
+
+	pthread_mutex_lock (&fightlock);
+	*sent += sides[0].fs_ph.sent + sides[1].fs_ph.sent;
+	*resent += sides[0].fs_ph.retransmits + sides[1].fs_ph.retransmits;
+	*dups += sides[0].fs_ph.duplicates + sides[1].fs_ph.duplicates;
+	i = sides[0].fs_acks + sides[1].fs_acks;
+	pthread_mutex_unlock (&fightlock);
+
+	if (i != FIGHT_TURNS * FIGHT_MSGS)
+		return (-1);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* benchFight - play fights through proto.c over a lossy link
+*
+* RETURNS: 0 if every fight finished correctly, -1 if any didn't
+*/
+
+int
+benchFight (int fights)
+{
+	uint32_t sent;
+	uint32_t resent;
+	uint32_t dups;
+	unsigned int l;
+	int stalled;
+	int errs;
+	int i;
+
+	chSemObjectInit (&turndone, 0);
+
+	chThdCreateStatic (NULL, 0, HIGHPRIO, linkThread, NULL);
+	chThdCreateStatic (NULL, 0, NORMALPRIO, tickThread, NULL);
+
+	errs = 0;
+
+	for (l = 0; l < sizeof(fightLoss) / sizeof(fightLoss[0]); l++) {
+		pthread_mutex_lock (&linklock);
+		linkloss = fightLoss[l];
+		linkseed = 1 + l;
+		linkframes = linklost = 0;
+		pthread_mutex_unlock (&linklock);
+
+		sent = resent = dups = 0;
+		lat = latmax = 0;
+		errors = 0;
+		stalled = 0;
+
+		for (i = 0; i < fights; i++) {
+			if (fightPlay (&sent, &resent, &dups) != 0)
+				stalled++;
+		}
+
+		printf ("fights at %d%% loss : %d of %d turns, %d stalled, "
+		    "%d out of order\n", fightLoss[l], fights, FIGHT_TURNS,
+		    stalled, errors);
+		printf ("turn latency     : %llu ms average, %llu ms max\n",
+		    (unsigned long long)(lat /
+		    (fights * FIGHT_TURNS) / 1000000),
+		    (unsigned long long)(latmax / 1000000));
+		printf ("per fight        : %.1f messages, %.1f resent, "
+		    "%.1f duplicates\n", (double)sent / fights,
+		    (double)resent / fights, (double)dups / fights);
+		printf ("frames on air    : %.1f per fight, %.1f lost\n\n",
+		    (double)linkframes / fights, (double)linklost / fights);
+
+		if (stalled || errors)
+			errs++;
+	}
+
+	return (errs ? -1 : 0);
+}
@@ -0,0 +1,137 @@
+/*
+ * Interfaces between the pieces of the host media benchmark.
+ */
+
+#ifndef _BENCH_HOST_H_
+#define _BENCH_HOST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Timing model for the shared SPI bus. The SD card and the display sit
+ * on the same SPI channel, so only one of them can be talking at once.
+ * Each transfer holds the bus for as long as it would take to clock its
+ * bytes out at hb_spihz, and each SD card read command also pays
+ * hb_readlat nanoseconds of latency. With hb_stream set, a read that
+ * follows on from the last one carries on with the same command, the
+ * way mmc_disk_read() does. A clock of 0 turns the model off.
+ */
+
+typedef struct host_bus {
+	uint32_t	hb_spihz;
+	uint32_t	hb_readlat;
+	int		hb_stream;
+} HOST_BUS;
+
+/*
+ * What the recording stand-ins saw during a run. All times are in
+ * nanoseconds.
+ */
+
+typedef struct host_stats {
+	uint64_t	hs_dispns;	/* Bus time spent on the display */
+	uint64_t	hs_diskns;	/* Bus time spent on the SD card */
+	uint64_t	hs_waitns;	/* Time spent waiting for the bus */
+	uint32_t	hs_windows;	/* Display windows opened */
+	uint64_t	hs_pixels;	/* Pixels sent to the display */
+	uint32_t	hs_reads;	/* SD card reads */
+	uint32_t	hs_cmds;	/* SD card read commands */
+	uint64_t	hs_sectors;	/* Sectors read */
+	uint64_t	hs_ticks;	/* PIT ticks while the DAC was enabled */
+	uint64_t	hs_samples;	/* Samples written to the DAC */
+	uint64_t	hs_empty;	/* Ticks with no sample to play */
+	uint64_t	hs_audiohash;	/* FNV-1a of every sample written */
+	uint32_t	hs_heap;	/* Bytes allocated from the heap */
+	uint32_t	hs_heappeak;	/* Most bytes allocated at once */
+} HOST_STATS;
+
+extern HOST_BUS hostBus;
+extern HOST_STATS hostStats;
+
+/*
+ * What the radio model saw. Times are in nanoseconds.
+ */
+
+typedef struct host_radio {
+	uint64_t	hr_xfers;	/* SPI transactions */
+	uint64_t	hr_bytes;	/* SPI bytes, both ways */
+	uint64_t	hr_spins;	/* CPU time spent on SPI transfers */
+	uint64_t	hr_frames;	/* Frames transmitted */
+	uint64_t	hr_airns;	/* Time on the air */
+	uint64_t	hr_irqs;	/* Interrupts raised on DIO0 */
+	uint64_t	hr_rxframes;	/* Frames received into the FIFO */
+	uint64_t	hr_rxlost;	/* Frames lost with the FIFO still full */
+	uint64_t	hr_rxwait;	/* Time frames sat in the FIFO */
+	uint64_t	hr_rxwaitmax;	/* Longest a frame sat in the FIFO */
+} HOST_RADIO;
+
+extern HOST_RADIO hostRadio;
+
+/*
+ * A change in what the buzzer is playing: the tone's frequency in Hz,
+ * or 0 when it went quiet, and the system time it happened (see
+ * hostSysNanos()).
+ */
+
+typedef struct host_tone {
+	uint64_t	ht_ns;
+	uint32_t	ht_hz;
+} HOST_TONE;
+
+/* host_os.c */
+
+extern void hostOsInit (void);
+extern uint64_t hostNanos (void);
+extern uint64_t hostSysNanos (void);
+extern void hostSleepUntil (uint64_t);
+extern void hostSimClock (int);
+extern void hostSimExempt (void);
+extern int hostSimSleepUntil (uint64_t);
+extern void hostSimDone (void);
+extern int hostSimWait (uint64_t *);
+extern void hostSimAdvance (void);
+extern void hostIsrEnter (void);
+extern void hostIsrExit (void);
+
+/* host_hw.c */
+
+extern int hostHwInit (void);
+extern void hostHwReset (void);
+extern void hostBusAcquire (void);
+extern void hostBusRelease (void);
+extern void hostBusXfer (uint32_t, uint64_t, uint64_t *);
+extern uint64_t hostFrameHash (void);
+extern int hostFrameSave (const char *);
+extern int hostAudioSave (const char *);
+extern const uint16_t * hostAudio (uint64_t *);
+extern const HOST_TONE * hostTones (int *);
+
+/* host_disk.c */
+
+extern int hostDiskCreate (const char *, uint32_t, int);
+extern int hostDiskOpen (const char *);
+extern void hostDiskClose (void);
+
+extern uint64_t hostFnv (uint64_t, const void *, size_t);
+
+#define HOST_FNV_INIT	0xCBF29CE484222325ULL
+
+/* host_radio.c */
+
+extern void hostRadioInit (void);
+extern int hostRadioReceive (const void *, uint8_t);
+
+/* radio.c */
+
+extern int benchRadio (int);
+
+/* fight.c */
+
+extern int benchFight (int);
+
+/* regress.c */
+
+extern int benchRegress (const char *, int);
+
+#endif /* _BENCH_HOST_H_ */
@@ -0,0 +1,353 @@
+/*
+ * FatFs disk driver backed by an image file, standing in for the SD card.
+ *
+ * Reads hold the shared SPI bus for as long as the SPI SD card driver
+ * would: each sector's data, CRC and start token clocked over the bus,
+ * plus a command latency unless the read carries on from the last one
+ * and hostBus.hb_stream is set. Writes are free, since the benchmark
+ * only writes while it's copying files onto a fresh image.
+ *
+ * We can also create an empty FAT16 image, so the benchmark doesn't
+ * depend on having a FAT formatter on the host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ch.h"
+
+#include "ff.h"
+#include "diskio.h"
+
+#include "host.h"
+
+#define SECTOR		512
+
+/* Bytes on the bus per sector: start token, data and CRC */
+
+#define SECTOR_BYTES	(SECTOR + 3)
+
+/* Bytes on the bus to stop an open read: CMD12, stuff byte and R1 */
+
+#define STOP_BYTES	8
+
+#define ROOT_ENTRIES	512
+
+static int diskfd = -1;
+static uint32_t disksectors;
+static uint32_t streamnext;
+static int streaming;
+static mutex_t fflock;
+
+/******************************************************************************
+*
+* hostFnv - fold a buffer into a 64-bit FNV-1a hash
+*
+* RETURNS: the updated hash
+*/
+
+uint64_t
+hostFnv (uint64_t h, const void * p, size_t len)
+{
+	const uint8_t * b;
+
+	b = p;
+	while (len--) {
+		h ^= *b++;
+		h *= 0x100000001B3ULL;
+	}
+
+	return (h);
+}
+
+static void
+put16 (uint8_t * p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+	return;
+}
+
+static void
+put32 (uint8_t * p, uint32_t v)
+{
+	put16 (p, v & 0xFFFF);
+	put16 (p + 2, v >> 16);
+	return;
+}
+
+/******************************************************************************
+*
+* hostDiskCreate - create an empty FAT16 image
+*
+* This function creates a <size> byte image file at <path>, with an
+* unpartitioned FAT16 file system using clusters of <spc> sectors, and
+* opens it for use. The file is sparse, so only the sectors we write
+* take up space on the host.
+*
+* RETURNS: 0 on success, or -1 if the image can't be created or the size
+*          doesn't give a valid FAT16 cluster count
+*/
+
+int
+hostDiskCreate (const char * path, uint32_t size, int spc)
+{
+	uint8_t bs[SECTOR];
+	uint32_t sectors;
+	uint32_t rootsecs;
+	uint32_t fatsz;
+	uint32_t clusters;
+	uint32_t i;
+	int fd;
+
+	sectors = size / SECTOR;
+	rootsecs = (ROOT_ENTRIES * 32) / SECTOR;
+
+	/*
+	 * The FAT size depends on the cluster count, which depends on
+	 * the FAT size, so go around until it settles.
+	 */
+
+	fatsz = 1;
+	for (i = 0; i < 4; i++) {
+		clusters = (sectors - 1 - (2 * fatsz) - rootsecs) / spc;
+		fatsz = (((clusters + 2) * 2) + SECTOR - 1) / SECTOR;
+	}
+
+	clusters = (sectors - 1 - (2 * fatsz) - rootsecs) / spc;
+	if (clusters < 4085 || clusters > 65524) {
+		fprintf (stderr, "%u byte image with %d sector clusters "
+		    "isn't a valid FAT16 volume\n", size, spc);
+		return (-1);
+	}
+
+	fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror (path);
+		return (-1);
+	}
+
+	if (ftruncate (fd, (off_t)sectors * SECTOR) == -1) {
+		perror (path);
+		close (fd);
+		return (-1);
+	}
+
+	memset (bs, 0, sizeof(bs));
+	bs[0] = 0xEB;
+	bs[1] = 0x3C;
+	bs[2] = 0x90;
+	memcpy (bs + 3, "MSDOS5.0", 8);
+	put16 (bs + 11, SECTOR);
+	bs[13] = spc;
+	put16 (bs + 14, 1);		/* Reserved sectors */
+	bs[16] = 2;			/* FATs */
+	put16 (bs + 17, ROOT_ENTRIES);
+	if (sectors < 0x10000)
+		put16 (bs + 19, sectors);
+	else
+		put32 (bs + 32, sectors);
+	bs[21] = 0xF8;			/* Media */
+	put16 (bs + 22, fatsz);
+	put16 (bs + 24, 63);		/* Sectors per track */
+	put16 (bs + 26, 255);		/* Heads */
+	bs[36] = 0x80;			/* Drive number */
+	bs[38] = 0x29;			/* Extended boot signature */
+	put32 (bs + 39, 0x12345678);	/* Volume serial number */
+	memcpy (bs + 43, "NO NAME    ", 11);
+	memcpy (bs + 54, "FAT16   ", 8);
+	bs[510] = 0x55;
+	bs[511] = 0xAA;
+
+	if (pwrite (fd, bs, SECTOR, 0) != SECTOR)
+		goto fail;
+
+	/* Each FAT starts with the media byte and an end of chain mark. */
+
+	memset (bs, 0, sizeof(bs));
+	put16 (bs, 0xFFF8);
+	put16 (bs + 2, 0xFFFF);
+
+	for (i = 0; i < 2; i++) {
+		if (pwrite (fd, bs, SECTOR,
+		    (off_t)(1 + (i * fatsz)) * SECTOR) != SECTOR)
+			goto fail;
+	}
+
+	close (fd);
+
+	return (hostDiskOpen (path));
+
+fail:
+	perror (path);
+	close (fd);
+	return (-1);
+}
+
+/******************************************************************************
+*
+* hostDiskOpen - attach an existing image to the disk driver
+*
+* RETURNS: 0 on success, -1 on failure
+*/
+
+int
+hostDiskOpen (const char * path)
+{
+	off_t len;
+
+	diskfd = open (path, O_RDWR);
+	if (diskfd == -1) {
+		perror (path);
+		return (-1);
+	}
+
+	len = lseek (diskfd, 0, SEEK_END);
+	disksectors = len / SECTOR;
+
+	return (0);
+}
+
+void
+hostDiskClose (void)
+{
+	if (diskfd != -1)
+		close (diskfd);
+	diskfd = -1;
+	return;
+}
+
+/*
+ * FatFs disk interface
+ */
+
+DSTATUS
+disk_initialize (BYTE pdrv)
+{
+	return (disk_status (pdrv));
+}
+
+DSTATUS
+disk_status (BYTE pdrv)
+{
+	if (pdrv != 0 || diskfd == -1)
+		return (STA_NOINIT);
+	return (0);
+}
+
+DRESULT
+disk_read (BYTE pdrv, BYTE * buff, DWORD sector, UINT count)
+{
+	ssize_t len;
+
+	if (pdrv != 0 || diskfd == -1)
+		return (RES_NOTRDY);
+
+	len = (ssize_t)count * SECTOR;
+	if (pread (diskfd, buff, len, (off_t)sector * SECTOR) != len)
+		return (RES_ERROR);
+
+	hostStats.hs_reads++;
+	hostStats.hs_sectors += count;
+
+	hostBusAcquire ();
+	if (streaming && sector == streamnext) {
+		hostBusXfer (count * SECTOR_BYTES, 0, &hostStats.hs_diskns);
+	} else {
+		hostStats.hs_cmds++;
+		hostBusXfer ((streaming ? STOP_BYTES : 0) +
+		    (count * SECTOR_BYTES), hostBus.hb_readlat,
+		    &hostStats.hs_diskns);
+	}
+	streaming = hostBus.hb_stream;
+	streamnext = sector + count;
+	hostBusRelease ();
+
+	return (RES_OK);
+}
+
+DRESULT
+disk_write (BYTE pdrv, const BYTE * buff, DWORD sector, UINT count)
+{
+	ssize_t len;
+
+	if (pdrv != 0 || diskfd == -1)
+		return (RES_NOTRDY);
+
+	len = (ssize_t)count * SECTOR;
+	if (pwrite (diskfd, buff, len, (off_t)sector * SECTOR) != len)
+		return (RES_ERROR);
+
+	streaming = 0;
+
+	return (RES_OK);
+}
+
+DRESULT
+disk_ioctl (BYTE pdrv, BYTE cmd, void * buff)
+{
+	if (pdrv != 0 || diskfd == -1)
+		return (RES_NOTRDY);
+
+	switch (cmd) {
+	case CTRL_SYNC:
+		return (RES_OK);
+	case GET_SECTOR_COUNT:
+		*(DWORD *)buff = disksectors;
+		return (RES_OK);
+	case GET_SECTOR_SIZE:
+		*(WORD *)buff = SECTOR;
+		return (RES_OK);
+	case GET_BLOCK_SIZE:
+		*(DWORD *)buff = 1;
+		return (RES_OK);
+	default:
+		break;
+	}
+
+	return (RES_PARERR);
+}
+
+DWORD
+get_fattime (void)
+{
+	return (((DWORD)(_NORTC_YEAR - 1980) << 25) |
+	    ((DWORD)_NORTC_MON << 21) | ((DWORD)_NORTC_MDAY << 16));
+}
+
+/*
+ * FatFs locking. There's only one volume, so one lock will do.
+ */
+
+int
+ff_cre_syncobj (BYTE vol, _SYNC_t * sobj)
+{
+	(void)vol;
+	chMtxObjectInit (&fflock);
+	*sobj = &fflock;
+	return (1);
+}
+
+int
+ff_del_syncobj (_SYNC_t sobj)
+{
+	(void)sobj;
+	return (1);
+}
+
+int
+ff_req_grant (_SYNC_t sobj)
+{
+	chMtxLock (sobj);
+	return (1);
+}
+
+void
+ff_rel_grant (_SYNC_t sobj)
+{
+	chMtxUnlock (sobj);
+	return;
+}
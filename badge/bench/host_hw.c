@@ -0,0 +1,606 @@
+/*
+ * Recording stand-ins for the hardware the media code drives: the shared
+ * SPI bus, the display, the SPI DMA channel, PIT1, the DAC and the TPM
+ * that drives the buzzer.
+ *
+ * The display is a 320x240 frame buffer. gdisp_lld_write_start() opens a
+ * window on it the way the ILI9341 driver does, and each dmaSend16() call
+ * fills pixels into the window in order, wrapping from one row to the
+ * next. Both hold the SPI bus for as long as the real transfers would
+ * take, so the display competes with the SD card for the bus just as it
+ * does on the badge.
+ *
+ * dac_lld.c talks to the DAC through its real register address, so we
+ * map a page of memory there. A PIT thread calls the handler registered
+ * with pit1Start() at the rate programmed into PIT1's load register, in
+ * simulated interrupt context, and picks each sample out of the DAC data
+ * register afterwards. A tick where the handler had nothing to write is
+ * counted as the audio running dry.
+ *
+ * tpm_lld.c programs TPM2 through a plain structure, so a thread polls
+ * it once TPM2's clock is turned on and logs each change of tone with
+ * the time it was first seen. A change has to be seen twice in a row
+ * before it's logged, so we never log the half programmed state in the
+ * middle of pwmToneStart(). While the simulated clock is on (see
+ * host_os.c), the same thread moves the clock on instead of polling,
+ * and looks at TPM2 each time before it does. No thread can be running
+ * then, so each change is logged at the exact time it was made.
+ *
+ * The model threads run on host time, outside the simulated clock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "gfx.h"
+
+#include "dac_lld.h"
+#include "dac_reg.h"
+#include "pit_lld.h"
+#include "pit_reg.h"
+#include "dma_lld.h"
+#include "kinetis_tpm.h"
+
+#include "host.h"
+
+/* Bytes sent to set up a display window: CASET, PASET and RAMWR */
+
+#define WINDOW_BYTES	11
+
+/* Value no 12-bit DAC sample can have, to spot ticks with no write */
+
+#define DAC_NOSAMPLE	0xFFFF
+
+/* Most samples we keep for hostAudioSave() (about 20 minutes) */
+
+#define AUDIO_MAX	(DAC_SAMPLERATE * 60 * 20)
+
+/*
+ * A wakeup this soon after the bus became free is taken to be a back to
+ * back transfer, so the host's scheduling latency doesn't pile up.
+ */
+
+#define BUS_SLOP	100000
+
+/* How often we look at TPM2, and how many tone changes we keep */
+
+#define TONE_POLL	20000
+#define TONE_MAX	4096
+
+HOST_BUS hostBus;
+HOST_STATS hostStats;
+
+static GDisplay display;
+GDisplay * GDISP = &display;
+
+PITDriver PIT1;
+TPM_TypeDef hostTPM2;
+
+static pixel_t fb[GDISP_SCREEN_HEIGHT][GDISP_SCREEN_WIDTH];
+static int winx;
+static int winy;
+static int wincx;
+static int wincy;
+static int curx;
+static int cury;
+
+static pthread_mutex_t buslock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t busfree;
+
+static uint8_t pitregs[0x120];
+static volatile uint8_t pitena;
+static uint16_t * audio;
+
+static HOST_TONE tones[TONE_MAX];
+static volatile int ntones;
+
+/******************************************************************************
+*
+* hostBusAcquire - take ownership of the SPI bus
+*
+* RETURNS: N/A
+*/
+
+void
+hostBusAcquire (void)
+{
+	uint64_t t;
+
+	t = hostNanos ();
+	pthread_mutex_lock (&buslock);
+	hostStats.hs_waitns += hostNanos () - t;
+
+	return;
+}
+
+void
+hostBusRelease (void)
+{
+	pthread_mutex_unlock (&buslock);
+	return;
+}
+
+/******************************************************************************
+*
+* hostBusXfer - account for a transfer on the SPI bus
+*
+* This function charges the time it takes to clock <bytes> bytes over the
+* bus, plus <extra> nanoseconds, to <ns>, and sleeps until the transfer
+* would have finished. The caller must hold the bus.
+*
+* RETURNS: N/A
+*/
+
+void
+hostBusXfer (uint32_t bytes, uint64_t extra, uint64_t * ns)
+{
+	uint64_t start;
+	uint64_t t;
+	uint64_t d;
+
+	if (hostBus.hb_spihz == 0)
+		return;
+
+	d = (((uint64_t)bytes * 8 * 1000000000ULL) / hostBus.hb_spihz) + extra;
+	*ns += d;
+
+	t = hostNanos ();
+	start = (t < busfree + BUS_SLOP) ? busfree : t;
+	if (start < t && t - start > d)
+		start = t - d;
+	busfree = start + d;
+	if (busfree > t)
+		hostSleepUntil (busfree);
+
+	return;
+}
+
+/******************************************************************************
+*
+* gdisp_lld_write_start - open a window on the display
+*
+* RETURNS: N/A
+*/
+
+void
+gdisp_lld_write_start (GDisplay * g)
+{
+	hostBusAcquire ();
+
+	winx = g->p.x;
+	winy = g->p.y;
+	wincx = g->p.cx;
+	wincy = g->p.cy;
+	curx = 0;
+	cury = 0;
+
+	hostStats.hs_windows++;
+	hostBusXfer (WINDOW_BYTES, 0, &hostStats.hs_dispns);
+
+	return;
+}
+
+void
+gdisp_lld_write_stop (GDisplay * g)
+{
+	(void)g;
+	hostBusRelease ();
+	return;
+}
+
+/******************************************************************************
+*
+* dmaSend16 - send pixels to the display window
+*
+* This stands in for sending <len> bytes of 16-bit data to the SPI
+* controller with DMA, which the media code only does between calls to
+* gdisp_lld_write_start() and gdisp_lld_write_stop(). Pixels that fall
+* outside the window or the screen are counted but dropped, as the
+* controller would.
+*
+* RETURNS: N/A
+*/
+
+void
+dmaSend16 (const void * src, uint32_t len)
+{
+	const pixel_t * p;
+	uint32_t n;
+	int x;
+	int y;
+
+	p = src;
+	n = len / sizeof(pixel_t);
+	hostStats.hs_pixels += n;
+
+	while (n--) {
+		x = winx + curx;
+		y = winy + cury;
+		if (cury < wincy && x >= 0 && x < GDISP_SCREEN_WIDTH &&
+		    y >= 0 && y < GDISP_SCREEN_HEIGHT)
+			fb[y][x] = *p;
+		p++;
+		if (++curx == wincx) {
+			curx = 0;
+			cury++;
+		}
+	}
+
+	hostBusXfer (len, 0, &hostStats.hs_dispns);
+
+	return;
+}
+
+/*
+ * PIT1
+ */
+
+void
+pit1Start (PITDriver * pit, PIT_FUNC func)
+{
+	pit->pit1_func = func;
+	CSR_WRITE_4(pit, PIT_LDVAL1,
+	    KINETIS_BUSCLK_FREQUENCY / DAC_SAMPLERATE);
+	return;
+}
+
+void
+pitEnable (PITDriver * pit, uint8_t chan)
+{
+	(void)pit;
+	if (chan == 1)
+		pitena = 1;
+	return;
+}
+
+void
+pitDisable (PITDriver * pit, uint8_t chan)
+{
+	(void)pit;
+	if (chan == 1)
+		pitena = 0;
+	return;
+}
+
+/******************************************************************************
+*
+* pitThread - fire the PIT1 interrupt
+*
+* This thread calls the PIT1 handler at the rate set in the PIT1 load
+* register while channel 1 is enabled. Ticks are scheduled against
+* absolute times, so if the host is slow to wake us up we catch up with
+* several ticks in a row instead of drifting. While the simulated clock
+* is on, the ticks are scheduled on it instead, so the DAC plays in step
+* with the threads feeding it however long they take on the host.
+*
+* RETURNS: N/A
+*/
+
+static
+THD_FUNCTION(pitThread, arg)
+{
+	volatile uint16_t * dat;
+	uint64_t next;
+	uint64_t period;
+	uint32_t ldval;
+	uint16_t s;
+	int played;
+
+	(void)arg;
+
+	chRegSetThreadName ("pit");
+	hostSimExempt ();
+
+	dat = (volatile uint16_t *)(DAC_BASE + DAC0_DAT0L);
+	next = 0;
+	played = 0;
+
+	while (1) {
+		if (pitena == 0 || PIT1.pit1_func == NULL) {
+			hostSimDone ();
+			chThdSleep (1);
+			next = 0;
+			played = 0;
+			continue;
+		}
+
+		ldval = CSR_READ_4(&PIT1, PIT_LDVAL1);
+		if (ldval == 0)
+			ldval = 1;
+		period = ((uint64_t)ldval * 1000000000ULL) /
+		    KINETIS_BUSCLK_FREQUENCY;
+
+		if (next == 0)
+			next = hostSysNanos ();
+		next += period;
+		if (hostSimSleepUntil (next) != 0)
+			hostSleepUntil (next);
+
+		hostIsrEnter ();
+		*dat = DAC_NOSAMPLE;
+		PIT1.pit1_func ();
+		s = *dat;
+		hostIsrExit ();
+
+		hostStats.hs_ticks++;
+		if (s == DAC_NOSAMPLE) {
+			/* Only count gaps once the audio has started. */
+			if (played)
+				hostStats.hs_empty++;
+			continue;
+		}
+
+		played = 1;
+		hostStats.hs_audiohash = hostFnv (hostStats.hs_audiohash,
+		    &s, sizeof(s));
+		if (audio != NULL && hostStats.hs_samples < AUDIO_MAX)
+			audio[hostStats.hs_samples] = s;
+		hostStats.hs_samples++;
+	}
+
+	/* NOTREACHED */
+	return;
+}
+
+/******************************************************************************
+*
+* tpmHz - work out the tone TPM2 is playing
+*
+* RETURNS: the frequency of the square wave in Hz, or 0 if it's stopped
+*/
+
+static uint32_t
+tpmHz (void)
+{
+	uint32_t sc;
+	uint32_t mod;
+
+	sc = hostTPM2.SC;
+	mod = hostTPM2.MOD;
+
+	if ((sc & (TPM_SC_CMOD_LPTPM_CLK | TPM_SC_CMOD_LPTPM_EXTCLK)) == 0 ||
+	    mod == 0)
+		return (0);
+
+	return ((KINETIS_SYSCLK_FREQUENCY >> (sc & TPM_SC_PS_MASK)) / mod);
+}
+
+/******************************************************************************
+*
+* tpmThread - log what the buzzer plays
+*
+* RETURNS: N/A
+*/
+
+static
+THD_FUNCTION(tpmThread, arg)
+{
+	uint64_t next;
+	uint64_t seen;
+	uint32_t cur;
+	uint32_t hz;
+	uint32_t last;
+
+	(void)arg;
+
+	chRegSetThreadName ("tpm");
+	hostSimExempt ();
+
+	cur = 0;
+	last = 0;
+	seen = 0;
+	next = 0;
+
+	while (1) {
+		if (hostSimWait (&seen) == 0) {
+			hz = tpmHz ();
+			if (hz != cur && ntones < TONE_MAX) {
+				tones[ntones].ht_ns = seen;
+				tones[ntones].ht_hz = hz;
+				ntones++;
+			}
+			cur = hz;
+			last = hz;
+			next = 0;
+			hostSimAdvance ();
+			continue;
+		}
+
+		if ((hostSIM.SCGC6 & SIM_SCGC6_TPM2) == 0) {
+			chThdSleep (1);
+			next = 0;
+			continue;
+		}
+
+		if (next == 0)
+			next = hostNanos ();
+		next += TONE_POLL;
+		hostSleepUntil (next);
+
+		hz = tpmHz ();
+		if (hz != last) {
+			last = hz;
+			seen = hostNanos ();
+			continue;
+		}
+
+		if (hz == cur)
+			continue;
+
+		cur = hz;
+		if (ntones < TONE_MAX) {
+			tones[ntones].ht_ns = seen;
+			tones[ntones].ht_hz = hz;
+			ntones++;
+		}
+	}
+
+	/* NOTREACHED */
+	return;
+}
+
+/******************************************************************************
+*
+* hostHwInit - set up the hardware stand-ins
+*
+* This maps the DAC's register page at its real address, points PIT1 at
+* our copy of its registers and starts the PIT thread.
+*
+* RETURNS: 0 on success, or -1 if the DAC registers couldn't be mapped
+*/
+
+int
+hostHwInit (void)
+{
+	void * p;
+
+	p = mmap ((void *)DAC_BASE, 4096, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+	if (p != (void *)DAC_BASE) {
+		perror ("can't map DAC registers");
+		return (-1);
+	}
+
+	PIT1.pit_base = pitregs;
+
+	audio = malloc (AUDIO_MAX * sizeof(uint16_t));
+
+	chThdCreateStatic (NULL, 0, HIGHPRIO, pitThread, NULL);
+	chThdCreateStatic (NULL, 0, HIGHPRIO, tpmThread, NULL);
+
+	hostHwReset ();
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* hostHwReset - clear the recorded state between runs
+*
+* RETURNS: N/A
+*/
+
+void
+hostHwReset (void)
+{
+	uint32_t heap;
+
+	/* The heap is still in use, so its peak starts from here. */
+
+	heap = hostStats.hs_heap;
+	memset (&hostStats, 0, sizeof(hostStats));
+	hostStats.hs_audiohash = HOST_FNV_INIT;
+	hostStats.hs_heap = heap;
+	hostStats.hs_heappeak = heap;
+	memset (fb, 0, sizeof(fb));
+	ntones = 0;
+
+	return;
+}
+
+/******************************************************************************
+*
+* hostFrameHash - fingerprint what's on the screen
+*
+* RETURNS: an FNV-1a hash of the frame buffer
+*/
+
+uint64_t
+hostFrameHash (void)
+{
+	return (hostFnv (HOST_FNV_INIT, fb, sizeof(fb)));
+}
+
+/******************************************************************************
+*
+* hostFrameSave - save the screen to a file
+*
+* The file holds the frame buffer as raw little-endian RGB565 pixels, the
+* same format the badge uses for .rgb images, without the header.
+*
+* RETURNS: 0 on success, -1 on failure
+*/
+
+int
+hostFrameSave (const char * path)
+{
+	FILE * f;
+	size_t r;
+
+	f = fopen (path, "w");
+	if (f == NULL)
+		return (-1);
+	r = fwrite (fb, sizeof(fb), 1, f);
+	fclose (f);
+
+	return (r == 1 ? 0 : -1);
+}
+
+/******************************************************************************
+*
+* hostAudioSave - save the samples written to the DAC to a file
+*
+* The file holds the 12-bit samples in 16-bit little-endian words, the
+* same format as a raw sound file for the badge.
+*
+* RETURNS: 0 on success, -1 on failure
+*/
+
+int
+hostAudioSave (const char * path)
+{
+	FILE * f;
+	size_t n;
+	size_t r;
+
+	f = fopen (path, "w");
+	if (f == NULL)
+		return (-1);
+	n = hostStats.hs_samples;
+	if (n > AUDIO_MAX)
+		n = AUDIO_MAX;
+	r = fwrite (audio, sizeof(uint16_t), n, f);
+	fclose (f);
+
+	return (r == n ? 0 : -1);
+}
+
+/******************************************************************************
+*
+* hostAudio - get the samples written to the DAC
+*
+* The number of samples kept is returned via <cnt>.
+*
+* RETURNS: a pointer to the samples
+*/
+
+const uint16_t *
+hostAudio (uint64_t * cnt)
+{
+	*cnt = hostStats.hs_samples;
+	if (*cnt > AUDIO_MAX || audio == NULL)
+		*cnt = audio == NULL ? 0 : AUDIO_MAX;
+
+	return (audio);
+}
+
+/******************************************************************************
+*
+* hostTones - get the changes of tone the buzzer made
+*
+* The number of changes logged is returned via <cnt>.
+*
+* RETURNS: a pointer to the log
+*/
+
+const HOST_TONE *
+hostTones (int * cnt)
+{
+	*cnt = ntones;
+	return (tones);
+}
@@ -0,0 +1,1033 @@
+/*
+ * ChibiOS/RT stand-in for the host media benchmark, built on POSIX
+ * threads.
+ *
+ * The system lock is a single mutex. Code running in "interrupt
+ * context" (the simulated PIT handler) holds it for the whole handler,
+ * which is what keeps an interrupt from landing inside a thread's
+ * critical section on the real hardware. The lock/unlock-from-ISR calls
+ * are therefore no-ops inside a handler.
+ *
+ * System time runs off the host's monotonic clock at CH_CFG_ST_FREQUENCY
+ * ticks per second, and the SysTick registers are worked out from the
+ * same clock so that cycle counts taken the way video_lld.c does come
+ * out in 48MHz CPU cycles. While the system lock is held, time stands
+ * still, the same way the tick count can't advance with interrupts off.
+ *
+ * System time can also come from a simulated clock instead, so that the
+ * timing of code that sleeps is exact however busy the host is. While
+ * it's on, a thread that sleeps waits for the clock to reach the end of
+ * its sleep, and the clock only moves on when every thread is blocked:
+ * asleep, waiting on a semaphore, a message, an event or another thread
+ * to exit. It then jumps straight to the next thread's wakeup time. To
+ * know when that is, we keep count of the threads that can run, so each
+ * wait takes its thread off the count and whoever wakes it up puts it
+ * back on. Threads waiting for a mutex or the SPI bus model still count
+ * as running, and semaphore timeouts are always in host time. The
+ * hardware models run on host time and don't count (see hostSimExempt()),
+ * except that one can sleep on the simulated clock with
+ * hostSimSleepUntil(), the way the PIT model does to keep the DAC in
+ * step with it. The TPM model in host_hw.c is what moves the clock on,
+ * since it has to look at the buzzer at each step anyway.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "host.h"
+
+#define ST_LOAD		((KINETIS_SYSCLK_FREQUENCY / CH_CFG_ST_FREQUENCY) - 1)
+
+/* What a thread not counted as running is waiting for */
+
+#define WAIT_SLEEP	1	/* The simulated clock */
+#define WAIT_MSG	2	/* A message, in chMsgWait() */
+#define WAIT_SEND	3	/* Its message to be released */
+#define WAIT_EVT	4	/* An event, in chEvtWaitOne() */
+
+SCB_Type hostSCB;
+SIM_TypeDef hostSIM;
+
+static pthread_mutex_t syslock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t msglock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t msgcond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t evtlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t evtcond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t simlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t simcond = PTHREAD_COND_INITIALIZER;
+static pthread_condattr_t condattr;
+static struct timespec t0;
+static thread_t mainthread;
+
+static volatile int simon;
+static uint64_t simns;
+static int simrun;
+static thread_t * sleepers;
+
+static __thread thread_t * self;
+static __thread int inisr;
+static __thread int locked;
+static __thread uint64_t frozen;
+static __thread SysTick_Type systick;
+
+/******************************************************************************
+*
+* hostNanos - return host time since startup
+*
+* RETURNS: the time in nanoseconds since hostOsInit() was called
+*/
+
+uint64_t
+hostNanos (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (((uint64_t)(ts.tv_sec - t0.tv_sec) * 1000000000ULL) +
+	    ts.tv_nsec - t0.tv_nsec);
+}
+
+/******************************************************************************
+*
+* hostSleepUntil - sleep until a given host time
+*
+* RETURNS: N/A
+*/
+
+void
+hostSleepUntil (uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t0.tv_sec + (ns / 1000000000ULL);
+	ts.tv_nsec = t0.tv_nsec + (ns % 1000000000ULL);
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME,
+	    &ts, NULL) == EINTR)
+		;
+
+	return;
+}
+
+static uint64_t
+now (void)
+{
+	if (simon)
+		return (simns);
+
+	return (locked ? frozen : hostNanos ());
+}
+
+static uint64_t
+cycles (void)
+{
+	return ((now () * (KINETIS_SYSCLK_FREQUENCY / 1000000)) / 1000);
+}
+
+/******************************************************************************
+*
+* hostSysNanos - return the system time
+*
+* RETURNS: the simulated clock in nanoseconds if it's on, otherwise the
+*          host time since startup
+*/
+
+uint64_t
+hostSysNanos (void)
+{
+	return (now ());
+}
+
+/*
+ * Add <n> to the count of threads that can run. If that leaves none,
+ * the simulated clock can move on.
+ */
+
+static void
+simRun (int n)
+{
+	pthread_mutex_lock (&simlock);
+	simrun += n;
+	if (simrun == 0)
+		pthread_cond_broadcast (&simcond);
+	pthread_mutex_unlock (&simlock);
+	return;
+}
+
+/* The calling thread is about to wait. */
+
+static void
+simBlock (void)
+{
+	if (!self->p_exempt)
+		simRun (-1);
+	return;
+}
+
+/* Thread <tp> has been woken up from a wait. */
+
+static void
+simWake (thread_t * tp)
+{
+	if (!tp->p_exempt)
+		simRun (1);
+	return;
+}
+
+/*
+ * Take the calling thread off the running count, if it's on it. That's
+ * always the case for an ordinary thread, and for an exempt one after
+ * the simulated clock woke it up. Called with simlock held.
+ */
+
+static void
+simStop (void)
+{
+	if (!self->p_exempt || self->p_woken) {
+		self->p_woken = 0;
+		if (--simrun == 0)
+			pthread_cond_broadcast (&simcond);
+	}
+	return;
+}
+
+/******************************************************************************
+*
+* hostSimSleepUntil - sleep until a given time on the simulated clock
+*
+* An exempt thread that sleeps this way counts as running from when the
+* clock wakes it up until it sleeps again or calls hostSimDone(), so the
+* clock waits for whatever it does when it wakes.
+*
+* RETURNS: 0, or -1 if the simulated clock isn't on
+*/
+
+int
+hostSimSleepUntil (uint64_t ns)
+{
+	pthread_mutex_lock (&simlock);
+
+	if (!simon) {
+		pthread_mutex_unlock (&simlock);
+		return (-1);
+	}
+
+	self->p_wake = ns;
+	self->p_wait = WAIT_SLEEP;
+	self->p_simnext = sleepers;
+	sleepers = self;
+
+	simStop ();
+
+	while (self->p_wait == WAIT_SLEEP)
+		pthread_cond_wait (&simcond, &simlock);
+
+	pthread_mutex_unlock (&simlock);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* hostSimDone - stop an exempt thread from holding up the simulated clock
+*
+* RETURNS: N/A
+*/
+
+void
+hostSimDone (void)
+{
+	pthread_mutex_lock (&simlock);
+	if (self->p_exempt)
+		simStop ();
+	pthread_mutex_unlock (&simlock);
+	return;
+}
+
+/*
+ * Sleep for <t> ticks of the simulated clock, which means until the
+ * t'th tick boundary from now.
+ *
+ * RETURNS: 0, or -1 if the simulated clock isn't on
+ */
+
+static int
+simSleep (systime_t t)
+{
+	uint64_t tick;
+
+	tick = (simns * CH_CFG_ST_FREQUENCY) / 1000000000ULL + t;
+
+	return (hostSimSleepUntil ((tick * 1000000000ULL +
+	    CH_CFG_ST_FREQUENCY - 1) / CH_CFG_ST_FREQUENCY));
+}
+
+/******************************************************************************
+*
+* hostSimClock - turn the simulated clock on or off
+*
+* When <on> is set, system time is taken from the simulated clock, which
+* starts from 0. When it's cleared, system time goes back to the host's
+* clock and any thread still asleep wakes up at once. The PIT model
+* keeps its schedule on whichever clock it started with, so the DAC
+* must be idle when the clock is switched.
+*
+* RETURNS: N/A
+*/
+
+void
+hostSimClock (int on)
+{
+	thread_t * tp;
+
+	pthread_mutex_lock (&simlock);
+
+	if (on) {
+		simns = 0;
+		simon = 1;
+	} else {
+		simon = 0;
+		for (tp = sleepers; tp != NULL; tp = tp->p_simnext) {
+			tp->p_wait = 0;
+			if (!tp->p_exempt)
+				simrun++;
+		}
+		sleepers = NULL;
+		pthread_cond_broadcast (&simcond);
+	}
+
+	pthread_mutex_unlock (&simlock);
+
+	return;
+}
+
+/******************************************************************************
+*
+* hostSimExempt - leave the calling thread off the simulated clock
+*
+* This is for the threads that model the hardware. They always run on
+* host time and the clock doesn't wait for them, so they must never
+* wait on a semaphore, message or event themselves.
+*
+* RETURNS: N/A
+*/
+
+void
+hostSimExempt (void)
+{
+	self->p_exempt = 1;
+	simRun (-1);
+	return;
+}
+
+/******************************************************************************
+*
+* hostSimWait - wait for the simulated clock to be ready to move on
+*
+* This waits until no thread can run and at least one is asleep, and
+* returns the time on the simulated clock via <ns>. The caller can look
+* at what the threads left behind before calling hostSimAdvance().
+*
+* RETURNS: 0, or -1 if the simulated clock isn't on
+*/
+
+int
+hostSimWait (uint64_t * ns)
+{
+	int r;
+
+	pthread_mutex_lock (&simlock);
+
+	while (simon && (simrun != 0 || sleepers == NULL))
+		pthread_cond_wait (&simcond, &simlock);
+
+	r = -1;
+	if (simon) {
+		*ns = simns;
+		r = 0;
+	}
+
+	pthread_mutex_unlock (&simlock);
+
+	return (r);
+}
+
+/******************************************************************************
+*
+* hostSimAdvance - move the simulated clock on to the next wakeup
+*
+* RETURNS: N/A
+*/
+
+void
+hostSimAdvance (void)
+{
+	thread_t ** pp;
+	thread_t * tp;
+	uint64_t next;
+
+	pthread_mutex_lock (&simlock);
+
+	if (sleepers != NULL) {
+		next = sleepers->p_wake;
+		for (tp = sleepers; tp != NULL; tp = tp->p_simnext) {
+			if (tp->p_wake < next)
+				next = tp->p_wake;
+		}
+		if (next > simns)
+			simns = next;
+
+		pp = &sleepers;
+		while ((tp = *pp) != NULL) {
+			if (tp->p_wake <= simns) {
+				*pp = tp->p_simnext;
+				tp->p_wait = 0;
+				tp->p_woken = tp->p_exempt;
+				simrun++;
+			} else
+				pp = &tp->p_simnext;
+		}
+
+		pthread_cond_broadcast (&simcond);
+	}
+
+	pthread_mutex_unlock (&simlock);
+
+	return;
+}
+
+/******************************************************************************
+*
+* hostOsInit - set up the OS stand-in
+*
+* This must be called from main() before anything else. The main thread
+* becomes a ChibiOS thread so that it can send messages and wait on
+* semaphores like any other.
+*
+* RETURNS: N/A
+*/
+
+void
+hostOsInit (void)
+{
+	clock_gettime (CLOCK_MONOTONIC, &t0);
+
+	pthread_condattr_init (&condattr);
+	pthread_condattr_setclock (&condattr, CLOCK_MONOTONIC);
+
+	memset (&mainthread, 0, sizeof(mainthread));
+	mainthread.p_thread = pthread_self ();
+	mainthread.p_prio = NORMALPRIO;
+	mainthread.p_name = "main";
+	self = &mainthread;
+	simrun = 1;
+
+	hostSCB.CPUID = 0x410CC601;
+
+	return;
+}
+
+/******************************************************************************
+*
+* hostIsrEnter - enter simulated interrupt context
+*
+* RETURNS: N/A
+*/
+
+void
+hostIsrEnter (void)
+{
+	chSysLock ();
+	inisr = 1;
+	return;
+}
+
+void
+hostIsrExit (void)
+{
+	inisr = 0;
+	chSysUnlock ();
+	return;
+}
+
+SysTick_Type *
+hostSysTick (void)
+{
+	systick.LOAD = ST_LOAD;
+	systick.VAL = ST_LOAD - (cycles () % (ST_LOAD + 1));
+	systick.CTRL = 7;
+
+	return (&systick);
+}
+
+void
+chSysLock (void)
+{
+	pthread_mutex_lock (&syslock);
+	frozen = hostNanos ();
+	locked = 1;
+	return;
+}
+
+void
+chSysUnlock (void)
+{
+	locked = 0;
+	pthread_mutex_unlock (&syslock);
+	return;
+}
+
+void
+chSysLockFromISR (void)
+{
+	if (!inisr)
+		chSysLock ();
+	return;
+}
+
+void
+chSysUnlockFromISR (void)
+{
+	if (!inisr)
+		chSysUnlock ();
+	return;
+}
+
+void
+chSysHalt (const char * reason)
+{
+	fprintf (stderr, "system halted: %s\n", reason);
+	abort ();
+}
+
+systime_t
+chVTGetSystemTimeX (void)
+{
+	if (simon)
+		return ((systime_t)((simns * CH_CFG_ST_FREQUENCY) /
+		    1000000000ULL));
+
+	return ((systime_t)(cycles () / (ST_LOAD + 1)));
+}
+
+/*
+ * Threads
+ */
+
+static void *
+thread_main (void * arg)
+{
+	thread_t * tp;
+
+	tp = arg;
+	self = tp;
+
+	tp->p_func (tp->p_arg);
+
+	pthread_mutex_lock (&tp->p_lock);
+	tp->p_done = 1;
+	if (tp->p_joined)
+		simRun (1);
+	pthread_cond_broadcast (&tp->p_cond);
+	pthread_mutex_unlock (&tp->p_lock);
+
+	simBlock ();
+
+	return (NULL);
+}
+
+thread_t *
+chThdCreateFromHeap (void * heap, size_t size, tprio_t prio,
+    tfunc_t func, void * arg)
+{
+	thread_t * tp;
+
+	(void)heap;
+	(void)size;
+
+	tp = calloc (1, sizeof(thread_t));
+	if (tp == NULL)
+		return (NULL);
+
+	pthread_mutex_init (&tp->p_lock, NULL);
+	pthread_cond_init (&tp->p_cond, NULL);
+	tp->p_func = func;
+	tp->p_arg = arg;
+	tp->p_prio = prio;
+
+	simRun (1);
+
+	if (pthread_create (&tp->p_thread, NULL, thread_main, tp) != 0) {
+		simRun (-1);
+		free (tp);
+		return (NULL);
+	}
+
+	return (tp);
+}
+
+thread_t *
+chThdCreateStatic (void * wa, size_t size, tprio_t prio,
+    tfunc_t func, void * arg)
+{
+	thread_t * tp;
+
+	(void)wa;
+
+	tp = chThdCreateFromHeap (NULL, size, prio, func, arg);
+	if (tp == NULL) {
+		fprintf (stderr, "can't create thread\n");
+		exit (1);
+	}
+
+	return (tp);
+}
+
+msg_t
+chThdWait (thread_t * tp)
+{
+	pthread_mutex_lock (&tp->p_lock);
+	if (tp->p_done == 0) {
+		tp->p_joined = 1;
+		simBlock ();
+		while (tp->p_done == 0)
+			pthread_cond_wait (&tp->p_cond, &tp->p_lock);
+	}
+	pthread_mutex_unlock (&tp->p_lock);
+
+	pthread_join (tp->p_thread, NULL);
+	pthread_mutex_destroy (&tp->p_lock);
+	pthread_cond_destroy (&tp->p_cond);
+	free (tp);
+
+	return (MSG_OK);
+}
+
+void
+chThdSleep (systime_t t)
+{
+	struct timespec ts;
+	uint64_t ns;
+
+	if (t == TIME_IMMEDIATE) {
+		sched_yield ();
+		return;
+	}
+
+	if (simon && !self->p_exempt && simSleep (t) == 0)
+		return;
+
+	ns = ((uint64_t)t * 1000000000ULL) / CH_CFG_ST_FREQUENCY;
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (nanosleep (&ts, &ts) == -1 && errno == EINTR)
+		;
+
+	return;
+}
+
+/*
+ * Sleep until <next> if we're still in the window that starts at <prev>.
+ * If we're already past it, don't sleep at all.
+ */
+
+systime_t
+chThdSleepUntilWindowed (systime_t prev, systime_t next)
+{
+	systime_t t;
+
+	t = chVTGetSystemTimeX ();
+	if ((systime_t)(t - prev) < (systime_t)(next - prev))
+		chThdSleep (next - t);
+
+	return (next);
+}
+
+void
+chThdYield (void)
+{
+	sched_yield ();
+	return;
+}
+
+thread_t *
+chThdGetSelfX (void)
+{
+	return (self);
+}
+
+tprio_t
+chThdGetPriorityX (void)
+{
+	return (self->p_prio);
+}
+
+void
+chRegSetThreadName (const char * name)
+{
+	char buf[16];
+
+	self->p_name = name;
+	strncpy (buf, name, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+	pthread_setname_np (pthread_self (), buf);
+
+	return;
+}
+
+/*
+ * Counting semaphores. As in ChibiOS, the counter goes negative when
+ * threads are waiting, and each signal either bumps the counter or
+ * wakes exactly one waiter. We don't know which waiter that will be, so
+ * the signal puts a thread back on the running count regardless, which
+ * is why the exempt threads mustn't wait on semaphores.
+ */
+
+void
+chSemObjectInit (semaphore_t * sp, cnt_t n)
+{
+	pthread_mutex_init (&sp->s_lock, NULL);
+	pthread_cond_init (&sp->s_cond, &condattr);
+	sp->s_cnt = n;
+	sp->s_wakeups = 0;
+	return;
+}
+
+msg_t
+chSemWaitTimeout (semaphore_t * sp, systime_t t)
+{
+	struct timespec ts;
+	uint64_t ns;
+	msg_t r;
+
+	r = MSG_OK;
+
+	pthread_mutex_lock (&sp->s_lock);
+
+	if (sp->s_cnt <= 0 && t == TIME_IMMEDIATE) {
+		pthread_mutex_unlock (&sp->s_lock);
+		return (MSG_TIMEOUT);
+	}
+
+	if (--sp->s_cnt >= 0) {
+		pthread_mutex_unlock (&sp->s_lock);
+		return (MSG_OK);
+	}
+
+	simBlock ();
+
+	if (t != TIME_INFINITE) {
+		clock_gettime (CLOCK_MONOTONIC, &ts);
+		ns = ((uint64_t)t * 1000000000ULL) / CH_CFG_ST_FREQUENCY;
+		ns += ts.tv_nsec;
+		ts.tv_sec += ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+	}
+
+	while (sp->s_wakeups == 0) {
+		if (t == TIME_INFINITE)
+			pthread_cond_wait (&sp->s_cond, &sp->s_lock);
+		else if (pthread_cond_timedwait (&sp->s_cond, &sp->s_lock,
+		    &ts) == ETIMEDOUT && sp->s_wakeups == 0) {
+			sp->s_cnt++;
+			simWake (self);
+			r = MSG_TIMEOUT;
+			break;
+		}
+	}
+
+	if (r == MSG_OK)
+		sp->s_wakeups--;
+
+	pthread_mutex_unlock (&sp->s_lock);
+
+	return (r);
+}
+
+msg_t
+chSemWait (semaphore_t * sp)
+{
+	return (chSemWaitTimeout (sp, TIME_INFINITE));
+}
+
+void
+chSemSignalI (semaphore_t * sp)
+{
+	pthread_mutex_lock (&sp->s_lock);
+	if (++sp->s_cnt <= 0) {
+		sp->s_wakeups++;
+		simRun (1);
+		pthread_cond_signal (&sp->s_cond);
+	}
+	pthread_mutex_unlock (&sp->s_lock);
+	return;
+}
+
+void
+chSemSignal (semaphore_t * sp)
+{
+	chSemSignalI (sp);
+	return;
+}
+
+cnt_t
+chSemGetCounterI (semaphore_t * sp)
+{
+	cnt_t n;
+
+	pthread_mutex_lock (&sp->s_lock);
+	n = sp->s_cnt;
+	pthread_mutex_unlock (&sp->s_lock);
+
+	return (n);
+}
+
+/* Only called when the counter is known to be above zero. */
+
+void
+chSemFastWaitI (semaphore_t * sp)
+{
+	pthread_mutex_lock (&sp->s_lock);
+	sp->s_cnt--;
+	pthread_mutex_unlock (&sp->s_lock);
+	return;
+}
+
+/*
+ * Nothing ever resets a semaphore that has threads waiting on it, so
+ * this just sets the counter.
+ */
+
+void
+chSemReset (semaphore_t * sp, cnt_t n)
+{
+	pthread_mutex_lock (&sp->s_lock);
+	if (sp->s_cnt >= 0)
+		sp->s_cnt = n;
+	pthread_mutex_unlock (&sp->s_lock);
+	return;
+}
+
+/*
+ * Mutexes
+ */
+
+void
+chMtxObjectInit (mutex_t * mp)
+{
+	pthread_mutex_init (&mp->m_lock, NULL);
+	return;
+}
+
+void
+chMtxLock (mutex_t * mp)
+{
+	pthread_mutex_lock (&mp->m_lock);
+	return;
+}
+
+void
+chMtxUnlock (mutex_t * mp)
+{
+	pthread_mutex_unlock (&mp->m_lock);
+	return;
+}
+
+/*
+ * Synchronous messages. The sender queues itself on the receiver and
+ * sleeps until the receiver releases it. One lock covers all threads,
+ * which is plenty for the handful of messages the media code sends.
+ */
+
+msg_t
+chMsgSend (thread_t * tp, msg_t msg)
+{
+	thread_t ** pp;
+
+	pthread_mutex_lock (&msglock);
+
+	self->p_msg = msg;
+	self->p_msgdone = 0;
+	self->p_msgnext = NULL;
+	for (pp = &tp->p_msgq; *pp != NULL; pp = &(*pp)->p_msgnext)
+		;
+	*pp = self;
+	if (tp->p_wait == WAIT_MSG) {
+		tp->p_wait = 0;
+		simWake (tp);
+	}
+	pthread_cond_broadcast (&msgcond);
+
+	self->p_wait = WAIT_SEND;
+	simBlock ();
+	while (self->p_msgdone == 0)
+		pthread_cond_wait (&msgcond, &msglock);
+	msg = self->p_msg;
+
+	pthread_mutex_unlock (&msglock);
+
+	return (msg);
+}
+
+thread_t *
+chMsgWait (void)
+{
+	thread_t * tp;
+
+	pthread_mutex_lock (&msglock);
+
+	if (self->p_msgq == NULL) {
+		self->p_wait = WAIT_MSG;
+		simBlock ();
+		while (self->p_msgq == NULL)
+			pthread_cond_wait (&msgcond, &msglock);
+	}
+	tp = self->p_msgq;
+	self->p_msgq = tp->p_msgnext;
+
+	pthread_mutex_unlock (&msglock);
+
+	return (tp);
+}
+
+void
+chMsgRelease (thread_t * tp, msg_t msg)
+{
+	pthread_mutex_lock (&msglock);
+	tp->p_msg = msg;
+	tp->p_msgdone = 1;
+	if (tp->p_wait == WAIT_SEND) {
+		tp->p_wait = 0;
+		simWake (tp);
+	}
+	pthread_cond_broadcast (&msgcond);
+	pthread_mutex_unlock (&msglock);
+
+	return;
+}
+
+/*
+ * Events. A broadcast sets the listener's bits in each listening thread
+ * and wakes it up. As with messages, one lock covers all threads.
+ */
+
+void
+chEvtRegisterMask (event_source_t * esp, event_listener_t * elp,
+    eventmask_t events)
+{
+	pthread_mutex_lock (&evtlock);
+	elp->el_listener = self;
+	elp->el_events = events;
+	elp->el_next = esp->es_next;
+	esp->es_next = elp;
+	pthread_mutex_unlock (&evtlock);
+
+	return;
+}
+
+void
+chEvtBroadcastI (event_source_t * esp)
+{
+	event_listener_t * elp;
+	thread_t * tp;
+
+	pthread_mutex_lock (&evtlock);
+	for (elp = esp->es_next; elp != NULL; elp = elp->el_next) {
+		tp = elp->el_listener;
+		tp->p_epending |= elp->el_events;
+		if (tp->p_wait == WAIT_EVT && (tp->p_epending & tp->p_ewait)) {
+			tp->p_wait = 0;
+			simWake (tp);
+		}
+	}
+	pthread_cond_broadcast (&evtcond);
+	pthread_mutex_unlock (&evtlock);
+
+	return;
+}
+
+eventmask_t
+chEvtWaitOne (eventmask_t events)
+{
+	eventmask_t m;
+
+	pthread_mutex_lock (&evtlock);
+
+	if ((self->p_epending & events) == 0) {
+		self->p_ewait = events;
+		self->p_wait = WAIT_EVT;
+		simBlock ();
+		while ((self->p_epending & events) == 0)
+			pthread_cond_wait (&evtcond, &evtlock);
+	}
+	m = self->p_epending & events;
+	m &= -m;
+	self->p_epending &= ~m;
+
+	pthread_mutex_unlock (&evtlock);
+
+	return (m);
+}
+
+void
+chEvtDispatch (const evhandler_t * handlers, eventmask_t events)
+{
+	eventid_t eid;
+
+	for (eid = 0; events != 0; eid++, events >>= 1) {
+		if (events & 1)
+			handlers[eid] (eid);
+	}
+
+	return;
+}
+
+/*
+ * The heap. The badge has about 16KB of RAM, so we track how much of
+ * it the media code has allocated at once.
+ */
+
+void *
+chHeapAlloc (void * heap, size_t size)
+{
+	uint64_t * p;
+	uint32_t use;
+
+	(void)heap;
+
+	p = malloc (size + sizeof(uint64_t));
+	if (p == NULL)
+		return (NULL);
+	p[0] = size;
+
+	use = __atomic_add_fetch (&hostStats.hs_heap, size, __ATOMIC_SEQ_CST);
+	if (use > hostStats.hs_heappeak)
+		hostStats.hs_heappeak = use;
+
+	return (p + 1);
+}
+
+void
+chHeapFree (void * p)
+{
+	uint64_t * h;
+
+	h = (uint64_t *)p - 1;
+	__atomic_sub_fetch (&hostStats.hs_heap, (uint32_t)h[0],
+	    __ATOMIC_SEQ_CST);
+	free (h);
+
+	return;
+}
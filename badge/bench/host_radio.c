@@ -0,0 +1,594 @@
+/*
+ * Register level stand-in for the SX1233 radio, for the radio checks in
+ * radio.c. radio_lld.c runs unchanged and talks to it through the spi.h
+ * stand-in, one register or FIFO access per transaction, just as it
+ * does on the badge.
+ *
+ * The KL SPI driver polls, so each transaction keeps the CPU busy for as
+ * long as the real one would: RADIO_XFER_NS to get hold of the bus and
+ * select the chip, and then the bytes themselves at RADIO_SPI_HZ. The
+ * time is spent spinning, so it shows up in the calling thread's CPU
+ * time.
+ *
+ * Once the radio is put into TX mode, the frame in the FIFO goes out
+ * over as long as its preamble, sync word, length byte, frame and CRC
+ * take at the programmed bitrate, and then PACKETSENT is set. DIO0
+ * follows DIOMAP1 for the current mode, as the datasheet lays it out,
+ * and each rising edge calls radioInterrupt() in simulated interrupt
+ * context, the way the EXT driver does.
+ *
+ * hostRadioReceive() plays the part of another badge: after the frame's
+ * airtime it lands in the FIFO and PAYLOADREADY is set, unless the radio
+ * isn't listening or the last frame still hasn't been read out, in
+ * which case it is lost, as it would be over the air. PAYLOADREADY
+ * clears once the FIFO has been read empty.
+ *
+ * The event thread stands in for the one in main.c: it starts the
+ * radio, so that radioStart() hooks rf_pkt_rdy to it, and then
+ * dispatches events.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "spi.h"
+#include "pal.h"
+#include "chprintf.h"
+
+#include "orchard.h"
+#include "orchard-events.h"
+#include "radio_reg.h"
+#include "radio_lld.h"
+
+#include "host.h"
+
+/* SPI0 runs at half the 24MHz bus clock */
+
+#define RADIO_SPI_HZ	12000000
+
+/* Driver overhead per transaction: mutex, bus acquire, chip select */
+
+#define RADIO_XFER_NS	2000
+
+#define RADIO_FIFO_SIZE	66
+
+HOST_RADIO hostRadio;
+
+SPIDriver SPID1;
+GPIO_TypeDef hostGPIO;
+struct evt_table orchard_events;
+event_source_t rf_pkt_rdy;
+void * stream;
+
+static pthread_mutex_t radiolock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t radiocond = PTHREAD_COND_INITIALIZER;
+
+static uint8_t regs[0x80];
+static uint8_t fifo[RADIO_FIFO_SIZE];
+static int fifolen;
+static int fifopos;
+
+static uint8_t xaddr;
+static int xfirst;
+static int xwrite;
+
+static int dio0;
+static int irqs;
+static uint32_t txseq;
+static uint64_t txend;
+static uint64_t rxstart;
+
+static semaphore_t evtready;
+
+/*
+ * Keep the CPU busy for <ns> nanoseconds, the way a polled SPI transfer
+ * does.
+ */
+
+static void
+spin (uint64_t ns)
+{
+	uint64_t end;
+
+	end = hostNanos () + ns;
+	while (hostNanos () < end)
+		;
+
+	hostRadio.hr_spins += ns;
+
+	return;
+}
+
+/*
+ * Work out the level of DIO0 from the mapping for the current mode, and
+ * note a rising edge as an interrupt to deliver once the lock is
+ * dropped. Called with the radio lock held.
+ */
+
+static void
+dio0Update (void)
+{
+	uint8_t map;
+	int level;
+
+	map = regs[KW01_DIOMAP1] & KW01_DIOMAP1_DIO0MAP;
+	level = 0;
+
+	switch (regs[KW01_OPMODE] & KW01_OPMODE_MODE) {
+	case KW01_MODE_RX:
+		if (map == KW01_DIO0_RX_CRCOK)
+			level = regs[KW01_IRQ2] & KW01_IRQ2_CRCOK;
+		else if (map == KW01_DIO0_RX_PAYLOADRDY)
+			level = regs[KW01_IRQ2] & KW01_IRQ2_PAYLOADREADY;
+		break;
+	case KW01_MODE_TX:
+		if (map == KW01_DIO0_TX_PACKETSENT)
+			level = regs[KW01_IRQ2] & KW01_IRQ2_PACKETSENT;
+		else if (map == KW01_DIO0_TX_TXREADY)
+			level = regs[KW01_IRQ1] & KW01_IRQ1_TXREADY;
+		break;
+	default:
+		break;
+	}
+
+	level = level != 0;
+	if (level && !dio0)
+		irqs++;
+	dio0 = level;
+
+	return;
+}
+
+/*
+ * Deliver the interrupts dio0Update() noted. Called without the radio
+ * lock, since radioInterrupt() takes the system lock.
+ */
+
+static void
+dio0Deliver (int n)
+{
+	while (n-- > 0) {
+		hostRadio.hr_irqs++;
+		hostIsrEnter ();
+		radioInterrupt (NULL, 0);
+		hostIsrExit ();
+	}
+
+	return;
+}
+
+/*
+ * How long a frame of <len> bytes, not counting the length byte, takes
+ * to send, in nanoseconds. With AES on, the radio pads the encrypted
+ * part out to whole 16 byte blocks.
+ */
+
+static uint64_t
+airtime (uint32_t len)
+{
+	uint32_t bitrate;
+	uint32_t bytes;
+
+	bitrate = (regs[KW01_BITRATEMSB] << 8) | regs[KW01_BITRATELSB];
+	if (bitrate == 0)
+		bitrate = 1;
+	bitrate = KW01_XTAL_FREQ / bitrate;
+
+	if (regs[KW01_PKTCONF2] & KW01_PKTCONF2_AESON)
+		len = (len + 15) & ~15;
+
+	bytes = (regs[KW01_PREAMBLEMSB] << 8) | regs[KW01_PREAMBLELSB];
+	if (regs[KW01_SYNCCONF] & KW01_SYNCCONF_SYNCON)
+		bytes += ((regs[KW01_SYNCCONF] & KW01_SYNCCONF_SYNCSIZE) >> 3) + 1;
+	bytes += 1 + len;
+	if (regs[KW01_PKTCONF1] & KW01_PKTCONF1_CRCON)
+		bytes += 2;
+
+	return (((uint64_t)bytes * 8 * 1000000000ULL) / bitrate);
+}
+
+static void
+modeSet (uint8_t val)
+{
+	uint8_t old;
+	uint8_t mode;
+
+	old = regs[KW01_OPMODE] & KW01_OPMODE_MODE;
+	mode = val & KW01_OPMODE_MODE;
+	regs[KW01_OPMODE] = val;
+
+	if (old == KW01_MODE_TX && mode != KW01_MODE_TX) {
+		regs[KW01_IRQ1] &= ~KW01_IRQ1_TXREADY;
+		regs[KW01_IRQ2] &= ~KW01_IRQ2_PACKETSENT;
+		fifolen = 0;
+		fifopos = 0;
+		txseq++;
+	}
+
+	if (old == KW01_MODE_RX && mode != KW01_MODE_RX)
+		regs[KW01_IRQ1] &= ~KW01_IRQ1_RXREADY;
+
+	regs[KW01_IRQ1] |= KW01_IRQ1_MODEREADY;
+
+	if (mode == KW01_MODE_TX && old != KW01_MODE_TX) {
+		regs[KW01_IRQ1] |= KW01_IRQ1_TXREADY;
+		txend = hostNanos () + airtime (fifolen ? fifo[0] : 0);
+		txseq++;
+		hostRadio.hr_frames++;
+		hostRadio.hr_airns += txend - hostNanos ();
+		pthread_cond_broadcast (&radiocond);
+	}
+
+	if (mode == KW01_MODE_RX)
+		regs[KW01_IRQ1] |= KW01_IRQ1_RXREADY;
+
+	return;
+}
+
+/*
+ * Note that the received frame in the FIFO has been read out, or lost.
+ */
+
+static void
+rxDone (int lost)
+{
+	uint64_t wait;
+
+	regs[KW01_IRQ2] &= ~(KW01_IRQ2_PAYLOADREADY | KW01_IRQ2_CRCOK);
+
+	if (lost) {
+		hostRadio.hr_rxlost++;
+		return;
+	}
+
+	wait = hostNanos () - rxstart;
+	hostRadio.hr_rxwait += wait;
+	if (wait > hostRadio.hr_rxwaitmax)
+		hostRadio.hr_rxwaitmax = wait;
+
+	return;
+}
+
+static void
+regWrite (uint8_t addr, uint8_t val)
+{
+	switch (addr) {
+	case KW01_FIFO:
+		/* Writing over a frame that hasn't been read loses it. */
+		if (regs[KW01_IRQ2] & KW01_IRQ2_PAYLOADREADY) {
+			rxDone (1);
+			fifolen = 0;
+			fifopos = 0;
+		}
+		if (fifolen < RADIO_FIFO_SIZE)
+			fifo[fifolen++] = val;
+		else
+			regs[KW01_IRQ2] |= KW01_IRQ2_FIFOOFLOW;
+		break;
+	case KW01_OPMODE:
+		modeSet (val);
+		break;
+	case KW01_IRQ1:
+		regs[addr] &= ~(val & (KW01_IRQ1_RSSI | KW01_IRQ1_SYNCMATCH));
+		break;
+	case KW01_IRQ2:
+		regs[addr] &= ~(val & KW01_IRQ2_FIFOOFLOW);
+		break;
+	default:
+		regs[addr] = val;
+		break;
+	}
+
+	dio0Update ();
+
+	return;
+}
+
+static uint8_t
+regRead (uint8_t addr)
+{
+	uint8_t val;
+
+	switch (addr) {
+	case KW01_FIFO:
+		val = fifopos < fifolen ? fifo[fifopos++] : 0;
+		if (fifopos == fifolen) {
+			fifolen = 0;
+			fifopos = 0;
+			if (regs[KW01_IRQ2] & KW01_IRQ2_PAYLOADREADY) {
+				rxDone (0);
+				dio0Update ();
+			}
+		}
+		break;
+	case KW01_IRQ2:
+		val = regs[addr] & ~KW01_IRQ2_FIFONOTEMPTY;
+		if (fifopos < fifolen)
+			val |= KW01_IRQ2_FIFONOTEMPTY;
+		break;
+	case KW01_VERSION:
+		val = 0x24;
+		break;
+	case KW01_RSSICONF:
+		val = regs[addr] | KW01_RSSICONF_DONE;
+		break;
+	case KW01_TEMPCTL:
+		val = regs[addr] & ~KW01_TEMPCTL_BUSY;
+		break;
+	default:
+		val = regs[addr];
+		break;
+	}
+
+	return (val);
+}
+
+/*
+ * The SPI driver stand-in. The first byte of each transaction is the
+ * register address, with the top bit set for a write, and the address
+ * moves on after each byte except for the FIFO.
+ */
+
+void
+spiAcquireBus (SPIDriver * spip)
+{
+	(void)spip;
+	pthread_mutex_lock (&radiolock);
+	return;
+}
+
+void
+spiReleaseBus (SPIDriver * spip)
+{
+	int n;
+
+	(void)spip;
+
+	n = irqs;
+	irqs = 0;
+	pthread_mutex_unlock (&radiolock);
+
+	dio0Deliver (n);
+
+	return;
+}
+
+void
+spiSelect (SPIDriver * spip)
+{
+	(void)spip;
+	xfirst = 1;
+	hostRadio.hr_xfers++;
+	spin (RADIO_XFER_NS);
+	return;
+}
+
+void
+spiUnselect (SPIDriver * spip)
+{
+	(void)spip;
+	return;
+}
+
+void
+spiSend (SPIDriver * spip, size_t n, const void * txbuf)
+{
+	const uint8_t * p;
+	size_t i;
+
+	(void)spip;
+
+	p = txbuf;
+	for (i = 0; i < n; i++) {
+		if (xfirst) {
+			xaddr = p[i] & 0x7F;
+			xwrite = p[i] & 0x80;
+			xfirst = 0;
+			continue;
+		}
+		if (xwrite)
+			regWrite (xaddr, p[i]);
+		if (xaddr != KW01_FIFO)
+			xaddr = (xaddr + 1) & 0x7F;
+	}
+
+	hostRadio.hr_bytes += n;
+	spin ((n * 8 * 1000000000ULL) / RADIO_SPI_HZ);
+
+	return;
+}
+
+void
+spiReceive (SPIDriver * spip, size_t n, void * rxbuf)
+{
+	uint8_t * p;
+	size_t i;
+
+	(void)spip;
+
+	p = rxbuf;
+	for (i = 0; i < n; i++) {
+		p[i] = regRead (xaddr);
+		if (xaddr != KW01_FIFO)
+			xaddr = (xaddr + 1) & 0x7F;
+	}
+
+	hostRadio.hr_bytes += n;
+	spin ((n * 8 * 1000000000ULL) / RADIO_SPI_HZ);
+
+	return;
+}
+
+int
+chprintf (BaseSequentialStream * chp, const char * fmt, ...)
+{
+	va_list ap;
+	int r;
+
+	if (chp == NULL)
+		return (0);
+
+	va_start (ap, fmt);
+	r = vprintf (fmt, ap);
+	va_end (ap);
+
+	return (r);
+}
+
+/******************************************************************************
+*
+* hostRadioReceive - have a frame arrive over the air
+*
+* This sleeps for the airtime of the <len> byte frame (header and
+* payload) and then puts it in the FIFO, with the length byte in front,
+* and raises PAYLOADREADY.
+*
+* RETURNS: 0 if the radio took the frame, or -1 if it was lost because
+*          the radio wasn't receiving or the FIFO was still full
+*/
+
+int
+hostRadioReceive (const void * frame, uint8_t len)
+{
+	int n;
+
+	hostSleepUntil (hostNanos () + airtime (len));
+
+	pthread_mutex_lock (&radiolock);
+
+	if ((regs[KW01_OPMODE] & KW01_OPMODE_MODE) != KW01_MODE_RX ||
+	    fifolen != 0 || len >= RADIO_FIFO_SIZE) {
+		hostRadio.hr_rxlost++;
+		pthread_mutex_unlock (&radiolock);
+		return (-1);
+	}
+
+	fifo[0] = len;
+	memcpy (fifo + 1, frame, len);
+	fifolen = len + 1;
+	fifopos = 0;
+
+	rxstart = hostNanos ();
+	hostRadio.hr_rxframes++;
+	regs[KW01_IRQ2] |= KW01_IRQ2_PAYLOADREADY | KW01_IRQ2_CRCOK;
+	dio0Update ();
+
+	n = irqs;
+	irqs = 0;
+	pthread_mutex_unlock (&radiolock);
+
+	dio0Deliver (n);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* txThread - finish sending each frame when its airtime is up
+*
+* RETURNS: N/A
+*/
+
+static
+THD_FUNCTION(txThread, arg)
+{
+	uint32_t seq;
+	uint64_t end;
+	int n;
+
+	(void)arg;
+
+	chRegSetThreadName ("radio");
+	hostSimExempt ();
+
+	pthread_mutex_lock (&radiolock);
+
+	while (1) {
+		while ((regs[KW01_OPMODE] & KW01_OPMODE_MODE) != KW01_MODE_TX ||
+		    (regs[KW01_IRQ2] & KW01_IRQ2_PACKETSENT))
+			pthread_cond_wait (&radiocond, &radiolock);
+
+		seq = txseq;
+		end = txend;
+		pthread_mutex_unlock (&radiolock);
+
+		hostSleepUntil (end);
+
+		pthread_mutex_lock (&radiolock);
+		if (seq == txseq) {
+			regs[KW01_IRQ2] |= KW01_IRQ2_PACKETSENT;
+			dio0Update ();
+		}
+		n = irqs;
+		irqs = 0;
+		pthread_mutex_unlock (&radiolock);
+
+		dio0Deliver (n);
+
+		pthread_mutex_lock (&radiolock);
+	}
+
+	/* NOTREACHED */
+	return;
+}
+
+/******************************************************************************
+*
+* evtThread - start the radio and dispatch its events, like main.c does
+*
+* RETURNS: N/A
+*/
+
+static
+THD_FUNCTION(evtThread, arg)
+{
+	(void)arg;
+
+	chRegSetThreadName ("events");
+
+	evtTableInit (orchard_events, 4);
+
+	radioStart (&SPID1);
+
+	chSemSignal (&evtready);
+
+	while (1)
+		chEvtDispatch (evtHandlers(orchard_events),
+		    chEvtWaitOne (ALL_EVENTS));
+
+	/* NOTREACHED */
+	return;
+}
+
+/******************************************************************************
+*
+* hostRadioInit - bring up the radio model and start the radio driver
+*
+* RETURNS: N/A
+*/
+
+void
+hostRadioInit (void)
+{
+	/* The SX1233's power-up bitrate is 4.8Kbps */
+
+	regs[KW01_BITRATEMSB] = 0x1A;
+	regs[KW01_BITRATELSB] = 0x0B;
+	regs[KW01_OPMODE] = KW01_MODE_STANDBY;
+	regs[KW01_IRQ1] = KW01_IRQ1_MODEREADY;
+
+	chSemObjectInit (&evtready, 0);
+
+	chThdCreateStatic (NULL, 0, HIGHPRIO, txThread, NULL);
+	chThdCreateStatic (NULL, 0, NORMALPRIO, evtThread, NULL);
+
+	chSemWait (&evtready);
+
+	memset (&hostRadio, 0, sizeof(hostRadio));
+
+	return;
+}
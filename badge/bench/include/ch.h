@@ -0,0 +1,169 @@
+/*
+ * Host stand-in for the parts of the ChibiOS/RT API used by the media
+ * code, built on POSIX threads. See host_os.c. Thread priorities are
+ * accepted but ignored, since the host scheduler doesn't honor them.
+ */
+
+#ifndef _BENCH_CH_H_
+#define _BENCH_CH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifndef FALSE
+#define FALSE			0
+#endif
+#ifndef TRUE
+#define TRUE			1
+#endif
+
+#include "chconf.h"
+
+typedef int32_t		msg_t;
+typedef int32_t		cnt_t;
+typedef uint32_t	systime_t;
+typedef uint32_t	tprio_t;
+typedef uint64_t	stkalign_t;
+
+#define MSG_OK			0
+#define MSG_TIMEOUT		-1
+#define MSG_RESET		-2
+
+#define TIME_IMMEDIATE		((systime_t)0)
+#define TIME_INFINITE		((systime_t)-1)
+
+#define S2ST(sec)		((systime_t)((uint32_t)(sec) *		\
+				CH_CFG_ST_FREQUENCY))
+#define MS2ST(msec)		((systime_t)((((uint32_t)(msec) *	\
+				CH_CFG_ST_FREQUENCY) + 999UL) / 1000UL))
+#define US2ST(usec)		((systime_t)((((uint32_t)(usec) *	\
+				CH_CFG_ST_FREQUENCY) + 999999UL) / 1000000UL))
+#define ST2MS(n)		(((n) * 1000UL + CH_CFG_ST_FREQUENCY - 1UL) / \
+				CH_CFG_ST_FREQUENCY)
+
+#define NORMALPRIO		128
+#define LOWPRIO			2
+#define HIGHPRIO		255
+
+#define THD_FUNCTION(tname, arg)	void tname(void * arg)
+typedef void (*tfunc_t)(void *);
+
+#define THD_WORKING_AREA_SIZE(n)	(n)
+#define THD_WORKING_AREA(s, n)		stkalign_t s[((n) +		\
+					sizeof(stkalign_t) - 1) /	\
+					sizeof(stkalign_t)]
+
+typedef uint32_t	eventmask_t;
+typedef int32_t		eventid_t;
+
+#define ALL_EVENTS		((eventmask_t)-1)
+#define EVENT_MASK(eid)		((eventmask_t)1 << (eventmask_t)(eid))
+
+typedef struct thread {
+	pthread_t	p_thread;
+	pthread_mutex_t	p_lock;
+	pthread_cond_t	p_cond;
+	tfunc_t		p_func;
+	void *		p_arg;
+	tprio_t		p_prio;
+	const char *	p_name;
+	int		p_done;
+	/* Synchronous messages */
+	struct thread *	p_msgnext;
+	struct thread *	p_msgq;
+	msg_t		p_msg;
+	int		p_msgdone;
+	/* Pending events */
+	eventmask_t	p_epending;
+	eventmask_t	p_ewait;
+	/* Simulated clock, see host_os.c */
+	int		p_wait;
+	int		p_joined;
+	int		p_exempt;
+	int		p_woken;
+	struct thread *	p_simnext;
+	uint64_t	p_wake;
+} thread_t;
+
+typedef struct semaphore {
+	pthread_mutex_t	s_lock;
+	pthread_cond_t	s_cond;
+	cnt_t		s_cnt;
+	cnt_t		s_wakeups;
+} semaphore_t;
+
+typedef struct mutex {
+	pthread_mutex_t	m_lock;
+} mutex_t;
+
+typedef struct event_listener {
+	struct event_listener *	el_next;
+	thread_t *		el_listener;
+	eventmask_t		el_events;
+} event_listener_t;
+
+typedef struct event_source {
+	event_listener_t *	es_next;
+} event_source_t;
+
+typedef void (*evhandler_t)(eventid_t);
+
+extern void chSysLock (void);
+extern void chSysUnlock (void);
+extern void chSysLockFromISR (void);
+extern void chSysUnlockFromISR (void);
+extern void chSysHalt (const char *);
+
+extern systime_t chVTGetSystemTimeX (void);
+#define chVTGetSystemTime()	chVTGetSystemTimeX()
+#define chVTTimeElapsedSinceX(t)	((systime_t)(chVTGetSystemTimeX () - (t)))
+
+extern thread_t * chThdCreateStatic (void *, size_t, tprio_t, tfunc_t, void *);
+extern thread_t * chThdCreateFromHeap (void *, size_t, tprio_t,
+    tfunc_t, void *);
+extern msg_t chThdWait (thread_t *);
+extern void chThdSleep (systime_t);
+extern systime_t chThdSleepUntilWindowed (systime_t, systime_t);
+#define chThdSleepMilliseconds(ms)	chThdSleep (MS2ST(ms))
+#define chThdSleepMicroseconds(us)	chThdSleep (US2ST(us))
+extern void chThdYield (void);
+extern thread_t * chThdGetSelfX (void);
+extern tprio_t chThdGetPriorityX (void);
+extern void chRegSetThreadName (const char *);
+
+extern void chSemObjectInit (semaphore_t *, cnt_t);
+extern msg_t chSemWait (semaphore_t *);
+extern msg_t chSemWaitTimeout (semaphore_t *, systime_t);
+extern void chSemSignal (semaphore_t *);
+extern void chSemSignalI (semaphore_t *);
+extern cnt_t chSemGetCounterI (semaphore_t *);
+extern void chSemFastWaitI (semaphore_t *);
+extern void chSemReset (semaphore_t *, cnt_t);
+
+/* Signalling from host threads already wakes the waiter. */
+
+#define chSchRescheduleS()		do { } while (0)
+
+extern void chMtxObjectInit (mutex_t *);
+extern void chMtxLock (mutex_t *);
+extern void chMtxUnlock (mutex_t *);
+
+extern msg_t chMsgSend (thread_t *, msg_t);
+extern thread_t * chMsgWait (void);
+extern void chMsgRelease (thread_t *, msg_t);
+#define chMsgGet(tp)		((tp)->p_msg)
+
+extern void chEvtRegisterMask (event_source_t *, event_listener_t *,
+    eventmask_t);
+#define chEvtRegister(esp, elp, eid)	\
+	chEvtRegisterMask (esp, elp, EVENT_MASK(eid))
+extern void chEvtBroadcastI (event_source_t *);
+extern eventmask_t chEvtWaitOne (eventmask_t);
+extern void chEvtDispatch (const evhandler_t *, eventmask_t);
+
+extern void * chHeapAlloc (void *, size_t);
+extern void chHeapFree (void *);
+
+#endif /* _BENCH_CH_H_ */
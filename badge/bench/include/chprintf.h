@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for chprintf(). The benchmark has no serial console, so
+ * the output goes to stdout when the stream is set, and nowhere when
+ * it's NULL.
+ */
+
+#ifndef _BENCH_CHPRINTF_H_
+#define _BENCH_CHPRINTF_H_
+
+typedef struct BaseSequentialStream BaseSequentialStream;
+
+extern int chprintf (BaseSequentialStream *, const char *, ...);
+
+#endif /* _BENCH_CHPRINTF_H_ */
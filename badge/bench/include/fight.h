@@ -0,0 +1,29 @@
+/*
+ * Force-included ahead of proto.c, which is built by itself for the
+ * fight protocol checks in fight.c. proto.c finds its ProtoHandles
+ * through the fight app's context, so this supplies just that much of
+ * orchard-app.h and app-fight.h, and switches the real ones off, since
+ * they drag in the whole UI.
+ */
+
+#ifndef _BENCH_FIGHT_H_
+#define _BENCH_FIGHT_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "chprintf.h"
+
+#define __ORCHARD_APP_H__
+#define __APP_FIGHT_H__
+
+struct _ProtoHandles;
+
+typedef struct _OrchardAppContext {
+	void *			priv;
+} OrchardAppContext;
+
+typedef struct _FightHandles {
+	struct _ProtoHandles *	proto;
+} FightHandles;
+
+#endif /* _BENCH_FIGHT_H_ */
@@ -0,0 +1,98 @@
+/*
+ * Host stand-in for the parts of uGFX used by the media code. Instead of
+ * the ILI9341 driver, the display is a 320x240 RGB565 frame buffer that
+ * the DMA stand-in writes into, one window at a time, the same way the
+ * real controller fills the window set up by gdisp_lld_write_start().
+ * See host_hw.c. There is no touch screen, so the mouse never reports
+ * any events.
+ */
+
+#ifndef _BENCH_GFX_H_
+#define _BENCH_GFX_H_
+
+#include "ch.h"
+
+#define GDISP_SCREEN_WIDTH	320
+#define GDISP_SCREEN_HEIGHT	240
+
+typedef int16_t		coord_t;
+typedef uint16_t	color_t;
+typedef color_t		pixel_t;
+typedef int		bool_t;
+typedef uint32_t	delaytime_t;
+
+typedef struct GDisplay {
+	struct {
+		coord_t		x, y;
+		coord_t		cx, cy;
+		color_t		color;
+	} p;
+} GDisplay;
+
+extern GDisplay * GDISP;
+
+extern void gdisp_lld_write_start (GDisplay *);
+extern void gdisp_lld_write_stop (GDisplay *);
+#define gdispGetWidth()		GDISP_SCREEN_WIDTH
+#define gdispGetHeight()	GDISP_SCREEN_HEIGHT
+
+typedef uint16_t	GEventType;
+
+typedef struct GEventMouse {
+	GEventType		type;
+	coord_t			x, y, z;
+	uint16_t		buttons;
+} GEventMouse;
+
+#define GMETA_MOUSE_DOWN	0x0010
+#define GMETA_MOUSE_UP		0x0020
+#define GLISTEN_MOUSEMETA	0x0001
+
+typedef struct GSource_t	GSource, *GSourceHandle;
+
+typedef struct GListener {
+	int		gl_unused;
+} GListener;
+
+typedef GEventMouse	GEvent;
+
+static inline GSourceHandle
+ginputGetMouse (int n)
+{
+	(void)n;
+	return (NULL);
+}
+
+static inline void
+geventListenerInit (GListener * pl)
+{
+	(void)pl;
+	return;
+}
+
+static inline bool_t
+geventAttachSource (GListener * pl, GSourceHandle gs, uint32_t flags)
+{
+	(void)pl;
+	(void)gs;
+	(void)flags;
+	return (TRUE);
+}
+
+static inline void
+geventDetachSource (GListener * pl, GSourceHandle gs)
+{
+	(void)pl;
+	(void)gs;
+	return;
+}
+
+static inline GEvent *
+geventEventWait (GListener * pl, delaytime_t timeout)
+{
+	(void)pl;
+	(void)timeout;
+	return (NULL);
+}
+
+#endif /* _BENCH_GFX_H_ */
@@ -0,0 +1,84 @@
+/*
+ * Host stand-in for the ChibiOS HAL and the handful of Cortex-M0+ and
+ * Kinetis registers the media code touches directly. The SysTick timer
+ * is simulated from the host clock (see host_os.c), so cycle counts
+ * taken with it come out in 48MHz CPU cycles of host time. TPM2, which
+ * drives the buzzer, is watched by a thread in host_hw.c. The radio is
+ * modeled in host_radio.c, behind the spi.h stand-in.
+ */
+
+#ifndef _BENCH_HAL_H_
+#define _BENCH_HAL_H_
+
+#include "ch.h"
+
+#define KINETIS_SYSCLK_FREQUENCY	48000000UL
+#define KINETIS_BUSCLK_FREQUENCY	(KINETIS_SYSCLK_FREQUENCY / 2)
+
+typedef struct {
+	volatile uint32_t	CTRL;
+	volatile uint32_t	LOAD;
+	volatile uint32_t	VAL;
+	volatile uint32_t	CALIB;
+} SysTick_Type;
+
+typedef struct {
+	volatile uint32_t	CPUID;
+	volatile uint32_t	ICSR;
+} SCB_Type;
+
+typedef struct {
+	volatile uint32_t	SOPT2;
+	volatile uint32_t	SCGC4;
+	volatile uint32_t	SCGC5;
+	volatile uint32_t	SCGC6;
+	volatile uint32_t	SCGC7;
+} SIM_TypeDef;
+
+typedef struct {
+	volatile uint32_t	SC;
+	volatile uint32_t	CNT;
+	volatile uint32_t	MOD;
+	struct {
+		volatile uint32_t	SC;
+		volatile uint32_t	V;
+	} C[6];
+} TPM_TypeDef;
+
+#define SCB_ICSR_PENDSTSET_Msk	(1UL << 26)
+#define SIM_SCGC6_DAC0		(1UL << 31)
+#define SIM_SCGC6_TPM2		(1UL << 26)
+#define SIM_SOPT2_TPMSRC_MASK	(3UL << 24)
+#define SIM_SOPT2_TPMSRC(x)	(((uint32_t)(x) << 24) & SIM_SOPT2_TPMSRC_MASK)
+
+#define KINETIS_TPM_CLOCK_SRC	1
+
+/* The radio supplies the CPU clock, so radio_lld.c mustn't reset it. */
+
+#define KINETIS_MCG_MODE_FEI	1
+#define KINETIS_MCG_MODE_FEE	2
+#define KINETIS_MCG_MODE	KINETIS_MCG_MODE_FEE
+
+typedef struct {
+	volatile uint32_t	PDOR;
+} GPIO_TypeDef;
+
+typedef struct EXTDriver EXTDriver;
+typedef uint32_t	expchannel_t;
+
+extern SysTick_Type * hostSysTick (void);
+extern SCB_Type hostSCB;
+extern SIM_TypeDef hostSIM;
+extern TPM_TypeDef hostTPM2;
+
+#define SysTick			(hostSysTick ())
+#define SCB			(&hostSCB)
+#define SIM			(&hostSIM)
+#define TPM2			(&hostTPM2)
+
+/* The real hal.h brings in the OSAL and the drivers. */
+
+#include "osal.h"
+#include "spi.h"
+
+#endif /* _BENCH_HAL_H_ */
@@ -0,0 +1,16 @@
+/*
+ * Host stand-in for the Kinetis TPM register bits tpm_lld.c uses.
+ */
+
+#ifndef _BENCH_KINETIS_TPM_H_
+#define _BENCH_KINETIS_TPM_H_
+
+#define TPM_SC_PS_MASK			(7 << 0)
+#define TPM_SC_CMOD_LPTPM_CLK		(1 << 3)
+#define TPM_SC_CMOD_LPTPM_EXTCLK	(2 << 3)
+
+#define TPM_CnSC_ELSB			(1 << 3)
+#define TPM_CnSC_MSB			(1 << 5)
+#define TPM_CnSC_CHIE			(1 << 6)
+
+#endif /* _BENCH_KINETIS_TPM_H_ */
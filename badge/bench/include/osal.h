@@ -0,0 +1,21 @@
+/*
+ * Host stand-in for the ChibiOS OSAL, mapped onto the ch.h stand-in.
+ */
+
+#ifndef _BENCH_OSAL_H_
+#define _BENCH_OSAL_H_
+
+#include "ch.h"
+
+#define osalSysLock()		chSysLock()
+#define osalSysUnlock()		chSysUnlock()
+#define osalSysLockFromISR()	chSysLockFromISR()
+#define osalSysUnlockFromISR()	chSysUnlockFromISR()
+
+#define osalMutexObjectInit(m)	chMtxObjectInit(m)
+#define osalMutexLock(m)	chMtxLock(m)
+#define osalMutexUnlock(m)	chMtxUnlock(m)
+
+#define osalThreadSleep(t)	chThdSleep(t)
+
+#endif /* _BENCH_OSAL_H_ */
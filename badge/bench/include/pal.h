@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for the ChibiOS PAL driver. The only pins the radio
+ * code touches are the LEDs and the radio reset line, so pad changes
+ * go nowhere.
+ */
+
+#ifndef _BENCH_PAL_H_
+#define _BENCH_PAL_H_
+
+#include "hal.h"
+
+extern GPIO_TypeDef hostGPIO;
+
+#define RED_LED_PORT		(&hostGPIO)
+#define RED_LED_PIN		16
+#define GREEN_LED_PORT		(&hostGPIO)
+#define GREEN_LED_PIN		1
+#define RADIO_RESET_PORT	(&hostGPIO)
+#define RADIO_RESET_PIN		7
+
+#define palSetPad(port, pad)	((void)(port), (void)(pad))
+#define palClearPad(port, pad)	((void)(port), (void)(pad))
+
+#endif /* _BENCH_PAL_H_ */
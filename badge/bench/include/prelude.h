@@ -0,0 +1,16 @@
+/*
+ * Force-included ahead of every badge source file in the benchmark
+ * build. The badge's own headers are found before ours when a source
+ * file includes them by name, so headers which drag in the whole UI
+ * and can't be built on the host are switched off here by defining
+ * their include guards up front.
+ */
+
+#ifndef _BENCH_PRELUDE_H_
+#define _BENCH_PRELUDE_H_
+
+/* orchard-ui.h: video_lld.c includes it but uses nothing from it. */
+
+#define __ORCHARD_UI_H__
+
+#endif /* _BENCH_PRELUDE_H_ */
@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for the ChibiOS SPI driver. Only the radio's SPI
+ * channel is modeled: the transfers go to the radio register model in
+ * host_radio.c.
+ */
+
+#ifndef _BENCH_SPI_H_
+#define _BENCH_SPI_H_
+
+#include <stddef.h>
+
+typedef struct SPIDriver {
+	int		spi_unused;
+} SPIDriver;
+
+extern SPIDriver SPID1;
+
+extern void spiAcquireBus (SPIDriver *);
+extern void spiReleaseBus (SPIDriver *);
+extern void spiSelect (SPIDriver *);
+extern void spiUnselect (SPIDriver *);
+extern void spiSend (SPIDriver *, size_t, const void *);
+extern void spiReceive (SPIDriver *, size_t, void *);
+
+#endif /* _BENCH_SPI_H_ */
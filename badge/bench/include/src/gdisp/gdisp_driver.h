@@ -0,0 +1,6 @@
+/*
+ * The real driver interface header pulls in all of uGFX; everything the
+ * media code needs from it is in the gfx.h stand-in.
+ */
+
+#include "gfx.h"
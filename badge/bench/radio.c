@@ -0,0 +1,785 @@
+/*
+ * Radio checks for the host media benchmark
+ *
+ * With -T <frames>, radio_lld.c is started against the SX1233 model in
+ * host_radio.c and radioSend() is called <frames> times at each of a
+ * few frame sizes, a short message, a middling one, and the biggest
+ * that fits with AES on. For each size we report what a send costs:
+ *
+ * - how long the caller was blocked in radioSend(), against how long
+ *   the frame took to go out over the air
+ * - how much CPU time the caller burned meanwhile, which on the badge
+ *   is time taken from every other thread
+ * - the SPI transactions per frame, counting the event thread's, and
+ *   how many radio interrupts were raised
+ *
+ * There's a short gap between sends, so each one starts with the radio
+ * idle and the interrupt handling of the last one out of the way.
+ *
+ * Then the radio is loaded more heavily than the air can carry: one
+ * thread sends a ping every RADIO_PING_GAP and another a chat message
+ * every RADIO_CHAT_GAP, while fight frames go out every RADIO_FIGHT_GAP. This
+ * is done once with everything calling radioSend(), and once with
+ * everything going through radioSendAsync(), and we report how long
+ * each fight frame took to get onto the air and back, how long the
+ * fight code was held up, and how many pings got through.
+ *
+ * Last, a crowd of badges is played at the radio: RADIO_RX_FRAMES frames
+ * arrive back to back, mostly pings and every RADIO_RX_FIGHT'th a fight
+ * frame. The ping handler takes as long as radio_ping_handler() does to
+ * print its JSON line on the console, and we report how many frames were
+ * lost because the FIFO hadn't been read in time, how long frames sat in
+ * the FIFO, how many the driver had to drop for want of a receive slot,
+ * and how long fight frames took to reach their handler. The handlers
+ * then pass each frame to the running app through orchard-radio.c, as
+ * main.c and app-fight.c do, and a thread standing in for the app
+ * thread takes RADIO_APP_EVENT over each; we report how many frames
+ * reached it and how many were dropped on the way.
+ *
+ * Then small frames are sent the way a fight goes: RADIO_AGG_BURSTS
+ * times, a bare fight ACK and a chat message for the peer and a ping for
+ * everyone are queued with radioSendAsync() back to back, and we report
+ * how many frames went out for them, their airtime, and how long the
+ * ACK took to get onto the air. Three chat messages for the peer are
+ * then queued behind a ping, the second too big to share a frame with
+ * the first and the third small enough to, and they have to go out in
+ * the order they were queued. Finally aggregate frames, each packing
+ * as many frames as the driver would, fight ACKs and a ping, are played
+ * at the radio, and every frame in them has to reach its handler and
+ * the app.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "orchard.h"
+#include "radio_lld.h"
+#include "orchard-radio.h"
+
+#include "host.h"
+
+/* Protocol ID for our frames, which nothing on the badge uses */
+
+#define RADIO_PROTOCOL_BENCH	0x7F
+
+/* Gap between sends */
+
+#define RADIO_GAP	MS2ST(5)
+
+/* The load test: how long it runs, and how often each kind is sent */
+
+#define RADIO_LOAD_RUN	MS2ST(3000)
+#define RADIO_PING_GAP	MS2ST(5)
+#define RADIO_CHAT_GAP	MS2ST(40)
+#define RADIO_FIGHT_GAP	MS2ST(50)
+
+/*
+ * The receive test: how many frames arrive, how often one is a fight
+ * frame, and how long the ping handler takes: at 115200 baud its JSON
+ * line keeps the console busy for about 20ms.
+ */
+
+#define RADIO_RX_FRAMES		64
+#define RADIO_RX_FIGHT		8
+#define RADIO_RX_HANDLER	MS2ST(20)
+
+/* How long the app takes over a radio event, and its thread's priority */
+
+#define RADIO_APP_EVENT		MS2ST(10)
+#define RADIO_APP_PRIO		(LOWPRIO + 2)
+
+/* Payload sizes of a ping (the user record) and a fight PACKET */
+
+#define RADIO_PING_LEN	46
+#define RADIO_FIGHT_LEN	51
+
+/*
+ * The aggregation test: how many bursts are sent and how far apart, the
+ * peer they're for, and the sizes of a bare fight ACK and a chat
+ * message. Then how many aggregate frames arrive.
+ */
+
+#define RADIO_AGG_BURSTS	50
+#define RADIO_AGG_GAP		MS2ST(50)
+#define RADIO_AGG_PEER		0x1234
+#define RADIO_ACK_LEN		8
+#define RADIO_CHAT_LEN		24
+#define RADIO_AGG_RX		8
+
+typedef struct radio_load {
+	volatile int	rl_stop;
+	int		rl_async;
+	uint32_t	rl_pings;
+	uint32_t	rl_pingdrops;
+	uint32_t	rl_chats;
+	uint32_t	rl_chatfails;
+	semaphore_t	rl_done;
+	volatile int	rl_sts;
+	uint64_t	rl_end;
+} RADIO_LOAD;
+
+typedef struct radio_rx {
+	uint32_t	rr_pings;
+	uint32_t	rr_fights;
+	uint32_t	rr_apppings;	/* Reached the app */
+	uint32_t	rr_appfights;
+	uint64_t	rr_lat;
+	uint64_t	rr_latmax;
+} RADIO_RX;
+
+typedef struct radio_agg {
+	uint32_t	ra_sent;
+	uint32_t	ra_failed;
+	uint64_t	ra_start;
+	uint64_t	ra_lat;
+	uint64_t	ra_latmax;
+	uint32_t	ra_next;	/* Next chat expected in order */
+	uint32_t	ra_reordered;
+} RADIO_AGG;
+
+#define RADIO_ORDER_MSGS	3
+
+typedef struct radio_order {
+	RADIO_AGG *	ro_agg;
+	uint32_t	ro_seq;		/* Order it was queued in */
+} RADIO_ORDER;
+
+static RADIO_RX radioRxStats;
+static semaphore_t radioAppEvent;
+
+static const uint8_t radioSizes[] = {
+	8, 32, KW01_PKT_AES_MAXLEN - KW01_PKT_HDRLEN
+};
+
+static uint64_t
+threadNanos (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec);
+}
+
+/*
+ * Send one frame either way. The async sends don't wait: the ping and
+ * chat threads just note whether the frame was queued.
+ */
+
+static int
+loadSend (RADIO_LOAD * rl, kw01_proto_t prot, uint8_t len,
+    KW01_TX_FUNC cb)
+{
+	static const uint8_t buf[KW01_PKT_PAYLOADLEN];
+
+	if (rl->rl_async)
+		return (radioSendAsync (radioDriver, RADIO_BROADCAST_ADDRESS,
+		    prot, len, buf, cb, rl));
+
+	return (radioSend (radioDriver, RADIO_BROADCAST_ADDRESS, prot,
+	    len, buf));
+}
+
+static void
+pingDone (int sts, void * arg)
+{
+	RADIO_LOAD * rl;
+
+	rl = arg;
+	if (sts == 0)
+		rl->rl_pings++;
+	else
+		rl->rl_pingdrops++;
+
+	return;
+}
+
+static
+THD_FUNCTION(pingThread, arg)
+{
+	RADIO_LOAD * rl;
+
+	rl = arg;
+
+	while (!rl->rl_stop) {
+		if (loadSend (rl, RADIO_PROTOCOL_PING, RADIO_PING_LEN,
+		    pingDone) != 0)
+			rl->rl_pingdrops++;
+		else if (!rl->rl_async)
+			rl->rl_pings++;
+		chThdSleep (RADIO_PING_GAP);
+	}
+
+	return;
+}
+
+static
+THD_FUNCTION(chatThread, arg)
+{
+	RADIO_LOAD * rl;
+
+	rl = arg;
+
+	while (!rl->rl_stop) {
+		if (loadSend (rl, RADIO_PROTOCOL_CHAT, 24, NULL) == 0)
+			rl->rl_chats++;
+		else
+			rl->rl_chatfails++;
+		chThdSleep (RADIO_CHAT_GAP);
+	}
+
+	return;
+}
+
+static void
+fightDone (int sts, void * arg)
+{
+	RADIO_LOAD * rl;
+
+	rl = arg;
+	rl->rl_sts = sts;
+	rl->rl_end = hostNanos ();
+	chSemSignal (&rl->rl_done);
+
+	return;
+}
+
+/*
+ * Send fight frames under load, and report how long each took to go
+ * out and how long the caller was held up.
+ */
+
+static int
+radioLoad (int async)
+{
+	RADIO_LOAD rl;
+	thread_t * ping;
+	thread_t * chat;
+	uint64_t lat;
+	uint64_t latmax;
+	uint64_t held;
+	uint64_t t;
+	uint64_t c;
+	systime_t start;
+	int frames;
+	int failed;
+
+	memset (&rl, 0, sizeof(rl));
+	rl.rl_async = async;
+	chSemObjectInit (&rl.rl_done, 0);
+
+	lat = latmax = held = 0;
+	frames = failed = 0;
+
+	ping = chThdCreateStatic (NULL, 0, NORMALPRIO, pingThread, &rl);
+	chat = chThdCreateStatic (NULL, 0, NORMALPRIO, chatThread, &rl);
+
+	start = chVTGetSystemTime ();
+	while (chVTTimeElapsedSinceX (start) < RADIO_LOAD_RUN) {
+		chThdSleep (RADIO_FIGHT_GAP);
+		t = hostNanos ();
+		if (async) {
+			if (loadSend (&rl, RADIO_PROTOCOL_FIGHT,
+			    RADIO_FIGHT_LEN, fightDone) != 0) {
+				failed++;
+				continue;
+			}
+			c = hostNanos ();
+			chSemWait (&rl.rl_done);
+			if (rl.rl_sts != 0)
+				failed++;
+			held += c - t;
+			t = rl.rl_end - t;
+		} else {
+			if (loadSend (&rl, RADIO_PROTOCOL_FIGHT,
+			    RADIO_FIGHT_LEN, NULL) != 0)
+				failed++;
+			t = hostNanos () - t;
+			held += t;
+		}
+		lat += t;
+		if (t > latmax)
+			latmax = t;
+		frames++;
+	}
+
+	rl.rl_stop = 1;
+	chThdWait (ping);
+	chThdWait (chat);
+	chThdSleep (RADIO_LOAD_RUN / 10);
+
+	printf ("%s under load\n", async ? "radioSendAsync()" : "radioSend()");
+	printf ("fight frames     : %d sent, %d failed\n", frames, failed);
+	printf ("fight latency    : %llu us average, %llu us max\n",
+	    (unsigned long long)(lat / (frames ? frames : 1) / 1000),
+	    (unsigned long long)(latmax / 1000));
+	printf ("fight caller     : %llu us held up per frame\n",
+	    (unsigned long long)(held / (frames ? frames : 1) / 1000));
+	printf ("pings            : %u sent, %u dropped\n", rl.rl_pings,
+	    rl.rl_pingdrops);
+	printf ("chat             : %u sent, %u failed\n\n", rl.rl_chats,
+	    rl.rl_chatfails);
+
+	return (failed || rl.rl_chatfails ? -1 : 0);
+}
+
+/*
+ * The app thread: like orchard-app.c's radio_event(), take every frame
+ * that's waiting each time the event fires.
+ */
+
+static
+THD_FUNCTION(appThread, arg)
+{
+	KW01_PKT * pkt;
+
+	(void)arg;
+
+	while (1) {
+		chSemWait (&radioAppEvent);
+		while ((pkt = orchardPktGet ()) != NULL) {
+			if (pkt->kw01_hdr.kw01_prot == RADIO_PROTOCOL_PING)
+				radioRxStats.rr_apppings++;
+			else
+				radioRxStats.rr_appfights++;
+			chThdSleep (RADIO_APP_EVENT);
+			orchardPktDone ();
+		}
+	}
+
+	/* NOTREACHED */
+	return;
+}
+
+/* Hand a frame to the app, as orchardAppRadioCallback() does. */
+
+static void
+appForward (KW01_PKT * pkt)
+{
+	if (orchardPktPut (pkt) == 0)
+		chSemSignal (&radioAppEvent);
+
+	return;
+}
+
+/*
+ * The receive handlers. Each frame carries the time it arrived.
+ */
+
+static void
+rxPing (KW01_PKT * pkt)
+{
+	radioRxStats.rr_pings++;
+	chThdSleep (RADIO_RX_HANDLER);
+	appForward (pkt);
+
+	return;
+}
+
+static void
+rxFight (KW01_PKT * pkt)
+{
+	uint64_t t;
+
+	memcpy (&t, pkt->kw01_payload, sizeof(t));
+	t = hostNanos () - t;
+
+	radioRxStats.rr_fights++;
+	radioRxStats.rr_lat += t;
+	if (t > radioRxStats.rr_latmax)
+		radioRxStats.rr_latmax = t;
+
+	appForward (pkt);
+
+	return;
+}
+
+static uint32_t
+rxDrops (kw01_proto_t prot)
+{
+	KW01_PKT_HANDLER * ph;
+	int i;
+
+	for (i = 0; i < KW01_PKT_HANDLERS_MAX; i++) {
+		ph = &radioDriver->kw01_handlers[i];
+		if (ph->kw01_handler != NULL && ph->kw01_prot == prot)
+			return (ph->kw01_drops);
+	}
+
+	return (0);
+}
+
+/*
+ * Have a burst of pings and fight frames arrive, and report what became
+ * of them.
+ */
+
+static int
+radioRx (void)
+{
+	uint8_t buf[KW01_PKT_MAXLEN];
+	KW01_PKT_HDR * hdr;
+	uint32_t pings;
+	uint32_t fights;
+	uint32_t lost;
+	uint64_t t;
+	int i;
+
+	memset (&radioRxStats, 0, sizeof(radioRxStats));
+	memset (&hostRadio, 0, sizeof(hostRadio));
+	memset (buf, 0, sizeof(buf));
+	orchard_pkt_drops = 0;
+
+	radioHandlerSet (radioDriver, RADIO_PROTOCOL_PING, rxPing);
+	radioHandlerSet (radioDriver, RADIO_PROTOCOL_FIGHT, rxFight);
+
+	hdr = (KW01_PKT_HDR *)buf;
+	hdr->kw01_dst = RADIO_BROADCAST_ADDRESS;
+	hdr->kw01_src = 0x1234;
+
+	pings = fights = 0;
+
+	for (i = 0; i < RADIO_RX_FRAMES; i++) {
+		t = hostNanos ();
+		memcpy (buf + sizeof(*hdr), &t, sizeof(t));
+		if ((i % RADIO_RX_FIGHT) == RADIO_RX_FIGHT - 1) {
+			hdr->kw01_prot = RADIO_PROTOCOL_FIGHT;
+			hostRadioReceive (buf, sizeof(*hdr) + RADIO_FIGHT_LEN);
+			fights++;
+		} else {
+			hdr->kw01_prot = RADIO_PROTOCOL_PING;
+			hostRadioReceive (buf, sizeof(*hdr) + RADIO_PING_LEN);
+			pings++;
+		}
+	}
+
+	/* Give the handlers time to catch up. */
+
+	chThdSleep (RADIO_RX_HANDLER * (KW01_RXQ_LEN + 2) +
+	    RADIO_APP_EVENT * ORCHARD_PKT_QLEN);
+
+	lost = hostRadio.hr_rxlost;
+
+	printf ("radio receive\n");
+	printf ("frames           : %u pings, %u fight, %u lost in the "
+	    "radio\n", pings, fights, lost);
+	printf ("FIFO wait        : %llu us average, %llu us max\n",
+	    (unsigned long long)(hostRadio.hr_rxwait /
+	    (hostRadio.hr_rxframes ? hostRadio.hr_rxframes : 1) / 1000),
+	    (unsigned long long)(hostRadio.hr_rxwaitmax / 1000));
+	printf ("pings            : %u handled, %u dropped\n",
+	    radioRxStats.rr_pings, rxDrops (RADIO_PROTOCOL_PING));
+	printf ("fight frames     : %u handled, %u dropped\n",
+	    radioRxStats.rr_fights, rxDrops (RADIO_PROTOCOL_FIGHT));
+	printf ("fight latency    : %llu us average, %llu us max\n",
+	    (unsigned long long)(radioRxStats.rr_lat /
+	    (radioRxStats.rr_fights ? radioRxStats.rr_fights : 1) / 1000),
+	    (unsigned long long)(radioRxStats.rr_latmax / 1000));
+	printf ("reached the app  : %u pings, %u fight, %u dropped\n\n",
+	    radioRxStats.rr_apppings, radioRxStats.rr_appfights,
+	    orchard_pkt_drops);
+
+	/*
+	 * Every frame has to be accounted for, and every fight frame that
+	 * was handled has to get to the app.
+	 */
+
+	if (radioRxStats.rr_pings + radioRxStats.rr_fights +
+	    rxDrops (RADIO_PROTOCOL_PING) + rxDrops (RADIO_PROTOCOL_FIGHT) +
+	    lost != pings + fights ||
+	    radioRxStats.rr_apppings + radioRxStats.rr_appfights +
+	    orchard_pkt_drops != radioRxStats.rr_pings +
+	    radioRxStats.rr_fights ||
+	    radioRxStats.rr_appfights != radioRxStats.rr_fights)
+		return (-1);
+
+	return (0);
+}
+
+static void
+aggDone (int sts, void * arg)
+{
+	RADIO_AGG * ra;
+
+	ra = arg;
+	if (sts == 0)
+		ra->ra_sent++;
+	else
+		ra->ra_failed++;
+
+	return;
+}
+
+static void
+aggAckDone (int sts, void * arg)
+{
+	RADIO_AGG * ra;
+	uint64_t t;
+
+	ra = arg;
+	t = hostNanos () - ra->ra_start;
+	ra->ra_lat += t;
+	if (t > ra->ra_latmax)
+		ra->ra_latmax = t;
+
+	aggDone (sts, arg);
+
+	return;
+}
+
+static void
+aggOrderDone (int sts, void * arg)
+{
+	RADIO_ORDER * ro;
+	RADIO_AGG * ra;
+
+	ro = arg;
+	ra = ro->ro_agg;
+	if (ro->ro_seq != ra->ra_next)
+		ra->ra_reordered++;
+	ra->ra_next++;
+
+	aggDone (sts, ra);
+
+	return;
+}
+
+/*
+ * Send bursts of small frames and report how many frames they took
+ * and how long they were on the air, then have aggregate frames arrive
+ * and make sure everything in them is handled.
+ */
+
+static int
+radioAgg (void)
+{
+	static const uint8_t buf[KW01_PKT_PAYLOADLEN];
+	uint8_t frame[KW01_PKT_MAXLEN];
+	KW01_PKT_HDR * hdr;
+	KW01_AGG_HDR * agg;
+	RADIO_AGG ra;
+	RADIO_ORDER ro[RADIO_ORDER_MSGS];
+	uint8_t olen[RADIO_ORDER_MSGS];
+	uint32_t queued;
+	uint64_t frames;
+	uint64_t airns;
+	uint8_t len;
+	uint64_t t;
+	int i;
+	int j;
+
+	memset (&ra, 0, sizeof(ra));
+	memset (&hostRadio, 0, sizeof(hostRadio));
+	queued = 0;
+
+	for (i = 0; i < RADIO_AGG_BURSTS; i++) {
+		chThdSleep (RADIO_AGG_GAP);
+		ra.ra_start = hostNanos ();
+		if (radioSendAsync (radioDriver, RADIO_AGG_PEER,
+		    RADIO_PROTOCOL_FIGHT, RADIO_ACK_LEN, buf, aggAckDone,
+		    &ra) != 0)
+			ra.ra_failed++;
+		if (radioSendAsync (radioDriver, RADIO_AGG_PEER,
+		    RADIO_PROTOCOL_CHAT, RADIO_CHAT_LEN, buf, aggDone,
+		    &ra) != 0)
+			ra.ra_failed++;
+		if (radioSendAsync (radioDriver, RADIO_BROADCAST_ADDRESS,
+		    RADIO_PROTOCOL_PING, RADIO_PING_LEN, buf, aggDone,
+		    &ra) != 0)
+			ra.ra_failed++;
+		queued += 3;
+	}
+
+	chThdSleep (RADIO_AGG_GAP);
+	frames = hostRadio.hr_frames;
+	airns = hostRadio.hr_airns;
+
+	/*
+	 * The second chat leaves too little room for the first to
+	 * join it, and the third would fit with the first but not with
+	 * the second. The ping keeps the radio busy while they queue.
+	 */
+
+	olen[0] = RADIO_ACK_LEN;
+	olen[1] = radioDriver->kw01_maxlen - KW01_PKT_HDRLEN -
+	    2 * KW01_AGG_HDRLEN - RADIO_ACK_LEN + 1;
+	olen[2] = RADIO_ACK_LEN;
+
+	if (radioSendAsync (radioDriver, RADIO_BROADCAST_ADDRESS,
+	    RADIO_PROTOCOL_PING, RADIO_PING_LEN, buf, aggDone, &ra) != 0)
+		ra.ra_failed++;
+	queued++;
+	for (i = 0; i < RADIO_ORDER_MSGS; i++) {
+		ro[i].ro_agg = &ra;
+		ro[i].ro_seq = i;
+		if (radioSendAsync (radioDriver, RADIO_AGG_PEER,
+		    RADIO_PROTOCOL_CHAT, olen[i], buf, aggOrderDone,
+		    &ro[i]) != 0)
+			ra.ra_failed++;
+		queued++;
+	}
+
+	chThdSleep (RADIO_AGG_GAP);
+
+	printf ("radio aggregation\n");
+	printf ("small frames     : %u queued, %u sent, %u failed\n",
+	    queued - (RADIO_ORDER_MSGS + 1), ra.ra_sent - (RADIO_ORDER_MSGS + 1),
+	    ra.ra_failed);
+	printf ("frames on air    : %llu, %llu us airtime per burst\n",
+	    (unsigned long long)frames,
+	    (unsigned long long)(airns / RADIO_AGG_BURSTS / 1000));
+	printf ("fight ACK        : %llu us average, %llu us max to send\n",
+	    (unsigned long long)(ra.ra_lat / RADIO_AGG_BURSTS / 1000),
+	    (unsigned long long)(ra.ra_latmax / 1000));
+	printf ("chat order       : %u of %d sent out of order\n",
+	    ra.ra_reordered, RADIO_ORDER_MSGS);
+
+	/*
+	 * Now the other way: as many frames as the driver packs, fight
+	 * ACKs and then a ping, in each aggregate.
+	 */
+
+	memset (&radioRxStats, 0, sizeof(radioRxStats));
+	memset (&hostRadio, 0, sizeof(hostRadio));
+	memset (frame, 0, sizeof(frame));
+	orchard_pkt_drops = 0;
+
+	hdr = (KW01_PKT_HDR *)frame;
+	hdr->kw01_dst = RADIO_BROADCAST_ADDRESS;
+	hdr->kw01_src = RADIO_AGG_PEER;
+	hdr->kw01_prot = RADIO_PROTOCOL_AGG;
+
+	for (i = 0; i < RADIO_AGG_RX; i++) {
+		t = hostNanos ();
+		len = sizeof(*hdr);
+		for (j = 0; j < KW01_TX_AGG_MAX; j++) {
+			agg = (KW01_AGG_HDR *)(frame + len);
+			len += KW01_AGG_HDRLEN;
+			if (j == KW01_TX_AGG_MAX - 1) {
+				agg->kw01_prot = RADIO_PROTOCOL_PING;
+				agg->kw01_len = RADIO_CHAT_LEN;
+			} else {
+				agg->kw01_prot = RADIO_PROTOCOL_FIGHT;
+				agg->kw01_len = RADIO_ACK_LEN;
+				memcpy (frame + len, &t, sizeof(t));
+			}
+			len += agg->kw01_len;
+		}
+		hostRadioReceive (frame, len);
+		chThdSleep (RADIO_RX_HANDLER +
+		    RADIO_APP_EVENT * (KW01_TX_AGG_MAX + 1));
+	}
+
+	printf ("aggregates in    : %d, %llu lost in the radio\n",
+	    RADIO_AGG_RX, (unsigned long long)hostRadio.hr_rxlost);
+	printf ("unpacked         : %u fight frames, %u pings handled\n",
+	    radioRxStats.rr_fights, radioRxStats.rr_pings);
+	printf ("reached the app  : %u pings, %u fight, %u dropped\n\n",
+	    radioRxStats.rr_apppings, radioRxStats.rr_appfights,
+	    orchard_pkt_drops);
+
+	if (ra.ra_failed || ra.ra_sent != queued || ra.ra_reordered ||
+	    ra.ra_next != RADIO_ORDER_MSGS || hostRadio.hr_rxlost ||
+	    radioRxStats.rr_fights != RADIO_AGG_RX * (KW01_TX_AGG_MAX - 1) ||
+	    radioRxStats.rr_pings != RADIO_AGG_RX ||
+	    radioRxStats.rr_appfights != radioRxStats.rr_fights ||
+	    radioRxStats.rr_apppings != radioRxStats.rr_pings)
+		return (-1);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* benchRadio - time radioSend() against the radio model
+*
+* RETURNS: 0 if every frame was sent, -1 if any failed
+*/
+
+int
+benchRadio (int frames)
+{
+	uint8_t buf[KW01_PKT_PAYLOADLEN];
+	uint64_t blocked;
+	uint64_t blockmax;
+	uint64_t cpu;
+	uint64_t t;
+	uint64_t c;
+	unsigned int s;
+	int failed;
+	int errs;
+	int i;
+
+	hostRadioInit ();
+
+	chSemObjectInit (&radioAppEvent, 0);
+	chThdCreateStatic (NULL, 0, RADIO_APP_PRIO, appThread, NULL);
+
+	for (i = 0; i < (int)sizeof(buf); i++)
+		buf[i] = i;
+
+	errs = 0;
+
+	for (s = 0; s < sizeof(radioSizes); s++) {
+		memset (&hostRadio, 0, sizeof(hostRadio));
+		blocked = 0;
+		blockmax = 0;
+		cpu = 0;
+		failed = 0;
+
+		for (i = 0; i < frames; i++) {
+			chThdSleep (RADIO_GAP);
+			t = hostNanos ();
+			c = threadNanos ();
+			if (radioSend (radioDriver, RADIO_BROADCAST_ADDRESS,
+			    RADIO_PROTOCOL_BENCH, radioSizes[s], buf) != 0)
+				failed++;
+			c = threadNanos () - c;
+			t = hostNanos () - t;
+			blocked += t;
+			cpu += c;
+			if (t > blockmax)
+				blockmax = t;
+		}
+
+		/* Let the last frame's interrupt handling finish. */
+
+		chThdSleep (RADIO_GAP);
+
+		printf ("radio frames     : %d of %u bytes, %d failed\n",
+		    frames, radioSizes[s], failed);
+		printf ("airtime          : %llu us per frame\n",
+		    (unsigned long long)(hostRadio.hr_airns /
+		    (hostRadio.hr_frames ? hostRadio.hr_frames : 1) / 1000));
+		printf ("caller blocked   : %llu us average, %llu us max\n",
+		    (unsigned long long)(blocked / frames / 1000),
+		    (unsigned long long)(blockmax / 1000));
+		printf ("caller CPU time  : %llu us per frame\n",
+		    (unsigned long long)(cpu / frames / 1000));
+		printf ("SPI transactions : %llu per frame, %llu bytes, "
+		    "%llu us\n",
+		    (unsigned long long)(hostRadio.hr_xfers / frames),
+		    (unsigned long long)(hostRadio.hr_bytes / frames),
+		    (unsigned long long)(hostRadio.hr_spins / frames / 1000));
+		printf ("radio interrupts : %llu per frame\n\n",
+		    (unsigned long long)(hostRadio.hr_irqs / frames));
+
+		if (failed)
+			errs++;
+	}
+
+	errs += radioLoad (0) != 0;
+	errs += radioLoad (1) != 0;
+	errs += radioRx () != 0;
+	errs += radioAgg () != 0;
+
+	printf ("Note: SPI timing is modeled, but CPU time is the host's.\n");
+
+	return (errs ? -1 : 0);
+}
@@ -0,0 +1,1007 @@
+/*
+ * Media regression checks for the host media benchmark
+ *
+ * With -G <dir>, the badge's audio and video code is run against the
+ * hardware stand-ins and what comes out is compared with golden files
+ * in <dir>, one per case:
+ *
+ * - dac_lld.c: a sound file of each kind (raw samples at the DAC rate,
+ *   raw samples at another rate, so they go through the resampler, and
+ *   ADPCM) is played with dacPlay(). Each DAC_SAMPLES buffer written to
+ *   the DAC is hashed, so a difference shows which buffer it starts in.
+ *
+ * - sound.c and tpm_lld.c: the buzzer tunes are played through
+ *   pwmThreadPlay() and playTone(), and a MIDI file (midi.c) through
+ *   pwmFileThreadPlay(). The TPM2 stand-in logs each change of tone and
+ *   when it happened. These run on the simulated clock (see host_os.c),
+ *   so the times are exact, however busy the host is.
+ *
+ * - video_lld.c: a short delta coded clip, with keyframes and an index,
+ *   is played with videoPlay(), also on the simulated clock, so no frame
+ *   is dropped. The screen it leaves behind is hashed and compared with
+ *   the clip's last frame as drawn here, and the audio is hashed.
+ *
+ * - fix_fft.c and ext/rfft: a fixed input is transformed at each size
+ *   and the outputs are hashed.
+ *
+ * All the inputs are made up here with integer arithmetic, so they're
+ * the same on any host, and everything has to match exactly. Each tune
+ * is then played again on host time, and how far its note boundaries
+ * land from the golden times is reported. That depends on the host's
+ * scheduling, so it never fails a check, but a change that makes the
+ * tune threads late shows up in the numbers.
+ *
+ * With -W as well, the golden files are written instead of checked.
+ * When a case fails, what it produced is saved as <case>.out in the
+ * current directory, in the same format, for diffing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "ff.h"
+
+#include "dac_lld.h"
+#include "tpm_lld.h"
+#include "video_lld.h"
+#include "sound.h"
+#include "fix_fft.h"
+#include "rfft.h"
+
+#include "host.h"
+
+/* A tune is over once the buzzer has been quiet this long (ns) */
+
+#define REG_QUIET	500000000ULL
+
+/* Give up on a tune that hasn't finished after this long (ns) */
+
+#define REG_TIMEOUT	30000000000ULL
+
+#define REG_PCM		0
+#define REG_RATE	1
+#define REG_ADPCM	2
+
+/* Lengths of the generated sound files, in samples or ADPCM blocks */
+
+#define REG_PCM_SAMPLES		(DAC_SAMPLERATE * 3 / 2)
+#define REG_RATE_HZ		8000
+#define REG_RATE_SAMPLES	REG_RATE_HZ
+#define REG_ADPCM_BLOCKS	40
+
+/*
+ * The test video. It's delta coded at full screen size, so it's drawn
+ * without scaling and the screen can be checked against the last frame.
+ * Each scanline pair carries REG_VID_SPC samples of audio.
+ */
+
+#define REG_VID_FILE		"REG.VID"
+#define REG_VID_WIDTH		320
+#define REG_VID_HEIGHT		240
+#define REG_VID_FPS		8
+#define REG_VID_RATE		7680
+#define REG_VID_FRAMES		12
+#define REG_VID_KEYINT		8
+#define REG_VID_PAIRS		(REG_VID_HEIGHT / 2)
+#define REG_VID_SPC		(REG_VID_RATE / (REG_VID_FPS * REG_VID_PAIRS))
+#define REG_VID_KEYS		\
+	((REG_VID_FRAMES + REG_VID_KEYINT - 1) / REG_VID_KEYINT)
+
+/* Shortest run of one color worth coding as a run */
+
+#define REG_VID_RUN		4
+
+#define REG_LINE	128
+
+typedef struct reg_case {
+	const char *	rc_name;
+	int		(*rc_run)(const struct reg_case *, FILE *);
+	int		rc_arg;
+	void		(*rc_play)(void);
+} REG_CASE;
+
+static int regDac (const REG_CASE *, FILE *);
+static int regTune (const REG_CASE *, FILE *);
+static int regMidi (const REG_CASE *, FILE *);
+static int regVideo (const REG_CASE *, FILE *);
+static int regFft (const REG_CASE *, FILE *);
+
+static const REG_CASE cases[] = {
+	{ "dac-pcm",		regDac,		REG_PCM,	NULL },
+	{ "dac-rate",		regDac,		REG_RATE,	NULL },
+	{ "dac-adpcm",		regDac,		REG_ADPCM,	NULL },
+	{ "tune-nope",		regTune,	0,		playNope },
+	{ "tune-hardfail",	regTune,	0,		playHardFail },
+	{ "tune-attacked",	regTune,	0,		playAttacked },
+	{ "tune-victory",	regTune,	0,		playVictory },
+	{ "tune-defeat",	regTune,	0,		playDefeat },
+	{ "tone-reset",		regTune,	0,		playConfigReset },
+	{ "midi",		regMidi,	0,		NULL },
+	{ "video-delta",	regVideo,	0,		NULL },
+	{ "fft",		regFft,		0,		NULL }
+};
+
+static char * regFiles[] = { "REGPCM.RAW", "REGRATE.RAW",
+    "REGADPCM.RAW" };
+
+/*
+ * A format 1 MIDI file, with the tempo on its own track. It covers
+ * running status, note on with velocity 0 as a note off, a note cut off
+ * by the next one (whose own note off must be ignored), a note too low
+ * for the buzzer, a drum, a text event and a tempo change in the middle.
+ */
+
+static const uint8_t regMidiFile[] = {
+	'M', 'T', 'h', 'd', 0, 0, 0, 6,
+	0, 1, 0, 2, 0, 96,
+
+	'M', 'T', 'r', 'k', 0, 0, 0, 19,
+	0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,	/* 120 bpm */
+	0x83, 0x00, 0xFF, 0x51, 0x03, 0x06, 0x1A, 0x80,	/* 150 bpm */
+	0x00, 0xFF, 0x2F, 0x00,
+
+	'M', 'T', 'r', 'k', 0, 0, 0, 66,
+	0x00, 0xFF, 0x01, 0x03, 'r', 'e', 'g',
+	0x00, 0x90, 0x3C, 0x64,		/* C4 */
+	0x30, 0x3C, 0x00,		/* running status off */
+	0x00, 0x3E, 0x64,		/* D4 */
+	0x30, 0x80, 0x3E, 0x40,		/* note off */
+	0x00, 0x90, 0x40, 0x64,		/* E4 */
+	0x18, 0x43, 0x64,		/* G4 cuts off E4 */
+	0x18, 0x40, 0x00,		/* ignored */
+	0x18, 0x43, 0x00,
+	0x00, 0x99, 0x24, 0x64,		/* drum, ignored */
+	0x00, 0x90, 0x12, 0x64,		/* too low, played at 30 */
+	0x30, 0x12, 0x00,
+	0x30, 0x48, 0x64,		/* C5 after a rest, 150 bpm */
+	0x60, 0x48, 0x00,
+	0x00, 0x89, 0x24, 0x00,		/* drum off */
+	0x18, 0x90, 0x47, 0x64,		/* B4 */
+	0x30, 0x47, 0x00,
+	0x00, 0xFF, 0x2F, 0x00
+};
+
+static uint32_t regSeed;
+
+static uint32_t
+regRand (void)
+{
+	regSeed = (regSeed * 1664525) + 1013904223;
+	return (regSeed);
+}
+
+/******************************************************************************
+*
+* regSweep - make up a test signal
+*
+* This fills <p> with <cnt> 12-bit samples of a triangle wave sweeping
+* from 200Hz to 2000Hz at <rate> samples per second, with a little noise.
+*
+* RETURNS: N/A
+*/
+
+static void
+regSweep (uint16_t * p, UINT cnt, uint32_t rate)
+{
+	uint32_t phase;
+	uint32_t hz;
+	uint32_t t;
+	UINT i;
+
+	regSeed = rate;
+	phase = 0;
+
+	for (i = 0; i < cnt; i++) {
+		hz = 200 + ((1800 * i) / cnt);
+		phase += (uint32_t)(((uint64_t)hz << 32) / rate);
+		t = phase >> 16;
+		if (t >= 32768)
+			t = 65535 - t;
+		p[i] = 1024 + (t >> 4) + ((regRand () >> 28) & 0xF) - 8;
+	}
+
+	return;
+}
+
+static int
+regWrite (const char * name, const void * buf, UINT len)
+{
+	FIL f;
+	UINT bw;
+	int r;
+
+	if (f_open (&f, name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+		fprintf (stderr, "can't create %s on the image\n", name);
+		return (-1);
+	}
+
+	r = f_write (&f, buf, len, &bw);
+	f_close (&f);
+
+	if (r != FR_OK || bw != len) {
+		fprintf (stderr, "can't write %s on the image\n", name);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Make up a color from <i>, spread out so that neighboring values look
+ * different.
+ */
+
+static uint16_t
+regColor (uint32_t i)
+{
+	return ((((i * 37) & 0x1F) << 11) | (((i * 11) & 0x3F) << 5) |
+	    ((i * 5) & 0x1F));
+}
+
+/******************************************************************************
+*
+* regFrame - make up a frame of the test video
+*
+* This draws frame <f> into <p>. Each frame has a still background of
+* 8x8 blocks, which codes as runs, a band of different colors that
+* scrolls, which codes as literals, and a box that moves, so most of
+* each frame is skipped after a keyframe. Every fourth frame is the same
+* as the one before it.
+*
+* RETURNS: N/A
+*/
+
+static void
+regFrame (uint16_t * p, int f)
+{
+	int bx;
+	int by;
+	int x;
+	int y;
+
+	if ((f % 4) == 2)
+		f--;
+
+	for (y = 0; y < REG_VID_HEIGHT; y++) {
+		for (x = 0; x < REG_VID_WIDTH; x++) {
+			if (y >= 100 && y < 116)
+				*p++ = regColor ((x * 3) + (f * 13));
+			else
+				*p++ = regColor ((x / 8) + ((y / 8) * 7));
+		}
+	}
+
+	p -= REG_VID_WIDTH * REG_VID_HEIGHT;
+	bx = (f * 23) % (REG_VID_WIDTH - 32);
+	by = (f * 17) % (REG_VID_HEIGHT - 32);
+	for (y = by; y < by + 32; y++) {
+		for (x = bx; x < bx + 32; x++)
+			p[(y * REG_VID_WIDTH) + x] = regColor ((f * 5) + 1);
+	}
+
+	return;
+}
+
+/*
+ * How many pixels from the start of <p>, up to <n>, are the same color.
+ */
+
+static int
+regRunLen (const uint16_t * p, int n)
+{
+	int i;
+
+	for (i = 1; i < n && p[i] == p[0]; i++)
+		;
+
+	return (i);
+}
+
+/******************************************************************************
+*
+* regDelta - delta code one scanline of the test video
+*
+* This codes the scanline <cur> into <op> as the ops described in
+* video_lld.h, skipping pixels that are the same in <prev>, the same
+* scanline of the frame before. For a keyframe, <prev> is NULL. The ops
+* can take up to twice the width of the scanline, but if they come to
+* more than a single literal op, that's what we use instead, as the
+* real encoder does.
+*
+* RETURNS: the number of 16-bit words of ops
+*/
+
+static int
+regDelta (const uint16_t * cur, const uint16_t * prev, uint16_t * op)
+{
+	int n;
+	int p;
+	int q;
+
+	n = 0;
+
+	for (p = 0; p < REG_VID_WIDTH; p = q) {
+		if (prev != NULL && cur[p] == prev[p]) {
+			for (q = p + 1; q < REG_VID_WIDTH &&
+			    cur[q] == prev[q]; q++)
+				;
+			op[n++] = VID_OP_SKIP | (q - p);
+			continue;
+		}
+
+		q = p + regRunLen (cur + p, REG_VID_WIDTH - p);
+		if (q - p >= REG_VID_RUN) {
+			op[n++] = VID_OP_RUN | (q - p);
+			op[n++] = cur[p];
+			continue;
+		}
+
+		for (q = p + 1; q < REG_VID_WIDTH; q++) {
+			if (prev != NULL && cur[q] == prev[q])
+				break;
+			if (regRunLen (cur + q,
+			    REG_VID_WIDTH - q) >= REG_VID_RUN)
+				break;
+		}
+		op[n++] = VID_OP_LIT | (q - p);
+		memcpy (op + n, cur + p, (q - p) * sizeof(uint16_t));
+		n += q - p;
+	}
+
+	if (n > REG_VID_WIDTH + 1) {
+		op[0] = VID_OP_LIT | REG_VID_WIDTH;
+		memcpy (op + 1, cur, REG_VID_WIDTH * sizeof(uint16_t));
+		n = REG_VID_WIDTH + 1;
+	}
+
+	return (n);
+}
+
+/******************************************************************************
+*
+* regVidMake - put the test video on the image
+*
+* RETURNS: 0 on success, -1 on failure
+*/
+
+static int
+regVidMake (void)
+{
+	VID_HEADER * hdr;
+	uint32_t index[REG_VID_KEYS];
+	uint16_t * cur;
+	uint16_t * prev;
+	uint16_t * t;
+	uint16_t * samples;
+	uint16_t * op;
+	uint16_t vlen;
+	uint8_t * buf;
+	uint8_t * p;
+	int key;
+	int f;
+	int l;
+	int n;
+	int r;
+
+	buf = malloc (sizeof(VID_HEADER) + sizeof(index) + (REG_VID_FRAMES *
+	    REG_VID_PAIRS * (REG_VID_WIDTH + 2 + REG_VID_SPC) * 2 *
+	    sizeof(uint16_t)));
+	cur = malloc (REG_VID_WIDTH * REG_VID_HEIGHT * sizeof(uint16_t));
+	prev = malloc (REG_VID_WIDTH * REG_VID_HEIGHT * sizeof(uint16_t));
+	samples = malloc (REG_VID_FRAMES * REG_VID_PAIRS * REG_VID_SPC *
+	    sizeof(uint16_t));
+	op = malloc (REG_VID_WIDTH * 4 * sizeof(uint16_t));
+
+	hdr = (VID_HEADER *)buf;
+	memset (hdr, 0, sizeof(VID_HEADER));
+	hdr->vh_magic[0] = VID_MAGIC0;
+	hdr->vh_magic[1] = VID_MAGIC1;
+	hdr->vh_magic[2] = VID_MAGIC2;
+	hdr->vh_version = VID_VERSION;
+	hdr->vh_codec = VID_CODEC_DELTA;
+	hdr->vh_fps = REG_VID_FPS;
+	hdr->vh_frames = REG_VID_FRAMES;
+	hdr->vh_width = REG_VID_WIDTH;
+	hdr->vh_height = REG_VID_HEIGHT;
+	hdr->vh_rate = REG_VID_RATE;
+	hdr->vh_keyint = REG_VID_KEYINT;
+	hdr->vh_flags = VID_FLAG_INDEX;
+
+	regSweep (samples, REG_VID_FRAMES * REG_VID_PAIRS * REG_VID_SPC,
+	    REG_VID_RATE);
+
+	p = (uint8_t *)(hdr + 1);
+
+	for (f = 0; f < REG_VID_FRAMES; f++) {
+		regFrame (cur, f);
+		key = (f % REG_VID_KEYINT) == 0;
+		if (key)
+			index[f / REG_VID_KEYINT] = p - buf;
+
+		for (l = 0; l < REG_VID_HEIGHT; l += 2) {
+			n = regDelta (cur + (l * REG_VID_WIDTH),
+			    key ? NULL : prev + (l * REG_VID_WIDTH), op);
+			n += regDelta (cur + ((l + 1) * REG_VID_WIDTH),
+			    key ? NULL : prev + ((l + 1) * REG_VID_WIDTH),
+			    op + n);
+			vlen = n;
+			memcpy (p, &vlen, sizeof(vlen));
+			p += sizeof(vlen);
+			memcpy (p, op, n * sizeof(uint16_t));
+			p += n * sizeof(uint16_t);
+			memcpy (p, samples + ((f * REG_VID_PAIRS) + (l / 2)) *
+			    REG_VID_SPC, REG_VID_SPC * sizeof(uint16_t));
+			p += REG_VID_SPC * sizeof(uint16_t);
+		}
+
+		t = prev;
+		prev = cur;
+		cur = t;
+	}
+
+	memcpy (p, index, sizeof(index));
+	p += sizeof(index);
+
+	r = regWrite (REG_VID_FILE, buf, p - buf);
+
+	free (op);
+	free (samples);
+	free (prev);
+	free (cur);
+	free (buf);
+
+	return (r);
+}
+
+/******************************************************************************
+*
+* regFilesMake - put the test files on the image
+*
+* RETURNS: 0 on success, -1 on failure
+*/
+
+static int
+regFilesMake (void)
+{
+	DAC_HEADER * hdr;
+	uint8_t * buf;
+	uint8_t * blk;
+	UINT len;
+	int i;
+	int j;
+	int r;
+
+	len = sizeof(DAC_HEADER) + (REG_PCM_SAMPLES * sizeof(uint16_t));
+	if (len < REG_ADPCM_BLOCKS * DAC_ADPCM_BLOCK + sizeof(DAC_HEADER))
+		len = REG_ADPCM_BLOCKS * DAC_ADPCM_BLOCK + sizeof(DAC_HEADER);
+	buf = calloc (1, len);
+	hdr = (DAC_HEADER *)buf;
+
+	/* Raw samples at the DAC's rate, with no header */
+
+	regSweep ((uint16_t *)buf, REG_PCM_SAMPLES, DAC_SAMPLERATE);
+	r = regWrite (regFiles[REG_PCM], buf,
+	    REG_PCM_SAMPLES * sizeof(uint16_t));
+
+	/* Raw samples at another rate, which has to have a header */
+
+	memset (hdr, 0, sizeof(DAC_HEADER));
+	hdr->dh_magic[0] = DAC_MAGIC0;
+	hdr->dh_magic[1] = DAC_MAGIC1;
+	hdr->dh_magic[2] = DAC_MAGIC2;
+	hdr->dh_version = DAC_VERSION;
+	hdr->dh_codec = DAC_CODEC_PCM;
+	hdr->dh_rate = REG_RATE_HZ;
+	hdr->dh_samples = REG_RATE_SAMPLES;
+	regSweep ((uint16_t *)(hdr + 1), REG_RATE_SAMPLES, REG_RATE_HZ);
+	r |= regWrite (regFiles[REG_RATE], buf, sizeof(DAC_HEADER) +
+	    (REG_RATE_SAMPLES * sizeof(uint16_t)));
+
+	/*
+	 * ADPCM blocks. Any nibbles decode to something, so these are
+	 * just random, with a random starting point for each block.
+	 */
+
+	hdr->dh_codec = DAC_CODEC_ADPCM;
+	hdr->dh_rate = 0;
+	hdr->dh_samples = REG_ADPCM_BLOCKS * DAC_SAMPLES;
+	regSeed = 1;
+	blk = (uint8_t *)(hdr + 1);
+	for (i = 0; i < REG_ADPCM_BLOCKS; i++) {
+		blk[0] = regRand () >> 24;
+		blk[1] = (regRand () >> 24) & 0x3F;
+		blk[2] = (regRand () >> 24) % 60;
+		blk[3] = 0;
+		for (j = DAC_ADPCM_HDR; j < DAC_ADPCM_BLOCK; j++)
+			blk[j] = regRand () >> 24;
+		blk += DAC_ADPCM_BLOCK;
+	}
+	r |= regWrite (regFiles[REG_ADPCM], buf, sizeof(DAC_HEADER) +
+	    (REG_ADPCM_BLOCKS * DAC_ADPCM_BLOCK));
+
+	r |= regWrite ("REG.MID", regMidiFile, sizeof(regMidiFile));
+
+	free (buf);
+
+	r |= regVidMake ();
+
+	return (r);
+}
+
+/******************************************************************************
+*
+* regDac - play a sound file and hash what reaches the DAC
+*
+* RETURNS: 0 on success, -1 if nothing was played
+*/
+
+static int
+regDac (const REG_CASE * c, FILE * out)
+{
+	const uint16_t * p;
+	uint64_t cnt;
+	uint64_t i;
+	UINT n;
+
+	dacPlay (regFiles[c->rc_arg]);
+	dacWait ();
+
+	p = hostAudio (&cnt);
+	if (cnt == 0)
+		return (-1);
+
+	fprintf (out, "samples %llu\n", (unsigned long long)cnt);
+	for (i = 0; i < cnt; i += DAC_SAMPLES) {
+		n = cnt - i < DAC_SAMPLES ? cnt - i : DAC_SAMPLES;
+		fprintf (out, "buf %llu %016llx\n",
+		    (unsigned long long)(i / DAC_SAMPLES),
+		    (unsigned long long)hostFnv (HOST_FNV_INIT, p + i,
+		    n * sizeof(uint16_t)));
+	}
+
+	if (hostStats.hs_empty != 0)
+		printf ("%s: audio ran dry %llu times\n", c->rc_name,
+		    (unsigned long long)hostStats.hs_empty);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* regTones - wait for the buzzer to finish and write out what it played
+*
+* Times are in microseconds from the first change of tone, and all the
+* waiting is done in system time, so on the simulated clock if it's on.
+*
+* RETURNS: 0 on success, -1 if the buzzer never went quiet
+*/
+
+static int
+regTones (FILE * out)
+{
+	const HOST_TONE * t;
+	uint64_t start;
+	int cnt;
+	int i;
+
+	start = hostSysNanos ();
+
+	while (1) {
+		t = hostTones (&cnt);
+		if (cnt != 0 && t[cnt - 1].ht_hz == 0 &&
+		    hostSysNanos () - t[cnt - 1].ht_ns > REG_QUIET)
+			break;
+		if (hostSysNanos () - start > REG_TIMEOUT)
+			return (-1);
+		chThdSleepMilliseconds (10);
+	}
+
+	for (i = 0; i < cnt; i++)
+		fprintf (out, "tone %llu %u\n",
+		    (unsigned long long)((t[i].ht_ns - t[0].ht_ns) / 1000),
+		    t[i].ht_hz);
+
+	return (0);
+}
+
+static int
+regTune (const REG_CASE * c, FILE * out)
+{
+	c->rc_play ();
+	return (regTones (out));
+}
+
+static int
+regMidi (const REG_CASE * c, FILE * out)
+{
+	int r;
+
+	(void)c;
+
+	if (pwmFileThreadPlay ("REG.MID") != 0)
+		return (-1);
+
+	r = regTones (out);
+	pwmFileStop ();
+
+	return (r);
+}
+
+/******************************************************************************
+*
+* regVideo - play the test video and hash what reaches the screen
+*
+* This plays the video through videoPlay(), and hashes the screen it
+* leaves behind and the audio. The screen should hold exactly the last
+* frame, so we also say whether it does. That doesn't depend on the
+* golden file being right.
+*
+* RETURNS: 0 on success, -1 if the video didn't play
+*/
+
+static int
+regVideo (const REG_CASE * c, FILE * out)
+{
+	uint16_t * p;
+	uint64_t hash;
+
+	(void)c;
+
+	if (videoPlay (REG_VID_FILE) != 0 || videoStats.vs_frames == 0)
+		return (-1);
+
+	dacSamplesWait ();
+
+	p = malloc (REG_VID_WIDTH * REG_VID_HEIGHT * sizeof(uint16_t));
+	regFrame (p, REG_VID_FRAMES - 1);
+	hash = hostFnv (HOST_FNV_INIT, p,
+	    REG_VID_WIDTH * REG_VID_HEIGHT * sizeof(uint16_t));
+	free (p);
+
+	fprintf (out, "frames %u, %u dropped\n", videoStats.vs_frames,
+	    videoStats.vs_dropped);
+	fprintf (out, "frame hash %016llx\n",
+	    (unsigned long long)hostFrameHash ());
+	fprintf (out, "last frame %s\n", hostFrameHash () == hash ?
+	    "matches" : "differs");
+	fprintf (out, "samples %llu\n",
+	    (unsigned long long)hostStats.hs_samples);
+	fprintf (out, "audio hash %016llx\n",
+	    (unsigned long long)hostStats.hs_audiohash);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* regFft - hash the spectrum code's output for a fixed input
+*
+* RETURNS: 0
+*/
+
+static int
+regFft (const REG_CASE * c, FILE * out)
+{
+	static int16_t in[RFFT_MAX];
+	static int16_t x[RFFT_MAX * 2];
+	static uint16_t mag[RFFT_MAX / 2];
+	uint16_t s[RFFT_MAX];
+	int n;
+	int m;
+	int i;
+
+	(void)c;
+
+	for (m = 6; m <= RFFT_LOG2_MAX; m++) {
+		n = 1 << m;
+		regSweep (s, n, n * 8);
+		for (i = 0; i < n; i++)
+			in[i] = (s[i] - 2048) << 3;
+
+		memcpy (x, in, n * sizeof(int16_t));
+		memset (x + n, 0, n * sizeof(int16_t));
+		fix_fft (x, x + n, m, 0);
+		fprintf (out, "fix_fft %d %016llx\n", n, (unsigned long long)
+		    hostFnv (HOST_FNV_INIT, x, n * 2 * sizeof(int16_t)));
+
+		memcpy (x, in, n * sizeof(int16_t));
+		rfft (x, m);
+		fprintf (out, "rfft %d %016llx\n", n, (unsigned long long)
+		    hostFnv (HOST_FNV_INIT, x, n * sizeof(int16_t)));
+
+		rfftMag (x, mag, m);
+		fprintf (out, "rfftMag %d %016llx\n", n, (unsigned long long)
+		    hostFnv (HOST_FNV_INIT, mag, (n / 2) * sizeof(uint16_t)));
+	}
+
+	return (0);
+}
+
+/*
+ * Get the next line from <*p> that isn't a comment, and move past it.
+ */
+
+static int
+regLine (const char ** p, char * line)
+{
+	const char * e;
+	size_t len;
+
+	while (**p == '#') {
+		e = strchr (*p, '\n');
+		*p = e == NULL ? *p + strlen (*p) : e + 1;
+	}
+
+	if (**p == '\0')
+		return (0);
+
+	e = strchr (*p, '\n');
+	len = e == NULL ? strlen (*p) : (size_t)(e - *p);
+	if (len >= REG_LINE)
+		len = REG_LINE - 1;
+	memcpy (line, *p, len);
+	line[len] = '\0';
+	*p = e == NULL ? *p + strlen (*p) : e + 1;
+
+	return (1);
+}
+
+/******************************************************************************
+*
+* regCompare - check a case's output against its golden file
+*
+* RETURNS: 0 if they match, -1 if not
+*/
+
+static int
+regCompare (const char * name, const char * gold, const char * out)
+{
+	char gl[REG_LINE];
+	char ol[REG_LINE];
+	int line;
+	int g;
+	int o;
+
+	for (line = 1; ; line++) {
+		g = regLine (&gold, gl);
+		o = regLine (&out, ol);
+		if (g == 0 && o == 0)
+			break;
+		if (g == 0 || o == 0) {
+			printf ("%s: FAILED, %s output at line %d\n", name,
+			    g == 0 ? "extra" : "missing", line);
+			return (-1);
+		}
+		if (strcmp (gl, ol) != 0) {
+			printf ("%s: FAILED at line %d: expected \"%s\", "
+			    "got \"%s\"\n", name, line, gl, ol);
+			return (-1);
+		}
+	}
+
+	printf ("%s: ok\n", name);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* regJitter - report how a tune played on host time compares with its golden
+*
+* This prints how far each note boundary in <out> is from the same one
+* in the golden file <gold>, on average and at worst. It's only for
+* information, so nothing here fails the check.
+*
+* RETURNS: N/A
+*/
+
+static void
+regJitter (const char * name, const char * gold, const char * out)
+{
+	char gl[REG_LINE];
+	char ol[REG_LINE];
+	unsigned long long gus;
+	unsigned long long ous;
+	unsigned ghz;
+	unsigned ohz;
+	uint64_t sum;
+	int64_t err;
+	int64_t max;
+	int notes;
+	int g;
+	int o;
+
+	sum = 0;
+	max = 0;
+	notes = 0;
+
+	while (1) {
+		g = regLine (&gold, gl);
+		o = regLine (&out, ol);
+		if (g == 0 && o == 0)
+			break;
+		if (g == 0 || o == 0 ||
+		    sscanf (gl, "tone %llu %u", &gus, &ghz) != 2 ||
+		    sscanf (ol, "tone %llu %u", &ous, &ohz) != 2 ||
+		    ghz != ohz) {
+			printf ("%s: on host time, played something else at "
+			    "note %d\n", name, notes + 1);
+			return;
+		}
+		err = (int64_t)ous - (int64_t)gus;
+		if (err < 0)
+			err = -err;
+		sum += err;
+		if (err > max)
+			max = err;
+		notes++;
+	}
+
+	if (notes != 0)
+		printf ("%s: on host time, %d note boundaries, timing error "
+		    "avg %llu us, max %lld us\n", name, notes,
+		    (unsigned long long)(sum / notes), (long long)max);
+
+	return;
+}
+
+static char *
+regRead (const char * path)
+{
+	FILE * f;
+	char * buf;
+	long len;
+
+	f = fopen (path, "r");
+	if (f == NULL)
+		return (NULL);
+	fseek (f, 0, SEEK_END);
+	len = ftell (f);
+	rewind (f);
+	buf = malloc (len + 1);
+	if (fread (buf, 1, len, f) != (size_t)len) {
+		free (buf);
+		fclose (f);
+		return (NULL);
+	}
+	buf[len] = '\0';
+	fclose (f);
+
+	return (buf);
+}
+
+static int
+regSave (const char * path, const char * name, const char * out)
+{
+	FILE * f;
+
+	f = fopen (path, "w");
+	if (f == NULL) {
+		perror (path);
+		return (-1);
+	}
+	fprintf (f, "# %s: golden output for mediabench -G, "
+	    "see regress.c\n", name);
+	fputs (out, f);
+	fclose (f);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* regRun - run a case
+*
+* This runs case <c> from a clean slate, on the simulated clock if <sim>
+* is set, and returns what it wrote via <out>, which the caller must
+* free.
+*
+* RETURNS: 0 on success, -1 if the case failed to run
+*/
+
+static int
+regRun (const REG_CASE * c, int sim, char ** out)
+{
+	size_t len;
+	FILE * f;
+	int r;
+
+	hostHwReset ();
+
+	if (sim)
+		hostSimClock (1);
+
+	f = open_memstream (out, &len);
+	r = c->rc_run (c, f);
+	fclose (f);
+
+	if (sim)
+		hostSimClock (0);
+
+	if (r != 0) {
+		free (*out);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* benchRegress - run the media regression checks
+*
+* This function runs each case and checks its output against the golden
+* file <dir>/<case>.txt, or with <update> set, writes the golden file.
+* The image must be mounted and the DAC started.
+*
+* RETURNS: 0 if everything matched, -1 if anything didn't
+*/
+
+int
+benchRegress (const char * dir, int update)
+{
+	const REG_CASE * c;
+	char path[256];
+	char * gold;
+	char * out;
+	unsigned i;
+	int tones;
+	int errs;
+
+	if (regFilesMake () != 0)
+		return (-1);
+
+	pwmStart ();
+
+	errs = 0;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		c = &cases[i];
+		tones = c->rc_run == regTune || c->rc_run == regMidi;
+
+		if (regRun (c, tones || c->rc_run == regVideo, &out) != 0) {
+			printf ("%s: FAILED, no output\n", c->rc_name);
+			errs++;
+			continue;
+		}
+
+		snprintf (path, sizeof(path), "%s/%s.txt", dir, c->rc_name);
+
+		if (update) {
+			errs += regSave (path, c->rc_name, out) != 0;
+			printf ("%s: wrote %s\n", c->rc_name, path);
+			free (out);
+			continue;
+		}
+
+		gold = regRead (path);
+		if (gold == NULL) {
+			printf ("%s: FAILED, can't read %s\n", c->rc_name,
+			    path);
+			errs++;
+		} else if (regCompare (c->rc_name, gold, out) != 0) {
+			snprintf (path, sizeof(path), "%s.out", c->rc_name);
+			regSave (path, c->rc_name, out);
+			errs++;
+		}
+
+		free (out);
+
+		if (gold != NULL && tones && regRun (c, 0, &out) == 0) {
+			regJitter (c->rc_name, gold, out);
+			free (out);
+		}
+
+		free (gold);
+	}
+
+	printf ("%d of %u media checks failed\n", errs,
+	    (unsigned)(sizeof(cases) / sizeof(cases[0])));
+
+	return (errs ? -1 : 0);
+}
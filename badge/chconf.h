@@ -401,8 +401,11 @@
  * @note    The default is @p FALSE.
  * @note    This debug option is not currently compatible with the
  *          tickless mode.
+ * @note    Left on in the badge firmware for the "cpu" shell command,
+ *          at the cost of a counter in every thread and an increment on
+ *          every system tick. Turning it off also drops the command.
  */
-#define CH_DBG_THREADS_PROFILING            FALSE
+#define CH_DBG_THREADS_PROFILING            TRUE
 
 /** @} */
 
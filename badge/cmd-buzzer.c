@@ -24,6 +24,7 @@
 
 static void buzzer_stop(BaseSequentialStream *chp) {
   chprintf(chp, "silence!\r\n");
+  pwmFileStop();
   pwmToneStop();;
 }
 
@@ -125,12 +126,28 @@ static void buzzer_play(BaseSequentialStream *chp, int argc, char *argv[]) {
   
 }
 
+static void buzzer_midi(BaseSequentialStream *chp, int argc, char *argv[]) {
+
+  if (argc != 2) {
+    chprintf(chp, "No file specified\r\n");
+    return;
+  }
+
+  if (pwmFileThreadPlay(argv[1]) != 0) {
+    chprintf(chp, "Can't play %s\r\n", argv[1]);
+    return;
+  }
+
+  chprintf(chp, "playing %s...\r\n", argv[1]);
+}
+
 static void cmd_buzzer(BaseSequentialStream *chp, int argc, char *argv[]) {
 
   if (argc == 0) {
     chprintf(chp, "buzzer commands:\r\n");
     chprintf(chp, "   tone [freq]          play frequency (in Hz)\r\n");
     chprintf(chp, "   play n               play note sequene #n\r\n");
+    chprintf(chp, "   midi file            play a MIDI file\r\n");
     chprintf(chp, "   stop                 turn off buzzer\r\n");
     return;
   }
@@ -145,6 +162,11 @@ static void cmd_buzzer(BaseSequentialStream *chp, int argc, char *argv[]) {
     return;
   }
 
+  if (!strcasecmp(argv[0], "midi")) {
+    buzzer_midi(chp, argc, argv);
+    return;
+  }
+
   if (!strcasecmp(argv[0], "stop"))
     buzzer_stop(chp);
   else
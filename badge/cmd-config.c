@@ -325,9 +325,9 @@ static void cmd_config_led_all(BaseSequentialStream *chp, int argc, char *argv[]
   config->led_r = r;
   config->led_g = g;
   config->led_b = b;
-  config->led_pattern = LED_PATTERNS_FULL - 1;
+  config->led_pattern = LED_PATTERNS_LIMITED - 1;
 
-  // the last pattern is always the 'ALL' state. 
+  // the last of the limited patterns is always the 'ALL' state.
   ledResetPattern();
 
 }
@@ -27,6 +27,7 @@
 #include "orchard-shell.h"
 
 #include "radio_lld.h"
+#include "orchard-radio.h"
 #include "hex.h"
 
 static void radio_get(BaseSequentialStream *chp, int argc, char *argv[]) {
@@ -119,6 +120,28 @@ radio_temperature (BaseSequentialStream *chp)
 	return;
 }
 
+static void radio_stats(BaseSequentialStream *chp) {
+
+  KW01_PKT_HANDLER * ph;
+  int i;
+
+  chprintf(chp, "Frames dropped with no receive slot free:\r\n");
+  for (i = 0; i < KW01_PKT_HANDLERS_MAX; i++) {
+    ph = &radioDriver->kw01_handlers[i];
+    if (ph->kw01_handler != NULL)
+      chprintf(chp, "   protocol 0x%02x: %d\r\n", ph->kw01_prot,
+               ph->kw01_drops);
+  }
+  chprintf(chp, "   other:         %d\r\n",
+           radioDriver->kw01_default_handler.kw01_drops);
+  chprintf(chp, "Frames dropped from the transmit queue: %d\r\n",
+           radioDriver->kw01_txdrops);
+  chprintf(chp, "Frames sent packed with others: %d\r\n",
+           radioDriver->kw01_txpacked);
+  chprintf(chp, "Frames dropped with the app's queue full: %d\r\n",
+           orchard_pkt_drops);
+}
+
 static void cmd_radio(BaseSequentialStream *chp, int argc, char *argv[]) {
 
   if (argc == 0) {
@@ -130,6 +153,7 @@ static void cmd_radio(BaseSequentialStream *chp, int argc, char *argv[]) {
     chprintf(chp, "   addr [addr]          Set radio node address\r\n");
 #endif /* KW01_RADIO_HWFILTER */
     chprintf(chp, "   temperature          Read radio temperature\r\n");
+    chprintf(chp, "   stats                Show frame counters\r\n");
     return;
   }
 
@@ -145,6 +169,8 @@ static void cmd_radio(BaseSequentialStream *chp, int argc, char *argv[]) {
 #endif /* KW01_RADIO_HWFILTER */
   else if (!strcasecmp(argv[0], "temperature"))
     radio_temperature (chp);
+  else if (!strcasecmp(argv[0], "stats"))
+    radio_stats(chp);
   else
     chprintf(chp, "Unrecognized radio command\r\n");
 }
@@ -0,0 +1,63 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006-2013 Giovanni Di Sirio
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "ch.h"
+#include "shell.h"
+#include "chprintf.h"
+
+#include "orchard-shell.h"
+
+#include <string.h>
+
+#include "mmc.h"
+
+static void cmd_sd(BaseSequentialStream *chp, int argc, char *argv[])
+{
+	MMC_STATS s;
+	uint32_t spc;
+
+	if (argc == 1 && strcmp (argv[0], "clear") == 0) {
+		memset (&mmcStats, 0, sizeof(mmcStats));
+		return;
+	}
+
+	if (argc > 0) {
+		chprintf(chp, "Usage: sd [clear]\r\n");
+		return;
+	}
+
+	s = mmcStats;
+
+	if (s.ms_cmds == 0) {
+		chprintf(chp, "No SD card reads yet\r\n");
+		return;
+	}
+
+	/* Sectors per command, times 100 */
+
+	spc = (s.ms_sectors * 100) / s.ms_cmds;
+
+	chprintf(chp, "read calls       : %u\r\n", s.ms_reads);
+	chprintf(chp, "read commands    : %u\r\n", s.ms_cmds);
+	chprintf(chp, "sectors read     : %u (%u.%02u per command)\r\n",
+	    s.ms_sectors, spc / 100, spc % 100);
+	if (s.ms_ticks != 0)
+		chprintf(chp, "read rate        : %u bytes/sec\r\n",
+		    (uint32_t)(((uint64_t)s.ms_sectors * 512 *
+		    CH_CFG_ST_FREQUENCY) / s.ms_ticks));
+}
+
+orchard_command("sd", cmd_sd);
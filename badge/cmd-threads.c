@@ -18,6 +18,8 @@
 #include "shell.h"
 #include "chprintf.h"
 
+#include <stdlib.h>
+
 #include "orchard-shell.h"
 
 static void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[])
@@ -43,3 +45,86 @@ static void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[])
 }
 
 orchard_command("threads", cmd_threads);
+
+#if CH_DBG_THREADS_PROFILING
+
+/*
+ * Most threads the cpu command reports on. Threads beyond this are
+ * left out of the report, but the busy total is worked out from the
+ * idle thread, so they still count towards it.
+ */
+
+#define CPU_THREADS 16
+
+static void cmd_cpu(BaseSequentialStream *chp, int argc, char *argv[])
+{
+  thread_t *tp;
+  thread_t *idle;
+  thread_t *thd[CPU_THREADS];
+  systime_t start[CPU_THREADS];
+  systime_t idlestart;
+  systime_t idletime;
+  systime_t t;
+  uint32_t ms;
+  uint32_t busy;
+  int n;
+  int i;
+
+  if (argc > 1) {
+    chprintf(chp, "Usage: cpu [milliseconds]\r\n");
+    return;
+  }
+
+  ms = 1000;
+  if (argc == 1)
+    ms = strtoul(argv[0], NULL, 0);
+  if (ms == 0)
+    ms = 1000;
+
+  /*
+   * With thread profiling turned on, the kernel charges each system
+   * tick to whichever thread it interrupted. Take a snapshot of every
+   * thread's count, wait, and see how the ticks in between were split.
+   * Each thread we track gets a reference, so it can't be freed and
+   * its memory reused by another thread while we sleep.
+   */
+
+  idle = chSysGetIdleThreadX();
+
+  n = 0;
+  tp = chRegFirstThread();
+  do {
+    if (n < CPU_THREADS) {
+      thd[n] = chThdAddRef(tp);
+      start[n] = tp->p_time;
+      n++;
+    }
+    tp = chRegNextThread(tp);
+  } while (tp != NULL);
+
+  t = chVTGetSystemTime();
+  idlestart = idle->p_time;
+  chThdSleepMilliseconds(ms);
+  idletime = idle->p_time - idlestart;
+  t = chVTTimeElapsedSinceX(t);
+
+  chprintf(chp, " cpu name\r\n");
+  for (i = 0; i < n; i++) {
+    tp = thd[i];
+    chprintf(chp, " %3lu%% %-10s%s\r\n",
+      (uint32_t)(((tp->p_time - start[i]) * 100UL) / t), tp->p_name,
+      tp->p_state == CH_STATE_FINAL ? " (exited)" : "");
+    chThdRelease(tp);
+  }
+
+  busy = 0;
+  if (idletime < t)
+    busy = t - idletime;
+
+  chprintf(chp, "busy %lu%% over %lu ms\r\n", (busy * 100UL) / t,
+    (uint32_t)ST2MS(t));
+}
+
+orchard_command("cpu", cmd_cpu);
+
+#endif /* CH_DBG_THREADS_PROFILING */
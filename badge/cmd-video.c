@@ -0,0 +1,97 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006-2013 Giovanni Di Sirio
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "ch.h"
+#include "shell.h"
+#include "chprintf.h"
+
+#include "orchard-shell.h"
+
+#include "video_lld.h"
+
+static const char * const codecs[VID_CODECS] = {
+	"raw 16bpp",
+	"delta 16bpp",
+	"palette 8bpp"
+};
+
+static void cmd_video(BaseSequentialStream *chp, int argc, char *argv[])
+{
+	VID_STATS * s;
+	VID_CODEC_STATS * c;
+	uint32_t fps;
+	int i;
+
+	(void)argv;
+	if (argc > 0) {
+		chprintf(chp, "Usage: video\r\n");
+		return;
+	}
+
+	s = &videoStats;
+
+	if (s->vs_ticks == 0 || s->vs_frames == 0) {
+		chprintf(chp, "No video played yet\r\n");
+		return;
+	}
+
+	/* Frames per second, times 100 */
+
+	fps = (uint32_t)(((uint64_t)s->vs_frames * 100 *
+	    CH_CFG_ST_FREQUENCY) / s->vs_ticks);
+
+	chprintf(chp, "codec            : %s\r\n", codecs[s->vs_codec]);
+	chprintf(chp, "frames played    : %u (%u fps encoded)\r\n",
+	    s->vs_frames, s->vs_fps);
+	chprintf(chp, "achieved rate    : %u.%02u fps\r\n",
+	    fps / 100, fps % 100);
+	chprintf(chp, "bytes per frame  : %u\r\n",
+	    s->vs_bytes / s->vs_frames);
+	chprintf(chp, "read buffers     : %u\r\n", s->vs_bufs);
+	chprintf(chp, "buffers full     : min %u max %u avg %u.%02u\r\n",
+	    s->vs_occmin, s->vs_occmax,
+	    s->vs_fills ? s->vs_occsum / s->vs_fills : 0,
+	    s->vs_fills ? ((s->vs_occsum * 100) / s->vs_fills) % 100 : 0);
+	chprintf(chp, "draw cycles/frame: %u (%u waiting for DMA)\r\n",
+	    (uint32_t)(s->vs_blitcyc / s->vs_frames),
+	    (uint32_t)(s->vs_dmacyc / s->vs_frames));
+	chprintf(chp, "stopped at frame : %u (%u seeks)\r\n",
+	    s->vs_pos, s->vs_seeks);
+	chprintf(chp, "reader waits     : %u (display bound)\r\n",
+	    s->vs_stalls);
+	chprintf(chp, "renderer waits   : %u (SD card bound)\r\n",
+	    s->vs_underruns);
+	chprintf(chp, "chunks dropped   : %u of %u (%u held back)\r\n",
+	    s->vs_dropped, s->vs_chunks, s->vs_held);
+	chprintf(chp, "audio ran dry    : %u times\r\n", s->vs_late);
+	chprintf(chp, "sustained read   : %u bytes/sec\r\n",
+	    (uint32_t)(((uint64_t)s->vs_bytes * CH_CFG_ST_FREQUENCY) /
+	    s->vs_ticks));
+
+	/* Compare against the last video played with each codec */
+
+	chprintf(chp, "\r\nlast run by codec:\r\n");
+	for (i = 0; i < VID_CODECS; i++) {
+		c = &videoCodecStats[i];
+		if (c->vc_fps == 0)
+			continue;
+		chprintf(chp, "%-16s : %u.%02u of %u fps, %u bytes/frame\r\n",
+		    codecs[i], c->vc_fps / 100, c->vc_fps % 100,
+		    c->vc_fpsenc, c->vc_bpf);
+	}
+}
+
+orchard_command("video", cmd_video);
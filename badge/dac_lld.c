@@ -41,19 +41,36 @@
  * is allocated to contain data read from the SD card. On each PIT interrupt,
  * the next sample in the buffer is copied to the DAC data register and the
  * buffer index is incremented. Using the PIT ensures the audio is played at
- * the correct rate without the need for manual delay loops. A thread running
- * at very low priority is responsible for keeping the sample buffer populated.
- * Other threads may cue up audio to play in the background while they perform
- * other tasks.
+ * the correct rate without the need for manual delay loops. A thread is
+ * responsible for keeping a small queue of sample buffers populated. The
+ * interrupt handler moves from one buffer to the next by itself and wakes
+ * the thread each time a buffer is used up, so the thread only runs when
+ * there's a buffer to refill. Other threads may cue up audio to play in the
+ * background while they perform other tasks.
  *
  * Audio samples must be provided in 16-bit words containing raw 12-bit sample
  * data. Samples are generated on a host system using a small program to
  * convert from 16-bit to 12-bit raw values as most audio processing software
  * does not support 12-bit sampling mode.
  *
- * Audio files stored on the SD card have no special header or formatting.
- * The DAC thread will continue to play samples until it reaches the end of
- * a file.
+ * Audio files stored on the SD card originally had no special header or
+ * formatting, and such files are still played as is. Files may also start
+ * with a small header (see dac_lld.h), which allows the samples to be
+ * stored using 4-bit IMA ADPCM instead. This cuts the amount of data read
+ * from the SD card by nearly a factor of four, at the cost of some audio
+ * quality. ADPCM blocks are decoded by the DAC thread as they're loaded
+ * into the playback buffer, so the interrupt handler still only has to
+ * copy one sample at a time. Decoding costs a few dozen cycles per sample,
+ * which is a tiny fraction of the time between PIT1 interrupts. The DAC
+ * thread will continue to play samples until it reaches the end of a file.
+ *
+ * The DAC thread can also play several sounds at once. There are
+ * DAC_VOICES voices: voice 0 plays files cued up with dacPlay(), and the
+ * rest play short sound effects started with dacVoicePlay(), which can be
+ * read from a file, taken from a buffer in RAM, or synthesized from a
+ * table of notes like the ones used for the buzzer. Each voice has its own
+ * volume, and the thread mixes them into the playback buffer one block at
+ * a time, clipping the result to the DAC's range.
  *
  * The current audio sample rate is 9216Hz. This was chosen to work well
  * in conjunction with video playback.
@@ -88,11 +105,111 @@ uint16_t * dacBuf;
 static volatile uint16_t * dacbuf = NULL;
 static volatile int dacpos;
 static volatile int dacmax;
+static volatile uint32_t dacplayed;
 
-static char * fname;
 static thread_t * pThread = NULL;
 static uint8_t play;
-static uint8_t dacloop;
+
+/*
+ * Sources of samples that a voice can play. A DAC_SOURCE is filled in by
+ * the thread asking for a voice to play, and copied by the DAC thread when
+ * it starts the voice.
+ */
+
+#define DAC_SRC_FILE		1	/* Stream a .raw file from the SD card */
+#define DAC_SRC_SAMPLES		2	/* Play a buffer of samples in memory */
+#define DAC_SRC_NOTES		3	/* Synthesize a PWM_NOTE tune */
+
+typedef struct dac_source {
+	uint8_t		ds_type;	/* DAC_SRC_xxx */
+	uint8_t		ds_loop;	/* DAC_PLAY_xxx, for files */
+	const void *	ds_ptr;		/* File name, samples or tune */
+	uint32_t	ds_cnt;		/* Number of samples */
+} DAC_SOURCE;
+
+/*
+ * Voice states. Other threads move a voice to DAC_VOICE_START or
+ * DAC_VOICE_STOP, and the DAC thread moves it to DAC_VOICE_ACTIVE when it
+ * starts playing and back to DAC_VOICE_IDLE when it's done.
+ */
+
+#define DAC_VOICE_IDLE		0
+#define DAC_VOICE_START		1
+#define DAC_VOICE_ACTIVE	2
+#define DAC_VOICE_STOP		3
+
+typedef struct dac_voice {
+	volatile uint8_t dv_state;	/* DAC_VOICE_xxx */
+	volatile uint16_t dv_gain;	/* DAC_GAIN_UNITY is full volume */
+	DAC_SOURCE	dv_src;		/* Requested source */
+	/* The rest belongs to the DAC thread. */
+	DAC_SOURCE	dv_cur;		/* Source being played */
+	uint8_t		dv_open;	/* Voice is playing */
+	int8_t		dv_codec;	/* DAC_CODEC_xxx, for files */
+	FIL *		dv_file;	/* Open file */
+	uint16_t *	dv_buf;		/* Samples loaded from the file */
+	DAC_RESAMPLER *	dv_rs;		/* Rate converter, if the file needs one */
+	uint32_t	dv_pos;		/* File data start, sample or note */
+	uint32_t	dv_phase;	/* Tone phase, 16.16 cycles */
+	uint32_t	dv_step;	/* Tone phase step per sample */
+	uint32_t	dv_left;	/* Samples left in the current note */
+} DAC_VOICE;
+
+/* Sample values */
+
+#define DAC_MIDPOINT		2048	/* Silence */
+#define DAC_MAXSAMPLE		4095
+
+static DAC_VOICE dacvoice[DAC_VOICES];
+static uint8_t dacquality = DAC_RESAMPLE_DEFAULT;
+static semaphore_t dacreq;
+static volatile uint8_t dacabort;
+
+/*
+ * Buffer queue used when playing a file. The DAC_BUFS buffers in dacBuf
+ * are used in turn: dachead is the one being played, and dacqueued more
+ * are loaded and waiting behind it. The dacfree semaphore counts the
+ * buffers that are free to be loaded.
+ */
+
+static semaphore_t dacfree;
+static UINT daccnt[DAC_BUFS];
+static volatile uint8_t dacring;
+static volatile uint8_t dachead;
+static volatile uint8_t dacqueued;
+
+/******************************************************************************
+*
+* dacNext - finish a queued buffer and start the next one
+*
+* This function is called from the PIT interrupt handler when the buffer
+* being played from the queue has been used up. It hands the buffer back
+* to the DAC thread and moves on to the next buffer in the queue, if one
+* has been loaded. If not, the audio runs dry until dacQueue() restarts it.
+*
+* RETURNS: N/A
+*/
+
+static void
+dacNext (void)
+{
+	osalSysLockFromISR ();
+
+	chSemSignalI (&dacfree);
+
+	if (dacqueued != 0) {
+		dacqueued--;
+		if (++dachead == DAC_BUFS)
+			dachead = 0;
+		dacbuf = dacBuf + (dachead * DAC_SAMPLES);
+		dacpos = 0;
+		dacmax = daccnt[dachead];
+	}
+
+	osalSysUnlockFromISR ();
+
+	return;
+}
 
 /******************************************************************************
 *
@@ -104,6 +221,9 @@ static uint8_t dacloop;
 * register.
 *
 * If there are no samples available, tbis function returns with no effect.
+* Otherwise, the count of samples played is bumped as well, so that callers
+* can use it as a clock. When the DAC thread is playing a file, finishing
+* a buffer also moves on to the next one in the queue.
 *
 * RETURNS: N/A
 */
@@ -114,140 +234,993 @@ dacWrite (void)
 	if (dacpos < dacmax) {
 		DAC_WRITE_2(&DAC1, DAC0_DAT0L, dacbuf[dacpos]);
 		dacpos++;
+		dacplayed++;
+		if (dacpos == dacmax && dacring)
+			dacNext ();
 	}
 
 	return;
 }
 
+/*
+ * IMA ADPCM step sizes and step index adjustments. These are the
+ * standard tables, so files can be produced by any IMA ADPCM encoder
+ * that can be made to emit our block layout.
+ */
+
+static const int16_t adpcm_steps[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t adpcm_index[8] = {
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
 /******************************************************************************
 *
-* dacThread - DAC audio player thread
+* dacAdpcmDecode - decode a block of IMA ADPCM samples
 *
-* This function implements the DAC player thread loop. It runs continuously
-* in the background and normally sleeps waiting for a request to play an
-* andio file. When either dacLoopPlay() or dacPlay() is called, it will open
-* the file and contiously load blocks of samples into a playback buffer which
-* is consumed by the dacWrite() function above.
+* This function decodes <cnt> samples from the ADPCM block pointed to by
+* <blk> into 12-bit DAC samples at <p>. The block starts with the decoder
+* state, followed by the sample nibbles. The header is always read before
+* any samples are written, and each input byte is read before the two
+* samples it produces are written, so <p> may overlap the end of the block.
+* Decoding in place like this lets the DAC thread get by with no extra
+* buffer. The block may be at any byte alignment.
 *
-* A double-buffering scheme is used. The sample buffer is divided in half,
-* and an effort is made to have the first half of the buffer playing while
-* the second half is being filled with data from the SD card.
+* RETURNS: N/A
+*/
+
+void
+dacAdpcmDecode (uint8_t * blk, uint16_t * p, int cnt)
+{
+	int32_t pred;
+	int32_t diff;
+	int step;
+	int index;
+	int i;
+	uint8_t b;
+	uint8_t n;
+
+	pred = (int16_t)(blk[0] | (blk[1] << 8));
+	index = blk[2];
+	if (index > 88)
+		index = 88;
+	blk += DAC_ADPCM_HDR;
+
+	b = 0;
+	for (i = 0; i < cnt; i++) {
+		if ((i & 1) == 0) {
+			b = *blk++;
+			n = b & 0xF;
+		} else
+			n = b >> 4;
+
+		step = adpcm_steps[index];
+		diff = step >> 3;
+		if (n & 4)
+			diff += step;
+		if (n & 2)
+			diff += step >> 1;
+		if (n & 1)
+			diff += step >> 2;
+
+		if (n & 8) {
+			pred -= diff;
+			if (pred < -32768)
+				pred = -32768;
+		} else {
+			pred += diff;
+			if (pred > 32767)
+				pred = 32767;
+		}
+
+		index += adpcm_index[n & 7];
+		if (index < 0)
+			index = 0;
+		else if (index > 88)
+			index = 88;
+
+		p[i] = (pred + 32768) >> 4;
+	}
+
+	return;
+}
+
+/******************************************************************************
+*
+* dacFileFormat - check the header of an audio file
+*
+* This function checks whether the file <f> starts with an audio header.
+* If it does, the header is validated and the file is left positioned
+* at the first block of samples. If not, the file is a headerless raw
+* file, and it's rewound to the start. The file's sample rate is
+* returned via <rate>.
+*
+* RETURNS: the DAC_CODEC_xxx value for the file, or -1 if the file has
+* a header we can't play
+*/
+
+int
+dacFileFormat (FIL * f, uint16_t * rate)
+{
+	DAC_HEADER hdr;
+	UINT br;
+
+	*rate = DAC_SAMPLERATE;
+
+	if (f_read (f, &hdr, sizeof(hdr), &br) != FR_OK ||
+	    br != sizeof(hdr) || hdr.dh_magic[0] != DAC_MAGIC0 ||
+	    hdr.dh_magic[1] != DAC_MAGIC1 || hdr.dh_magic[2] != DAC_MAGIC2) {
+		if (f_lseek (f, 0) != FR_OK)
+			return (-1);
+		return (DAC_CODEC_PCM);
+	}
+
+	if (hdr.dh_version != DAC_VERSION ||
+	    hdr.dh_codec > DAC_CODEC_ADPCM ||
+	    (hdr.dh_rate != 0 && hdr.dh_rate < DAC_RATE_MIN))
+		return (-1);
+
+	if (hdr.dh_rate != 0)
+		*rate = hdr.dh_rate;
+
+	return (hdr.dh_codec);
+}
+
+/******************************************************************************
+*
+* dacFileRead - load one buffer's worth of samples from an audio file
+*
+* This function reads up to DAC_SAMPLES samples from the file <f> into
+* the buffer <p>, which must be able to hold DAC_SAMPLES samples. The
+* <codec> argument is the value returned by dacFileFormat(). ADPCM blocks
+* are read into the end of the buffer and decoded in place. The number of
+* samples loaded is returned via <cnt>, and is 0 at the end of the file.
+*
+* RETURNS: FR_OK on success, or a FatFs error code if the read failed
+*/
+
+int
+dacFileRead (FIL * f, int codec, uint16_t * p, UINT * cnt)
+{
+	uint8_t * blk;
+	UINT br;
+	int r;
+
+	if (codec == DAC_CODEC_PCM) {
+		r = f_read (f, p, DAC_BYTES, &br);
+		*cnt = br >> 1;
+		return (r);
+	}
+
+	blk = (uint8_t *)p + DAC_BYTES - DAC_ADPCM_BLOCK;
+	r = f_read (f, blk, DAC_ADPCM_BLOCK, &br);
+
+	if (r != FR_OK || br <= DAC_ADPCM_HDR) {
+		*cnt = 0;
+		return (r);
+	}
+
+	*cnt = (br - DAC_ADPCM_HDR) * 2;
+	dacAdpcmDecode (blk, p, *cnt);
+
+	return (FR_OK);
+}
+
+/*
+ * Cubic interpolation filter for the resampler. Row n holds the weights
+ * given to the four input samples around a point n/DAC_RESAMPLE_PHASES
+ * of the way from the second sample to the third, as 2.14 fixed point
+ * values that add up to 1. These are the Catmull-Rom spline weights, so
+ * the output passes through every input sample.
+ */
+
+static const int16_t dac_cubic[DAC_RESAMPLE_PHASES][4] = {
+	{ 0, 16384, 0, 0 }, { -240, 16345, 287, -8 },
+	{ -450, 16230, 634, -30 }, { -631, 16044, 1036, -65 },
+	{ -784, 15792, 1488, -112 }, { -911, 15478, 1986, -169 },
+	{ -1014, 15106, 2526, -234 }, { -1094, 14681, 3103, -306 },
+	{ -1152, 14208, 3712, -384 }, { -1190, 13691, 4349, -466 },
+	{ -1210, 13134, 5010, -550 }, { -1213, 12542, 5690, -635 },
+	{ -1200, 11920, 6384, -720 }, { -1173, 11272, 7088, -803 },
+	{ -1134, 10602, 7798, -882 }, { -1084, 9915, 8509, -956 },
+	{ -1024, 9216, 9216, -1024 }, { -956, 8509, 9915, -1084 },
+	{ -882, 7798, 10602, -1134 }, { -803, 7088, 11272, -1173 },
+	{ -720, 6384, 11920, -1200 }, { -635, 5690, 12542, -1213 },
+	{ -550, 5010, 13134, -1210 }, { -466, 4349, 13691, -1190 },
+	{ -384, 3712, 14208, -1152 }, { -306, 3103, 14681, -1094 },
+	{ -234, 2526, 15106, -1014 }, { -169, 1986, 15478, -911 },
+	{ -112, 1488, 15792, -784 }, { -65, 1036, 16044, -631 },
+	{ -30, 634, 16230, -450 }, { -8, 287, 16345, -240 }
+};
+
+/******************************************************************************
+*
+* dacResampleQuality - select the sample rate conversion method
+*
+* This function sets the DAC_RESAMPLE_xxx level used for files that are
+* started after it's called. Files already playing keep the level they
+* started with.
 *
 * RETURNS: N/A
 */
 
-static
-THD_FUNCTION(dacThread, arg)
+void
+dacResampleQuality (uint8_t quality)
+{
+	if (quality <= DAC_RESAMPLE_CUBIC)
+		dacquality = quality;
+
+	return;
+}
+
+/******************************************************************************
+*
+* dacResampleInit - set up a resampler
+*
+* This function prepares <rs> to convert samples recorded at <rate> Hz to
+* DAC_SAMPLERATE, using the current resampling level. The filter starts
+* out with silence behind the first input sample. It should also be
+* called again after seeking, to drop the samples left from the old
+* position.
+*
+* RETURNS: N/A
+*/
+
+void
+dacResampleInit (DAC_RESAMPLER * rs, uint16_t rate)
+{
+	int i;
+
+	rs->rs_step = ((uint32_t)rate << 16) / DAC_SAMPLERATE;
+	rs->rs_phase = 0;
+	for (i = 0; i < 4; i++)
+		rs->rs_hist[i] = DAC_MIDPOINT;
+
+	/* Load samples until the first one is in rs_hist[1]. */
+
+	rs->rs_need = 3;
+	rs->rs_quality = dacquality;
+	rs->rs_pos = 0;
+	rs->rs_cnt = 0;
+
+	return;
+}
+
+/******************************************************************************
+*
+* dacResample - convert a block of samples to the DAC rate
+*
+* This function takes up to <*inlen> samples from <in> and produces up to
+* <outlen> samples at DAC_SAMPLERATE in <out>, stopping when it runs out
+* of either. The filter state is kept in <rs> from one call to the next,
+* so a stream can be fed in blocks of any size. The number of input
+* samples used is returned via <inlen>.
+*
+* RETURNS: the number of samples written to <out>
+*/
+
+UINT
+dacResample (DAC_RESAMPLER * rs, const uint16_t * in, UINT * inlen,
+    uint16_t * out, UINT outlen)
+{
+	const int16_t * c;
+	uint16_t * h;
+	uint32_t frac;
+	int32_t s;
+	UINT i;
+	UINT n;
+
+	h = rs->rs_hist;
+	i = 0;
+	n = 0;
+
+	while (n < outlen) {
+
+		/* Shift in the input samples we've moved past. */
+
+		while (rs->rs_need != 0) {
+			if (i == *inlen)
+				goto done;
+			h[0] = h[1];
+			h[1] = h[2];
+			h[2] = h[3];
+			h[3] = in[i++];
+			rs->rs_need--;
+		}
+
+		frac = rs->rs_phase;
+
+		switch (rs->rs_quality) {
+		case DAC_RESAMPLE_NEAREST:
+			s = frac < 0x8000 ? h[1] : h[2];
+			break;
+		case DAC_RESAMPLE_LINEAR:
+			s = h[1] + ((((int32_t)h[2] - h[1]) *
+			    (int32_t)frac) >> 16);
+			break;
+		default:
+			c = dac_cubic[frac / (0x10000 / DAC_RESAMPLE_PHASES)];
+			s = ((c[0] * h[0]) + (c[1] * h[1]) + (c[2] * h[2]) +
+			    (c[3] * h[3]) + 8192) >> 14;
+			if (s < 0)
+				s = 0;
+			else if (s > DAC_MAXSAMPLE)
+				s = DAC_MAXSAMPLE;
+			break;
+		}
+
+		out[n++] = s;
+
+		rs->rs_phase += rs->rs_step;
+		rs->rs_need = rs->rs_phase >> 16;
+		rs->rs_phase &= 0xFFFF;
+	}
+
+done:
+	*inlen = i;
+
+	return (n);
+}
+
+/******************************************************************************
+*
+* dacFileResample - load one buffer's worth of samples at the DAC rate
+*
+* This function works like dacFileRead(), except that the samples are
+* converted from the file's sample rate using the resampler <rs>, which
+* must have been set up with dacResampleInit(). Samples are read from
+* the file into the resampler's own buffer a block at a time. If <rs> is
+* NULL, the file is already at DAC_SAMPLERATE and this is the same as
+* dacFileRead().
+*
+* RETURNS: FR_OK on success, or a FatFs error code if the read failed
+*/
+
+int
+dacFileResample (FIL * f, int codec, DAC_RESAMPLER * rs, uint16_t * p,
+    UINT * cnt)
+{
+	UINT in;
+	UINT n;
+	int r;
+
+	if (rs == NULL)
+		return (dacFileRead (f, codec, p, cnt));
+
+	n = 0;
+
+	while (n < DAC_SAMPLES) {
+		if (rs->rs_pos == rs->rs_cnt) {
+			r = dacFileRead (f, codec, rs->rs_in, &in);
+			if (r != FR_OK) {
+				*cnt = 0;
+				return (r);
+			}
+			rs->rs_pos = 0;
+			rs->rs_cnt = in;
+			if (in == 0)
+				break;
+		}
+		in = rs->rs_cnt - rs->rs_pos;
+		n += dacResample (rs, rs->rs_in + rs->rs_pos, &in,
+		    p + n, DAC_SAMPLES - n);
+		rs->rs_pos += in;
+	}
+
+	*cnt = n;
+
+	return (FR_OK);
+}
+
+/******************************************************************************
+*
+* dacQueue - queue a loaded buffer for playback
+*
+* This function adds buffer <idx>, holding <cnt> samples, to the end of the
+* playback queue. Buffers must be queued in turn. If the interrupt handler
+* has run out of samples, either because playback is just starting or
+* because the SD card couldn't keep up, the buffer starts playing at once.
+*
+* RETURNS: N/A
+*/
+
+static void
+dacQueue (int idx, UINT cnt)
+{
+	osalSysLock ();
+
+	daccnt[idx] = cnt;
+
+	if (dacpos == dacmax) {
+		dachead = idx;
+		dacbuf = dacBuf + (idx * DAC_SAMPLES);
+		dacpos = 0;
+		dacmax = cnt;
+	} else
+		dacqueued++;
+
+	osalSysUnlock ();
+
+	return;
+}
+
+/* Levels for the mixer */
+
+#define DAC_TONE_LEVEL		512	/* Amplitude of synthesized notes */
+#define DAC_NOTE_MAX		127	/* Highest MIDI note we synthesize */
+
+/*
+ * Square wave phase steps for MIDI notes 120 to 131 (C9 to B9), as 16.16
+ * fractions of a cycle per sample at DAC_SAMPLERATE. Lower octaves are
+ * these shifted right. The note numbers are the same as the ones used
+ * for the PWM buzzer in tpm_lld.c.
+ */
+
+static const uint32_t dac_semitones[12] = {
+	59534, 63074, 66825, 70799, 75009, 79469,
+	84194, 89201, 94505, 100124, 106078, 112386
+};
+
+/******************************************************************************
+*
+* dacMixSample - add one sample to the mix
+*
+* This function adds the sample <s> to the mixed sample <out>, scaled by
+* <gain> (where DAC_GAIN_UNITY is full volume). Both are 12-bit DAC
+* samples centered on DAC_MIDPOINT. The result is clipped to the range
+* of the DAC instead of being allowed to wrap around.
+*
+* RETURNS: the new mixed sample
+*/
+
+static inline uint16_t
+dacMixSample (uint16_t out, int32_t s, uint16_t gain)
+{
+	int32_t m;
+
+	m = out + (((s - DAC_MIDPOINT) * gain) >> 8);
+
+	if (m < 0)
+		m = 0;
+	else if (m > DAC_MAXSAMPLE)
+		m = DAC_MAXSAMPLE;
+
+	return (m);
+}
+
+/******************************************************************************
+*
+* dacVoiceOpen - start playing a voice
+*
+* This function is called by the DAC thread to set up voice <v> to play the
+* source it was given. Streamed files are opened, and effect voices get a
+* buffer to load their samples into. Voice 0 always loads its samples
+* straight into the playback buffer, and uses the file handle <f0> that
+* lives on the DAC thread's stack. Files recorded at some other rate than
+* DAC_SAMPLERATE also get a resampler.
+*
+* RETURNS: 0 if the voice is ready to play, or -1 if it can't be played
+*/
+
+static int
+dacVoiceOpen (DAC_VOICE * v, FIL * f0)
+{
+	DAC_SOURCE * s;
+	uint16_t rate;
+
+	s = &v->dv_cur;
+	v->dv_file = NULL;
+	v->dv_buf = NULL;
+	v->dv_rs = NULL;
+	v->dv_pos = 0;
+	v->dv_phase = 0;
+	v->dv_step = 0;
+	v->dv_left = 0;
+
+	if (s->ds_type != DAC_SRC_FILE)
+		return (0);
+
+	if (v == &dacvoice[0]) {
+		v->dv_file = f0;
+		v->dv_buf = NULL;
+	} else {
+		v->dv_file = chHeapAlloc (NULL, sizeof(FIL) + DAC_BYTES);
+		if (v->dv_file == NULL)
+			return (-1);
+		v->dv_buf = (uint16_t *)(v->dv_file + 1);
+	}
+
+	if (f_open (v->dv_file, (char *)s->ds_ptr, FA_READ) != FR_OK)
+		goto fail;
+
+	v->dv_codec = dacFileFormat (v->dv_file, &rate);
+	if (v->dv_codec == -1) {
+		f_close (v->dv_file);
+		goto fail;
+	}
+
+	if (rate != DAC_SAMPLERATE) {
+		v->dv_rs = chHeapAlloc (NULL, sizeof(DAC_RESAMPLER));
+		if (v->dv_rs == NULL) {
+			f_close (v->dv_file);
+			goto fail;
+		}
+		dacResampleInit (v->dv_rs, rate);
+	}
+
+	v->dv_pos = f_tell (v->dv_file);
+
+	return (0);
+
+fail:
+	if (v->dv_buf != NULL)
+		chHeapFree (v->dv_file);
+	v->dv_file = NULL;
+	v->dv_buf = NULL;
+	return (-1);
+}
+
+/******************************************************************************
+*
+* dacVoiceClose - stop playing a voice
+*
+* This function releases whatever the DAC thread set up for voice <v> and
+* marks it idle again, unless a new request for it arrived while it was
+* playing, in which case that request is left for the DAC thread to pick
+* up next.
+*
+* RETURNS: N/A
+*/
+
+static void
+dacVoiceClose (DAC_VOICE * v)
+{
+	if (v->dv_file != NULL) {
+		f_close (v->dv_file);
+		if (v->dv_buf != NULL)
+			chHeapFree (v->dv_file);
+	}
+
+	if (v->dv_rs != NULL)
+		chHeapFree (v->dv_rs);
+
+	v->dv_file = NULL;
+	v->dv_buf = NULL;
+	v->dv_rs = NULL;
+	v->dv_open = 0;
+
+	osalSysLock ();
+	if (v->dv_state != DAC_VOICE_START)
+		v->dv_state = DAC_VOICE_IDLE;
+	osalSysUnlock ();
+
+	return;
+}
+
+/******************************************************************************
+*
+* dacVoiceFile - load the next block of samples from a streamed file
+*
+* This function reads the next block of samples for voice <v> into <p>,
+* going back to the start of the file when it reaches the end if the voice
+* is looping. The resampler carries on across the jump, so a loop plays
+* through without a click.
+*
+* RETURNS: the number of samples loaded, or 0 at the end of the file
+*/
+
+static UINT
+dacVoiceFile (DAC_VOICE * v, uint16_t * p)
 {
-	FIL f;
 	UINT br;
-	uint16_t * p;
-	userconfig *config;
-	thread_t * th;
-	char * file = NULL;
 
-        (void)arg;
+	if (dacFileResample (v->dv_file, v->dv_codec, v->dv_rs,
+	    p, &br) != FR_OK)
+		return (0);
 
-	chRegSetThreadName ("dac");
-	config = getConfig();
+	if (br == 0 && v->dv_cur.ds_loop == DAC_PLAY_LOOP &&
+	    f_lseek (v->dv_file, v->dv_pos) == FR_OK &&
+	    dacFileResample (v->dv_file, v->dv_codec, v->dv_rs,
+	    p, &br) != FR_OK)
+		br = 0;
 
-	while (1) {
-		if (play == 0) {
-			th = chMsgWait ();
-			file = fname;
-			play = 1;
-			chMsgRelease (th, MSG_OK);
+	return (br);
+}
+
+/******************************************************************************
+*
+* dacVoiceSynth - synthesize the next block of a tune
+*
+* This function plays the PWM_NOTE tune for voice <v> as a square wave,
+* mixing up to DAC_SAMPLES samples of it into <out>. Tunes are interpreted
+* the same way as by the PWM buzzer thread in tpm_lld.c: PWM_NOTE_PAUSE
+* leaves the current tone playing, PWM_NOTE_OFF silences it, and each
+* duration unit is 8 milliseconds.
+*
+* RETURNS: the number of samples mixed, or 0 at the end of the tune
+*/
+
+static UINT
+dacVoiceSynth (DAC_VOICE * v, uint16_t * out)
+{
+	const PWM_NOTE * n;
+	uint16_t gain;
+	UINT i;
+
+	gain = v->dv_gain;
+
+	for (i = 0; i < DAC_SAMPLES; i++) {
+		while (v->dv_left == 0) {
+			n = (const PWM_NOTE *)v->dv_cur.ds_ptr + v->dv_pos;
+			if (n->pwm_duration == PWM_DURATION_END)
+				return (i);
+			if (n->pwm_duration == PWM_DURATION_LOOP) {
+				if (v->dv_pos == 0)
+					return (i);
+				v->dv_pos = 0;
+				continue;
+			}
+			if (n->pwm_note == PWM_NOTE_PAUSE)
+				;
+			else if (n->pwm_note > DAC_NOTE_MAX)
+				v->dv_step = 0;
+			else
+				v->dv_step = dac_semitones[n->pwm_note % 12] >>
+				    (10 - (n->pwm_note / 12));
+			v->dv_left = ((uint32_t)n->pwm_duration * 8 *
+			    DAC_SAMPLERATE) / 1000;
+			v->dv_pos++;
 		}
- 
-		if (config->sound_enabled == 0) {
-			play = 0;
-			file = NULL;
+
+		v->dv_left--;
+		if (v->dv_step == 0)
 			continue;
+		v->dv_phase += v->dv_step;
+		out[i] = dacMixSample (out[i], (v->dv_phase & 0x8000) ?
+		    DAC_MIDPOINT + DAC_TONE_LEVEL :
+		    DAC_MIDPOINT - DAC_TONE_LEVEL, gain);
+	}
+
+	return (i);
+}
+
+/******************************************************************************
+*
+* dacVoiceMix - mix the next block of an effect voice
+*
+* This function mixes up to DAC_SAMPLES samples from voice <v> into <out>,
+* scaled by the voice's gain.
+*
+* RETURNS: the number of samples mixed, or 0 if the voice has finished
+*/
+
+static UINT
+dacVoiceMix (DAC_VOICE * v, uint16_t * out)
+{
+	const uint16_t * p;
+	uint16_t gain;
+	UINT cnt;
+	UINT i;
+
+	switch (v->dv_cur.ds_type) {
+	case DAC_SRC_FILE:
+		p = v->dv_buf;
+		cnt = dacVoiceFile (v, v->dv_buf);
+		break;
+	case DAC_SRC_SAMPLES:
+		p = (const uint16_t *)v->dv_cur.ds_ptr + v->dv_pos;
+		cnt = v->dv_cur.ds_cnt - v->dv_pos;
+		if (cnt > DAC_SAMPLES)
+			cnt = DAC_SAMPLES;
+		v->dv_pos += cnt;
+		break;
+	case DAC_SRC_NOTES:
+		return (dacVoiceSynth (v, out));
+	default:
+		return (0);
+	}
+
+	gain = v->dv_gain;
+	for (i = 0; i < cnt; i++)
+		out[i] = dacMixSample (out[i], p[i], gain);
+
+	return (cnt);
+}
+
+/******************************************************************************
+*
+* dacMix - produce the next buffer of mixed samples
+*
+* This function fills the playback buffer <out> with the next block of
+* samples from every voice that's playing. Voice 0, which is the one used
+* by dacPlay(), is loaded straight into the buffer, so when it plays by
+* itself at full volume there's no mixing to do at all. The effect voices
+* are then added on top of it one at a time. Voices that run out of
+* samples are closed. Mixing happens here, a whole buffer at a time, so
+* the interrupt handler still only copies one sample per PIT1 interrupt,
+* and each extra voice costs about a dozen cycles per sample.
+*
+* RETURNS: the number of samples in the buffer, or 0 if every voice has
+*          finished
+*/
+
+static UINT
+dacMix (uint16_t * out)
+{
+	DAC_VOICE * v;
+	UINT cnt;
+	UINT n;
+	UINT i;
+	int effects;
+
+	effects = 0;
+	for (i = 1; i < DAC_VOICES; i++)
+		effects += dacvoice[i].dv_open;
+
+	v = &dacvoice[0];
+	cnt = 0;
+
+	if (v->dv_open) {
+		cnt = dacVoiceFile (v, out);
+		if (cnt == 0)
+			dacVoiceClose (v);
+		else if (v->dv_gain != DAC_GAIN_UNITY) {
+			for (i = 0; i < cnt; i++)
+				out[i] = dacMixSample (DAC_MIDPOINT,
+				    out[i], v->dv_gain);
 		}
+	}
 
-		/*
-		 * If the video app is running, then it's already using
-		 * the DAC, and we shouldn't try to use it again here
-		 * because can't play from two sources at once.
-		 */
- 	
-		if (dacBuf != NULL) {
-			play = 0;
+	if (effects == 0)
+		return (cnt);
+
+	/* Pad out the buffer with silence for the effects to go on. */
+
+	for (i = cnt; i < DAC_SAMPLES; i++)
+		out[i] = DAC_MIDPOINT;
+
+	for (i = 1; i < DAC_VOICES; i++) {
+		v = &dacvoice[i];
+		if (v->dv_open == 0)
 			continue;
-		}
+		n = dacVoiceMix (v, out);
+		if (n == 0)
+			dacVoiceClose (v);
+		if (n > cnt)
+			cnt = n;
+	}
 
-		if (f_open (&f, file, FA_READ) != FR_OK) {
-			play = 0;
+	return (cnt);
+}
+
+/******************************************************************************
+*
+* dacVoiceUpdate - act on requests to start and stop voices
+*
+* This function is called by the DAC thread before it loads each buffer.
+* Voices that have been asked to stop are closed, and voices that have been
+* asked to play a new source are (re)opened. Requests are made by other
+* threads through dacLoopPlay() and the dacVoice functions, which only
+* update the shared voice state and wake us up.
+*
+* RETURNS: N/A
+*/
+
+static void
+dacVoiceUpdate (FIL * f0)
+{
+	userconfig * config;
+	DAC_VOICE * v;
+	uint8_t state;
+	int i;
+
+	config = getConfig ();
+
+	for (i = 0; i < DAC_VOICES; i++) {
+		v = &dacvoice[i];
+
+		/* Close voices that were stopped or given a new source. */
+
+		state = v->dv_state;
+		if (state == DAC_VOICE_ACTIVE)
 			continue;
+
+		if (v->dv_open || state == DAC_VOICE_STOP)
+			dacVoiceClose (v);
+
+		osalSysLock ();
+		state = v->dv_state;
+		if (state == DAC_VOICE_START) {
+			v->dv_cur = v->dv_src;
+			v->dv_state = DAC_VOICE_ACTIVE;
 		}
+		osalSysUnlock ();
 
-		dacBuf = chHeapAlloc (NULL,
-		    (DAC_SAMPLES * sizeof(uint16_t)) * 2);
+		if (state != DAC_VOICE_START)
+			continue;
 
-		/* Load the first block of samples. */
+		/*
+		 * If sound is turned off, or if the video app or the music
+		 * player is already using the DAC by itself, then we
+		 * can't play anything.
+		 */
 
-		p = dacBuf;
-		if (f_read (&f, p, DAC_BYTES, &br) != FR_OK) {
-			f_close (&f);
-			chHeapFree (dacBuf);
-			dacBuf = NULL;
-			play = 0;
+		if (config->sound_enabled == 0 ||
+		    (dacBuf != NULL && dacring == 0) ||
+		    dacVoiceOpen (v, f0) != 0) {
+			dacVoiceClose (v);
 			continue;
 		}
 
-		pitEnable (&PIT1, 1);
+		v->dv_open = 1;
+	}
 
-		while (1) {
+	return;
+}
 
-			/* Start the samples playing */
+/******************************************************************************
+*
+* dacRingStop - stop playing from the buffer queue
+*
+* This function is called by the DAC thread once nothing is left playing,
+* or when all playback is being stopped by dacPlay(NULL). In the first case
+* it waits for the buffers already queued to finish playing. Then the
+* interrupt handler is stopped and the buffers are freed.
+*
+* RETURNS: N/A
+*/
 
-			dacbuf = p;
-			dacpos = 0;
-			dacmax = br >> 1;
+static void
+dacRingStop (void)
+{
+	int i;
 
-			/* Swap buffers and load the next block of samples */
+	if (dacabort == 0) {
+		for (i = 0; i < DAC_BUFS; i++)
+			chSemWait (&dacfree);
+	}
 
-			if (p == dacBuf)
-				p += DAC_SAMPLES;
-			else
-				p = dacBuf;
+	pitDisable (&PIT1, 1);
 
-			if (f_read (&f, p, DAC_BYTES, &br) != FR_OK)
-				break;
+	osalSysLock ();
+	dacring = 0;
+	dacqueued = 0;
+	dacpos = 0;
+	dacmax = 0;
+	dacbuf = NULL;
+	osalSysUnlock ();
 
-			/*
-			 * Wait until the current block of samples
-			 * finishes playing before playing the next
-			 * block.
-			 */
+	chHeapFree (dacBuf);
+	dacBuf = NULL;
 
-			while (dacpos != dacmax)
-				;
+	return;
+}
+
+/******************************************************************************
+*
+* dacThread - DAC audio player thread
+*
+* This function implements the DAC player thread loop. It runs continuously
+* in the background and normally sleeps waiting for a request to play
+* something. Requests come from dacLoopPlay() and dacPlay(), which play an
+* audio file on voice 0, and from the dacVoice functions, which play sound
+* effects on the other voices. While any voice is playing, the thread
+* mixes blocks of samples from all of them into a queue of playback
+* buffers which are consumed by the dacWrite() function above.
+*
+* There are DAC_BUFS buffers. The thread sleeps on the dacfree semaphore
+* until the interrupt handler finishes with one, then mixes the next block
+* of samples into it and queues it up behind the others. This way the
+* thread uses no CPU time while it waits, and a slow SD card read only
+* causes a gap in the audio if it takes longer than all of the queued
+* buffers take to play.
+*
+* RETURNS: N/A
+*/
 
-			/* If we read 0 bytes, we reached end of file. */
+static
+THD_FUNCTION(dacThread, arg)
+{
+	FIL f;
+	UINT cnt;
+	uint16_t * p;
+	int fill = 0;
+	int stop;
+	int open;
+	int i;
 
-			if (br == 0)
-				break;
+        (void)arg;
 
-			/* If told to stop, exit the loop. */
+	chRegSetThreadName ("dac");
 
-			if (play == 0)
-				break;
-		}
+	while (1) {
 
-		/* We're done, close the file. */
+		/*
+		 * Check for a request to stop everything before looking
+		 * at the voices, since the voices are told to stop first.
+		 */
 
-		dacpos = 0;
-		dacmax = 0;
-		dacbuf = NULL;
-		if (br == 0 && dacloop == DAC_PLAY_ONCE) {
-			file = NULL;
+		stop = dacabort;
+
+		dacVoiceUpdate (&f);
+
+		open = 0;
+		for (i = 0; i < DAC_VOICES; i++)
+			open += dacvoice[i].dv_open;
+
+		if (dacring && (open == 0 || stop))
+			dacRingStop ();
+
+		if (stop)
+			dacabort = 0;
+
+		/*
+		 * Voice 0 counts as playing until its last buffer has
+		 * been played out, not just loaded.
+		 */
+
+		osalSysLock ();
+		if (dacring == 0 && dacvoice[0].dv_state == DAC_VOICE_IDLE)
 			play = 0;
+		osalSysUnlock ();
+
+		if (open == 0) {
+			chSemWait (&dacreq);
+			continue;
 		}
-		chHeapFree (dacBuf);
-		dacBuf = NULL;
-		f_close (&f);
-		pitDisable (&PIT1, 1);
+
+		if (dacring == 0) {
+			dacBuf = chHeapAlloc (NULL, DAC_BYTES * DAC_BUFS);
+			if (dacBuf == NULL) {
+				for (i = 0; i < DAC_VOICES; i++)
+					dacVoiceStop (i);
+				continue;
+			}
+			chSemObjectInit (&dacfree, DAC_BUFS);
+			dacqueued = 0;
+			dacring = 1;
+			fill = 0;
+			pitEnable (&PIT1, 1);
+		}
+
+		/* Wait for a free buffer. */
+
+		chSemWait (&dacfree);
+
+		/* If told to stop everything, don't load it. */
+
+		if (dacabort) {
+			chSemSignal (&dacfree);
+			continue;
+		}
+
+		p = dacBuf + (fill * DAC_SAMPLES);
+		cnt = dacMix (p);
+
+		/*
+		 * If every voice has finished, we don't need the buffer
+		 * after all. Otherwise queue it up.
+		 */
+
+		if (cnt == 0) {
+			chSemSignal (&dacfree);
+			continue;
+		}
+
+		dacQueue (fill, cnt);
+
+		if (++fill == DAC_BUFS)
+			fill = 0;
 	}
 
 	/* NOTREACHED */
@@ -269,6 +1242,8 @@ THD_FUNCTION(dacThread, arg)
 void
 dacStart (DACDriver * dac)
 {
+	int i;
+
 	dac->dac_base = (uint8_t *)DAC_BASE;
 
 	SIM->SCGC6 |= SIM_SCGC6_DAC0;
@@ -278,24 +1253,74 @@ dacStart (DACDriver * dac)
 
 	pit1Start (&PIT1, dacWrite);
 
+	for (i = 0; i < DAC_VOICES; i++)
+		dacvoice[i].dv_gain = DAC_GAIN_UNITY;
+	chSemObjectInit (&dacreq, 0);
+
 	pThread = chThdCreateStatic (waDacThread, sizeof(waDacThread),
 		DAC_THREAD_PRIO, dacThread, NULL);
 
 	return;
 }
 
+/******************************************************************************
+*
+* dacVoiceRequest - ask the DAC thread to play something on a voice
+*
+* This function hands the source <src> to voice <voice> at volume <gain>
+* and wakes up the DAC thread to start it. If <voice> is -1, the first
+* idle effect voice is used. Any source the voice was already playing is
+* replaced.
+*
+* RETURNS: the voice number, or -1 if there was no idle effect voice
+*/
+
+static int
+dacVoiceRequest (int voice, DAC_SOURCE * src, uint16_t gain)
+{
+	int i;
+
+	osalSysLock ();
+
+	if (voice == -1) {
+		for (i = 1; i < DAC_VOICES; i++) {
+			if (dacvoice[i].dv_state == DAC_VOICE_IDLE) {
+				voice = i;
+				break;
+			}
+		}
+	}
+
+	if (voice != -1) {
+		dacvoice[voice].dv_src = *src;
+		dacvoice[voice].dv_gain = gain;
+		dacvoice[voice].dv_state = DAC_VOICE_START;
+		if (voice == 0)
+			play = 1;
+		chSemSignalI (&dacreq);
+		chSchRescheduleS ();
+	}
+
+	osalSysUnlock ();
+
+	return (voice);
+}
+
 /******************************************************************************
 *
 * dacLoopPlay - play an audio file
 *
 * This function cues up an audio file to be played by the background DAC
-* thread. The file name is specified by <file>. If <loop> is DAC_PLAY_ONCE,
-* the sample file is played once and then the player thread will go idle
-* again. If <loop> is DAC_PLAY_LOOP, the same file will be played over and
-* over again.
+* thread on voice 0. The file name is specified by <file>. If <loop> is
+* DAC_PLAY_ONCE, the sample file is played once and then the voice goes
+* idle again. If <loop> is DAC_PLAY_LOOP, the same file will be played over
+* and over again. Any file already playing on voice 0 is stopped first.
+* Sound effects playing on the other voices carry on.
 *
-* Playback of any sample file (including one that is looping) can be halted
-* at any time by calling dacLoopPlay() with <file> set to NULL.
+* Calling dacLoopPlay() with <file> set to NULL halts all playback,
+* including sound effects, and waits until the DAC thread has let go of
+* the DAC. Callers that want to drive the DAC themselves with
+* dacSamplesPlay() must do this first.
 *
 * RETURNS: N/A
 */
@@ -303,10 +1328,28 @@ dacStart (DACDriver * dac)
 void
 dacLoopPlay (char * file, uint8_t loop)
 {
-	play = 0;
-	dacloop = loop;
-	fname = file;
-	chMsgSend (pThread, MSG_OK);
+	DAC_SOURCE src;
+	int i;
+
+	if (pThread == NULL)
+		return;
+
+	if (file == NULL) {
+		for (i = 0; i < DAC_VOICES; i++)
+			dacVoiceStop (i);
+		dacabort = 1;
+		chSemSignal (&dacreq);
+		while (dacabort != 0)
+			chThdSleep (1);
+		return;
+	}
+
+	src.ds_type = DAC_SRC_FILE;
+	src.ds_loop = loop;
+	src.ds_ptr = file;
+	src.ds_cnt = 0;
+
+	(void) dacVoiceRequest (0, &src, dacvoice[0].dv_gain);
 
 	return;
 }
@@ -329,6 +1372,138 @@ dacPlay (char * file)
 	return;
 }
 
+/******************************************************************************
+*
+* dacVoicePlay - play an audio file as a sound effect
+*
+* This function streams the audio file <file> from the SD card on one of
+* the effect voices, mixed in with whatever else is playing, at volume
+* <gain>. DAC_GAIN_UNITY plays it at full volume. The file is played once.
+* Each file effect needs a buffer of DAC_BYTES bytes from the heap while
+* it plays.
+*
+* RETURNS: the voice number, or -1 if all the effect voices are busy
+*/
+
+int
+dacVoicePlay (char * file, uint16_t gain)
+{
+	DAC_SOURCE src;
+
+	src.ds_type = DAC_SRC_FILE;
+	src.ds_loop = DAC_PLAY_ONCE;
+	src.ds_ptr = file;
+	src.ds_cnt = 0;
+
+	return (dacVoiceRequest (-1, &src, gain));
+}
+
+/******************************************************************************
+*
+* dacVoiceSamples - play a buffer of samples as a sound effect
+*
+* This function plays the <cnt> 12-bit samples at <p> once on one of the
+* effect voices, at volume <gain>. The samples are read straight from <p>
+* as they're mixed, so they can live in flash, but the buffer must stay
+* around until the voice is done with it.
+*
+* RETURNS: the voice number, or -1 if all the effect voices are busy
+*/
+
+int
+dacVoiceSamples (const uint16_t * p, uint32_t cnt, uint16_t gain)
+{
+	DAC_SOURCE src;
+
+	src.ds_type = DAC_SRC_SAMPLES;
+	src.ds_loop = DAC_PLAY_ONCE;
+	src.ds_ptr = p;
+	src.ds_cnt = cnt;
+
+	return (dacVoiceRequest (-1, &src, gain));
+}
+
+/******************************************************************************
+*
+* dacVoiceNotes - play a tune as a sound effect
+*
+* This function plays the same kind of PWM_NOTE tune used with
+* pwmThreadPlay() through the DAC instead of the buzzer, synthesized as a
+* square wave on one of the effect voices at volume <gain>. A tune that
+* ends with PWM_DURATION_LOOP plays until it's stopped with dacVoiceStop().
+*
+* RETURNS: the voice number, or -1 if all the effect voices are busy
+*/
+
+int
+dacVoiceNotes (const PWM_NOTE * tune, uint16_t gain)
+{
+	DAC_SOURCE src;
+
+	src.ds_type = DAC_SRC_NOTES;
+	src.ds_loop = DAC_PLAY_ONCE;
+	src.ds_ptr = tune;
+	src.ds_cnt = 0;
+
+	return (dacVoiceRequest (-1, &src, gain));
+}
+
+/******************************************************************************
+*
+* dacVoiceStop - stop a voice
+*
+* This function stops whatever is playing on voice <voice>. Voice 0 is the
+* one used by dacPlay(). The voice stops when the DAC thread next loads a
+* buffer.
+*
+* RETURNS: N/A
+*/
+
+void
+dacVoiceStop (int voice)
+{
+	DAC_VOICE * v;
+
+	if (voice < 0 || voice >= DAC_VOICES)
+		return;
+
+	v = &dacvoice[voice];
+
+	osalSysLock ();
+	if (v->dv_state == DAC_VOICE_START)
+		v->dv_state = DAC_VOICE_IDLE;
+	else if (v->dv_state == DAC_VOICE_ACTIVE)
+		v->dv_state = DAC_VOICE_STOP;
+	chSemSignalI (&dacreq);
+	chSchRescheduleS ();
+	osalSysUnlock ();
+
+	return;
+}
+
+/******************************************************************************
+*
+* dacVoiceGain - change the volume of a voice
+*
+* This function sets the volume of voice <voice> to <gain>, where
+* DAC_GAIN_UNITY is full volume. It can be used, for example, to turn down
+* the music on voice 0 while a sound effect plays. The change takes effect
+* from the next buffer the DAC thread loads.
+*
+* RETURNS: N/A
+*/
+
+void
+dacVoiceGain (int voice, uint16_t gain)
+{
+	if (voice < 0 || voice >= DAC_VOICES)
+		return;
+
+	dacvoice[voice].dv_gain = gain;
+
+	return;
+}
+
 /******************************************************************************
 *
 * dacWait - wait for current audio file to finish playing
@@ -339,7 +1514,8 @@ dacPlay (char * file)
 * the SD card, and since the SD card and screen share the same SPI bus,
 * updating the screen while a sound effect is playing can cause the
 * sound to stutter. This can be mitigated by waiting for the effect to
-* finish playing.
+* finish playing. If sound effects were mixed in over the file, this also
+* waits for them, since they keep the SD card busy too.
 *
 * RETURNS: The number of ticks we had to wait until the playback finished.
 */
@@ -411,3 +1587,22 @@ dacSamplesWait (void)
 
 	return (waits);
 }
+
+/******************************************************************************
+*
+* dacSamplesPlayed - get the number of samples played
+*
+* This function returns a running count of the samples that have actually
+* been written to the DAC. The count only advances while there are samples
+* to play, so it stops when the sample buffer runs dry, and it's never
+* reset (it simply wraps). The video player uses the difference between two
+* readings as its master clock to keep the video in step with the audio.
+*
+* RETURNS: The number of samples played so far.
+*/
+
+uint32_t
+dacSamplesPlayed (void)
+{
+	return (dacplayed);
+}
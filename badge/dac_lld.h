@@ -33,23 +33,126 @@
 #ifndef _DAC_LLD_H_
 #define _DAC_LLD_H_
 
+#include "ff.h"
+#include "tpm_lld.h"
+
 typedef struct dac_driver {
 	uint8_t *	dac_base;
 } DACDriver;
 
-#define DAC_THREAD_PRIO		3
+#define DAC_THREAD_PRIO		(NORMALPRIO + 1)
 
 #define DAC_SAMPLERATE		9216
 #define DAC_SAMPLES		192
 #define DAC_BYTES		(DAC_SAMPLES * 2)
 
+/*
+ * Number of DAC_SAMPLES buffers the DAC thread keeps queued when playing
+ * a file. Each one holds about 21ms of audio, so this is how long the
+ * thread can be held off the SD card before the audio runs dry.
+ */
+
+#define DAC_BUFS		3
+
 #define DAC_PLAY_ONCE		0
 #define DAC_PLAY_LOOP		1
 
+/*
+ * The DAC thread mixes several voices together. Voice 0 plays the files
+ * started with dacPlay() and dacLoopPlay(), and the rest play sound
+ * effects on top of it. Each voice has its own volume, where
+ * DAC_GAIN_UNITY is full volume.
+ */
+
+#define DAC_VOICES		3
+#define DAC_GAIN_UNITY		256
+
+/*
+ * Audio files may start with a header describing how the samples are
+ * stored. Files without one are raw 12-bit samples in 16-bit words, the
+ * same as always. A raw sample never has its high byte set above 0x0F,
+ * so the magic can't be confused with sample data. A sample rate of 0
+ * means DAC_SAMPLERATE. Files recorded at any other rate from
+ * DAC_RATE_MIN up are converted to DAC_SAMPLERATE as they're played
+ * (see below), so they don't have to be resampled on the host first.
+ *
+ * With the IMA ADPCM codec, the samples are stored 4 bits each in blocks
+ * of DAC_SAMPLES samples, so that each block fills one playback buffer.
+ * Each block starts with the decoder state: the 16-bit signed predictor
+ * and the step size index, followed by a pad byte. The sample nibbles
+ * follow, low nibble first. Since every block carries its own
+ * state, blocks can be decoded independently, which makes seeking easy.
+ * The last block in a file may be short.
+ */
+
+#define DAC_MAGIC0		'D'
+#define DAC_MAGIC1		'A'
+#define DAC_MAGIC2		'C'
+#define DAC_VERSION		1
+
+#define DAC_CODEC_PCM		0	/* 12-bit samples in 16-bit words */
+#define DAC_CODEC_ADPCM		1	/* 4-bit IMA ADPCM blocks */
+
+typedef struct dac_header {
+	uint8_t		dh_magic[3];	/* 'D', 'A', 'C' */
+	uint8_t		dh_version;	/* DAC_VERSION */
+	uint8_t		dh_codec;	/* DAC_CODEC_xxx */
+	uint8_t		dh_pad;
+	uint16_t	dh_rate;	/* Sample rate in Hz */
+	uint32_t	dh_samples;	/* Total number of samples */
+} DAC_HEADER;
+
+#define DAC_ADPCM_HDR		4
+#define DAC_ADPCM_BYTES(n)	(DAC_ADPCM_HDR + (((n) + 1) >> 1))
+#define DAC_ADPCM_BLOCK		DAC_ADPCM_BYTES(DAC_SAMPLES)
+
+/* Size of the file data for one playback buffer of samples */
+
+#define DAC_BLOCK_BYTES(codec)	\
+	((codec) == DAC_CODEC_ADPCM ? DAC_ADPCM_BLOCK : DAC_BYTES)
+
 #define KINETIS_DAC_IRQ_VECTOR Vector98
 
 #define dacStop()		dacPlay(NULL)
 
+/*
+ * Sample rate conversion. The resampler steps through the input at
+ * rs_step input samples per output sample, in 16.16 fixed point, and
+ * works out each output sample from the input samples around it:
+ *
+ * DAC_RESAMPLE_NEAREST	takes the closest input sample
+ * DAC_RESAMPLE_LINEAR	interpolates between the two closest samples
+ * DAC_RESAMPLE_CUBIC	runs a 4 tap cubic interpolation filter, with
+ *			coefficients for DAC_RESAMPLE_PHASES positions
+ *			between each pair of input samples
+ *
+ * Each level costs more cycles per sample than the one before it. None
+ * of them filter out frequencies the DAC rate can't represent, so files
+ * recorded at higher rates than DAC_SAMPLERATE should have nothing above
+ * half of DAC_SAMPLERATE in them. For files, dacFileResample() also
+ * keeps the last block it read from the file in the resampler.
+ */
+
+#define DAC_RATE_MIN		1000
+
+#define DAC_RESAMPLE_NEAREST	0
+#define DAC_RESAMPLE_LINEAR	1
+#define DAC_RESAMPLE_CUBIC	2
+#define DAC_RESAMPLE_DEFAULT	DAC_RESAMPLE_LINEAR
+
+#define DAC_RESAMPLE_PHASES	32
+
+typedef struct dac_resampler {
+	uint32_t	rs_step;	/* Input samples per output, 16.16 */
+	uint32_t	rs_phase;	/* Position past rs_hist[1], 0.16 */
+	uint16_t	rs_hist[4];	/* Last four input samples */
+	uint8_t		rs_need;	/* Input samples due before next output */
+	uint8_t		rs_quality;	/* DAC_RESAMPLE_xxx */
+	uint16_t	rs_pos;		/* Next sample to use in rs_in */
+	uint16_t	rs_cnt;		/* Samples loaded into rs_in */
+	uint16_t	rs_in[DAC_SAMPLES];	/* Samples read from a file */
+} DAC_RESAMPLER;
+
 #define DAC_READ_1(drv, addr)					\
         *(volatile uint8_t *)((drv)->dac_base + addr)
 
@@ -78,7 +181,25 @@ extern void dacPlay (char *);
 extern int dacWait (void);
 extern void dacLoopPlay (char *, uint8_t);
 
+extern int dacVoicePlay (char *, uint16_t);
+extern int dacVoiceSamples (const uint16_t *, uint32_t, uint16_t);
+extern int dacVoiceNotes (const PWM_NOTE *, uint16_t);
+extern void dacVoiceStop (int);
+extern void dacVoiceGain (int, uint16_t);
+
+extern void dacResampleQuality (uint8_t);
+extern void dacResampleInit (DAC_RESAMPLER *, uint16_t);
+extern UINT dacResample (DAC_RESAMPLER *, const uint16_t *, UINT *,
+    uint16_t *, UINT);
+
 extern void dacSamplesPlay (uint16_t * p, int cnt);
 extern int dacSamplesWait (void);
+extern uint32_t dacSamplesPlayed (void);
+
+extern void dacAdpcmDecode (uint8_t * blk, uint16_t * p, int cnt);
+extern int dacFileFormat (FIL * f, uint16_t * rate);
+extern int dacFileRead (FIL * f, int codec, uint16_t * p, UINT * cnt);
+extern int dacFileResample (FIL * f, int codec, DAC_RESAMPLER * rs,
+    uint16_t * p, UINT * cnt);
 
 #endif /* _DAC_LLD_H_ */
@@ -0,0 +1,424 @@
+/*-
+ * Copyright (c) 2017
+ *      Bill Paul <wpaul@windriver.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Bill Paul.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Bill Paul AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL Bill Paul OR THE VOICES IN HIS HEAD
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module generates and decodes DTMF (touch tone) signals using only
+ * integer arithmetic. The KW01's Cortex-M0+ has no FPU, so the double
+ * precision sine approximations we used before were all done in software
+ * and cost well over a thousand cycles per sample.
+ *
+ * Tones are made with a pair of 32-bit phase accumulators. The top 8 bits
+ * of each phase select an entry in a 256 entry sine table and the next 8
+ * bits interpolate between it and the next one, which is good to about
+ * 80dB, far better than the DAC's 12 bits. Generating a two tone sample
+ * takes two table lookups, three multiplies and some shifts, roughly 45
+ * cycles on the M0+.
+ *
+ * The decoder runs a Goertzel filter for each of the eight DTMF
+ * frequencies over blocks of DTMF_BLOCK_MS milliseconds of samples. Each
+ * filter step is one multiply, a shift and two adds, so a sample costs
+ * about 110 cycles for all eight filters plus the energy sum. That's
+ * around 2% of the CPU at 9216Hz. A block is taken to hold a digit when
+ * the strongest row and column tones are loud enough, stand out from the
+ * other tones in their group, are within the allowed twist of each other
+ * and carry at least half the block's energy. A digit has to be seen in
+ * two blocks in a row before it's reported, and is reported only once
+ * however long it's held.
+ */
+
+#include "dtmf.h"
+
+/* Smallest tone amplitude we'll accept, out of 128 */
+
+#define DTMF_MIN_LEVEL		2
+
+/*
+ * The filters run on samples cut down to 8 bits. The tones we're
+ * looking for are well above the noise, and with DTMF_RATE_MAX and
+ * DTMF_BLOCK_MS limiting the block size, the filter state and the
+ * products in the filter loop can't overflow 32 bits.
+ */
+
+#define DTMF_SHIFT		4
+
+/* Filter coefficients are 2cos(w) in Q13 */
+
+#define DTMF_COEFF_SHIFT	13
+
+/* Filter state is scaled down by this much to compute tone power */
+
+#define DTMF_POWER_SHIFT	6
+
+const char dtmfDigits[(DTMF_ROWS * DTMF_COLS) + 1] = "123A456B789C*0#D";
+
+const uint16_t dtmfFreqs[DTMF_TONES] = {
+	697, 770, 852, 941,		/* Rows */
+	1209, 1336, 1477, 1633		/* Columns */
+};
+
+/* One cycle of a sine wave in Q15, plus the first entry again at the end */
+
+static const int16_t dtmf_sin[257] = {
+	0, 804, 1608, 2410, 3212, 4011, 4808, 5602,
+	6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+	12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+	18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+	23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+	27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+	30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+	32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+	32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285,
+	32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571,
+	30273, 29956, 29621, 29268, 28898, 28510, 28105, 27683,
+	27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+	23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868,
+	18204, 17530, 16846, 16151, 15446, 14732, 14010, 13279,
+	12539, 11793, 11039, 10278, 9512, 8739, 7962, 7179,
+	6393, 5602, 4808, 4011, 3212, 2410, 1608, 804,
+	0, -804, -1608, -2410, -3212, -4011, -4808, -5602,
+	-6393, -7179, -7962, -8739, -9512, -10278, -11039, -11793,
+	-12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530,
+	-18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+	-23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+	-27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956,
+	-30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+	-32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+	-32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285,
+	-32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571,
+	-30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+	-27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731,
+	-23170, -22594, -22005, -21403, -20787, -20159, -19519, -18868,
+	-18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+	-12539, -11793, -11039, -10278, -9512, -8739, -7962, -7179,
+	-6393, -5602, -4808, -4011, -3212, -2410, -1608, -804,
+	0
+};
+
+/******************************************************************************
+*
+* dtmfSin - look up the sine of a phase
+*
+* The phase is a fraction of a full cycle, with 2^32 being all the way
+* around.
+*
+* RETURNS: the sine in Q15
+*/
+
+int16_t
+dtmfSin (uint32_t phase)
+{
+	const int16_t * p;
+	int32_t frac;
+
+	p = &dtmf_sin[phase >> 24];
+	frac = (phase >> 16) & 0xFF;
+
+	return (p[0] + (((p[1] - p[0]) * frac) >> 8));
+}
+
+/******************************************************************************
+*
+* dtmfToneInit - set up the generator for a pair of tones
+*
+* This function prepares <t> to produce the sum of <freqa> and <freqb> Hz
+* at <rate> samples per second, peaking at <level> either side of the
+* DAC's midpoint. Both oscillators start at zero phase. Pass the same
+* frequency twice for a single tone.
+*
+* RETURNS: N/A
+*/
+
+void
+dtmfToneInit (DTMF_TONE * t, uint16_t freqa, uint16_t freqb,
+    uint32_t rate, uint16_t level)
+{
+	if (level > DTMF_LEVEL_MAX)
+		level = DTMF_LEVEL_MAX;
+
+	t->dt_phase[0] = 0;
+	t->dt_phase[1] = 0;
+	t->dt_step[0] = ((uint64_t)freqa << 32) / rate;
+	t->dt_step[1] = ((uint64_t)freqb << 32) / rate;
+	t->dt_level = level;
+
+	return;
+}
+
+/******************************************************************************
+*
+* dtmfToneGen - generate samples from a pair of tones
+*
+* This function writes the next <cnt> 12-bit samples from the generator
+* <t> into <buf>. The phases carry over from one call to the next, so a
+* long tone can be produced a buffer at a time without any clicks.
+*
+* RETURNS: N/A
+*/
+
+void
+dtmfToneGen (DTMF_TONE * t, uint16_t * buf, uint32_t cnt)
+{
+	uint32_t pa;
+	uint32_t pb;
+	int32_t s;
+
+	pa = t->dt_phase[0];
+	pb = t->dt_phase[1];
+
+	while (cnt--) {
+		s = dtmfSin (pa) + dtmfSin (pb);
+		*buf++ = DTMF_MIDPOINT + ((s * t->dt_level) >> 16);
+		pa += t->dt_step[0];
+		pb += t->dt_step[1];
+	}
+
+	t->dt_phase[0] = pa;
+	t->dt_phase[1] = pb;
+
+	return;
+}
+
+/******************************************************************************
+*
+* dtmfDigitTone - set up the generator for a DTMF digit
+*
+* RETURNS: 0 on success, or -1 if <digit> isn't one of dtmfDigits
+*/
+
+int
+dtmfDigitTone (DTMF_TONE * t, char digit, uint32_t rate, uint16_t level)
+{
+	int i;
+
+	for (i = 0; dtmfDigits[i] != '\0'; i++) {
+		if (dtmfDigits[i] == digit)
+			break;
+	}
+
+	if (dtmfDigits[i] == '\0')
+		return (-1);
+
+	dtmfToneInit (t, dtmfFreqs[i / DTMF_COLS],
+	    dtmfFreqs[DTMF_ROWS + (i % DTMF_COLS)], rate, level);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* dtmfDetectInit - set up the decoder
+*
+* This function prepares <d> to decode samples taken at <rate> Hz,
+* which must be between DTMF_RATE_MIN and DTMF_RATE_MAX.
+*
+* RETURNS: 0 on success, or -1 if the rate is out of range
+*/
+
+int
+dtmfDetectInit (DTMF_DETECT * d, uint32_t rate)
+{
+	uint32_t step;
+	int i;
+
+	if (rate < DTMF_RATE_MIN || rate > DTMF_RATE_MAX)
+		return (-1);
+
+	for (i = 0; i < DTMF_TONES; i++) {
+		step = ((uint64_t)dtmfFreqs[i] << 32) / rate;
+		d->dd_coeff[i] = dtmfSin (step + 0x40000000) >>
+		    (14 - DTMF_COEFF_SHIFT);
+		d->dd_s1[i] = 0;
+		d->dd_s2[i] = 0;
+	}
+
+	d->dd_energy = 0;
+	d->dd_block = (rate * DTMF_BLOCK_MS) / 1000;
+	d->dd_cnt = 0;
+	d->dd_last = '\0';
+	d->dd_digit = '\0';
+
+	return (0);
+}
+
+/*
+ * Find the strongest of <cnt> tone powers and check that it stands out
+ * from the others by at least 6dB.
+ *
+ * RETURNS: the index of the strongest tone, or -1 if none stands out
+ */
+
+static int
+dtmfPeak (const uint32_t * pwr, int cnt)
+{
+	int best;
+	int i;
+
+	best = 0;
+	for (i = 1; i < cnt; i++) {
+		if (pwr[i] > pwr[best])
+			best = i;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		if (i != best && pwr[i] * 4 > pwr[best])
+			return (-1);
+	}
+
+	return (best);
+}
+
+/*
+ * Work out which digit, if any, the block just finished holds, and
+ * reset the filters for the next one.
+ */
+
+static char
+dtmfBlock (DTMF_DETECT * d)
+{
+	uint32_t pwr[DTMF_TONES];
+	uint32_t row;
+	uint32_t col;
+	uint32_t n;
+	int32_t t1;
+	int32_t t2;
+	int r;
+	int c;
+	int i;
+
+	for (i = 0; i < DTMF_TONES; i++) {
+		t1 = d->dd_s1[i] >> DTMF_POWER_SHIFT;
+		t2 = d->dd_s2[i] >> DTMF_POWER_SHIFT;
+		pwr[i] = (t1 * t1) + (t2 * t2) -
+		    (((d->dd_coeff[i] * t1) >> DTMF_COEFF_SHIFT) * t2);
+		d->dd_s1[i] = 0;
+		d->dd_s2[i] = 0;
+	}
+
+	r = dtmfPeak (pwr, DTMF_ROWS);
+	c = dtmfPeak (pwr + DTMF_ROWS, DTMF_COLS);
+
+	if (r == -1 || c == -1)
+		return ('\0');
+
+	row = pwr[r];
+	col = pwr[DTMF_ROWS + c];
+
+	/*
+	 * A tone of amplitude A over n samples comes out with a power
+	 * of about (nA)^2 / 16384 here, and adds nA^2 / 2 to the
+	 * energy. Both tones must be loud enough, and between them
+	 * they must make up at least half the energy in the block, or
+	 * it's more likely to be speech or music than a digit.
+	 */
+
+	n = d->dd_block;
+	if (row < ((n * n * DTMF_MIN_LEVEL * DTMF_MIN_LEVEL) >> 14) ||
+	    col < ((n * n * DTMF_MIN_LEVEL * DTMF_MIN_LEVEL) >> 14))
+		return ('\0');
+
+	if (row + col < ((d->dd_energy * n) >> 14))
+		return ('\0');
+
+	/*
+	 * The column tone may be up to 4dB louder than the row tone
+	 * (reverse twist) or 8dB quieter (normal twist).
+	 */
+
+	if (col * 2 > row * 5 || row > col * 6)
+		return ('\0');
+
+	return (dtmfDigits[(r * DTMF_COLS) + c]);
+}
+
+/******************************************************************************
+*
+* dtmfDetect - look for DTMF digits in a buffer of samples
+*
+* This function feeds up to <*cnt> 12-bit samples from <buf>, in the
+* same form the DAC takes, through the decoder <d>. It stops early if a
+* new digit is recognized, and sets <*cnt> to the number of samples it
+* used, so the caller can pick up from there. Samples can be fed in any
+* amounts: the decoder carries partial blocks over from one call to the
+* next.
+*
+* RETURNS: the digit recognized, or '\0' if none was
+*/
+
+char
+dtmfDetect (DTMF_DETECT * d, const uint16_t * buf, uint32_t * cnt)
+{
+	uint32_t i;
+	int32_t x;
+	int32_t s;
+	char digit;
+	int j;
+
+	for (i = 0; i < *cnt; i++) {
+		x = ((int32_t)buf[i] - DTMF_MIDPOINT) >> DTMF_SHIFT;
+		d->dd_energy += x * x;
+
+		for (j = 0; j < DTMF_TONES; j++) {
+			s = x + ((d->dd_coeff[j] * d->dd_s1[j]) >>
+			    DTMF_COEFF_SHIFT) - d->dd_s2[j];
+			d->dd_s2[j] = d->dd_s1[j];
+			d->dd_s1[j] = s;
+		}
+
+		if (++d->dd_cnt < d->dd_block)
+			continue;
+
+		digit = dtmfBlock (d);
+		d->dd_cnt = 0;
+		d->dd_energy = 0;
+
+		/*
+		 * Report a digit once it's been seen in two blocks in
+		 * a row, and forget it once two blocks in a row have
+		 * had nothing, so a single bad block doesn't make us
+		 * report the same key twice.
+		 */
+
+		if (digit == '\0') {
+			if (d->dd_last == '\0')
+				d->dd_digit = '\0';
+		} else if (digit == d->dd_last && digit != d->dd_digit) {
+			d->dd_digit = digit;
+			d->dd_last = digit;
+			*cnt = i + 1;
+			return (digit);
+		}
+
+		d->dd_last = digit;
+	}
+
+	return ('\0');
+}
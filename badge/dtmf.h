@@ -0,0 +1,110 @@
+/*-
+ * Copyright (c) 2017
+ *      Bill Paul <wpaul@windriver.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Bill Paul.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Bill Paul AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL Bill Paul OR THE VOICES IN HIS HEAD
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _DTMF_H_
+#define _DTMF_H_
+
+#include <stdint.h>
+
+/*
+ * DTMF Frequencies
+ *
+ *           Upper Band
+ *           1209 Hz 1336Hz 1477Hz 1633 Hz
+ * Lower Band
+ *   697 Hz       1       2      3      A
+ *   770 Hz       4       5      6      B
+ *   852 Hz       7       8      9      C
+ *   941 Hz       *       0      #      D
+ */
+
+#define DTMF_ROWS		4
+#define DTMF_COLS		4
+#define DTMF_TONES		(DTMF_ROWS + DTMF_COLS)
+
+#define DTMF_MIDPOINT		2048	/* DAC level for silence */
+#define DTMF_LEVEL_MAX		2047	/* Loudest two tone signal */
+
+/*
+ * Sample rates the decoder can work at. The decoder looks at blocks of
+ * DTMF_BLOCK_MS milliseconds of samples whatever the rate, which is
+ * long enough to tell neighboring DTMF tones apart. A digit has to
+ * fill about two blocks, 50ms or so, to be recognized.
+ */
+
+#define DTMF_RATE_MIN		4000
+#define DTMF_RATE_MAX		12000
+#define DTMF_BLOCK_MS		25
+
+/*
+ * Tone generator: two phase accumulators stepping through a sine
+ * table, summed and scaled to <dt_level> either side of the midpoint.
+ */
+
+typedef struct dtmf_tone {
+	uint32_t		dt_phase[2];
+	uint32_t		dt_step[2];
+	uint16_t		dt_level;
+} DTMF_TONE;
+
+/*
+ * Goertzel decoder state, kept from one call to the next so samples
+ * can be fed in whatever sized pieces are handy.
+ */
+
+typedef struct dtmf_detect {
+	int32_t			dd_s1[DTMF_TONES];
+	int32_t			dd_s2[DTMF_TONES];
+	int16_t			dd_coeff[DTMF_TONES];
+	uint32_t		dd_energy;
+	uint16_t		dd_block;
+	uint16_t		dd_cnt;
+	char			dd_last;
+	char			dd_digit;
+} DTMF_DETECT;
+
+extern const char dtmfDigits[(DTMF_ROWS * DTMF_COLS) + 1];
+extern const uint16_t dtmfFreqs[DTMF_TONES];
+
+extern int16_t dtmfSin (uint32_t phase);
+
+extern void dtmfToneInit (DTMF_TONE * t, uint16_t freqa, uint16_t freqb,
+    uint32_t rate, uint16_t level);
+extern void dtmfToneGen (DTMF_TONE * t, uint16_t * buf, uint32_t cnt);
+extern int dtmfDigitTone (DTMF_TONE * t, char digit, uint32_t rate,
+    uint16_t level);
+
+extern int dtmfDetectInit (DTMF_DETECT * d, uint32_t rate);
+extern char dtmfDetect (DTMF_DETECT * d, const uint16_t * buf,
+    uint32_t * cnt);
+
+#endif /* _DTMF_H_ */
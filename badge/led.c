@@ -55,6 +55,7 @@ static void anim_violets(void);
 static void anim_wave(void);
 static void anim_violetwave(void); // sorry, my favorite color is purple sooo...
 static void anim_kraftwerk(void);
+static void anim_audio(void);
 
 static uint8_t ledExitRequest = 0;
 static uint8_t ledsOff = 1;
@@ -80,7 +81,8 @@ const struct FXENTRY fxlist[] = {
   { "Violets", anim_violets},
   { "RGB Bounce", anim_rgb_bounce},
   { "Violet Wave", anim_violetwave },
-  { "Kraftwerk", anim_kraftwerk }
+  { "Kraftwerk", anim_kraftwerk },
+  { "Audio", anim_audio }
 };
 
 // stock colors
@@ -835,6 +837,68 @@ static void anim_all_same(void) {
   }
 }
 
+/*
+ * Audio levels for anim_audio(), published by whatever is playing
+ * (currently the music player's spectrum analyzer) through
+ * ledAudioLevels(). There's only one writer, so instead of a lock we
+ * use a sequence count: it's odd while an update is in progress, and
+ * a reader that sees it odd or changed under it just keeps what it
+ * had. The LED thread runs at a higher priority than the player, so
+ * it must never wait for the writer to finish.
+ */
+static struct {
+  volatile uint32_t seq;
+  systime_t stamp;
+  uint8_t level[LEDS_COUNT];
+} led_audio;
+
+void ledAudioLevels(const uint8_t *level) {
+  led_audio.seq++;
+  __DMB();
+  memcpy(led_audio.level, level, sizeof(led_audio.level));
+  led_audio.stamp = chVTGetSystemTimeX();
+  __DMB();
+  led_audio.seq++;
+}
+
+static bool ledAudioSnapshot(uint8_t *level, systime_t *stamp) {
+  uint32_t seq;
+
+  seq = led_audio.seq;
+  if (seq == 0 || (seq & 1))
+    return false;
+  __DMB();
+  memcpy(level, led_audio.level, sizeof(led_audio.level));
+  *stamp = led_audio.stamp;
+  __DMB();
+
+  return (led_audio.seq == seq);
+}
+
+static void anim_audio(void) {
+  static uint8_t level[LEDS_COUNT];
+  static systime_t stamp;
+  uint8_t color[3];
+  uint8_t v;
+  int i;
+
+  // a torn read keeps the last levels; old ones mean nothing is playing
+  ledAudioSnapshot(level, &stamp);
+  if (led_audio.seq == 0 ||
+      chVTTimeElapsedSinceX(stamp) > MS2ST(LED_AUDIO_IDLE_MS)) {
+    anim_violetwave();
+    return;
+  }
+
+  // bass is red on the first LED, treble violet on the last, and
+  // loud bands wash out towards white
+  for (i = 0; i < led_config.max_pixels; i++) {
+    v = (level[i] * level[i]) >> 8; // squared, so quiet bands stay dark
+    HSVtoRGB((i * 300) / LEDS_COUNT, 255 - (v >> 2), v, color);
+    ledSetRGB(led_config.fb, i, color[0], color[1], color[2]);
+  }
+}
+
 static THD_WORKING_AREA(waEffectsThread, 256);
 static THD_FUNCTION(effects_thread, arg) {
   (void)arg;
@@ -9,7 +9,7 @@
 
 /* starting from 1, not 0!  */
 #define LED_PATTERNS_LIMITED 12 // most but not all patterns
-#define LED_PATTERNS_FULL    17 // all if unlocked.
+#define LED_PATTERNS_FULL    18 // all if unlocked.
 
 #define sign(x) (( x > 0 ) - ( x < 0 ))
 
@@ -59,6 +59,10 @@ void leds_show_unlocks(void);
 
 void ledSetHP(userconfig *c, peer *p);
 
+/* audio levels for the "Audio" pattern, one per LED, 0-255 */
+#define LED_AUDIO_IDLE_MS 250 // older than this and the pattern idles
+void ledAudioLevels(const uint8_t *level);
+
 const char *effectsCurName(void);
 
 #define EFFECTS_REDRAW_MS 35
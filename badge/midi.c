@@ -0,0 +1,467 @@
+/*-
+ * Copyright (c) 2017
+ *      Bill Paul <wpaul@windriver.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Bill Paul.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Bill Paul AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL Bill Paul OR THE VOICES IN HIS HEAD
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module reads Standard MIDI Files from the SD card a few bytes at a
+ * time, so that tunes can be played on the buzzer without first being
+ * converted into PWM_NOTE tables and compiled into the firmware.
+ *
+ * The buzzer can only play one note at a time, so we only follow one
+ * track: the first one with any notes in it. Format 1 files usually keep
+ * the tempo changes in a track of their own, the first one, so for those
+ * we also follow that track and merge its events with the notes by time.
+ * Each track we follow gets its own file handle and a MIDI_BUFSZ byte
+ * buffer, which is all the memory we need no matter how long the song is.
+ *
+ * Event times are worked out from the time of the last tempo change
+ * rather than by adding up the time between events, so rounding errors
+ * don't build up over the course of a song.
+ */
+
+#include "ch.h"
+#include "hal.h"
+
+#include "ff.h"
+
+#include "midi.h"
+
+#include <string.h>
+
+static uint32_t
+midiGet32 (const uint8_t * p)
+{
+	return (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	    ((uint32_t)p[2] << 8) | p[3]);
+}
+
+/******************************************************************************
+*
+* midiByte - read the next byte of a track
+*
+* RETURNS: the byte, or -1 at the end of the track or on a read error
+*/
+
+static int
+midiByte (MIDI_TRACK * t)
+{
+	UINT n;
+	UINT br;
+
+	if (t->mt_pos == t->mt_len) {
+		n = MIDI_BUFSZ;
+		if (n > t->mt_left)
+			n = t->mt_left;
+		if (n == 0 || f_read (&t->mt_f, t->mt_buf, n, &br) != FR_OK ||
+		    br == 0) {
+			t->mt_left = 0;
+			return (-1);
+		}
+		t->mt_left -= br;
+		t->mt_len = br;
+		t->mt_pos = 0;
+	}
+
+	return (t->mt_buf[t->mt_pos++]);
+}
+
+/*
+ * Read a variable length quantity: up to four bytes, seven bits
+ * at a time, most significant first.
+ */
+
+static int32_t
+midiVarLen (MIDI_TRACK * t)
+{
+	int32_t v;
+	int c;
+	int i;
+
+	v = 0;
+	for (i = 0; i < 4; i++) {
+		c = midiByte (t);
+		if (c == -1)
+			return (-1);
+		v = (v << 7) | (c & 0x7F);
+		if ((c & 0x80) == 0)
+			return (v);
+	}
+
+	return (-1);
+}
+
+/*
+ * Skip over <len> bytes of a track. Anything past what's in the buffer
+ * is skipped with a seek, so long text or sysex events don't have to be
+ * read in.
+ */
+
+static int
+midiSkip (MIDI_TRACK * t, uint32_t len)
+{
+	uint32_t n;
+
+	n = t->mt_len - t->mt_pos;
+	if (n > len)
+		n = len;
+	t->mt_pos += n;
+	len -= n;
+
+	if (len == 0)
+		return (0);
+
+	if (len > t->mt_left ||
+	    f_lseek (&t->mt_f, f_tell (&t->mt_f) + len) != FR_OK) {
+		t->mt_left = 0;
+		return (-1);
+	}
+
+	t->mt_left -= len;
+
+	return (0);
+}
+
+static int
+midiTrackStart (MIDI_TRACK * t, FSIZE_t off, uint32_t len)
+{
+	if (f_lseek (&t->mt_f, off) != FR_OK)
+		return (-1);
+
+	t->mt_left = len;
+	t->mt_tick = 0;
+	t->mt_pos = 0;
+	t->mt_len = 0;
+	t->mt_status = 0;
+	t->mt_pending = 0;
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* midiTrackEvent - find the next event we care about in a track
+*
+* This function reads through track <t> until it finds a note on, note
+* off or tempo change, and leaves it in the track's mt_event, with its
+* time in ticks in mt_tick. Everything else is skipped, though it still
+* counts towards the time.
+*
+* RETURNS: 0 if an event was found, or -1 at the end of the track
+*/
+
+static int
+midiTrackEvent (MIDI_TRACK * t)
+{
+	MIDI_EVENT * ev;
+	int32_t delta;
+	int32_t len;
+	int status;
+	int type;
+	int d0;
+	int d1;
+
+	ev = &t->mt_event;
+	t->mt_pending = 0;
+
+	while (1) {
+		delta = midiVarLen (t);
+		if (delta == -1)
+			return (-1);
+		t->mt_tick += delta;
+
+		status = midiByte (t);
+		if (status == -1)
+			return (-1);
+
+		/*
+		 * Channel messages. A data byte where the status should be
+		 * means the status is the same as the last message's.
+		 */
+
+		if (status < 0xF0) {
+			if (status < 0x80) {
+				if (t->mt_status == 0)
+					return (-1);
+				d0 = status;
+				status = t->mt_status;
+			} else {
+				t->mt_status = status;
+				d0 = midiByte (t);
+			}
+
+			type = status & 0xF0;
+			d1 = 0;
+			if (type != 0xC0 && type != 0xD0)
+				d1 = midiByte (t);
+			if (d0 == -1 || d1 == -1)
+				return (-1);
+
+			/* A note on with no velocity is a note off. */
+
+			if (type == 0x90 && d1 != 0)
+				ev->me_type = MIDI_EV_NOTE_ON;
+			else if (type == 0x80 || type == 0x90)
+				ev->me_type = MIDI_EV_NOTE_OFF;
+			else
+				continue;
+
+			ev->me_chan = status & 0x0F;
+			ev->me_note = d0;
+			ev->me_vel = d1;
+			t->mt_pending = 1;
+			return (0);
+		}
+
+		/* Sysex and meta events cancel running status. */
+
+		t->mt_status = 0;
+
+		if (status == 0xF0 || status == 0xF7) {
+			len = midiVarLen (t);
+			if (len == -1 || midiSkip (t, len) == -1)
+				return (-1);
+			continue;
+		}
+
+		if (status != 0xFF)
+			return (-1);
+
+		type = midiByte (t);
+		len = midiVarLen (t);
+		if (type == -1 || len == -1 || type == 0x2F)
+			return (-1);
+
+		if (type == 0x51 && len == 3) {
+			d0 = midiByte (t);
+			d1 = midiByte (t);
+			len = midiByte (t);
+			if (d0 == -1 || d1 == -1 || len == -1)
+				return (-1);
+			ev->me_type = MIDI_EV_TEMPO;
+			ev->me_tempo = (d0 << 16) | (d1 << 8) | len;
+			t->mt_pending = 1;
+			return (0);
+		}
+
+		if (midiSkip (t, len) == -1)
+			return (-1);
+	}
+
+	/* NOTREACHED */
+	return (-1);
+}
+
+/******************************************************************************
+*
+* midiOpen - open a MIDI file for playing
+*
+* This function opens the Standard MIDI File <fname>, picks the tracks to
+* follow and reads up to the first event of each, so that midiNext() can
+* be called to get the notes in order.
+*
+* RETURNS: 0 on success, or -1 if the file can't be opened, isn't a MIDI
+*          file or has no notes in it
+*/
+
+int
+midiOpen (MIDI_FILE * m, const char * fname)
+{
+	MIDI_TRACK * t;
+	uint8_t hdr[14];
+	FSIZE_t tempo;
+	FSIZE_t notes;
+	FSIZE_t pos;
+	uint32_t tempolen;
+	uint32_t noteslen;
+	uint32_t len;
+	uint16_t format;
+	uint16_t div;
+	UINT br;
+	int i;
+
+	memset (m, 0, sizeof(MIDI_FILE));
+	t = &m->mf_track[0];
+
+	if (f_open (&t->mt_f, fname, FA_READ) != FR_OK)
+		return (-1);
+
+	m->mf_tracks = 1;
+
+	if (f_read (&t->mt_f, hdr, sizeof(hdr), &br) != FR_OK ||
+	    br != sizeof(hdr) || memcmp (hdr, "MThd", 4) != 0 ||
+	    midiGet32 (hdr + 4) < 6)
+		goto fail;
+
+	format = (hdr[8] << 8) | hdr[9];
+	div = (hdr[12] << 8) | hdr[13];
+
+	/*
+	 * The division is either ticks per beat or, if the top bit is
+	 * set, SMPTE frames per second and ticks per frame. In the
+	 * second case the ticks are a fixed length of time, so we
+	 * treat it as ticks per "beat" of one second and ignore any
+	 * tempo changes.
+	 */
+
+	m->mf_tempo = MIDI_TEMPO_DEFAULT;
+	if (div & 0x8000) {
+		div = -(int8_t)(div >> 8) * (div & 0xFF);
+		m->mf_tempo = 1000000;
+		m->mf_smpte = 1;
+	}
+
+	if (div == 0)
+		goto fail;
+
+	m->mf_division = div;
+
+	/*
+	 * Walk the chunks looking for the first track with notes in it,
+	 * remembering the first track in case it's a tempo map. Chunks
+	 * that aren't tracks are skipped, as the standard says to.
+	 */
+
+	pos = 8 + midiGet32 (hdr + 4);
+	tempo = notes = 0;
+	tempolen = noteslen = 0;
+
+	while (notes == 0 && pos + 8 <= f_size (&t->mt_f)) {
+		if (f_lseek (&t->mt_f, pos) != FR_OK ||
+		    f_read (&t->mt_f, hdr, 8, &br) != FR_OK || br != 8)
+			goto fail;
+
+		len = midiGet32 (hdr + 4);
+		pos += 8;
+
+		if (memcmp (hdr, "MTrk", 4) == 0) {
+			if (format == 1 && tempo == 0) {
+				tempo = pos;
+				tempolen = len;
+			}
+			if (midiTrackStart (t, pos, len) != 0)
+				goto fail;
+			while (midiTrackEvent (t) == 0) {
+				if (t->mt_event.me_type == MIDI_EV_NOTE_ON) {
+					notes = pos;
+					noteslen = len;
+					break;
+				}
+			}
+		}
+
+		pos += len;
+	}
+
+	if (notes == 0 || midiTrackStart (t, notes, noteslen) != 0)
+		goto fail;
+
+	if (tempo != 0 && tempo != notes) {
+		t = &m->mf_track[1];
+		if (f_open (&t->mt_f, fname, FA_READ) != FR_OK)
+			goto fail;
+		m->mf_tracks = 2;
+		if (midiTrackStart (t, tempo, tempolen) != 0)
+			goto fail;
+	}
+
+	for (i = 0; i < m->mf_tracks; i++)
+		midiTrackEvent (&m->mf_track[i]);
+
+	return (0);
+
+fail:
+	midiClose (m);
+	return (-1);
+}
+
+/******************************************************************************
+*
+* midiNext - get the next note from a MIDI file
+*
+* This function returns the next note on or note off event in the file
+* opened with midiOpen() in <ev>, with the time it's due in microseconds
+* from the start of the song. Tempo changes are dealt with along the way.
+*
+* RETURNS: 0 if a note was found, or -1 at the end of the song
+*/
+
+int
+midiNext (MIDI_FILE * m, MIDI_EVENT * ev)
+{
+	MIDI_TRACK * t;
+	uint32_t tick;
+
+	while (1) {
+		/*
+		 * Take whichever track's event comes first. The tempo
+		 * track wins ties, so a tempo change applies to notes
+		 * at the same time.
+		 */
+
+		t = &m->mf_track[0];
+		if (t->mt_pending == 0)
+			return (-1);
+		if (m->mf_tracks > 1 && m->mf_track[1].mt_pending &&
+		    m->mf_track[1].mt_tick <= t->mt_tick)
+			t = &m->mf_track[1];
+
+		tick = t->mt_tick;
+		*ev = t->mt_event;
+		ev->me_usecs = m->mf_usecs + (((uint64_t)(tick - m->mf_tick) *
+		    m->mf_tempo) / m->mf_division);
+
+		midiTrackEvent (t);
+
+		if (ev->me_type != MIDI_EV_TEMPO)
+			return (0);
+
+		if (m->mf_smpte == 0 && ev->me_tempo != 0) {
+			m->mf_usecs = ev->me_usecs;
+			m->mf_tick = tick;
+			m->mf_tempo = ev->me_tempo;
+		}
+	}
+
+	/* NOTREACHED */
+	return (-1);
+}
+
+void
+midiClose (MIDI_FILE * m)
+{
+	int i;
+
+	for (i = 0; i < m->mf_tracks; i++)
+		f_close (&m->mf_track[i].mt_f);
+	m->mf_tracks = 0;
+
+	return;
+}
@@ -0,0 +1,94 @@
+/*-
+ * Copyright (c) 2017
+ *      Bill Paul <wpaul@windriver.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Bill Paul.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Bill Paul AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL Bill Paul OR THE VOICES IN HIS HEAD
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MIDI_H_
+#define _MIDI_H_
+
+/*
+ * Bytes of each track we read from the file at a time. MIDI data is
+ * dense and slow, so a small buffer costs very few extra reads.
+ */
+
+#define MIDI_BUFSZ		32
+
+/* Tracks we follow at once: the notes, and the tempo map if it's apart */
+
+#define MIDI_TRACKS		2
+
+/* Channel 10 is always percussion, which a tone generator can't play */
+
+#define MIDI_CHAN_DRUMS		9
+
+/* Default tempo, 120 beats per minute, in microseconds per beat */
+
+#define MIDI_TEMPO_DEFAULT	500000
+
+#define MIDI_EV_NOTE_OFF	1
+#define MIDI_EV_NOTE_ON		2
+#define MIDI_EV_TEMPO		3
+
+typedef struct midi_event {
+	uint32_t		me_usecs;	/* From the start of the song */
+	uint8_t			me_type;
+	uint8_t			me_chan;
+	uint8_t			me_note;
+	uint8_t			me_vel;
+	uint32_t		me_tempo;	/* For MIDI_EV_TEMPO */
+} MIDI_EVENT;
+
+typedef struct midi_track {
+	FIL			mt_f;
+	uint32_t		mt_left;	/* Chunk bytes not yet read */
+	uint32_t		mt_tick;	/* Time of the last event */
+	uint8_t			mt_buf[MIDI_BUFSZ];
+	uint8_t			mt_pos;
+	uint8_t			mt_len;
+	uint8_t			mt_status;	/* For running status */
+	uint8_t			mt_pending;	/* mt_event is valid */
+	MIDI_EVENT		mt_event;	/* Next event, for merging */
+} MIDI_TRACK;
+
+typedef struct midi_file {
+	MIDI_TRACK		mf_track[MIDI_TRACKS];
+	uint8_t			mf_tracks;
+	uint8_t			mf_smpte;	/* Ignore tempo changes */
+	uint16_t		mf_division;	/* Ticks per beat */
+	uint32_t		mf_tempo;	/* Microseconds per beat */
+	uint32_t		mf_tick;	/* Tick of the last tempo change */
+	uint32_t		mf_usecs;	/* Time of the last tempo change */
+} MIDI_FILE;
+
+extern int midiOpen (MIDI_FILE * m, const char * fname);
+extern int midiNext (MIDI_FILE * m, MIDI_EVENT * ev);
+extern void midiClose (MIDI_FILE * m);
+
+#endif /* _MIDI_H_ */
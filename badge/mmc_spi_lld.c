@@ -38,8 +38,6 @@
 #include "diskio.h"
 #include "mmc.h"
 
-#define MMC_FORCE_MULTIBLOCK_READ
-
 #ifndef UPDATER
 #include "dma_lld.h"
 #endif
@@ -95,6 +93,15 @@ BYTE Timer1, Timer2;	/* 100Hz decrement timer */
 static __attribute__((section(".fsbss")))
 BYTE CardType;			/* Card type flags (b0:MMC, b1:SDv1, b2:SDv2, b3:Block addressing) */
 
+static __attribute__((section(".fsbss")))
+BYTE Streaming;			/* A multiple block read is still open */
+
+static __attribute__((section(".fsbss")))
+DWORD StreamNext;		/* Sector the open read will deliver next (LBA) */
+
+__attribute__((section(".fsbss")))
+MMC_STATS mmcStats;
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -350,6 +357,38 @@ BYTE send_cmd (		/* Returns R1 resp (bit7==1:Send failed) */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Stop an open multiple block read                                      */
+/*-----------------------------------------------------------------------*/
+
+/*
+ * FatFs reads most files one sector at a time through its window, so
+ * a sound or music file turns into a long run of one sector reads for
+ * consecutive sectors. Rather than pay for a command (and the card's
+ * access time) on every one of them, mmc_disk_read() leaves its CMD18
+ * running when it's done and just deselects the card. The card holds
+ * the next block until it's clocked out, so if the next read asks for
+ * the sector that follows, we select the card again and carry on
+ * receiving data blocks. Anything else has to stop the transfer first.
+ * This gets the same effect as reading ahead into a buffer without
+ * giving up any RAM for one.
+ *
+ * Must be called with the bus held.
+ */
+
+static
+void stream_stop (void)
+{
+	if (!Streaming) return;
+
+	Streaming = 0;
+	CS_LOW();
+	send_cmd(CMD12, 0);	/* STOP_TRANSMISSION */
+	deselect();
+}
+
+
+
 /*--------------------------------------------------------------------------
 
    Public Functions
@@ -379,6 +418,7 @@ DSTATUS mmc_disk_initialize (void)
 	for (n = 10; n; n--) xchg_spi(0xFF);	/* 80 dummy clocks */
 
 	ty = 0;
+	Streaming = 0;						/* CMD0 ends any open read */
 	if (send_cmd(CMD0, 0) == 1) {			/* Put the card SPI mode */
 		Timer1 = 100;						/* Initialization timeout of 1000 msec */
 		if (send_cmd(CMD8, 0x1AA) == 1) {	/* Is the card SDv2? */
@@ -441,38 +481,58 @@ DRESULT mmc_disk_read (
 	UINT count			/* Sector count (1..128) */
 )
 {
-	BYTE cmd;
+	DWORD next;
+#ifndef UPDATER
+	systime_t t;
+#endif
 
 
 	if (!count) return RES_PARERR;
 	if (Stat & STA_NOINIT) return RES_NOTRDY;
 
-	if (!(CardType & CT_BLOCK)) sector *= 512;	/* Convert to byte address if needed */
+	next = sector + count;
 
-#ifdef MMC_FORCE_MULTIBLOCK_READ
-	/*
-	 * Always use command 18 (multiple block read). There seem to
-	 * be some SD cards that don't perform quite as well when using
-	 * single the single block read command.
-	 */
-	cmd = CMD18;
-#else
-	cmd = count > 1 ? CMD18 : CMD17;			/*  READ_MULTIPLE_BLOCK : READ_SINGLE_BLOCK */
-#endif
 	spiAcquireBus(&SPID2);
 	SPI1->C1 &= ~SPIx_C1_SPIE;
 	pitEnable (&PIT1, 0);
-	if (send_cmd(cmd, sector) == 0) {
+#ifndef UPDATER
+	t = chVTGetSystemTimeX ();
+#endif
+	mmcStats.ms_reads++;
+
+	if (Streaming && sector == StreamNext) {
+		CS_LOW();			/* Pick up the open read where it left off */
+	} else {
+		stream_stop();
+		if (!(CardType & CT_BLOCK)) sector *= 512;	/* Convert to byte address if needed */
+
+		/*
+		 * Always use command 18 (multiple block read), even for
+		 * one sector. There seem to be some SD cards that don't
+		 * perform quite as well when using the single block read
+		 * command, and it lets the read run on into the next call.
+		 */
+		mmcStats.ms_cmds++;
+		if (send_cmd(CMD18, sector) == 0) Streaming = 1;
+	}
+
+	if (Streaming) {
 		do {
 			if (!rcvr_datablock(buff, 512)) break;
 			buff += 512;
+			mmcStats.ms_sectors++;
 		} while (--count);
-#ifndef MMC_FORCE_MULTIBLOCK_READ
-		if (cmd == CMD18)
-#endif
+		if (count) {
 			send_cmd(CMD12, 0);	/* STOP_TRANSMISSION */
+			Streaming = 0;
+		} else {
+			StreamNext = next;
+		}
 	}
 	deselect();
+#ifndef UPDATER
+	mmcStats.ms_ticks += chVTGetSystemTimeX () - t;
+#endif
 	pitDisable (&PIT1, 0);
 	SPI1->C1 |= SPIx_C1_SPIE;
 	spiReleaseBus(&SPID2);
@@ -502,6 +562,7 @@ DRESULT mmc_disk_write (
 	spiAcquireBus(&SPID2);
 	SPI1->C1 &= ~SPIx_C1_SPIE;
 	pitEnable (&PIT1, 0);
+	stream_stop();
 	if (count == 1) {	/* Single block write */
 		if ((send_cmd(CMD24, sector) == 0)	/* WRITE_BLOCK */
 			&& xmit_datablock(buff, 0xFE))
@@ -552,6 +613,7 @@ DRESULT mmc_disk_ioctl (
 	spiAcquireBus(&SPID2);
 	SPI1->C1 &= ~SPIx_C1_SPIE;
 	pitEnable (&PIT1, 0);
+	stream_stop();
 	res = RES_ERROR;
 	switch (cmd) {
 	case CTRL_SYNC :		/* Make sure that no pending write process. Do not remove this or written sector might not left updated. */
@@ -12,6 +12,7 @@
 #include "led.h"
 #include "dac_lld.h"
 #include "radio_lld.h"
+#include "orchard-radio.h"
 
 #include "shell.h" // for enemy testing function
 #include "orchard-shell.h" // for enemy testing function
@@ -77,9 +78,6 @@ uint8_t shout_ok;
    it, and it will be cleared on reset */
 systime_t char_reset_at = 0;
 
-static KW01_PKT orchard_pkt;
-uint8_t orchard_pkt_busy;
-
 static void run_ping(void *arg) {
   (void)arg;
   chSysLockFromISR();
@@ -171,8 +169,8 @@ static void execute_ping(eventid_t id) {
     upkt.rtc = rtc + clockdelta;
   }
   
-  radioSend (&KRADIO1, RADIO_BROADCAST_ADDRESS,  RADIO_PROTOCOL_PING,
-	     sizeof (upkt), &upkt);
+  radioSendAsync (&KRADIO1, RADIO_BROADCAST_ADDRESS,  RADIO_PROTOCOL_PING,
+		  sizeof (upkt), &upkt, NULL, NULL);
 
 #endif /* LEADERBOARD_AGENT */
   // while we're at it, clean up the enemy list every two pings
@@ -218,15 +216,10 @@ void orchardAppRadioCallback (KW01_PKT * pkt) {
     return;
 
   /*
-   * We buffer the current frame. If another frame arrives before
-   * the app has processed it, then we drop the new frame. We could
-   * expand this to permit buffering of more frames, but for now
-   * this seems sufficient.
+   * Queue the frame for the app thread. If the app has fallen so far
+   * behind that the queue is full, the new frame is dropped.
    */
-  if (orchard_pkt_busy == 0) {
-    memcpy (&orchard_pkt, pkt, sizeof(KW01_PKT));
-    orchard_pkt_busy++;
-  } else
+  if (orchardPktPut (pkt) != 0)
     return;
 
   chEvtBroadcast (&orchard_app_radio);
@@ -236,15 +229,20 @@ void orchardAppRadioCallback (KW01_PKT * pkt) {
 
 static void radio_event(eventid_t id) {
   OrchardAppEvent evt;
+  KW01_PKT * pkt;
 
   (void) id;
 
-  if (instance.context != NULL) {
+  /*
+   * Several frames may have been queued for one event, so hand the
+   * app everything that's waiting.
+   */
+  while (instance.context != NULL && (pkt = orchardPktGet ()) != NULL) {
     evt.type = radioEvent;
-    evt.radio.pPkt = &orchard_pkt;
+    evt.radio.pPkt = pkt;
 
     instance.app->event (instance.context, &evt);
-    orchard_pkt_busy--;
+    orchardPktDone ();
   }
 
   return;
@@ -333,7 +331,7 @@ static void terminate(eventid_t id) {
   evt.app.event = appTerminate;
   instance.app->event(instance.context, &evt);
 
-  orchard_pkt_busy = 0;
+  orchardPktFlush ();
 
   chThdTerminate(instance.thr);
 }
@@ -517,7 +515,7 @@ static THD_FUNCTION(orchard_app_thread, arg) {
   evtTableUnhook(orchard_app_events, orchard_app_radio, radio_event);
   evtTableUnhook(orchard_app_events, orchard_app_key, key_event);
  
-  orchard_pkt_busy = 0;
+  orchardPktFlush ();
 
   /* Atomically broadcasting the event source and terminating the thread,
      there is not a chSysUnlock() because the thread terminates upon return.*/
@@ -0,0 +1,83 @@
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "radio_lld.h"
+#include "orchard-radio.h"
+
+static KW01_PKT orchard_pkts[ORCHARD_PKT_QLEN];
+static uint8_t orchard_pkt_head;
+static uint8_t orchard_pkt_count;
+
+/* Frames the app never saw because the queue was full */
+uint32_t orchard_pkt_drops;
+
+/*
+ * Copy a frame onto the end of the queue. This is called from the
+ * radio's receive thread, and the copy is done with the lock held so a
+ * flush can't leave a half written slot behind.
+ */
+
+int orchardPktPut (KW01_PKT * pkt) {
+  uint8_t slot;
+  uint8_t room;
+
+  chSysLock();
+  room = ORCHARD_PKT_QLEN - orchard_pkt_count;
+  if (room == 0 ||
+      (room == 1 && pkt->kw01_hdr.kw01_prot == RADIO_PROTOCOL_PING)) {
+    orchard_pkt_drops++;
+    chSysUnlock();
+    return (-1);
+  }
+
+  slot = (orchard_pkt_head + orchard_pkt_count) % ORCHARD_PKT_QLEN;
+  memcpy (&orchard_pkts[slot], pkt, sizeof(KW01_PKT));
+  orchard_pkt_count++;
+  chSysUnlock();
+
+  return (0);
+}
+
+/*
+ * The oldest frame, or NULL if there are none. It stays at the head of
+ * the queue until orchardPktDone() is called, so the app can work on it
+ * in place.
+ */
+
+KW01_PKT * orchardPktGet (void) {
+  KW01_PKT * pkt;
+
+  pkt = NULL;
+
+  chSysLock();
+  if (orchard_pkt_count != 0)
+    pkt = &orchard_pkts[orchard_pkt_head];
+  chSysUnlock();
+
+  return (pkt);
+}
+
+void orchardPktDone (void) {
+
+  chSysLock();
+  if (orchard_pkt_count != 0) {
+    orchard_pkt_head = (orchard_pkt_head + 1) % ORCHARD_PKT_QLEN;
+    orchard_pkt_count--;
+  }
+  chSysUnlock();
+
+  return;
+}
+
+/* Throw away whatever the last app didn't get to. */
+
+void orchardPktFlush (void) {
+
+  chSysLock();
+  orchard_pkt_head = 0;
+  orchard_pkt_count = 0;
+  chSysUnlock();
+
+  return;
+}
@@ -0,0 +1,23 @@
+#ifndef __ORCHARD_RADIO_H__
+#define __ORCHARD_RADIO_H__
+
+#include "radio_lld.h"
+
+/*
+ * Radio frames for the running app wait in a queue until the app
+ * thread gets to them. The radio's receive thread can hand over several
+ * back to back, after a slow ping handler or when it unpacks an
+ * aggregate frame, so there's room for as many as the radio itself
+ * queues. As in the radio's queue, pings never take the last free slot.
+ */
+
+#define ORCHARD_PKT_QLEN	KW01_RXQ_LEN
+
+extern uint32_t orchard_pkt_drops;
+
+extern int orchardPktPut (KW01_PKT * pkt);
+extern KW01_PKT * orchardPktGet (void);
+extern void orchardPktDone (void);
+extern void orchardPktFlush (void);
+
+#endif /* __ORCHARD_RADIO_H__ */
@@ -8,28 +8,219 @@
 #include <string.h>
 
 #include "app-fight.h"
-#include "ringbuf.h"
 
-/*  
- * A naive implementation of the Stop and Wait protocol with timeout,
- * ARQ, and a txqueue.
+/*
+ * A small sliding window protocol. Up to PROTO_WINDOW messages can be
+ * waiting for an ACK at once. The receiver acknowledges everything it
+ * has in order with a cumulative ACK, plus a bitmap of the messages
+ * that arrived after a gap, and holds on to those until the gap is
+ * filled, so each message is passed up once and in order. Messages
+ * are resent on a timeout worked out from the measured round trip
+ * time, or as soon as a later message is acknowledged ahead of them.
  */
 
+static void
+protoReset (ProtoHandles *p)
+{
+  int i;
+
+  p->state = PROTO_STATE_IDLE;
+  p->txbase = p->txseq = rand();
+  for (i = 0; i < PROTO_WINDOW; i++)
+    p->txwin[i].state = PROTO_SLOT_FREE;
+  p->srtt = p->rttvar = 0;
+  p->rto = PROTO_RTO_INIT;
+
+  p->rxsynced = 0;
+  p->rxmask = 0;
+
+  return;
+}
+
 void
 protoInit (OrchardAppContext *context)
 {
   ProtoHandles * p;
-  
+
   p = (((FightHandles *)context->priv)->proto);
 
-  p->state = PROTO_STATE_IDLE;
-  p->rxseq = p->txseq = rand();
-  p->interval = PROTO_TICK_US + (rand () & 0xFFFF);
+  protoReset(p);
+  p->last_contact = chVTGetSystemTime();
+  p->sent = p->retransmits = p->duplicates = 0;
 
   p->cb_ack = p->cb_recv = p->cb_timeout = NULL;
 
-  ringInit(&p->txring);
-  
+  return;
+}
+
+/*
+ * Fill in the fields every message carries: where our window starts,
+ * and what we've received.
+ */
+
+static void
+hdrFill (ProtoHandles *p, PACKET *proto)
+{
+  uint16_t seq;
+  int i;
+
+  proto->prot_base = p->txbase;
+  proto->prot_msg &= ~PROTO_ACK;
+  proto->prot_ack = 0;
+  proto->prot_sack = 0;
+
+  if (!p->rxsynced)
+    return;
+
+  proto->prot_msg |= PROTO_ACK;
+  proto->prot_ack = p->rxseq;
+  for (i = 0; i < PROTO_WINDOW - 1; i++) {
+    seq = p->rxseq + 1 + i;
+    if (p->rxmask & (1 << (seq % PROTO_WINDOW)))
+      proto->prot_sack |= 1 << i;
+  }
+
+  return;
+}
+
+static int
+slotSend (ProtoHandles *p, ProtoSlot *s)
+{
+  hdrFill(p, &s->pkt);
+  s->sent = chVTGetSystemTime();
+
+  return radioSendAsync (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
+                         PROTO_HDRLEN + p->mtu, &s->pkt, NULL, NULL);
+}
+
+static void
+ackSend (ProtoHandles *p)
+{
+  PACKET ack;
+
+  ack.prot_seq = p->txseq;
+  ack.prot_msg = 0;
+  hdrFill(p, &ack);
+
+  radioSendAsync (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
+                  PROTO_HDRLEN, &ack, NULL, NULL);
+
+  return;
+}
+
+/*
+ * Take a round trip time sample and work out a new retransmit
+ * timeout. srtt is kept times 8 and rttvar times 4, as in RFC 6298.
+ */
+
+static void
+rttSample (ProtoHandles *p, systime_t rtt)
+{
+  int32_t delta;
+
+  if (rtt == 0)
+    rtt = 1;
+
+  if (p->srtt == 0) {
+    p->srtt = rtt << 3;
+    p->rttvar = rtt << 1;
+  } else {
+    delta = (int32_t)rtt - (int32_t)(p->srtt >> 3);
+    p->srtt += delta;
+    if (delta < 0)
+      delta = -delta;
+    p->rttvar += delta - (int32_t)(p->rttvar >> 2);
+  }
+
+  p->rto = (p->srtt >> 3) + p->rttvar;
+  if (p->rto < PROTO_RTO_MIN)
+    p->rto = PROTO_RTO_MIN;
+  if (p->rto > PROTO_RTO_MAX)
+    p->rto = PROTO_RTO_MAX;
+
+  return;
+}
+
+/*
+ * One of our messages got through: move its slot to <state>, and the
+ * first time, time it if it was only sent once and pass it to the ack
+ * callback in <pkt>.
+ */
+
+static void
+msgAcked (ProtoHandles *p, ProtoSlot *s, uint8_t state, KW01_PKT *pkt)
+{
+  uint8_t old;
+
+  old = s->state;
+  s->state = state;
+
+  if (old != PROTO_SLOT_SENT)
+    return;
+
+  if (!s->resent)
+    rttSample(p, chVTTimeElapsedSinceX(s->sent));
+  memcpy(pkt->kw01_payload, &s->pkt, sizeof(PACKET));
+  pkt->kw01_length = PROTO_HDRLEN + p->mtu;
+#ifdef DEBUG_FIGHT_NETWORK
+  chprintf (stream, "message %d was acknowledged\r\n", s->pkt.prot_seq);
+#endif
+  if (p->cb_ack != NULL)
+    p->cb_ack(pkt);
+
+  return;
+}
+
+static void
+ackHandle (ProtoHandles *p, uint16_t ack, uint8_t sack, KW01_PKT *pkt)
+{
+  ProtoSlot * s;
+  uint16_t seq;
+  int i;
+
+  /* Ignore an ACK for something we haven't sent. */
+
+  if ((uint16_t)(ack - p->txbase) > (uint16_t)(p->txseq - p->txbase))
+    return;
+
+  /*
+   * Everything before <ack> has arrived. Each slot is freed before
+   * its callback runs, so the callback can send the next message.
+   */
+
+  while (p->txbase != ack) {
+    s = &p->txwin[p->txbase % PROTO_WINDOW];
+    p->txbase++;
+    msgAcked(p, s, PROTO_SLOT_FREE, pkt);
+  }
+
+  /* So have these, after a gap. */
+
+  for (i = 0; i < PROTO_WINDOW - 1; i++) {
+    seq = ack + 1 + i;
+    if (!(sack & (1 << i)) ||
+        (uint16_t)(seq - p->txbase) >= (uint16_t)(p->txseq - p->txbase))
+      continue;
+    msgAcked(p, &p->txwin[seq % PROTO_WINDOW], PROTO_SLOT_SACKED, pkt);
+  }
+
+  /*
+   * Something after <ack> made it, so <ack> itself was probably
+   * lost: send it again now, unless it went out again too recently
+   * to have been acknowledged yet.
+   */
+
+  s = &p->txwin[ack % PROTO_WINDOW];
+  if (sack != 0 && ack != p->txseq && s->state == PROTO_SLOT_SENT &&
+      p->srtt != 0 && chVTTimeElapsedSinceX(s->sent) >= (p->srtt >> 3)) {
+    s->resent = 1;
+    p->retransmits++;
+    slotSend(p, s);
+  }
+
+  if (p->state == PROTO_STATE_WAITACK && p->txbase == p->txseq)
+    p->state = PROTO_STATE_CONNECTED;
+
   return;
 }
 
@@ -37,45 +228,50 @@ void
 tickHandle (OrchardAppContext *context)
 {
   ProtoHandles * p;
-  p = (((FightHandles *)context->priv)->proto);
+  ProtoSlot * s;
+  uint16_t seq;
+  int resent;
 
-  // reset the interval
+  p = (((FightHandles *)context->priv)->proto);
 
-  if (p->interval > 0) {
-    // no work to do yet
-    // regardless of frame rate, we will work this out.
-    p->interval = p->interval - ST2US(chVTGetSystemTime() - p->last_tick_time);
-    p->last_tick_time = chVTGetSystemTime();
-    return;
-  }
-  
-  p->interval = PROTO_TICK_US + (rand () & 0xFFFF);
-  
-  if (p->state != PROTO_STATE_IDLE) {
-    p->intervals_since_last_contact++;
-    if (p->intervals_since_last_contact > 10) {
+  if (p->state != PROTO_STATE_IDLE &&
+      chVTTimeElapsedSinceX(p->last_contact) > PROTO_TIMEOUT) {
 #ifdef DEBUG_FIGHT_NETWORK
-      chprintf (stream, "request timed out!!\r\n");
+    chprintf (stream, "request timed out!!\r\n");
 #endif
-      p->intervals_since_last_contact = 0;
-      p->state = PROTO_STATE_IDLE;
-      p->rxseq = p->txseq = rand();
-    }
+    protoReset(p);
+    return;
   }
-  
+
+  if (p->state != PROTO_STATE_WAITACK)
+    return;
+
   /*
-   * Keep retransmitting until our packet is
-   * acknowleged or we time out.
+   * Resend whatever has waited too long for an ACK, and back off
+   * the timeout.
    */
-  if (p->state == PROTO_STATE_WAITACK) {
-    ringGetItem(&p->txring, false, &p->wpkt);
+
+  resent = 0;
+  for (seq = p->txbase; seq != p->txseq; seq++) {
+    s = &p->txwin[seq % PROTO_WINDOW];
+    if (s->state != PROTO_SLOT_SENT ||
+        chVTTimeElapsedSinceX(s->sent) < p->rto)
+      continue;
 #ifdef DEBUG_FIGHT_NETWORK
-    chprintf (stream, "resend packet %d\r\n", p->wpkt.prot_seq);
+    chprintf (stream, "resend packet %d\r\n", seq);
 #endif
-    radioSend (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
-               sizeof(PACKET), &p->wpkt);
+    s->resent = 1;
+    p->retransmits++;
+    slotSend(p, s);
+    resent = 1;
   }
-  
+
+  if (resent) {
+    p->rto <<= 1;
+    if (p->rto > PROTO_RTO_MAX)
+      p->rto = PROTO_RTO_MAX;
+  }
+
   return;
 }
 
@@ -83,48 +279,60 @@ int
 msgSend (OrchardAppContext *context, void * payload)
 {
   ProtoHandles * p;
-  int8_t res;
+  ProtoSlot * s;
 
-  res = 0;
   p = (((FightHandles *)context->priv)->proto);
 
-  p->state = PROTO_STATE_WAITACK;
-  p->wpkt.prot_msg = PROTO_SYN;
-  p->wpkt.prot_seq = p->txseq;
-
-  memcpy(&p->wpkt.prot_payload, payload, p->mtu);
-  
-  if (ringIsEmpty(&p->txring)) { 
-    /* we're up to date and can immediately send. */
-    res = radioSend (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
-                     sizeof(PACKET), &p->wpkt);
+  if (p->mtu > PROTO_MTU)
+    return (-1);
+
+  if ((uint16_t)(p->txseq - p->txbase) >= PROTO_WINDOW) {
 #ifdef DEBUG_FIGHT_NETWORK
-    chprintf(stream, "Send message to peer %x txseq %d\r\n", p->netid, p->txseq);
+    chprintf(stream, "packet dropped (window full)\r\n");
 #endif
-    p->txseq++; 
-#ifdef DEBUG_FIGHT_NETWORK
-  } else {
-    chprintf(stream, "packet queued (still busy)\r\n");
-  }
-#else
+    return (-1);
   }
+
+  /* Start timing out the peer from now. */
+
+  if (p->state == PROTO_STATE_IDLE)
+    p->last_contact = chVTGetSystemTime();
+
+  s = &p->txwin[p->txseq % PROTO_WINDOW];
+  s->pkt.prot_seq = p->txseq;
+  s->pkt.prot_msg = PROTO_SYN;
+  memcpy(&s->pkt.prot_payload, payload, p->mtu);
+  s->state = PROTO_SLOT_SENT;
+  s->resent = 0;
+
+  p->state = PROTO_STATE_WAITACK;
+  p->txseq++;
+  p->sent++;
+
+#ifdef DEBUG_FIGHT_NETWORK
+  chprintf(stream, "Send message to peer %x txseq %d\r\n", p->netid,
+           s->pkt.prot_seq);
 #endif
-  
-  // always inject to queue.
-  ringPutItem(&p->txring, &p->wpkt);    
 
-  return res;
+  /*
+   * The message is in the window now, so if the radio's queue is
+   * full, it'll just go out when it's resent.
+   */
+
+  slotSend(p, s);
+
+  return (0);
 }
 
 int
 msgReceived (OrchardAppContext *context)
 {
   ProtoHandles * p;
-  
+
   p = (((FightHandles *)context->priv)->proto);
-  if (p->rxseq == p->txseq)
+  if (p->txbase == p->txseq)
     return (0);
-  
+
   return (-1);
 }
 
@@ -133,154 +341,162 @@ void
 rstSend (OrchardAppContext *context)
 {
   ProtoHandles * p;
-  PACKET * proto;
-  
+  PACKET rst;
+
   p = (((FightHandles *)context->priv)->proto);
-  
-  proto = (PACKET *)&p->txring[0];
-  
-  p->state = PROTO_STATE_WAITACK;
-  
-  proto->prot_msg = PROTO_RST;
-  proto->prot_seq = p->txseq;
-  
-  radioSend (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
-             sizeof(PACKET), proto);
-  
-  p->txseq++;
+
+  rst.prot_msg = PROTO_RST;
+  rst.prot_seq = p->txseq;
+  hdrFill(p, &rst);
+
+  radioSendAsync (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
+             PROTO_HDRLEN, &rst, NULL, NULL);
+
+  protoReset(p);
   return;
 }
 #endif
 
+/*
+ * A message arrived. Pass it up if it's the next one, along with any
+ * held ones it makes next in turn; hold on to it if it's early, and
+ * drop it if we've had it before. Either way, acknowledge it, so a
+ * sender whose ACK got lost stops resending.
+ */
+
+static int
+dataHandle (ProtoHandles *p, KW01_PKT *pkt)
+{
+  PACKET * proto;
+  uint16_t seq;
+  int16_t off;
+  uint8_t bit;
+
+  proto = (PACKET *)&pkt->kw01_payload;
+  seq = proto->prot_seq;
+
+  /*
+   * Start from the sender's window if we haven't heard from it yet,
+   * or if the window has moved somewhere it couldn't have got to
+   * without us, which means the peer has started over.
+   */
+
+  off = (int16_t)(proto->prot_base - p->rxseq);
+  if (!p->rxsynced || off > 0 || off < -PROTO_WINDOW) {
+    p->rxseq = proto->prot_base;
+    p->rxmask = 0;
+    p->rxsynced = 1;
+  }
+
+  off = (int16_t)(seq - p->rxseq);
+  bit = 1 << (seq % PROTO_WINDOW);
+
+  if (off < 0 || off >= PROTO_WINDOW || (off > 0 && (p->rxmask & bit))) {
+#ifdef DEBUG_FIGHT_NETWORK
+    chprintf (stream, "message %d was a duplicate\r\n", seq);
+#endif
+    p->duplicates++;
+    ackSend(p);
+    return (-1);
+  }
+
+  if (off > 0) {
+    memcpy(&p->rxwin[seq % PROTO_WINDOW], proto, sizeof(PACKET));
+    p->rxmask |= bit;
+    ackSend(p);
+    return (0);
+  }
+
+#ifdef DEBUG_FIGHT_NETWORK
+  chprintf (stream, "message %d was received\r\n", seq);
+#endif
+
+  /*
+   * Move past this message and the held ones that follow it, and
+   * acknowledge them all before the callbacks run.
+   */
+
+  p->rxseq++;
+  while (p->rxmask & (1 << (p->rxseq % PROTO_WINDOW)))
+    p->rxseq++;
+
+  ackSend(p);
+
+  if (p->cb_recv != NULL)
+    p->cb_recv(pkt);
+
+  for (seq++; seq != p->rxseq; seq++) {
+    bit = 1 << (seq % PROTO_WINDOW);
+    memcpy(proto, &p->rxwin[seq % PROTO_WINDOW], sizeof(PACKET));
+    p->rxmask &= ~bit;
+    if (p->cb_recv != NULL)
+      p->cb_recv(pkt);
+  }
+
+  return (0);
+}
+
 int
 rxHandle (OrchardAppContext *context, KW01_PKT * pkt)
 {
   ProtoHandles * p;
   PACKET * proto;  // inbound
+  uint16_t ack;
+  uint8_t sack;
+  uint8_t msg;
   int sts = -1;
 
-#ifdef DEBUG_FIGHT_NETWORK
-  int result;
-#endif
-  
   p = (((FightHandles *)context->priv)->proto);
   proto = (PACKET *)&pkt->kw01_payload;
-#ifdef DEBUG_FIGHT_NETWORK  
+#ifdef DEBUG_FIGHT_NETWORK
   chprintf(stream,"in rxhandle, packet from %x expecting from %x protocol %x flags %d\r\n", pkt->kw01_hdr.kw01_src, p->netid, pkt->kw01_hdr.kw01_prot, proto->prot_msg);
 #endif
-  
+
   /*
    * Note: we may end getting here either because we received
    * a message specifically for our protocol, or because
    * we received a ping. Either way, we know our peer is
    * still in range, so we can keep the connection alive.
    */
-  
-  p->intervals_since_last_contact = 0;
-  
+
+  p->last_contact = chVTGetSystemTime();
+
   /* If this is for our protocol, then process the packet. */
   if (pkt->kw01_hdr.kw01_prot != RADIO_PROTOCOL_FIGHT)
     return (sts);
-  
+
   if (pkt->kw01_hdr.kw01_src != p->netid)
     return (sts);
-  
-  /*
-   * Sequence number must match, or else this is
-   * a bogus packet.
-   */
-  if (proto->prot_seq == p->txseq) {
-#ifdef DEBUG_FIGHT_NETWORK
-    chprintf (stream, "out of txsequence message!!!\r\n");
-#endif
-    p->state = PROTO_STATE_IDLE;
-    p->intervals_since_last_contact = 0;
 
-    /* TODO: even if we have an out of sequence message we must ACK them,
-     * because if we do not ACK they will resend
-     */
+  if (pkt->kw01_length < PROTO_HDRLEN)
+    return (sts);
 
-    /* TODO: how about handling delayed ACK -- must have a number of the
-     * acknowledgement? Ack numbers must verified... 
-     */
-    return (-1);
-  }
-  
-  switch (proto->prot_msg) {
-  case PROTO_ACK:
-#ifdef DEBUG_FIGHT_NETWORK
-    chprintf (stream, "message %d was acknowledged\r\n",
-              proto->prot_seq);
-#endif
-    p->rxseq++;
-    p->state = PROTO_STATE_CONNECTED;
-    sts = 0;
-
-    // we're gonna reuse the proto memory because reasons
-    ringGetItem(&p->txring, true, proto);
-
-    // handle the ack callback
-    if (p->cb_ack != NULL)
-      p->cb_ack(pkt);
-
-    if (! ringIsEmpty(&p->txring) ){
-      ringGetItem(&p->txring, false, proto); // no dequeue, we're not done.
-      p->state = PROTO_STATE_WAITACK;
-      proto->prot_msg = PROTO_SYN;
-      proto->prot_seq = p->txseq;
-      
-      radioSend (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
-                 sizeof(PACKET), proto);
-
-      p->txseq++;
-    }      
-    
-    break;
-    
-  case PROTO_SYN:
-    proto->prot_msg = PROTO_ACK;
-#ifdef DEBUG_FIGHT_NETWORK
-    chprintf (stream, "message %d was received\r\n", proto->prot_seq);
-#endif
-#ifdef DEBUG_FIGHT_NETWORK
-    /* send ACK */
-    result = radioSend (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
-                        sizeof(PACKET), proto);
-
-    chprintf(stream, "ack sent = %d\r\n", result);
-#else
-    /* send ACK */
-    radioSend (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
-                        sizeof(PACKET), proto);
-#endif
-    
-    /* fire the recv callback with the full packet */
-    if (p->cb_recv != NULL)
-      p->cb_recv(pkt);
-    break;
-    
-  case PROTO_RST:
+  /* The callbacks may overwrite the packet, so save these first. */
+
+  msg = proto->prot_msg;
+  ack = proto->prot_ack;
+  sack = proto->prot_sack;
+
+  if (msg & PROTO_RST) {
 #ifdef DEBUG_FIGHT_NETWORK
-    chprintf (stream, "peer disconnected\r\n", proto->prot_seq);
+    chprintf (stream, "peer disconnected\r\n");
 #endif
-    proto->prot_msg = PROTO_ACK;
-    radioSend (&KRADIO1, p->netid, RADIO_PROTOCOL_FIGHT,
-               sizeof(PACKET), proto);
-    p->state = PROTO_STATE_IDLE;
-    p->intervals_since_last_contact = 0;
+    protoReset(p);
 
     /* fire the timeout callback */
     if (p->cb_timeout != NULL)
       p->cb_timeout(pkt);
-    break;
-  default:
-#ifdef DEBUG_FIGHT_NETWORK
-    chprintf(stream, "bogus packet\r\n");
-#endif
-    break;
+    return (0);
   }
-  
-  proto->prot_msg = 0;
-  
+
+  if (msg & PROTO_SYN)
+    sts = dataHandle(p, pkt);
+
+  if (msg & PROTO_ACK) {
+    ackHandle(p, ack, sack, pkt);
+    if (!(msg & PROTO_SYN))
+      sts = 0;
+  }
+
   return (sts);
 }
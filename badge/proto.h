@@ -14,53 +14,98 @@
 #define PROTO_STATE_WAITACK	0x03
 
 /*
- * Messages
+ * Message flags. A message carries a payload if PROTO_SYN is set, and
+ * valid acknowledgement fields if PROTO_ACK is set. A bare ACK is just
+ * the header.
  */
 
 #define PROTO_SYN		0x01
 #define PROTO_ACK		0x02
-#define PROTO_RST		0x03
+#define PROTO_RST		0x04
 
 /*
  * We tell the compiler to make this structure packed so that it
  * doesn't try to silently insert any padding for alignment
  * purposes.
+ *
+ * prot_seq is the sequence number of this message, and prot_base the
+ * oldest one the sender is still waiting to have acknowledged, which
+ * tells a receiver that hasn't heard from it yet where to start.
+ * prot_ack is the next sequence number the sender expects from us, so
+ * everything before it has arrived, and bit n of prot_sack says that
+ * message prot_ack + 1 + n has arrived too.
  */
 
+#define PROTO_MTU		44	/* Room for a fightpkt */
+
 #pragma pack(1)
 typedef struct packet {
-  uint32_t		prot_seq;
+  uint16_t		prot_seq;
+  uint16_t		prot_base;
+  uint16_t		prot_ack;
+  uint8_t		prot_sack;
   uint8_t		prot_msg; // flags
-  uint8_t		prot_payload[46]; // sizeof(user)
+  uint8_t		prot_payload[PROTO_MTU];
 } PACKET;
 
 #pragma pack()
 
-#define PROTO_TICK_US           500000
-#define PROTO_RING_SIZE         3
+#define PROTO_HDRLEN		(sizeof(PACKET) - PROTO_MTU)
+
+/*
+ * Up to PROTO_WINDOW messages may be waiting to be acknowledged, and
+ * the receiver holds on to as many that arrive out of order. Each
+ * message is resent when it has gone unacknowledged for the
+ * retransmit timeout, which is worked out from the round trip times of
+ * messages that got through the first time (RFC 6298), and doubles
+ * with each timeout up to PROTO_RTO_MAX, so a message gets several
+ * tries before the peer is given up on: that happens when we've heard
+ * nothing at all from it for PROTO_TIMEOUT. tickHandle() does the
+ * resending, so it happens on the app's frame interval.
+ */
+
+#define PROTO_WINDOW		4
+#define PROTO_RTO_INIT		MS2ST(250)
+#define PROTO_RTO_MIN		MS2ST(60)
+#define PROTO_RTO_MAX		MS2ST(500)
+#define PROTO_TIMEOUT		MS2ST(5000)
 
-typedef struct _ringBuf
-{
-  int     first;
-  int     last;
-  int     validItems;
-  PACKET  data[PROTO_RING_SIZE];
-} ringBuffer;
+#define PROTO_SLOT_FREE		0
+#define PROTO_SLOT_SENT		1	/* Waiting for an ACK */
+#define PROTO_SLOT_SACKED	2	/* Arrived, but not yet in order */
+
+typedef struct _ProtoSlot {
+  PACKET		pkt;
+  systime_t		sent;	/* when it was last sent */
+  uint8_t		state;
+  uint8_t		resent; /* don't time it, it was sent more than once */
+} ProtoSlot;
 
 typedef struct _ProtoHandles {
   uint32_t		netid;
-  uint32_t		txseq;
-  ringBuffer		txring;
-  uint32_t		rxseq;
   uint8_t		state;
   uint8_t               mtu; /* packet size */
-  uint32_t              last_tick_time;
-  int			interval;
-  int			intervals_since_last_contact;
 
-  /* workspaces */
-  PACKET                wpkt; /* workspace packet for funcs */
-  
+  /* sender */
+  uint16_t		txbase;	/* oldest unacknowledged message */
+  uint16_t		txseq;	/* next message to send */
+  ProtoSlot		txwin[PROTO_WINDOW];
+  systime_t		srtt;	/* smoothed RTT, times 8 */
+  systime_t		rttvar;	/* RTT variation, times 4 */
+  systime_t		rto;
+  systime_t		last_contact;
+
+  /* receiver */
+  uint8_t		rxsynced;
+  uint8_t		rxmask;	/* which rxwin slots hold a message */
+  uint16_t		rxseq;	/* next message expected */
+  PACKET		rxwin[PROTO_WINDOW];
+
+  /* counters */
+  uint16_t		sent;
+  uint16_t		retransmits;
+  uint16_t		duplicates;
+
   /* callbacks */
   void                  (*cb_ack)(KW01_PKT *);
   void                  (*cb_recv)(KW01_PKT *);
@@ -91,6 +91,8 @@
 #include "orchard.h"
 #include "orchard-events.h"
 
+#include <string.h>
+
 #ifndef KW01_RADIO_HWFILTER
 #include "userconfig.h"
 #endif
@@ -101,12 +103,30 @@
 
 /*
  * Statically allocate memory for a single radio handle structure.
- * This includes the device state and one packet structure.
+ * This includes the device state, the receive and transmit queues, one
+ * packet structure for frames that have to be dropped, and one for
+ * frames unpacked from a RADIO_PROTOCOL_AGG frame.
  */
 
 RADIODriver KRADIO1;
 
+/*
+ * The transmit thread only runs radioSend() and the completion
+ * callbacks.
+ */
+
+static THD_WORKING_AREA(waRadioTxThread, 256);
+
+/*
+ * The receive thread runs the protocol handlers, which print to the
+ * console, so it gets more.
+ */
+
+static THD_WORKING_AREA(waRadioRxThread, 512);
+
 static int radioReceive (RADIODriver *);
+static void radioRxThread (void *);
+static void radioTxThread (void *);
 static void radioIntrHandle (eventid_t);
 static void radioSelect (RADIODriver *);
 static void radioUnselect (RADIODriver *);
@@ -124,17 +144,29 @@ static int radioModeSet (RADIODriver *, uint8_t);
 * handler to execute. The thread-level handler then processes the device
 * events.
 *
+* While radioSend() is waiting for a frame to go out, DIO0 signals
+* PACKETSENT instead, and the ISR wakes up the sender directly. The event
+* thread can't help there: radioSend() holds the radio mutex, and may
+* well have been called from the event thread itself.
+*
 * RETURNS: N/A
 */
 
 void
 radioInterrupt (EXTDriver *extp, expchannel_t channel)
 {
+	RADIODriver * radio;
+
 	(void)extp;
 	(void)channel;
 
+	radio = radioDriver;
+
 	chSysLockFromISR ();
-	chEvtBroadcastI (&rf_pkt_rdy);
+	if (radio->kw01_flags & KW01_FLAG_TX)
+		chSemSignalI (&radio->kw01_txdone);
+	else
+		chEvtBroadcastI (&rf_pkt_rdy);
 	chSysUnlockFromISR ();
 
 	return;
@@ -142,17 +174,62 @@ radioInterrupt (EXTDriver *extp, expchannel_t channel)
 
 /******************************************************************************
 *
-* radioReceive - receive a packet and dispatch it
+* radioHandlerFind - look up the handler for a protocol
+*
+* RETURNS: the handler entry for <prot>, or the default handler entry if
+*          there isn't one
+*/
+
+static KW01_PKT_HANDLER *
+radioHandlerFind (RADIODriver * radio, kw01_proto_t prot)
+{
+	KW01_PKT_HANDLER * ph;
+	uint8_t i;
+
+	for (i = 0; i < KW01_PKT_HANDLERS_MAX; i++) {
+		ph = &radio->kw01_handlers[i];
+		if (ph->kw01_handler != NULL && ph->kw01_prot == prot)
+			return (ph);
+	}
+
+	return (&radio->kw01_default_handler);
+}
+
+/******************************************************************************
+*
+* radioRxFree - put a receive slot back on the free list
+*
+* RETURNS: N/A
+*/
+
+static void
+radioRxFree (RADIODriver * radio, KW01_RX * rx)
+{
+	chSysLock ();
+	rx->kw01_next = radio->kw01_rxfree;
+	radio->kw01_rxfree = rx;
+	chSysUnlock ();
+
+	return;
+}
+
+/******************************************************************************
+*
+* radioReceive - receive a packet and queue it for dispatch
 *
 * This function is invoked when the thread-level interrupt handler detects
 * a "payload ready" event. It reads the current packet from the FIFO into
-* the kw01_pkt structure, along with the current signal strength reading.
-* Each packet includes a protocol type, which is compared against a list
-* of pre-set protocol handlers. If no matching protocol is found, a default
-* handler is called which just prints the packet contents to the serial
-* port.
+* a free receive slot, along with the current signal strength reading,
+* and queues it for the receive thread, which passes it to the handler
+* for its protocol.
+*
+* Pings are queued behind everything else, and may not take the last
+* free slot, so a crowd of badges pinging can't hold up a fight frame
+* for long. If there is no free slot, the frame still has to be read to
+* empty the FIFO, so it goes into the kw01_pkt structure and is dropped,
+* and the drop is counted against the handler for its protocol.
 *
-* RETURNS: 0 if the packet was dispatched successfully, or -1 if the
+* RETURNS: 0 if the packet was queued or dropped, or -1 if the
 *          frame size is larger than KW01_PKT_MAXLEN
 */
 
@@ -160,18 +237,27 @@ static int
 radioReceive (RADIODriver * radio)
 {
 	uint8_t * p;
-	KW01_PKT_HANDLER * ph;
+	KW01_RX * rx;
+	KW01_RX ** pp;
 	KW01_PKT * pkt;
 	uint8_t reg;
 	uint8_t len;
-	uint8_t i;
 #ifndef KW01_RADIO_HWFILTER
 	userconfig * config;
 #endif
 
  	palClearPad (GREEN_LED_PORT, GREEN_LED_PIN);   /* Green */
 
-	pkt = &radio->kw01_pkt;
+	chSysLock ();
+	rx = radio->kw01_rxfree;
+	if (rx != NULL)
+		radio->kw01_rxfree = rx->kw01_next;
+	chSysUnlock ();
+
+	if (rx != NULL)
+		pkt = &rx->kw01_pkt;
+	else
+		pkt = &radio->kw01_pkt;
 
 	/* Get the signal strength reading for this frame. */
 
@@ -192,9 +278,13 @@ radioReceive (RADIODriver * radio)
 	    len < sizeof (KW01_PKT_HDR)) {
           	palSetPad (GREEN_LED_PORT, GREEN_LED_PIN);   /* Green */
 		radioUnselect (radio);
+		if (rx != NULL)
+			radioRxFree (radio, rx);
 		return (-1);
 	}
 
+	/* Set the payload length (don't include the header length) */
+
 	pkt->kw01_length = len - sizeof (KW01_PKT_HDR);
 
 	/* Read in the he frame. */
@@ -215,29 +305,151 @@ radioReceive (RADIODriver * radio)
 	config = getConfig ();
 
 	if (pkt->kw01_hdr.kw01_dst != RADIO_BROADCAST_ADDRESS &&
-	    pkt->kw01_hdr.kw01_dst != config->netid)
+	    pkt->kw01_hdr.kw01_dst != config->netid) {
+		if (rx != NULL)
+			radioRxFree (radio, rx);
 		return (0);
+	}
 
 #endif
 
-	/* Set the payload length (don't include the header length) */
+	chSysLock ();
 
-	for (i = 0; i < KW01_PKT_HANDLERS_MAX; i++) {
-		ph = &radio->kw01_handlers[i];
-		if (ph->kw01_handler != NULL &&
-		    ph->kw01_prot == pkt->kw01_hdr.kw01_prot) {
-			ph->kw01_handler (pkt);
-			return(0);
-		}
+	/* Keep the last free slot for something other than a ping. */
+
+	if (rx != NULL && radio->kw01_rxfree == NULL &&
+	    pkt->kw01_hdr.kw01_prot == RADIO_PROTOCOL_PING) {
+		rx->kw01_next = radio->kw01_rxfree;
+		radio->kw01_rxfree = rx;
+		rx = NULL;
 	}
 
-	if (i == KW01_PKT_HANDLERS_MAX &&
-	    radio->kw01_default_handler.kw01_handler != NULL)
-		radio->kw01_default_handler.kw01_handler (pkt);
+	if (rx == NULL) {
+		chSysUnlock ();
+		radioHandlerFind (radio, pkt->kw01_hdr.kw01_prot)->kw01_drops++;
+		return (0);
+	}
+
+	/* Pings go to the back of the queue, anything else ahead of them. */
+
+	pp = &radio->kw01_rxhead;
+	if (pkt->kw01_hdr.kw01_prot != RADIO_PROTOCOL_PING) {
+		while (*pp != NULL &&
+		    (*pp)->kw01_pkt.kw01_hdr.kw01_prot != RADIO_PROTOCOL_PING)
+			pp = &(*pp)->kw01_next;
+	} else {
+		while (*pp != NULL)
+			pp = &(*pp)->kw01_next;
+	}
+	rx->kw01_next = *pp;
+	*pp = rx;
+
+	chSemSignalI (&radio->kw01_rxqsem);
+	chSysUnlock ();
 
 	return (0);
 }
 
+/******************************************************************************
+*
+* radioRxUnpack - pass the frames packed in an aggregate to their handlers
+*
+* Each frame in a RADIO_PROTOCOL_AGG frame is copied out into the
+* kw01_rxagg structure, with the aggregate's header and signal strength
+* and its own protocol, and handed to the handler for that protocol, in
+* the order they were packed. Unpacking stops at the first one that runs
+* past the end of the aggregate.
+*
+* RETURNS: N/A
+*/
+
+static void
+radioRxUnpack (RADIODriver * radio, KW01_PKT * pkt)
+{
+	KW01_PKT_HANDLER * ph;
+	KW01_AGG_HDR * agg;
+	KW01_PKT * sub;
+	uint8_t * p;
+	uint8_t * end;
+
+	sub = &radio->kw01_rxagg;
+	p = pkt->kw01_payload;
+	end = p + pkt->kw01_length;
+
+	while (end - p >= (int)KW01_AGG_HDRLEN) {
+		agg = (KW01_AGG_HDR *)p;
+		p += KW01_AGG_HDRLEN;
+		if (agg->kw01_len > end - p)
+			break;
+
+		sub->kw01_rssi = pkt->kw01_rssi;
+		sub->kw01_length = agg->kw01_len;
+		sub->kw01_hdr = pkt->kw01_hdr;
+		sub->kw01_hdr.kw01_prot = agg->kw01_prot;
+		memcpy (sub->kw01_payload, p, agg->kw01_len);
+		p += agg->kw01_len;
+
+		ph = radioHandlerFind (radio, agg->kw01_prot);
+		if (ph->kw01_handler != NULL)
+			ph->kw01_handler (sub);
+	}
+
+	return;
+}
+
+/******************************************************************************
+*
+* radioRxThread - pass received frames to their protocol handlers
+*
+* This thread sleeps until radioReceive() queues a frame, then calls the
+* handler for its protocol, or the default handler if there is none, and
+* puts the slot back on the free list. An aggregate frame is unpacked
+* and each of the frames in it handled in turn. Handlers must copy
+* anything they want to keep, since the slot is reused as soon as they
+* return.
+*
+* RETURNS: N/A
+*/
+
+static void
+radioRxThread (void * arg)
+{
+	RADIODriver * radio;
+	KW01_PKT_HANDLER * ph;
+	KW01_RX * rx;
+
+	radio = arg;
+
+	chRegSetThreadName ("RadioRx");
+
+	while (1) {
+		chSemWait (&radio->kw01_rxqsem);
+
+		chSysLock ();
+		rx = radio->kw01_rxhead;
+		if (rx != NULL)
+			radio->kw01_rxhead = rx->kw01_next;
+		chSysUnlock ();
+
+		if (rx == NULL)
+			continue;
+
+		if (rx->kw01_pkt.kw01_hdr.kw01_prot == RADIO_PROTOCOL_AGG) {
+			radioRxUnpack (radio, &rx->kw01_pkt);
+		} else {
+			ph = radioHandlerFind (radio,
+			    rx->kw01_pkt.kw01_hdr.kw01_prot);
+			if (ph->kw01_handler != NULL)
+				ph->kw01_handler (&rx->kw01_pkt);
+		}
+
+		radioRxFree (radio, rx);
+	}
+
+	/* NOTREACHED */
+	return;
+}
+
 /******************************************************************************
 *
 * radioIntrHandle - thread-level interrupt handler
@@ -248,10 +460,10 @@ radioReceive (RADIODriver * radio)
 * of sync bytes and a valid CRC. Since address filtering is enabled, we
 * should also only get a frame that matches either this node's address
 * or the broadcast address. If a PAYLOADREADY event occurs, we call the
-* receive handler to dispatch the frame.
+* receive handler to read the frame and queue it for the receive thread.
 *
-* The other event we should be triggered for is PACKETSENT, but we don't
-* care about that since we use a synchronous transmit scheme.
+* PACKETSENT never gets here: radioInterrupt() hands it straight to
+* radioSend().
 *
 * RETURNS: N/A
 */
@@ -578,14 +790,37 @@ radioStart (SPIDriver * sp)
 			    0x01, 0x02, 0x04, 0x4,
 			    0x01, 0x02, 0x04, 0x4,
 			    0x01, 0x02, 0x04, 0x4 };
-#ifdef KW01_RSSI_CALIBRATE
 	unsigned int i;
+#ifdef KW01_RSSI_CALIBRATE
 	uint8_t rssi;
 #endif
 
 	radio = radioDriver;
 
 	osalMutexObjectInit (&radio->kw01_mutex);
+	chSemObjectInit (&radio->kw01_txdone, 0);
+
+	/* Put all the transmit queue slots on the free list. */
+
+	chSemObjectInit (&radio->kw01_txqsem, 0);
+	radio->kw01_txfree = NULL;
+	for (i = 0; i < KW01_TXQ_LEN; i++) {
+		radio->kw01_txq[i].kw01_next = radio->kw01_txfree;
+		radio->kw01_txfree = &radio->kw01_txq[i];
+	}
+	for (i = 0; i < KW01_TX_CLASSES; i++)
+		radio->kw01_txhead[i] = NULL;
+	radio->kw01_txdrops = 0;
+
+	/* Likewise the receive queue slots. */
+
+	chSemObjectInit (&radio->kw01_rxqsem, 0);
+	radio->kw01_rxfree = NULL;
+	for (i = 0; i < KW01_RXQ_LEN; i++) {
+		radio->kw01_rxq[i].kw01_next = radio->kw01_rxfree;
+		radio->kw01_rxfree = &radio->kw01_rxq[i];
+	}
+	radio->kw01_rxhead = NULL;
 
 	radio->kw01_spi = sp;
 
@@ -625,7 +860,7 @@ radioStart (SPIDriver * sp)
 	radioWrite (radio, KW01_PKTCONF2, KW01_PKTCONF2_IPKTDELAY |
 	    KW01_PKTCONF2_AUTORRX);
 	radioWrite (radio, KW01_PAYLEN, KW01_PKT_MAXLEN);
-	radioWrite (radio, KW01_DIOMAP1, 0x40);
+	radioWrite (radio, KW01_DIOMAP1, KW01_DIO0_RX_PAYLOADRDY);
 
 	radioWrite (radio, KW01_PREAMBLEMSB, 0);
 	radioWrite (radio, KW01_PREAMBLELSB, 3);
@@ -689,6 +924,11 @@ radioStart (SPIDriver * sp)
 	radioModeSet (radio, KW01_MODE_RX);
 	radioRelease (radio);
 
+	chThdCreateStatic (waRadioRxThread, sizeof(waRadioRxThread),
+	    KW01_RX_THREAD_PRIO, radioRxThread, radio);
+	chThdCreateStatic (waRadioTxThread, sizeof(waRadioTxThread),
+	    KW01_TX_THREAD_PRIO, radioTxThread, radio);
+
 #ifdef KW01_RSSI_CALIBRATE
 	/* Calibrate the squelch level. Set squelch to full open, */
 
@@ -1031,12 +1271,17 @@ radioHandlerSet (RADIODriver * radio, kw01_proto_t prot, KW01_PKT_FUNC handler)
 * This function transmits a frame over the air. The frame data must be
 * less than 61 bytes in size. The radio is put into the standby mode
 * and then the packet length, destination address and payload are loaded
-* into the FIFO. Once the data is loaded, the radio is set to the transmit
-* state. The routine then polls for the PACKETSET status to be indicated
-* before putting the radio back into receive mode again.
+* into the FIFO. Once the data is loaded, DIO0 is switched over to signal
+* PACKETSENT and the radio is set to the transmit state. The caller then
+* sleeps until radioInterrupt() says the frame is out, rather than polling
+* the radio over SPI, and the radio is put back into receive mode again.
+*
+* Every wakeup is checked against the IRQ2 register, since with the rev2
+* radio workaround radioInterrupt() is called from a timer, and the last
+* check also catches a PACKETSENT whose interrupt went astray.
 *
 * RETURNS: 0 if transmission was successful, or -1 if the frame was too
-*          large or initiating transmission failed
+*          large or initiating transmission failed or timed out
 */
 
 int
@@ -1045,7 +1290,9 @@ radioSend (RADIODriver * radio, kw01_dst_t dest, kw01_proto_t prot,
 {
 	KW01_PKT_HDR hdr;
 	uint8_t reg;
-	unsigned int i;
+	systime_t start;
+	msg_t msg;
+	int sts;
 #ifndef KW01_RADIO_HWFILTER
 	userconfig * config;
 #endif
@@ -1098,23 +1345,364 @@ radioSend (RADIODriver * radio, kw01_dst_t dest, kw01_proto_t prot,
 
 	palSetPad (RED_LED_PORT, RED_LED_PIN);  /* Red */
 
-	if (radioModeSet (radio, KW01_MODE_TX) != 0) {
-		radioRelease (radio);
-		return (-1);
+	/* Have the radio interrupt us when the frame has been sent. */
+
+	radioSpiWrite (radio, KW01_DIOMAP1, KW01_DIO0_TX_PACKETSENT);
+	chSemReset (&radio->kw01_txdone, 0);
+
+	chSysLock ();
+	radio->kw01_flags |= KW01_FLAG_TX;
+	chSysUnlock ();
+
+	sts = -1;
+
+	if (radioModeSet (radio, KW01_MODE_TX) == 0) {
+		start = chVTGetSystemTime ();
+		do {
+			msg = chSemWaitTimeout (&radio->kw01_txdone,
+			    KW01_TX_TIMEOUT);
+			reg = radioSpiRead (radio, KW01_IRQ2);
+			if (reg & KW01_IRQ2_PACKETSENT) {
+				sts = 0;
+				break;
+			}
+		} while (msg == MSG_OK &&
+		    chVTTimeElapsedSinceX (start) < KW01_TX_TIMEOUT);
 	}
 
-	for (i = 0; i < KW01_DELAY * 100; i++) {
-		reg = radioSpiRead (radio, KW01_IRQ2);
-		if (reg & KW01_IRQ2_PACKETSENT)
-			break;
-	}
+	/*
+	 * Switch DIO0 back to PAYLOADREADY while still in TX mode, where
+	 * that mapping means TXREADY and is already asserted, so leaving
+	 * TX doesn't lose a receive interrupt or raise a spurious one.
+	 */
 
+	chSysLock ();
+	radio->kw01_flags &= ~KW01_FLAG_TX;
+	chSysUnlock ();
+
+	radioSpiWrite (radio, KW01_DIOMAP1, KW01_DIO0_RX_PAYLOADRDY);
 	radioModeSet (radio, KW01_MODE_RX);
 	radioRelease (radio);
 
-	if (i == KW01_DELAY)
+	return (sts);
+}
+
+/******************************************************************************
+*
+* radioTxClass - pick the transmit queue class for a protocol
+*
+* RETURNS: one of KW01_TX_FIGHT, KW01_TX_CHAT or KW01_TX_PING
+*/
+
+static uint8_t
+radioTxClass (kw01_proto_t prot)
+{
+	if (prot == RADIO_PROTOCOL_FIGHT)
+		return (KW01_TX_FIGHT);
+	if (prot == RADIO_PROTOCOL_PING)
+		return (KW01_TX_PING);
+	return (KW01_TX_CHAT);
+}
+
+/******************************************************************************
+*
+* radioTxRoom - work out how much room a frame leaves for packing
+*
+* RETURNS: the number of payload bytes left over if <tx> is sent in a
+*          RADIO_PROTOCOL_AGG frame, or -1 if it can't be packed
+*/
+
+static int
+radioTxRoom (RADIODriver * radio, KW01_TX * tx)
+{
+	if (tx->kw01_prot > 0xFF || tx->kw01_prot == RADIO_PROTOCOL_AGG)
 		return (-1);
 
+	return ((radio->kw01_maxlen - KW01_PKT_HDRLEN) -
+	    (int)(KW01_AGG_HDRLEN + tx->kw01_len));
+}
+
+/******************************************************************************
+*
+* radioTxPack - take frames that can go out with another off the queue
+*
+* This looks through the queue, highest class first, for frames going to
+* the same destination as <tx> that fit in the aggregate frame along
+* with it, takes up to KW01_TX_AGG_MAX - 1 of them off the queue and
+* chains them to <tx>. Within a class, it stops at the first frame for
+* that destination that doesn't fit, so that a smaller frame queued
+* after it can't overtake it. It must be called with the system lock
+* held.
+*
+* RETURNS: N/A
+*/
+
+static void
+radioTxPack (RADIODriver * radio, KW01_TX * tx)
+{
+	KW01_TX ** pp;
+	KW01_TX * last;
+	int room;
+	int need;
+	int n;
+	int i;
+
+	room = radioTxRoom (radio, tx);
+	last = tx;
+	n = 1;
+
+	for (i = 0; i < KW01_TX_CLASSES && room > 0; i++) {
+		pp = &radio->kw01_txhead[i];
+		while (*pp != NULL && n < KW01_TX_AGG_MAX) {
+			if ((*pp)->kw01_dst != tx->kw01_dst) {
+				pp = &(*pp)->kw01_next;
+				continue;
+			}
+
+			/*
+			 * Frames for one badge have to go out in the
+			 * order they were queued in, so once one of them
+			 * can't be packed, nothing behind it in this class
+			 * can be either.
+			 */
+
+			need = KW01_AGG_HDRLEN + (*pp)->kw01_len;
+			if (need > room || radioTxRoom (radio, *pp) < 0)
+				break;
+			room -= need;
+			n++;
+			last->kw01_next = *pp;
+			last = *pp;
+			*pp = last->kw01_next;
+			last->kw01_next = NULL;
+
+			/* It won't need a turn of its own. */
+
+			chSemFastWaitI (&radio->kw01_txqsem);
+		}
+	}
+
+	return;
+}
+
+/******************************************************************************
+*
+* radioTxAgg - build an aggregate frame out of a chain of frames
+*
+* RETURNS: the length of the aggregate frame's payload in kw01_txagg
+*/
+
+static uint8_t
+radioTxAgg (RADIODriver * radio, KW01_TX * tx)
+{
+	KW01_AGG_HDR * agg;
+	uint8_t len;
+
+	len = 0;
+
+	for (; tx != NULL; tx = tx->kw01_next) {
+		agg = (KW01_AGG_HDR *)&radio->kw01_txagg[len];
+		agg->kw01_prot = tx->kw01_prot;
+		agg->kw01_len = tx->kw01_len;
+		len += KW01_AGG_HDRLEN;
+		memcpy (&radio->kw01_txagg[len], tx->kw01_payload,
+		    tx->kw01_len);
+		len += tx->kw01_len;
+		radio->kw01_txpacked++;
+	}
+
+	return (len);
+}
+
+/******************************************************************************
+*
+* radioTxThread - transmit the frames queued by radioSendAsync()
+*
+* This thread sleeps until a frame is queued, then takes the oldest frame
+* of the highest class off the queue, along with any frames it can be
+* packed with (see radioTxPack()), and sends them with radioSend(). It
+* then calls the completion callback of each and puts its slot back on
+* the free list.
+*
+* If the frame is the only one waiting and there's room for another as
+* big as it, the thread waits KW01_TX_AGG_WAIT for one to pack with it
+* before taking it. It looks again afterwards, so a frame of a higher
+* class queued in the meantime is still sent first.
+*
+* RETURNS: N/A
+*/
+
+static void
+radioTxThread (void * arg)
+{
+	RADIODriver * radio;
+	KW01_TX * tx;
+	KW01_TX * next;
+	int hold;
+	int sts;
+	int i;
+
+	radio = arg;
+
+	chRegSetThreadName ("RadioTx");
+
+	while (1) {
+		chSemWait (&radio->kw01_txqsem);
+
+		chSysLock ();
+		tx = NULL;
+		for (i = 0; i < KW01_TX_CLASSES && tx == NULL; i++)
+			tx = radio->kw01_txhead[i];
+		hold = tx != NULL &&
+		    chSemGetCounterI (&radio->kw01_txqsem) == 0 &&
+		    radioTxRoom (radio, tx) >=
+		    (int)(KW01_AGG_HDRLEN + tx->kw01_len);
+		chSysUnlock ();
+
+		if (hold)
+			chThdSleep (KW01_TX_AGG_WAIT);
+
+		chSysLock ();
+		tx = NULL;
+		for (i = 0; i < KW01_TX_CLASSES; i++) {
+			tx = radio->kw01_txhead[i];
+			if (tx != NULL) {
+				radio->kw01_txhead[i] = tx->kw01_next;
+				tx->kw01_next = NULL;
+				radioTxPack (radio, tx);
+				break;
+			}
+		}
+		chSysUnlock ();
+
+		if (tx == NULL)
+			continue;
+
+		if (tx->kw01_next == NULL)
+			sts = radioSend (radio, tx->kw01_dst, tx->kw01_prot,
+			    tx->kw01_len, tx->kw01_payload);
+		else
+			sts = radioSend (radio, tx->kw01_dst,
+			    RADIO_PROTOCOL_AGG, radioTxAgg (radio, tx),
+			    radio->kw01_txagg);
+
+		for (; tx != NULL; tx = next) {
+			next = tx->kw01_next;
+
+			if (tx->kw01_cb != NULL)
+				tx->kw01_cb (sts, tx->kw01_arg);
+
+			chSysLock ();
+			tx->kw01_next = radio->kw01_txfree;
+			radio->kw01_txfree = tx;
+			chSysUnlock ();
+		}
+	}
+
+	/* NOTREACHED */
+	return;
+}
+
+/******************************************************************************
+*
+* radioSendAsync - queue a packet for transmission
+*
+* This function copies a frame into the transmit queue and returns without
+* waiting for it to be sent. The transmit thread sends it once all the
+* frames of a higher class, and the older ones of its own class, have
+* gone out. If <cb> isn't NULL, it is called with the result of the send,
+* and with <arg>.
+*
+* A ping is refused if there's already one waiting. When the queue is
+* full, the newest waiting ping is dropped to make room for any other
+* frame; its callback is called with -1 before this function returns.
+*
+* RETURNS: 0 if the frame was queued, or -1 if it was too large or there
+*          was no room for it
+*/
+
+int
+radioSendAsync (RADIODriver * radio, kw01_dst_t dest, kw01_proto_t prot,
+                uint8_t len, const void * payload, KW01_TX_FUNC cb, void * arg)
+{
+	KW01_TX * tx;
+	KW01_TX ** pp;
+	KW01_TX_FUNC dropcb;
+	void * droparg;
+	uint8_t class;
+	int dropped;
+
+	if (len > (radio->kw01_maxlen - KW01_PKT_HDRLEN))
+		return (-1);
+
+	class = radioTxClass (prot);
+	dropped = 0;
+	dropcb = NULL;
+	droparg = NULL;
+
+	/*
+	 * The copy is done with the lock held too, so the transmit
+	 * thread never sees a slot that's half filled in.
+	 */
+
+	chSysLock ();
+
+	tx = radio->kw01_txfree;
+
+	if (class == KW01_TX_PING &&
+	    radio->kw01_txhead[KW01_TX_PING] != NULL) {
+		tx = NULL;
+	} else if (tx != NULL) {
+		radio->kw01_txfree = tx->kw01_next;
+	} else if (class != KW01_TX_PING &&
+	    radio->kw01_txhead[KW01_TX_PING] != NULL) {
+		/* Take over the slot of the newest waiting ping. */
+		pp = &radio->kw01_txhead[KW01_TX_PING];
+		while ((*pp)->kw01_next != NULL)
+			pp = &(*pp)->kw01_next;
+		tx = *pp;
+		*pp = NULL;
+		dropcb = tx->kw01_cb;
+		droparg = tx->kw01_arg;
+		dropped = 1;
+	}
+
+	if (tx == NULL || dropped)
+		radio->kw01_txdrops++;
+
+	if (tx == NULL) {
+		chSysUnlock ();
+		return (-1);
+	}
+
+	tx->kw01_next = NULL;
+	tx->kw01_cb = cb;
+	tx->kw01_arg = arg;
+	tx->kw01_dst = dest;
+	tx->kw01_prot = prot;
+	tx->kw01_len = len;
+	memcpy (tx->kw01_payload, payload, len);
+
+	pp = &radio->kw01_txhead[class];
+	while (*pp != NULL)
+		pp = &(*pp)->kw01_next;
+	*pp = tx;
+
+	/*
+	 * A slot taken over from a ping is already counted in the
+	 * semaphore, so only a new one needs a signal.
+	 */
+
+	if (!dropped) {
+		chSemSignalI (&radio->kw01_txqsem);
+		chSchRescheduleS ();
+	}
+
+	chSysUnlock ();
+
+	if (dropcb != NULL)
+		dropcb (-1, droparg);
+
 	return (0);
 }
 
@@ -35,6 +35,67 @@
 
 #define KW01_DELAY 1000
 
+/*
+ * How long radioSend() waits for a frame to go out. A full frame takes
+ * about 13ms at 50Kbps, so this leaves plenty of room.
+ */
+
+#define KW01_TX_TIMEOUT	MS2ST(50)
+
+/*
+ * Frames handed to radioSendAsync() wait in a queue of KW01_TXQ_LEN
+ * slots until the transmit thread gets to them. Each frame goes in one
+ * of three classes according to its protocol, and the thread always
+ * sends the oldest frame of the highest class first, so a fight frame
+ * waits for at most the frame already on the air. Pings can be dropped:
+ * only one may be queued at a time, and a full queue gives up a ping to
+ * make room for anything else.
+ */
+
+#define KW01_TXQ_LEN		4
+
+#define KW01_TX_FIGHT		0	/* Fight protocol */
+#define KW01_TX_CHAT		1	/* Chat, shout and anything else */
+#define KW01_TX_PING		2	/* Pings */
+#define KW01_TX_CLASSES		3
+
+#define KW01_TX_THREAD_PRIO	(NORMALPRIO + 1)
+
+/*
+ * Small frames for the same destination are sent together: when the
+ * transmit thread takes a frame off the queue, others waiting for the
+ * same address that fit alongside it are packed with it into one
+ * RADIO_PROTOCOL_AGG frame, up to KW01_TX_AGG_MAX frames in all, which
+ * saves the preamble, sync word, header and CRC of each. A frame that's
+ * alone in the queue, and small enough that another like it would fit
+ * too, is held for KW01_TX_AGG_WAIT first, in case its sender has
+ * another on the way. A frame sent by itself goes out as it always did.
+ *
+ * The receiver hands the frames in an aggregate to their handlers one
+ * after another, and most of those pass them on to the app's queue
+ * (orchard-radio.h), so an aggregate never holds more frames than that
+ * queue has room for with one frame already waiting.
+ */
+
+#define KW01_TX_AGG_WAIT	MS2ST(2)
+#define KW01_TX_AGG_MAX		(KW01_RXQ_LEN - 1)
+
+/*
+ * Received frames are read out of the FIFO into one of KW01_RXQ_LEN
+ * slots and handed to the receive thread, which calls the protocol
+ * handlers. The event thread only has to drain the FIFO, so a slow
+ * handler doesn't keep the radio from taking the next frame. If there's
+ * no slot for a frame, it is read and thrown away, and the drop is
+ * counted against its protocol handler. As on the transmit side, pings
+ * give way: they never take the last free slot, and other frames are
+ * handled ahead of them. The receive thread runs below the event thread
+ * so that draining the FIFO always comes first.
+ */
+
+#define KW01_RXQ_LEN		4
+
+#define KW01_RX_THREAD_PRIO	(NORMALPRIO - 1)
+
 #define KW01_CARRIER_FREQUENCY	921575000
 #define KW01_DEVIATION		170000
 /*
@@ -75,6 +136,7 @@
 #define RADIO_PROTOCOL_CHAT	0x01	/* Send message to 1 badge */
 #define RADIO_PROTOCOL_SHOUT	0x02	/* Broadcast message to all badges */
 #define RADIO_PROTOCOL_PING	0x03	/* Solicit ping ID from badges */
+#define RADIO_PROTOCOL_AGG	0x04	/* Several frames packed together */
 
 #define RADIO_PROTOCOL_FIGHT	0x80	/* Fight */
 
@@ -121,12 +183,52 @@ typedef struct kw01_pkt {
 
 typedef void (*KW01_PKT_FUNC)(KW01_PKT *);
 
+/*
+ * The payload of a RADIO_PROTOCOL_AGG frame is a series of frames, each
+ * one this header followed by kw01_len bytes of payload. They're
+ * unpacked into a KW01_PKT of their own before they're handed to their
+ * handlers, so the payload is still longword aligned there.
+ */
+
+typedef struct kw01_agg_hdr {
+	uint8_t		kw01_prot;	/* Protocol type */
+	uint8_t		kw01_len;	/* Payload length */
+} KW01_AGG_HDR;
+
+#define KW01_AGG_HDRLEN		sizeof(KW01_AGG_HDR)
+
+/*
+ * Completion callback for radioSendAsync(): called with 0 once the frame
+ * has been sent or -1 if it couldn't be, along with the caller's
+ * argument. It runs on the transmit thread, or on the thread of a
+ * caller whose frame pushed a queued ping out, so it must be brief.
+ */
+
+typedef void (*KW01_TX_FUNC)(int, void *);
+
+typedef struct kw01_tx {
+	struct kw01_tx *	kw01_next;
+	KW01_TX_FUNC		kw01_cb;
+	void *			kw01_arg;
+	kw01_dst_t		kw01_dst;
+	kw01_proto_t		kw01_prot;
+	uint8_t			kw01_len;
+	uint8_t			kw01_payload[KW01_PKT_PAYLOADLEN];
+} KW01_TX;
+
+typedef struct kw01_rx {
+	struct kw01_rx *	kw01_next;
+	KW01_PKT		kw01_pkt;
+} KW01_RX;
+
 typedef struct kw01_pkt_handler {
 	KW01_PKT_FUNC	kw01_handler;
 	uint8_t		kw01_prot;
+	uint32_t	kw01_drops;	/* Frames dropped with no RX slot */
 } KW01_PKT_HANDLER;
 
 #define KW01_FLAG_AES		0x01	/* AES enabled */
+#define KW01_FLAG_TX		0x02	/* Waiting for PACKETSENT */
 
 typedef struct radio_driver {
 	SPIDriver *	kw01_spi;
@@ -134,6 +236,19 @@ typedef struct radio_driver {
 	uint8_t		kw01_flags;
 	uint8_t		kw01_maxlen;
 	mutex_t		kw01_mutex;
+	semaphore_t	kw01_txdone;
+	semaphore_t	kw01_txqsem;
+	KW01_TX		kw01_txq[KW01_TXQ_LEN];
+	KW01_TX *	kw01_txfree;
+	KW01_TX *	kw01_txhead[KW01_TX_CLASSES];
+	uint32_t	kw01_txdrops;
+	uint32_t	kw01_txpacked;	/* Frames sent packed with others */
+	uint8_t		kw01_txagg[KW01_PKT_PAYLOADLEN];
+	semaphore_t	kw01_rxqsem;
+	KW01_RX		kw01_rxq[KW01_RXQ_LEN];
+	KW01_RX *	kw01_rxfree;
+	KW01_RX *	kw01_rxhead;
+	KW01_PKT	kw01_rxagg;
 	KW01_PKT_HANDLER kw01_handlers[KW01_PKT_HANDLERS_MAX];
 	KW01_PKT_HANDLER kw01_default_handler;
 } RADIODriver;
@@ -150,6 +265,9 @@ extern void radioAcquire (RADIODriver *);
 extern void radioRelease (RADIODriver *);
 extern int radioSend(RADIODriver *, kw01_dst_t dest, kw01_proto_t prot,
 			uint8_t len, const void * payload);
+extern int radioSendAsync(RADIODriver *, kw01_dst_t dest, kw01_proto_t prot,
+			uint8_t len, const void * payload,
+			KW01_TX_FUNC cb, void * arg);
 
 extern int radioFrequencySet (RADIODriver *, uint32_t freq);
 extern int radioDeviationSet (RADIODriver *, uint32_t freq);
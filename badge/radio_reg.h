@@ -388,6 +388,16 @@
 #define KW01_DIOMAP1_DIO2MAP	0x0C	/* DIO2 mapping */
 #define KW01_DIOMAP1_DIO3MAP	0x03	/* DIO3 mapping */
 
+/*
+ * What DIO0 signals depends on the mode. The same mapping value
+ * means one thing in RX mode and another in TX mode.
+ */
+
+#define KW01_DIO0_RX_CRCOK	0x00	/* RX: CRC ok */
+#define KW01_DIO0_RX_PAYLOADRDY	0x40	/* RX: payload ready */
+#define KW01_DIO0_TX_PACKETSENT	0x00	/* TX: packet sent */
+#define KW01_DIO0_TX_TXREADY	0x40	/* TX: TX ready */
+
 /* Digital I/O pin mapping register 2 */
 
 #define KW01_DIOMAP2_DIO4MAP	0xC0	/* DIO4 mapping */
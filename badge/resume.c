@@ -0,0 +1,186 @@
+/*-
+ * Copyright (c) 2017
+ *      Bill Paul <wpaul@windriver.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Bill Paul.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Bill Paul AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL Bill Paul OR THE VOICES IN HIS HEAD
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module keeps track of where the user stopped playing a video or
+ * song, so that playback can be resumed later. Each clip gets its own
+ * sidecar file, named after the clip with the extension replaced by
+ * .RS and the first letter of the old one. We use separate files rather
+ * than the userconfig block so that the positions follow the SD card
+ * around, and so that we don't wear out the flash every time someone
+ * stops a video.
+ */
+
+#include "ch.h"
+#include "hal.h"
+
+#include "ff.h"
+#include "ffconf.h"
+
+#include "resume.h"
+
+#include <string.h>
+
+/******************************************************************************
+*
+* resume_name - build the sidecar file name for a clip
+*
+* This function copies the name of the clip <fname> into <buf>, which is
+* <len> bytes long, replacing its extension with RESUME_EXT and the first
+* letter of the old extension. The clip's extension is also copied into
+* <ext>, padded out with NULs, so that it can be checked against the
+* record in the sidecar. Since we don't use long file names, the result
+* always fits in 13 bytes.
+*
+* RETURNS: 0 on success, or -1 if the name is too long
+*/
+
+static int
+resume_name (char * fname, char * buf, int len, char * ext)
+{
+	char * p;
+	int n;
+
+	memset (ext, 0, RESUME_EXTLEN);
+
+	p = strrchr (fname, '.');
+	if (p == NULL)
+		n = strlen (fname);
+	else {
+		n = p - fname;
+		strncpy (ext, p + 1, RESUME_EXTLEN - 1);
+	}
+
+	if (n + strlen (RESUME_EXT) + 2 > (unsigned)len)
+		return (-1);
+
+	memcpy (buf, fname, n);
+	strcpy (buf + n, RESUME_EXT);
+	n += strlen (RESUME_EXT);
+	buf[n] = ext[0] == '\0' ? RESUME_NOEXT : ext[0];
+	buf[n + 1] = '\0';
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* resume_read - read the position from a sidecar file
+*
+* This function reads the record in the sidecar file <name>, and checks
+* that it was written for a clip with the extension <ext>.
+*
+* RETURNS: the saved position, or 0 if there isn't one for this clip
+*/
+
+static uint32_t
+resume_read (char * name, char * ext)
+{
+	RESUME_REC rec;
+	FIL f;
+	UINT br;
+
+	if (f_open (&f, name, FA_READ) != FR_OK)
+		return (0);
+
+	if (f_read (&f, &rec, sizeof(rec), &br) != FR_OK ||
+	    br != sizeof(rec) || rec.rr_magic != RESUME_MAGIC ||
+	    memcmp (rec.rr_ext, ext, sizeof(rec.rr_ext)) != 0)
+		rec.rr_pos = 0;
+
+	f_close (&f);
+
+	return (rec.rr_pos);
+}
+
+/******************************************************************************
+*
+* resumeGet - get the saved playback position for a clip
+*
+* This function looks for the sidecar file for the clip <fname> and
+* returns the position stored in it.
+*
+* RETURNS: the saved position, or 0 if there isn't one
+*/
+
+uint32_t
+resumeGet (char * fname)
+{
+	char name[13];
+	char ext[RESUME_EXTLEN];
+
+	if (resume_name (fname, name, sizeof(name), ext) != 0)
+		return (0);
+
+	return (resume_read (name, ext));
+}
+
+/******************************************************************************
+*
+* resumeSave - save the playback position for a clip
+*
+* This function records <pos> as the position to resume the clip <fname>
+* from. A position of 0 means the clip should start from the beginning
+* next time, in which case we just remove the sidecar file, if there
+* is one and it belongs to this clip.
+*
+* RETURNS: N/A
+*/
+
+void
+resumeSave (char * fname, uint32_t pos)
+{
+	RESUME_REC rec;
+	char name[13];
+	FIL f;
+	UINT bw;
+
+	if (resume_name (fname, name, sizeof(name), rec.rr_ext) != 0)
+		return;
+
+	if (pos == 0) {
+		if (resume_read (name, rec.rr_ext) != 0)
+			f_unlink (name);
+		return;
+	}
+
+	if (f_open (&f, name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+		return;
+
+	rec.rr_magic = RESUME_MAGIC;
+	rec.rr_pos = pos;
+
+	f_write (&f, &rec, sizeof(rec), &bw);
+	f_close (&f);
+
+	return;
+}
@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2017
+ *      Bill Paul <wpaul@windriver.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Bill Paul.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Bill Paul AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL Bill Paul OR THE VOICES IN HIS HEAD
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RESUME_H_
+#define _RESUME_H_
+
+/*
+ * Playback resume support. The position at which a long clip was
+ * interrupted is kept in a small sidecar file next to it on the SD
+ * card, so that the next time it's played it can pick up where it left
+ * off. The sidecar has the same base name, and an extension of .RS
+ * followed by the first letter of the clip's own extension, so that
+ * FOO.VID and FOO.RAW get FOO.RSV and FOO.RSR. The record also holds
+ * the clip's whole extension, and a record for some other type of clip
+ * that happens to map to the same sidecar is ignored. Positions are
+ * opaque to this module: the video player uses frame numbers, and the
+ * music player uses sample numbers.
+ */
+
+#define RESUME_EXT		".RS"
+#define RESUME_NOEXT		'_'		/* Clip has no extension */
+#define RESUME_MAGIC		0x324D5352	/* "RSM2" */
+#define RESUME_EXTLEN		4
+
+typedef struct resume_rec {
+	uint32_t	rr_magic;
+	char		rr_ext[RESUME_EXTLEN];	/* Clip's extension */
+	uint32_t	rr_pos;
+} RESUME_REC;
+
+extern uint32_t resumeGet (char *);
+extern void resumeSave (char *, uint32_t);
+
+#endif /* _RESUME_H_ */
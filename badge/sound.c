@@ -191,11 +191,11 @@ void playDefeat(void) {
 }
 
 void playDodge(void) {
-  /* played when you dodge an attack */
-  dacPlay("fight/clank1.raw");
+  /* played when you dodge an attack, over whatever else is playing */
+  dacVoicePlay("fight/clank1.raw", DAC_GAIN_UNITY);
 }
 
 void playHit(void) {
-  /* played when you're hit */
-  dacPlay("fight/hit1.raw");
+  /* played when you're hit, over whatever else is playing */
+  dacVoicePlay("fight/hit1.raw", DAC_GAIN_UNITY);
 }
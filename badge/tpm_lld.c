@@ -51,6 +51,12 @@
  * note has a duration of PWM_DURATION_LOOP, the same tune will play
  * over and over until pwmThreadPlay(NULL) is called.
  *
+ * Tunes can also be played straight from Standard MIDI Files on the SD
+ * card with pwmFileThreadPlay(). Since that involves reading the card, it
+ * runs in a thread of its own, created when the file is played, which
+ * schedules each note against the time the song started so the tempo
+ * doesn't drift.
+ *
  * The TPM includes a pre-scaler feature which we make use of here. We
  * want to use the TPM to generate a pulse train at audio frequencies.
  * When using the 48MHz system clock as the TPM timer source, the divisor
@@ -69,6 +75,9 @@
 #include "kinetis_tpm.h"
 #include "userconfig.h"
 
+#include "ff.h"
+#include "midi.h"
+
 /*
  * This table represents the 127 available MIDI note frequencies.
  * Using this table allows us to specify nots using a single byte.
@@ -102,6 +111,22 @@ static PWM_NOTE * pTune;
 static uint8_t play;
 static thread_t * pThread;
 
+/*
+ * The MIDI file player needs room on its stack for reading the SD card.
+ * While a long note or rest plays, it wakes up every PWM_FILE_SLICE
+ * ticks to see if it's been told to stop.
+ */
+
+#define PWM_FILE_STACK		512
+#define PWM_FILE_SLICE		MS2ST(20)
+
+/* Notes lower than this are too low for the TPM, so play them higher */
+
+#define PWM_NOTE_LOWEST		24
+
+static thread_t * pFileThread;
+static volatile uint8_t fileplay;
+
 #ifdef REV2_RADIO_WAR
 #include "radio_lld.h"
 
@@ -381,6 +406,7 @@ pwmThreadPlay (const PWM_NOTE * p)
 	 * our next command to play a tune might be ignored.
 	 */
 
+	pwmFileStop ();
 	play = 0;
 
 	if (p == NULL)
@@ -394,3 +420,160 @@ pwmThreadPlay (const PWM_NOTE * p)
 
 	return;
 }
+
+/******************************************************************************
+*
+* pwmFileThread - play a MIDI file
+*
+* This thread plays the notes from the MIDI file opened in <arg> until
+* the song ends or fileplay is cleared. Each note is due at a time
+* measured from the start of the song, so time spent reading the SD card
+* doesn't add up over the course of a song: if we fall behind, the next
+* notes are simply played late until we catch up. The buzzer can only
+* play one note at a time, so a new note cuts off the one playing, and a
+* note off only stops the note it belongs to. Percussion is ignored.
+*
+* When the song is done the thread closes the file, frees it and exits.
+* Its own memory is freed by whoever calls pwmFileStop() next.
+*
+* RETURNS: N/A
+*/
+
+static
+THD_FUNCTION(pwmFileThread, arg)
+{
+	MIDI_FILE * m;
+	MIDI_EVENT ev;
+	systime_t start;
+	systime_t prev;
+	systime_t next;
+	systime_t due;
+	int note;
+	int tone;
+
+	m = arg;
+	note = -1;
+
+	chRegSetThreadName ("pwmfile");
+
+	start = chVTGetSystemTime ();
+	prev = start;
+
+	while (fileplay && midiNext (m, &ev) == 0) {
+		if (ev.me_chan == MIDI_CHAN_DRUMS)
+			continue;
+
+		/*
+		 * Sleep until the note is due, a slice at a time. If
+		 * we're already late, the windowed sleep returns at
+		 * once.
+		 */
+
+		due = start + (systime_t)(((uint64_t)ev.me_usecs *
+		    CH_CFG_ST_FREQUENCY) / 1000000);
+
+		while (fileplay && prev != due) {
+			next = due;
+			if (next - prev > PWM_FILE_SLICE)
+				next = prev + PWM_FILE_SLICE;
+			prev = chThdSleepUntilWindowed (prev, next);
+		}
+
+		if (ev.me_type == MIDI_EV_NOTE_ON) {
+			note = ev.me_note;
+			tone = note;
+			while (tone < PWM_NOTE_LOWEST)
+				tone += 12;
+			pwmToneStart (tone);
+		} else if (ev.me_note == note) {
+			pwmToneStop ();
+			note = -1;
+		}
+	}
+
+	pwmToneStop ();
+	midiClose (m);
+	chHeapFree (m);
+
+	return;
+}
+
+/******************************************************************************
+*
+* pwmFileStop - stop playing a MIDI file
+*
+* This function stops the MIDI file player, if it's running, and waits
+* for its thread to exit. This is also where the thread's memory is freed
+* if the song already finished by itself.
+*
+* RETURNS: N/A
+*/
+
+void
+pwmFileStop (void)
+{
+	fileplay = 0;
+
+	if (pFileThread == NULL)
+		return;
+
+	chThdWait (pFileThread);
+	pFileThread = NULL;
+
+	return;
+}
+
+/******************************************************************************
+*
+* pwmFileThreadPlay - play a MIDI file using a background thread
+*
+* This function starts playing the Standard MIDI File <fname> from the SD
+* card on the buzzer, stopping whatever tune or file was playing before.
+* The file is read a little at a time as it plays, so songs of any length
+* can be played without using up flash or much RAM. Calling
+* pwmThreadPlay(NULL) or pwmFileStop() stops it.
+*
+* RETURNS: 0 if the file started playing, or -1 if sound is turned off,
+*          the file can't be used or there isn't enough memory
+*/
+
+int
+pwmFileThreadPlay (const char * fname)
+{
+	userconfig * config;
+	MIDI_FILE * m;
+
+	/* Stop anything that's playing and wait for it to finish. */
+
+	pwmFileStop ();
+	play = 0;
+	while (pTune != NULL)
+		chThdSleepMicroseconds(1);
+
+	config = getConfig ();
+	if (config->sound_enabled == 0)
+		return (-1);
+
+	m = chHeapAlloc (NULL, sizeof(MIDI_FILE));
+	if (m == NULL)
+		return (-1);
+
+	if (midiOpen (m, fname) != 0) {
+		chHeapFree (m);
+		return (-1);
+	}
+
+	fileplay = 1;
+	pFileThread = chThdCreateFromHeap (NULL,
+	    THD_WORKING_AREA_SIZE(PWM_FILE_STACK), TPM_THREAD_PRIO,
+	    pwmFileThread, m);
+
+	if (pFileThread == NULL) {
+		fileplay = 0;
+		midiClose (m);
+		chHeapFree (m);
+		return (-1);
+	}
+
+	return (0);
+}
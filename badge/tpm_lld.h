@@ -84,7 +84,6 @@ typedef struct pwm_note {
 
 #define PWM_BUFSIZ		8
 
-#define pwmFileThreadPlay(x)
 #define pwmChanThreadPlay(x,y,z) pwmThreadPlay(x)
 /* TPM note player thread priority */
 
@@ -96,5 +95,7 @@ extern void pwmToneStart (uint8_t);
 extern void pwmToneStop (void);
 
 extern void pwmThreadPlay (const PWM_NOTE *);
+extern int pwmFileThreadPlay (const char *);
+extern void pwmFileStop (void);
 
 #endif /* _TPM_H_ */
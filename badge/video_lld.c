@@ -103,16 +103,72 @@
  * (which is the resulution limit of the DAC). Finally, another custom
  * program combines the raw video and audio samples together.
  *
- * If the SD card is too slow, things will still work, but there will be
- * pauses between the audio samples, which will make things sound choppy
- * or warbly. To compensate for this, an optional feature is available
- * which allows us to detect if we are processing samples faster than
- * we can load new ones, and if so we reduce the interval timer
- * frequency until we hit a rate that we can sustain. Hopefully this
- * condition should not arise very often with the production hardware.
- * With the currently available SD card I/O bandwidth, we no don't have
- * any problems keeping up, so this feature is disabled by default to
- * conserve code size.
+ * Version 2 video files add a small header and an optional delta codec.
+ * Each pair of scanlines is coded as runs of pixels which are either
+ * unchanged from the previous frame, repeated, or stored literally (see
+ * video_lld.h for the details). We don't have enough RAM to keep a copy
+ * of the previous frame, but we don't need one: the display controller
+ * already has it. Unchanged pixels are simply never redrawn, and only
+ * the spans of each scanline that changed are sent to the screen, using
+ * a display window sized to fit each span. For typical clips this cuts
+ * the amount of data read from the SD card per frame by more than half,
+ * which lets us play at higher frame rates. The frame rate is stored in
+ * the header, and the number of audio samples in each chunk scales
+ * with it. Files with no header are assumed to be version 1 files and
+ * are played exactly as before.
+ *
+ * The palette codec goes the other way: it still redraws every pixel,
+ * but stores each one as an 8-bit index into a palette of up to 256
+ * colors which is sent once per frame or group of frames. That halves
+ * the amount of data read for each frame. The indexes are expanded
+ * through the palette into the scanline buffer before being drawn, so
+ * the drawing side works exactly as it does for 16-bit video. The
+ * video shell command shows the frame rate achieved with each codec so
+ * that they can be compared.
+ *
+ * The header can also describe a frame size and audio sample rate other
+ * than 128x96 and 9216Hz. Full screen playback supports three frame sizes,
+ * each with its own blit routine: 320x240 is drawn as is using DMA,
+ * 160x120 is simply doubled, and 128x96 uses the 2.5 cadence described
+ * above. Video played in a window is always drawn at its native size.
+ * The interval timer is reprogrammed for the audio rate of each file, so
+ * the only requirement is that the rate works out to a whole number of
+ * samples for each pair of scanlines.
+ *
+ * The audio in each chunk may also be stored as a block of IMA ADPCM
+ * samples, using the same block layout as ADPCM sound files. Each block
+ * carries its own decoder state, so seeking works the same way as with
+ * 12-bit samples. This shrinks the audio part of each chunk by nearly a
+ * factor of four, which matters most at small frame sizes where the audio
+ * is a big part of each chunk.
+ *
+ * Reading from the SD card is handled by a separate reader thread, which
+ * runs at a slightly higher priority than the caller and keeps a small
+ * set of buffers filled with data from the file. The player consumes
+ * data from these buffers as it decodes. This lets SD card reads overlap
+ * with decoding, and with the time the player spends waiting for the
+ * audio to catch up. We count how often each side has to wait on the
+ * other (see VID_STATS), which tells us whether the SD card or the
+ * display is holding things up.
+ *
+ * The audio is the master clock. The DAC keeps a count of the samples it
+ * has played, and each chunk has a presentation time: the position of its
+ * first audio sample in the stream. Because the audio is double buffered,
+ * each chunk should be drawn while the block of audio before its own is
+ * playing, so we aim to draw it one block ahead of its presentation time.
+ * If the player falls more than VID_SYNC_SKEW samples behind that, because
+ * the SD card or the display can't keep up, the chunk is dropped: it's
+ * still read and its audio still queued, but it isn't drawn. This frees up
+ * time (and the SPI bus) for reading, so the audio keeps playing at the
+ * right pitch instead of stuttering. Dropped raw and palette coded lines
+ * are redrawn with the next frame, while dropped delta coded lines stay
+ * stale until the next keyframe. If the player gets more than
+ * VID_SYNC_SKEW samples ahead, the chunk is held back, leaving the last
+ * picture on the screen until the audio catches up, so that the video
+ * moves smoothly instead of in bursts. The number of chunks dropped and
+ * held, and the number of times the audio ran dry, are kept in VID_STATS,
+ * which together with the number of bytes read shows how much a given
+ * card can really sustain.
  */
 
 #include "ch.h"
@@ -133,9 +189,16 @@
 
 #include "src/gdisp/gdisp_driver.h"
 
-/* Enable this if SD card I/O is too slow. */
+#include "video_lld.h"
+
+#include <string.h>
+
+/*
+ * Enable this to scale video up by writing each pixel to the SPI
+ * controller by hand instead of using DMA, for comparison.
+ */
 
-#undef VIDEO_AUTO_RATE_ADJUST
+#undef VIDEO_PIO_BLIT
 
 #define SAMPLE_CHUNKS		32
 #define SAMPLES_PER_LINE	12
@@ -155,6 +218,380 @@
 
 #define SAMPLE_INTERVAL		((SAMPLE_CHUNKS / 4) - 1)
 
+/*
+ * How far, in audio samples, the video may drift from the audio before
+ * chunks are dropped or held back. The default is an eighth of a play
+ * buffer, or about 2.6ms at 9216Hz. Larger values drop fewer chunks
+ * when the player can't keep up, but let the audio run dry more often.
+ */
+
+#define VID_SYNC_SKEW		(SAMPLES_PER_PLAY / 8)
+
+/*
+ * Limits on what a version 2 header may describe. The width is limited by
+ * the display, the number of audio samples per chunk by how much RAM we're
+ * willing to set aside for them, and the sample rate by how often we're
+ * willing to take a PIT interrupt.
+ */
+
+#define VID_WIDTH_MAX		320
+#define VID_SAMPLES_MAX		48
+#define VID_RATE_MIN		4000
+#define VID_RATE_MAX		16000
+
+/*
+ * Size of the FatFs fast seek cluster map, in DWORDs. This covers
+ * files split into up to 7 fragments, which is plenty for a card that
+ * was filled by copying files onto it. More fragmented files just
+ * fall back to following the FAT chain.
+ */
+
+#define VID_CLMT_SIZE		16
+
+/* How far a touch on the left or right edge of the screen skips */
+
+#define VID_SEEK_SECS		10
+
+/*
+ * Read-ahead buffers. Each buffer is one SD card sector so that FatFs
+ * can read straight into it. Two buffers is enough to let the reader
+ * and renderer run in parallel; more can be used to ride out slow
+ * cards if there's enough heap.
+ */
+
+#define VID_READ_BUFS		2
+#define VID_READ_BUFSZ		512
+#define VID_READ_STACK		512
+
+/*
+ * Map a source pixel column or scanline to its position on the display
+ * when upscaling by 2.5. Odd pixels are drawn three times and even pixels
+ * twice. Scanlines are drawn in pairs: the lines in even numbered pairs
+ * are drawn twice and the lines in odd numbered pairs are drawn three
+ * times, so every two pairs of lines covers 10 display rows.
+ */
+
+#define VID_SCALE_X(x)		(((x) * 2) + ((x) >> 1))
+#define VID_SCALE_REPS(l)	((((l) >> 1) & 1) ? 3 : 2)
+#define VID_SCALE_Y(l)		((((l) >> 2) * 10) +			\
+				(((l) >> 1) & 1) * 4 +			\
+				((l) & 1) * VID_SCALE_REPS(l))
+
+typedef struct vid_reader {
+	FIL *		vr_file;
+	uint8_t *	vr_buf;
+	UINT		vr_len[VID_READ_BUFS];
+	semaphore_t	vr_full;
+	semaphore_t	vr_empty;
+	thread_t *	vr_thread;
+	volatile uint8_t vr_stop;
+	uint8_t		vr_eof;
+	uint8_t		vr_have;
+	uint8_t		vr_head;
+	uint8_t		vr_tail;
+	UINT		vr_pos;
+} VID_READER;
+
+/*
+ * Playback parameters for a video file, worked out from its header. The
+ * blit routine draws part of a source scanline, scaling it up to fill the
+ * screen if needed.
+ */
+
+struct vid_format;
+
+typedef void (*vid_blit_t)(struct vid_format *, pixel_t *, int, int, int);
+
+typedef struct vid_format {
+	uint8_t		vf_codec;
+	uint8_t		vf_fps;
+	uint16_t	vf_width;
+	uint16_t	vf_height;
+	uint16_t	vf_rate;
+	uint16_t	vf_spc;
+	uint16_t	vf_abytes;
+	uint16_t	vf_frames;
+	uint8_t		vf_keyint;
+	uint8_t		vf_flags;
+	UINT		vf_chunk;
+	FSIZE_t		vf_data;
+	FSIZE_t		vf_index;
+	int16_t		vf_x;
+	int16_t		vf_y;
+	pixel_t *	vf_xbuf;
+	vid_blit_t	vf_blit;
+} VID_FORMAT;
+
+VID_STATS videoStats;
+VID_CODEC_STATS videoCodecStats[VID_CODECS];
+
+/******************************************************************************
+*
+* vidReadThread - video read-ahead thread
+*
+* This function implements the reader side of the video pipeline. It waits
+* for an empty buffer, fills it from the file with f_read(), and then hands
+* it to the renderer. A buffer with a length of 0 marks the end of the
+* file, after which the thread exits. The thread also exits if the renderer
+* sets the vr_stop flag.
+*
+* RETURNS: N/A
+*/
+
+static
+THD_FUNCTION(vidReadThread, arg)
+{
+	VID_READER * rd;
+	UINT br;
+
+	rd = arg;
+
+	chRegSetThreadName ("vidread");
+
+	while (1) {
+		if (chSemWaitTimeout (&rd->vr_empty,
+		    TIME_IMMEDIATE) == MSG_TIMEOUT) {
+			videoStats.vs_stalls++;
+			chSemWait (&rd->vr_empty);
+		}
+
+		if (rd->vr_stop)
+			break;
+
+		if (f_read (rd->vr_file,
+		    rd->vr_buf + (rd->vr_head * VID_READ_BUFSZ),
+		    VID_READ_BUFSZ, &br) != FR_OK)
+			br = 0;
+
+		rd->vr_len[rd->vr_head] = br;
+		rd->vr_head++;
+		if (rd->vr_head == VID_READ_BUFS)
+			rd->vr_head = 0;
+		videoStats.vs_bytes += br;
+
+		chSemSignal (&rd->vr_full);
+
+		if (br == 0)
+			break;
+	}
+
+	return;
+}
+
+/******************************************************************************
+*
+* vid_read - read data from the video read-ahead buffers
+*
+* This function copies <len> bytes of file data from the read-ahead buffers
+* into <dst>, waiting for the reader thread to fill more buffers as needed.
+* Each time a buffer is emptied, it's handed back to the reader thread.
+*
+* RETURNS: the number of bytes copied, which is less than <len> only at the
+* end of the file
+*/
+
+__attribute__((section(".textextra")))
+static UINT
+vid_read (VID_READER * rd, void * dst, UINT len)
+{
+	uint8_t * p;
+	UINT done;
+	UINT cnt;
+	cnt_t occ;
+
+	p = dst;
+	done = 0;
+
+	while (len) {
+		if (rd->vr_have == 0) {
+			if (rd->vr_eof)
+				break;
+
+			osalSysLock ();
+			occ = chSemGetCounterI (&rd->vr_full);
+			osalSysUnlock ();
+
+			if (occ < videoStats.vs_occmin)
+				videoStats.vs_occmin = occ;
+			if (occ > videoStats.vs_occmax)
+				videoStats.vs_occmax = occ;
+			videoStats.vs_occsum += occ;
+			videoStats.vs_fills++;
+
+			if (occ == 0)
+				videoStats.vs_underruns++;
+
+			chSemWait (&rd->vr_full);
+
+			rd->vr_have = 1;
+			rd->vr_pos = 0;
+
+			if (rd->vr_len[rd->vr_tail] == 0) {
+				rd->vr_eof = 1;
+				break;
+			}
+		}
+
+		cnt = rd->vr_len[rd->vr_tail] - rd->vr_pos;
+		if (cnt > len)
+			cnt = len;
+
+		memcpy (p, rd->vr_buf + (rd->vr_tail * VID_READ_BUFSZ) +
+		    rd->vr_pos, cnt);
+
+		p += cnt;
+		len -= cnt;
+		done += cnt;
+		rd->vr_pos += cnt;
+
+		if (rd->vr_pos == rd->vr_len[rd->vr_tail]) {
+			rd->vr_have = 0;
+			rd->vr_tail++;
+			if (rd->vr_tail == VID_READ_BUFS)
+				rd->vr_tail = 0;
+			chSemSignal (&rd->vr_empty);
+		}
+	}
+
+	return (done);
+}
+
+/******************************************************************************
+*
+* vid_reader_start - start the video read-ahead thread
+*
+* This function initializes the read-ahead state in <rd> for the already
+* open file <f>, allocates the buffers, and starts the reader thread at
+* one priority level above the calling thread.
+*
+* RETURNS: 0 on success, or -1 if we ran out of memory
+*/
+
+__attribute__((section(".textextra")))
+static int
+vid_reader_start (VID_READER * rd, FIL * f)
+{
+	memset (rd, 0, sizeof(VID_READER));
+
+	rd->vr_file = f;
+	rd->vr_buf = chHeapAlloc (NULL, VID_READ_BUFS * VID_READ_BUFSZ);
+
+	if (rd->vr_buf == NULL)
+		return (-1);
+
+	chSemObjectInit (&rd->vr_full, 0);
+	chSemObjectInit (&rd->vr_empty, VID_READ_BUFS);
+
+	rd->vr_thread = chThdCreateFromHeap (NULL,
+	    THD_WORKING_AREA_SIZE(VID_READ_STACK),
+	    chThdGetPriorityX () + 1, vidReadThread, rd);
+
+	if (rd->vr_thread == NULL) {
+		chHeapFree (rd->vr_buf);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* vid_bufs_free - release the playback buffers
+*
+* This function frees the buffers videoWinPlayAt() allocates for the
+* video data, the decoded scanline, the palette, the scaling blits and
+* the audio samples. Any of them may be NULL, either because the file
+* doesn't need it or because we ran out of memory before getting to it.
+*
+* RETURNS: N/A
+*/
+
+__attribute__((section(".textextra")))
+static void
+vid_bufs_free (VID_FORMAT * vf, pixel_t * buf, pixel_t * line, pixel_t * pal)
+{
+	if (buf != NULL)
+		chHeapFree (buf);
+	if (line != NULL)
+		chHeapFree (line);
+	if (pal != NULL)
+		chHeapFree (pal);
+	if (vf->vf_xbuf != NULL) {
+		chHeapFree (vf->vf_xbuf);
+		vf->vf_xbuf = NULL;
+	}
+	if (dacBuf != NULL) {
+		chHeapFree (dacBuf);
+		dacBuf = NULL;
+	}
+
+	return;
+}
+
+/******************************************************************************
+*
+* vid_reader_stop - stop the video read-ahead thread
+*
+* This function tells the reader thread to exit, waits for it to do so,
+* and releases the read-ahead buffers. If the reader is blocked waiting
+* for an empty buffer, we signal the empty semaphore to wake it up so
+* it can notice the stop flag. It's safe to call this on a reader that
+* has already been stopped, or that failed to start.
+*
+* RETURNS: N/A
+*/
+
+__attribute__((section(".textextra")))
+static void
+vid_reader_stop (VID_READER * rd)
+{
+	if (rd->vr_thread == NULL)
+		return;
+
+	rd->vr_stop = 1;
+	chSemSignal (&rd->vr_empty);
+	chThdWait (rd->vr_thread);
+	chHeapFree (rd->vr_buf);
+	rd->vr_thread = NULL;
+
+	return;
+}
+
+/******************************************************************************
+*
+* vid_cycles - read a free-running CPU cycle count
+*
+* The Cortex-M0+ has no DWT cycle counter, so we build one from the
+* system tick: the number of ticks so far times the SysTick reload value,
+* plus however far the SysTick timer has counted down into the current
+* tick. If the timer has wrapped but the tick interrupt hasn't been
+* serviced yet, we account for the pending tick ourselves. The count
+* wraps every 89 seconds or so at 48MHz, which is fine for timing short
+* operations.
+*
+* RETURNS: the current cycle count
+*/
+
+__attribute__((section(".textextra")))
+static uint32_t
+vid_cycles (void)
+{
+	uint32_t ticks;
+	uint32_t val;
+
+	osalSysLock ();
+	val = SysTick->VAL;
+	ticks = chVTGetSystemTimeX ();
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+		val = SysTick->VAL;
+		ticks++;
+	}
+	osalSysUnlock ();
+
+	return ((ticks * (SysTick->LOAD + 1)) + (SysTick->LOAD - val));
+}
+
+#ifdef VIDEO_PIO_BLIT
 /******************************************************************************
 *
 * write_pixel - write pixel data to the display
@@ -187,72 +624,529 @@ write_pixel (pixel_t p1, int textextra)
 
         return;
 }
+#else
+/******************************************************************************
+*
+* vid_send - send a scanline to the display with DMA
+*
+* This function sends the <n> pixels in <p> to the display <reps> times
+* in a row using DMA, and keeps track of how long we spend waiting for the
+* transfers. The calling thread sleeps while each transfer is in progress,
+* so this time is available to other threads.
+*
+* RETURNS: N/A
+*/
+
+__attribute__((section(".textextra")))
+static void
+vid_send (pixel_t * p, int n, int reps)
+{
+	uint32_t t;
+
+	t = vid_cycles ();
+	while (reps--)
+		dmaSend16 (p, n * sizeof(pixel_t));
+	videoStats.vs_dmacyc += vid_cycles () - t;
+
+	return;
+}
+#endif
 
 /******************************************************************************
 *
-* draw_lines - draw video scanlines on the display
+* draw_span_25x - draw part of a scanline upscaled by 2.5
 *
-* This is a helper function which takes one scanline's worth of data read
-* from a video file and draws it to the screen. The <buf> argument is a
-* pointer to a buffer containing 16-bit pixel data. The size is assumed
-* to be the encoded horizontal video width (which is currently 128 pixels).
+* This is the blit routine for 128x96 video played full screen. It draws
+* the pixels between columns <x0> and <x1> (exclusive) from the scanline
+* buffer <line>, which holds source scanline number <l> of the current frame.
+* A display window is programmed to cover just this span, so that the
+* pixels around it are left alone. This is what lets the delta decoder skip
+* over pixels that haven't changed since the last frame.
 *
 * Since the video is 128x96 pixels and the display is 320x240, we upscale
 * each scanline by a factor of 2.5 so that we fill the whole screen. Each
-* scanline is drawn at least twice. If the <textextra> argument is non-zero,
-* the scanline is drawn a third time as well. This results in each line
-* being drawn 2.5 times. The write_pixel() function used to place each
-* pixel on the screen uses a similar transformation.
-*
-* Note that we manually draw the pixels rather than using DMA to draw each
-* display line. This is an intentional design trade-off. Since we perform
-* a transformation on each scanline before writing it to the screen, we
-* would have to allocate an additional RAM buffer and put the formatted
-* pixel data therebefore we could use a DMA transfer to write it to the
-* display. It turns out writing to the display without DMA is still fast
-* enough that we can get away without doing that.
+* scanline is drawn at least twice, and the lines in every other pair of
+* scanlines are drawn a third time. This results in each line being drawn
+* 2.5 times. Pixels are stretched the same way: even pixels are drawn
+* twice and odd pixels three times.
+*
+* We stretch the span into the expansion buffer once, and then send it to
+* the display with DMA as many times as the line needs to be repeated.
+* Writing each pixel by hand with write_pixel() instead keeps the CPU busy
+* spinning on the SPI controller for the whole line, which leaves nothing
+* for the reader thread or anyone else. That method can still be selected
+* with VIDEO_PIO_BLIT for comparison.
 *
 * RETURNS: N/A
 */
 
 __attribute__((section(".textextra")))
 static void
-draw_lines (pixel_t * buf, int textextra)
+draw_span_25x (VID_FORMAT * vf, pixel_t * line, int l, int x0, int x1)
 {
-	uint8_t p;
+	uint32_t t;
+	int reps;
+	int p;
+#ifndef VIDEO_PIO_BLIT
+	pixel_t * d;
+#endif
+
+	t = vid_cycles ();
+
+	reps = VID_SCALE_REPS(l);
+
+	GDISP->p.x = VID_SCALE_X(x0);
+	GDISP->p.y = VID_SCALE_Y(l);
+	GDISP->p.cx = VID_SCALE_X(x1) - GDISP->p.x;
+	GDISP->p.cy = reps;
 
-	for (p = 0; p < FRAMERES_HORIZONTAL; p++) {
-		write_pixel (buf[p], p & 1);
+#ifdef VIDEO_PIO_BLIT
+	(void)vf;
+	gdisp_lld_write_start (GDISP);
+	while (reps--) {
+		for (p = x0; p < x1; p++)
+			write_pixel (line[p], p & 1);
+	}
+	gdisp_lld_write_stop (GDISP);
+#else
+	d = vf->vf_xbuf;
+	for (p = x0; p < x1; p++) {
+		*d++ = line[p];
+		*d++ = line[p];
+		if (p & 1)
+			*d++ = line[p];
 	}
 
-	for (p = 0; p < FRAMERES_HORIZONTAL; p++) {
-		write_pixel (buf[p], p & 1);
+	gdisp_lld_write_start (GDISP);
+	vid_send (vf->vf_xbuf, GDISP->p.cx, reps);
+	gdisp_lld_write_stop (GDISP);
+#endif
+
+	videoStats.vs_blitcyc += vid_cycles () - t;
+
+	return;
+}
+
+/******************************************************************************
+*
+* draw_span_2x - draw part of a scanline upscaled by 2
+*
+* This is the blit routine for 160x120 video played full screen. It works
+* just like draw_span_25x(), except that every pixel and every scanline is
+* simply drawn twice.
+*
+* RETURNS: N/A
+*/
+
+__attribute__((section(".textextra")))
+static void
+draw_span_2x (VID_FORMAT * vf, pixel_t * line, int l, int x0, int x1)
+{
+	uint32_t t;
+	int p;
+#ifndef VIDEO_PIO_BLIT
+	pixel_t * d;
+#endif
+
+	t = vid_cycles ();
+
+	GDISP->p.x = x0 * 2;
+	GDISP->p.y = l * 2;
+	GDISP->p.cx = (x1 - x0) * 2;
+	GDISP->p.cy = 2;
+
+#ifdef VIDEO_PIO_BLIT
+	(void)vf;
+	gdisp_lld_write_start (GDISP);
+	for (p = x0; p < x1; p++)
+		write_pixel (line[p], 0);
+	for (p = x0; p < x1; p++)
+		write_pixel (line[p], 0);
+	gdisp_lld_write_stop (GDISP);
+#else
+	d = vf->vf_xbuf;
+	for (p = x0; p < x1; p++) {
+		*d++ = line[p];
+		*d++ = line[p];
 	}
 
-	if (textextra) {
-		for (p = 0; p < FRAMERES_HORIZONTAL; p++) {
-			write_pixel (buf[p], p & 1);
+	gdisp_lld_write_start (GDISP);
+	vid_send (vf->vf_xbuf, GDISP->p.cx, 2);
+	gdisp_lld_write_stop (GDISP);
+#endif
+
+	videoStats.vs_blitcyc += vid_cycles () - t;
+
+	return;
+}
+
+/******************************************************************************
+*
+* draw_span_1x - draw part of a scanline at native resolution
+*
+* This is the blit routine for 320x240 video played full screen, and for
+* video of any size played in a window. No scaling is needed, so the
+* pixels are sent to the display straight from the scanline buffer using
+* DMA.
+*
+* RETURNS: N/A
+*/
+
+__attribute__((section(".textextra")))
+static void
+draw_span_1x (VID_FORMAT * vf, pixel_t * line, int l, int x0, int x1)
+{
+	uint32_t t;
+
+	t = vid_cycles ();
+
+	GDISP->p.x = vf->vf_x + x0;
+	GDISP->p.y = vf->vf_y + l;
+	GDISP->p.cx = x1 - x0;
+	GDISP->p.cy = 1;
+
+	gdisp_lld_write_start (GDISP);
+#ifdef VIDEO_PIO_BLIT
+	dmaSend16 (line + x0, (x1 - x0) * sizeof(pixel_t));
+#else
+	vid_send (line + x0, x1 - x0, 1);
+#endif
+	gdisp_lld_write_stop (GDISP);
+
+	videoStats.vs_blitcyc += vid_cycles () - t;
+
+	return;
+}
+
+/******************************************************************************
+*
+* delta_line - decode and draw one delta coded scanline
+*
+* This function decodes the ops describing source scanline <l> starting at
+* <op>, expands them into the scanline buffer <line>, and draws each run of
+* changed pixels with the blit routine selected in <vf>. Consecutive run
+* and literal ops are merged into a single span so that we only program
+* one display window for each contiguous region of changed pixels. The
+* <end> argument marks the end of the valid coded data.
+*
+* RETURNS: pointer to the ops for the next scanline, or NULL if the coded
+* data is corrupt
+*/
+
+__attribute__((section(".textextra")))
+static uint16_t *
+delta_line (VID_FORMAT * vf, uint16_t * op, uint16_t * end, pixel_t * line,
+	int l)
+{
+	int start;
+	int cnt;
+	int p;
+
+	start = -1;
+	p = 0;
+
+	while (p < vf->vf_width) {
+		if (op >= end)
+			return (NULL);
+
+		cnt = *op & VID_OP_COUNT;
+		if (cnt == 0 || p + cnt > vf->vf_width)
+			return (NULL);
+
+		switch (*op & VID_OP_MASK) {
+		case VID_OP_SKIP:
+			if (start != -1) {
+				vf->vf_blit (vf, line, l, start, p);
+				start = -1;
+			}
+			op++;
+			break;
+		case VID_OP_RUN:
+			if (op + 1 >= end)
+				return (NULL);
+			if (start == -1)
+				start = p;
+			while (cnt--)
+				line[p + cnt] = op[1];
+			cnt = *op & VID_OP_COUNT;
+			op += 2;
+			break;
+		case VID_OP_LIT:
+			if (op + cnt >= end)
+				return (NULL);
+			if (start == -1)
+				start = p;
+			memcpy (line + p, op + 1, cnt * sizeof(pixel_t));
+			op += cnt + 1;
+			break;
+		default:
+			return (NULL);
 		}
+
+		p += cnt;
 	}
 
+	if (start != -1)
+		vf->vf_blit (vf, line, l, start, p);
+
+	return (op);
+}
+
+/******************************************************************************
+*
+* pal_line - expand and draw one palette coded scanline
+*
+* This function looks up each 8-bit pixel index in the scanline <idx> in
+* the palette <pal>, writes the resulting RGB565 pixels into the scanline
+* buffer <line>, and draws them as source scanline <l> with the blit
+* routine selected in <vf>.
+*
+* RETURNS: N/A
+*/
+
+__attribute__((section(".textextra")))
+static void
+pal_line (VID_FORMAT * vf, uint8_t * idx, pixel_t * pal, pixel_t * line,
+	int l)
+{
+	int p;
+
+	for (p = 0; p < vf->vf_width; p++)
+		line[p] = pal[idx[p]];
+
+	vf->vf_blit (vf, line, l, 0, vf->vf_width);
+
 	return;
 }
 
+/******************************************************************************
+*
+* vid_format - work out how to play a video file
+*
+* This function validates the header <hdr> of a version 2 video file and
+* fills in the playback parameters in <vf>. If <hdr> is NULL, the file is
+* a headerless version 1 file, and the original 128x96 8 frames per second
+* format is assumed. If <x> and <y> are both 0, the video is to be played
+* full screen, and the blit routine is chosen based on the frame size.
+* Otherwise the video is played at native resolution in a window at <x>
+* and <y>, which must fit on the screen.
+*
+* RETURNS: 0 if the file can be played, or -1 if not
+*/
+
+__attribute__((section(".textextra")))
+static int
+vid_format (VID_HEADER * hdr, VID_FORMAT * vf, int x, int y)
+{
+	int pairs;
+
+	vf->vf_codec = VID_CODEC_RAW;
+	vf->vf_fps = FRAMES_PER_SECOND;
+	vf->vf_width = FRAMERES_HORIZONTAL;
+	vf->vf_height = FRAMERES_VERTICAL;
+	vf->vf_rate = DAC_SAMPLERATE;
+	vf->vf_frames = 0;
+	vf->vf_keyint = 0;
+	vf->vf_flags = 0;
+	vf->vf_data = 0;
+	vf->vf_index = 0;
+	vf->vf_x = x;
+	vf->vf_y = y;
+	vf->vf_xbuf = NULL;
+
+	if (hdr != NULL) {
+		if (hdr->vh_version != VID_VERSION ||
+		    hdr->vh_codec >= VID_CODECS || hdr->vh_fps == 0)
+			return (-1);
+		vf->vf_codec = hdr->vh_codec;
+		vf->vf_fps = hdr->vh_fps;
+		if (hdr->vh_width != 0)
+			vf->vf_width = hdr->vh_width;
+		if (hdr->vh_height != 0)
+			vf->vf_height = hdr->vh_height;
+		if (hdr->vh_rate != 0)
+			vf->vf_rate = hdr->vh_rate;
+		vf->vf_frames = hdr->vh_frames;
+		vf->vf_keyint = hdr->vh_keyint;
+		vf->vf_flags = hdr->vh_flags;
+		vf->vf_data = sizeof(VID_HEADER);
+	}
+
+	if (vf->vf_height % LINE_RATE || vf->vf_width > VID_WIDTH_MAX ||
+	    vf->vf_rate < VID_RATE_MIN || vf->vf_rate > VID_RATE_MAX)
+		return (-1);
+
+	/*
+	 * The audio rate must work out to a whole number of
+	 * samples for each pair of scanlines.
+	 */
+
+	pairs = vf->vf_fps * (vf->vf_height / LINE_RATE);
+	vf->vf_spc = vf->vf_rate / pairs;
+
+	if (vf->vf_spc == 0 || vf->vf_spc > VID_SAMPLES_MAX ||
+	    vf->vf_spc * pairs != vf->vf_rate)
+		return (-1);
+
+	if (vf->vf_flags & VID_FLAG_ADPCM)
+		vf->vf_abytes = DAC_ADPCM_BYTES(vf->vf_spc);
+	else
+		vf->vf_abytes = vf->vf_spc * sizeof(uint16_t);
+
+	/* Raw chunks are always the same size */
+
+	vf->vf_chunk = vf->vf_width * LINE_RATE * sizeof(pixel_t) +
+	    vf->vf_abytes;
+
+	if (x != 0 || y != 0) {
+		if (x + vf->vf_width > gdispGetWidth () ||
+		    y + vf->vf_height > gdispGetHeight ())
+			return (-1);
+		vf->vf_blit = draw_span_1x;
+	} else if (vf->vf_width == 320 && vf->vf_height == 240)
+		vf->vf_blit = draw_span_1x;
+	else if (vf->vf_width == 160 && vf->vf_height == 120)
+		vf->vf_blit = draw_span_2x;
+	else if (vf->vf_width == 128 && vf->vf_height == 96)
+		vf->vf_blit = draw_span_25x;
+	else
+		return (-1);
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* vid_seek - move to a given frame in a video file
+*
+* This function positions the file <f> at the start of the frame <frame>
+* described by <vf>, or at the closest keyframe before it. Raw files can
+* be positioned at any frame, since all frames are the same size. Delta
+* and palette coded files can only be positioned at keyframes, which we
+* look up in the seek index at the end of the file. The read-ahead thread
+* must not be running while we do this.
+*
+* RETURNS: the number of the frame we moved to, or -1 if the file can't
+* be positioned there
+*/
+
+__attribute__((section(".textextra")))
+static int
+vid_seek (FIL * f, VID_FORMAT * vf, int frame)
+{
+	uint8_t b[4];
+	FSIZE_t ofs;
+	UINT br;
+
+	if (frame < 0)
+		frame = 0;
+
+	if (vf->vf_frames != 0 && frame >= vf->vf_frames)
+		return (-1);
+
+	if (vf->vf_codec == VID_CODEC_RAW) {
+		ofs = vf->vf_data + (FSIZE_t)frame *
+		    (vf->vf_height / LINE_RATE) * vf->vf_chunk;
+	} else {
+		if (vf->vf_index == 0)
+			return (-1);
+		frame -= frame % vf->vf_keyint;
+		if (f_lseek (f, vf->vf_index +
+		    (frame / vf->vf_keyint) * sizeof(b)) != FR_OK ||
+		    f_read (f, b, sizeof(b), &br) != FR_OK ||
+		    br != sizeof(b))
+			return (-1);
+		ofs = b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24);
+		if (ofs < vf->vf_data || ofs >= vf->vf_index)
+			return (-1);
+	}
+
+	if (f_lseek (f, ofs) != FR_OK)
+		return (-1);
+
+	return (frame);
+}
+
+/******************************************************************************
+*
+* videoCheck - check if a video file can be played
+*
+* This function reads the header of the video file specified by <fname> and
+* checks whether we know how to play it full screen. Files without a header
+* are assumed to be playable version 1 files. This allows applications to
+* weed out files we can't play before the user picks them.
+*
+* RETURNS: 0 if the file can be played, or -1 if not
+*/
+
+__attribute__((section(".textextra")))
+int
+videoCheck (char * fname)
+{
+	VID_HEADER hdr;
+	VID_FORMAT vf;
+	FIL f;
+	UINT br;
+	int r;
+
+	if (f_open (&f, fname, FA_READ) != FR_OK)
+		return (-1);
+
+	r = f_read (&f, &hdr, sizeof(hdr), &br);
+
+	f_close (&f);
+
+	if (r != FR_OK)
+		return (-1);
+
+	if (br == sizeof(hdr) && hdr.vh_magic[0] == VID_MAGIC0 &&
+	    hdr.vh_magic[1] == VID_MAGIC1 && hdr.vh_magic[2] == VID_MAGIC2)
+		return (vid_format (&hdr, &vf, 0, 0));
+
+	return (vid_format (NULL, &vf, 0, 0));
+}
+
 /******************************************************************************
 *
 * videoWinPlay - play a video
 *
 * This function plays an encoded video file specified by <fname> from the
-* SD card. The file must be encoded using the encode_video.sh script. There
-* is no special header on the file. It contains raw RGB565 pixel data and
-* 12-bit samples which are output to the ILI9341 controller and the DAC,
-* respectively.
+* SD card, starting at the beginning. See videoWinPlayAt() for details.
+*
+* RETURNS: 0 when video finishes playing, or -1 if interrupted
+*/
+
+__attribute__((section(".textextra")))
+int
+videoWinPlay (char * fname, int x, int y)
+{
+	return (videoWinPlayAt (fname, x, y, 0));
+}
+
+/******************************************************************************
+*
+* videoWinPlayAt - play a video starting at a given frame
+*
+* This function plays an encoded video file specified by <fname> from the
+* SD card. The file must be encoded using the encode_video.sh script. It
+* contains RGB565 pixel data and 12-bit samples which are output to the
+* ILI9341 controller and the DAC, respectively. Version 2 files begin with
+* a VID_HEADER that describes the codec, frame size, frame rate and audio
+* rate. Files without a header are treated as raw version 1 files with
+* 128x96 frames playing at 8 frames per second.
+*
+* Playback starts at frame <start>, or at the closest keyframe before it.
+* If the file can't be positioned there, playback starts at the beginning.
 *
 * The video will keep playing until the end of file is reached, or until the
-* user touches the touch screen.
+* user touches the touch screen. If the file can be positioned (raw files,
+* and delta or palette coded files with a seek index), touching the left
+* or right edge of the screen skips back or forward by VID_SEEK_SECS
+* seconds instead. The frame at which playback stopped is left in
+* videoStats.vs_pos so that the caller can resume from there later.
 *
 * If <x> and <y> are non-zero, then the video will be played at its native
-* 128x96 resolution at the specified X and Y coordinates on the screen. If
+* resolution at the specified X and Y coordinates on the screen. If
 * <x> and <y> are both 0, then the vide will be upscaled to consume the
 * entire display.
 *
@@ -261,226 +1155,414 @@ draw_lines (pixel_t * buf, int textextra)
 
 __attribute__((section(".textextra")))
 int
-videoWinPlay (char * fname, int x, int y)
+videoWinPlayAt (char * fname, int x, int y, uint32_t start)
 {
 	GEventMouse * me = NULL;
 	GListener gl;
 	GSourceHandle gs;
+	VID_HEADER hdr;
+	VID_FORMAT vf;
+	VID_READER rd;
+	DWORD clmt[VID_CLMT_SIZE];
+	systime_t t;
 	uint16_t * cur;
 	uint16_t * ps;
+	uint16_t * op;
+	uint16_t * samples;
+	uint8_t * audio;
+	uint16_t vlen;
 	pixel_t * buf;
+	pixel_t * line;
+	pixel_t * pal;
+	VID_CODEC_STATS * cs;
 	FIL f;
 	UINT br;
+	UINT vidsz;
+	int seekable;
+	int frame;
+	int cpp;
+	int spp;
+	int l;
 	int p;
 	int i;
-	int j;
-#ifdef VIDEO_AUTO_RATE_ADJUST
-	uint32_t rate;
-	int lastwait;
-	int curwait;
-	int skipcnt;
-#endif
+	int r;
+	uint32_t clk;
+	uint32_t pts;
+	uint32_t queued;
+	int32_t skew;
 
 	if (f_open (&f, fname, FA_READ) != FR_OK)
 		return (0);
 
-	/* Capture mouse up/down events */
+	/*
+	 * Build a cluster map for the file so that seeking doesn't
+	 * have to walk the FAT chain. If the file is too fragmented to
+	 * fit in the map, we just fall back to normal seeks.
+	 */
 
-	gs = ginputGetMouse (0);
-	geventListenerInit (&gl);
-	geventAttachSource (&gl, gs, GLISTEN_MOUSEMETA);
+	clmt[0] = VID_CLMT_SIZE;
+	f.cltbl = clmt;
+	if (f_lseek (&f, CREATE_LINKMAP) != FR_OK)
+		f.cltbl = NULL;
 
-	/* start the video */
+	memset (&videoStats, 0, sizeof(videoStats));
+	videoStats.vs_occmin = VID_READ_BUFS;
+	videoStats.vs_bufs = VID_READ_BUFS;
 
 	/*
-	 * This tells the graphics controller the dimensions of the
-	 * drawing viewport. The drawing viewport is like a circular
-	 * buffer: we can keep writing pixels to it sequentially and
-	 * when we reach the end, the controller will automatically
-	 * wrap back to the beginning. We tell the controller the
-	 * drawing frame is 2.5 times the size of our actual video
-	 * frame data, and then upscale on the fly.
+	 * Check for a version 2 header. If there isn't one, this
+	 * is a raw version 1 file, so rewind to the start.
 	 */
 
-	if (x == 0 && y == 0) {
-		GDISP->p.x = 0;
-		GDISP->p.y = 0;
-		GDISP->p.cx = gdispGetWidth ();
-		GDISP->p.cy = gdispGetHeight ();
-	} else {
-		GDISP->p.x = x;
-		GDISP->p.y = y;
-		GDISP->p.cx = FRAMERES_HORIZONTAL;
-		GDISP->p.cy = FRAMERES_VERTICAL;
+	r = f_read (&f, &hdr, sizeof(hdr), &br);
+
+	if (r == FR_OK && br == sizeof(hdr) && hdr.vh_magic[0] == VID_MAGIC0 &&
+	    hdr.vh_magic[1] == VID_MAGIC1 && hdr.vh_magic[2] == VID_MAGIC2)
+		r = vid_format (&hdr, &vf, x, y);
+	else {
+		f_lseek (&f, 0);
+		r = vid_format (NULL, &vf, x, y);
 	}
 
-	gdisp_lld_write_start (GDISP);
-	gdisp_lld_write_stop (GDISP);
+	if (r != 0) {
+		f_close (&f);
+		return (0);
+	}
 
 	/*
-	 * Now that we've programmed the viewport, we set the X/Y
-	 * coordinates to special values that tell the
-	 * gdisp_lld_write_start function to skip programming
-	 * the viewport area again. This saves us from calling
-	 * the set_viewport() function for every scanline, which
-	 * would be redundant: we're always just drawing data to
-	 * the same window until the video compltes.
+	 * Locate the seek index. It's the last thing in the file,
+	 * with one entry for each keyframe.
 	 */
 
-	GDISP->p.x = -1;
-	GDISP->p.y = -1;
+	if (vf.vf_codec != VID_CODEC_RAW && vf.vf_flags & VID_FLAG_INDEX &&
+	    vf.vf_keyint != 0 && vf.vf_frames != 0) {
+		vf.vf_index = ((vf.vf_frames + vf.vf_keyint - 1) /
+		    vf.vf_keyint) * sizeof(uint32_t);
+		if (vf.vf_index + vf.vf_data < f_size (&f))
+			vf.vf_index = f_size (&f) - vf.vf_index;
+		else
+			vf.vf_index = 0;
+	}
+
+	seekable = (vf.vf_codec == VID_CODEC_RAW || vf.vf_index != 0);
+
+	frame = 0;
+	if (start != 0 && seekable) {
+		frame = vid_seek (&f, &vf, start);
+		if (frame == -1) {
+			frame = 0;
+			f_lseek (&f, vf.vf_data);
+		}
+	}
+
+	if (vid_reader_start (&rd, &f) != 0) {
+		f_close (&f);
+		return (0);
+	}
 
-	buf = chHeapAlloc (NULL, VID_BUFSZ + VID_EXTRA);
+	videoStats.vs_fps = vf.vf_fps;
+	videoStats.vs_codec = vf.vf_codec;
+
+	/*
+	 * Work out how many chunks worth of audio samples we
+	 * need to buffer before each play, and how much video
+	 * data we need to be able to hold for each chunk.
+	 */
+
+	cpp = SAMPLES_PER_PLAY / vf.vf_spc;
+	if (cpp == 0)
+		cpp = 1;
+	spp = cpp * vf.vf_spc;
+
+	if (vf.vf_codec == VID_CODEC_DELTA)
+		vidsz = (vf.vf_width + 1) * LINE_RATE * sizeof(uint16_t);
+	else if (vf.vf_codec == VID_CODEC_PAL8)
+		vidsz = vf.vf_width * LINE_RATE * sizeof(uint8_t);
+	else
+		vidsz = vf.vf_width * LINE_RATE * sizeof(pixel_t);
+
+	buf = chHeapAlloc (NULL, vidsz + vf.vf_abytes);
+	/*
+	 * The scaling blit routines stretch each scanline into an
+	 * expansion buffer one display line wide before sending it.
+	 */
+
+#ifndef VIDEO_PIO_BLIT
+	if (vf.vf_blit != draw_span_1x)
+		vf.vf_xbuf = chHeapAlloc (NULL,
+		    gdispGetWidth () * sizeof(pixel_t));
+#endif
+
+	line = NULL;
+	if (vf.vf_codec != VID_CODEC_RAW)
+		line = chHeapAlloc (NULL, vf.vf_width * sizeof(pixel_t));
+	pal = NULL;
+	if (vf.vf_codec == VID_CODEC_PAL8)
+		pal = chHeapAlloc (NULL, VID_PAL_MAX * sizeof(pixel_t));
 
 	dacPlay (NULL);
 
+	dacBuf = chHeapAlloc (NULL, spp * 2 * sizeof(uint16_t));
+
+	if (buf == NULL || dacBuf == NULL ||
+#ifndef VIDEO_PIO_BLIT
+	    (vf.vf_xbuf == NULL && vf.vf_blit != draw_span_1x) ||
+#endif
+	    (line == NULL && vf.vf_codec != VID_CODEC_RAW) ||
+	    (pal == NULL && vf.vf_codec == VID_CODEC_PAL8)) {
+		vid_bufs_free (&vf, buf, line, pal);
+		vid_reader_stop (&rd);
+		f_close (&f);
+		return (0);
+	}
+
+	if (pal != NULL)
+		memset (pal, 0, VID_PAL_MAX * sizeof(pixel_t));
+
+	/* Capture mouse up/down events */
+
+	gs = ginputGetMouse (0);
+	geventListenerInit (&gl);
+	geventAttachSource (&gl, gs, GLISTEN_MOUSEMETA);
+
 	i = 0;
-	j = 0;
-	dacBuf = chHeapAlloc (NULL, AUD_BUFSZ);
+	l = 0;
 	ps = dacBuf;
 	cur = dacBuf;
-#ifdef VIDEO_AUTO_RATE_ADJUST
-	skipcnt = 0;
-	curwait = 0;
-	lastwait = 0;
-#endif
+	pts = 0;
+	queued = 0;
+	clk = dacSamplesPlayed ();
 
-	/* Enable the PIT for the DAC */
+	/* Set the PIT to the file's audio rate and enable it for the DAC */
 
+	CSR_WRITE_4(&PIT1, PIT_LDVAL1, KINETIS_BUSCLK_FREQUENCY / vf.vf_rate);
 	pitEnable (&PIT1, 1);
 
+	t = chVTGetSystemTime ();
+
 	while (1) {
-		/* Read two scan lines from the stream */
+		/*
+		 * Palette coded frames start with a new palette, or
+		 * with a count of 0 if they use the same palette as
+		 * the frame before.
+		 */
 
-		f_read (&f, buf, VID_BUFSZ + VID_EXTRA, &br);
+		if (vf.vf_codec == VID_CODEC_PAL8 && l == 0) {
+			if (vid_read (&rd, &vlen, sizeof(vlen)) !=
+			    sizeof(vlen) || vlen > VID_PAL_MAX)
+				break;
+			if (vid_read (&rd, pal, vlen * sizeof(pixel_t)) !=
+			    vlen * sizeof(pixel_t))
+				break;
+		}
 
-		if (br == 0)
-			break;
+		/*
+		 * Read two scan lines from the stream. For delta coded
+		 * files, we have to read the length of the coded video
+		 * data first in order to know how much to read.
+		 */
+
+		if (vf.vf_codec == VID_CODEC_DELTA) {
+			if (vid_read (&rd, &vlen, sizeof(vlen)) !=
+			    sizeof(vlen) ||
+			    vlen * sizeof(uint16_t) > vidsz)
+				break;
+			if (vid_read (&rd, buf, vlen * sizeof(uint16_t) +
+			    vf.vf_abytes) !=
+			    vlen * sizeof(uint16_t) + vf.vf_abytes)
+				break;
+			audio = (uint8_t *)(buf + vlen);
+		} else {
+			if (vid_read (&rd, buf, vidsz + vf.vf_abytes) !=
+			    vidsz + vf.vf_abytes)
+				break;
+			audio = (uint8_t *)buf + vidsz;
+		}
+
+		videoStats.vs_chunks++;
 
 		/* Extract the audio sample data */
 
-		for (p = 0; p < SAMPLES_PER_LINE * 2; p++)
-			ps[p] = buf[(VID_BUFSZ / 2) + p];
+		if (vf.vf_flags & VID_FLAG_ADPCM)
+			dacAdpcmDecode (audio, ps, vf.vf_spc);
+		else {
+			samples = (uint16_t *)audio;
+			for (p = 0; p < vf.vf_spc; p++)
+				ps[p] = samples[p];
+		}
 
 		/*
 		 * When we have enough audio data buffered,
 		 * start it playing.
 		 */
 
-		if ((i & SAMPLE_INTERVAL) == SAMPLE_INTERVAL) {
-#ifdef VIDEO_AUTO_RATE_ADJUST
-			curwait = dacSamplesWait ();
-			if (curwait == 0 && lastwait == 0)
-				skipcnt++;
-			else
-				skipcnt = 0;
-			lastwait = curwait;
-#else
+		if ((i % cpp) == (cpp - 1)) {
+			/*
+			 * If everything queued has already played,
+			 * the audio ran dry waiting for us.
+			 */
+			if (queued != 0 &&
+			    dacSamplesPlayed () - clk == queued)
+				videoStats.vs_late++;
 			(void) dacSamplesWait ();
-#endif
-			dacSamplesPlay (cur, SAMPLES_PER_PLAY);
+			dacSamplesPlay (cur, spp);
+			queued += spp;
 			if (cur == dacBuf)
-				cur = dacBuf + SAMPLES_PER_PLAY; 
+				cur = dacBuf + spp;
 			else
 				cur = dacBuf;
 		}
 
-		ps += (SAMPLES_PER_LINE * 2);
+		ps += vf.vf_spc;
 		i++;
-		if (i == (SAMPLE_CHUNKS / 2)) {
+		if (i == (cpp * 2)) {
 			ps = dacBuf;
 			i = 0;
 		}
 
-#ifdef VIDEO_AUTO_RATE_ADJUST
 		/*
-		 * This is a hack to deal with slow SD cards. If the
-		 * card is too slow, audio will sound warbly due to
-		 * delays caused by waiting for data to load. To avoid
-		 * the warble, we reduce the PIT frequency a little
-		 * to slow down the audio until the rate matches
-		 * what the SD card can sustain.
-		 *
-		 * This should not be necessary now that we set the
-		 * SPI clock to full speed for SD card access, but
-		 * the code is kept around just in case.
+		 * Check this chunk against the audio clock. The skew
+		 * is how far ahead of the audio we are, less the one
+		 * block of audio we should be ahead by. Too far behind
+		 * and we skip drawing this chunk, too far ahead and we
+		 * wait. Waiting can't stall, since the time we wait
+		 * for is always within audio that's already queued.
+		 * Until the first block of audio has been queued,
+		 * the clock hasn't started, so there's nothing to
+		 * sync with.
 		 */
 
-		if (skipcnt > 5) {
-			skipcnt = 0;
-			rate = CSR_READ_4(&PIT1, PIT_LDVAL1);
- 			rate += 100;
-			CSR_WRITE_4(&PIT1, PIT_LDVAL1, rate);
+		skew = (int32_t)(pts - (dacSamplesPlayed () - clk)) - spp;
+		pts += vf.vf_spc;
+
+		if (queued == 0)
+			skew = 0;
+
+		if (skew < -VID_SYNC_SKEW) {
+			videoStats.vs_dropped++;
+			goto next;
+		}
+
+		if (skew > VID_SYNC_SKEW) {
+			videoStats.vs_held++;
+			while ((int32_t)(pts - vf.vf_spc - spp - VID_SYNC_SKEW -
+			    (dacSamplesPlayed () - clk)) > 0)
+				chThdSleep (1);
 		}
-#endif
 
 		/*
-		 * Write video data to the screen. Note: we write each
-                 * pixel and line two and a half times. This scales up the
-		 * size of the displayed image, at the expense of pixelating
-		 * it But hey, old school pixelated video is elite, right?
-		 *
-		 * In the case where we're drawing the video in the
-		 * same 128x96 pixel format in which it was encoded,
-		 * we can just DMA the pixels directly to the screen.
+		 * Write video data to the screen. The blit routine
+		 * chosen for this file takes care of scaling the
+		 * video up to fill the screen, if needed. Raw
+		 * scanlines are always drawn in full. Delta coded
+		 * scanlines are drawn span by span, skipping over
+		 * pixels that haven't changed.
 		 *
-		 * Note that when we call gdisp_lld_write_start() here,
-		 * it does not reset the viewport because we previously
-		 * programmed the display X/Y coordinates to -1 before
-		 * we began playing the video. This tells the start
-		 * routine to skip the set_viewport() step. We don't need
-		 * it because the display chip will automatically wrap
-		 * back to the start of the viewport once we finish drawing
-		 * a frame. This means we only need to initialize the
-		 * viewport once.
-		 *
-		 * Sadly, we still need to call the start/stop routines
-		 * every time we draw to the screen because the sceen,
-		 * SD card and touch controller are all on the same SPI
-		 * channel. For performance, we program the SPI controller
-		 * to use 16-bit mode when talking to to the screen, but we
-		 * use 8-bit mode fo everything else. So we need the
-		 * start/stop functions to switch the modes.
+		 * Each blit programs its own display window and
+		 * calls the gdisp_lld_write_start()/stop() routines
+		 * around each span. We need to do that anyway because
+		 * the sceen, SD card and touch controller are all on
+		 * the same SPI channel. For performance, we program
+		 * the SPI controller to use 16-bit mode when talking to
+		 * to the screen, but we use 8-bit mode fo everything
+		 * else. So we need the start/stop functions to switch
+		 * the modes.
 		 */
 
-		gdisp_lld_write_start (GDISP);
-
-		if (x == 0 && y == 0) {
-			draw_lines (buf, j & 1);
-			draw_lines (buf + FRAMERES_HORIZONTAL, j & 1);
-
-			j++;
-			if (j == FRAMERES_VERTICAL)
-				j = 0;
+		if (vf.vf_codec == VID_CODEC_DELTA) {
+			op = delta_line (&vf, buf, buf + vlen, line, l);
+			if (op != NULL)
+				op = delta_line (&vf, op, buf + vlen, line,
+				    l + 1);
+			if (op == NULL)
+				break;
+		} else if (vf.vf_codec == VID_CODEC_PAL8) {
+			pal_line (&vf, (uint8_t *)buf, pal, line, l);
+			pal_line (&vf, (uint8_t *)buf + vf.vf_width, pal,
+			    line, l + 1);
 		} else {
-			dmaSend16 (buf, VID_BUFSZ);
+			vf.vf_blit (&vf, buf, l, 0, vf.vf_width);
+			vf.vf_blit (&vf, buf + vf.vf_width, l + 1, 0,
+			    vf.vf_width);
 		}
 
-		gdisp_lld_write_stop (GDISP);
+next:
+		l += LINE_RATE;
+		if (l == vf.vf_height) {
+			l = 0;
+			frame++;
+			videoStats.vs_frames++;
+			/* Don't play the seek index as video. */
+			if (frame == vf.vf_frames)
+				break;
+		}
 
-		/* Check for the user requesting exit. */
+		/*
+		 * Check for the user requesting exit, or a skip
+		 * forward or back. To skip, we stop the reader
+		 * thread, position the file at the new frame, and
+		 * then start reading again. We always land on a
+		 * keyframe, so the first frame after the skip
+		 * redraws the whole screen. The audio just carries
+		 * on from the new position.
+		 */
 
 		me = (GEventMouse *)geventEventWait (&gl, 0);
-		if (me != NULL && me->buttons & GMETA_MOUSE_DOWN)
+		if (me == NULL || (me->buttons & GMETA_MOUSE_DOWN) == 0)
+			continue;
+
+		if (seekable == 0)
+			break;
+		if (me->x < gdispGetWidth () / 4)
+			r = frame - (vf.vf_fps * VID_SEEK_SECS);
+		else if (me->x >= gdispGetWidth () - gdispGetWidth () / 4)
+			r = frame + (vf.vf_fps * VID_SEEK_SECS);
+		else
+			break;
+
+		me = NULL;
+		vid_reader_stop (&rd);
+		r = vid_seek (&f, &vf, r);
+		if (r == -1) {
+			/*
+			 * Skipped past the end, or couldn't read the
+			 * index. Either way, we're done.
+			 */
 			break;
+		}
+		if (vid_reader_start (&rd, &f) != 0)
+			break;
+		frame = r;
+		l = 0;
+		videoStats.vs_seeks++;
 	}
 
+	videoStats.vs_ticks = chVTTimeElapsedSinceX (t);
+	videoStats.vs_pos = frame;
+
+	/* Remember how well this codec did, for comparison. */
+
+	if (videoStats.vs_ticks != 0 && videoStats.vs_frames != 0) {
+		cs = &videoCodecStats[vf.vf_codec];
+		cs->vc_fps = (uint32_t)(((uint64_t)videoStats.vs_frames *
+		    100 * CH_CFG_ST_FREQUENCY) / videoStats.vs_ticks);
+		cs->vc_fpsenc = vf.vf_fps;
+		cs->vc_bpf = videoStats.vs_bytes / videoStats.vs_frames;
+	}
+
+	vid_reader_stop (&rd);
+
 	geventDetachSource (&gl, NULL);
-	chHeapFree (buf);
-	chHeapFree (dacBuf);
-	dacBuf = NULL;
+	vid_bufs_free (&vf, buf, line, pal);
 	f_close (&f);
 
-
 	pitDisable (&PIT1, 1);
 	dacSamplesPlay (NULL, 0);
 
-#ifdef VIDEO_AUTO_RATE_ADJUST
-	/* Re-initialize the DAC's PIT frequency, in case we changed it. */
+	/* Re-initialize the DAC's PIT frequency, since we changed it. */
 
 	CSR_WRITE_4(&PIT1, PIT_LDVAL1,
 	    KINETIS_BUSCLK_FREQUENCY / DAC_SAMPLERATE);
-#endif
 
 	if (me != NULL && me->buttons & GMETA_MOUSE_DOWN)
 		return (-1);
@@ -33,7 +33,153 @@
 #ifndef _VIDEO_LLD_H_
 #define _VIDEO_LLD_H_
 
+/*
+ * Version 2 video file format
+ *
+ * Version 1 files have no header: they consist of nothing but raw
+ * interleaved pixel and sample chunks. Version 2 files start with
+ * the header below, which is followed by a sequence of chunks, each
+ * of which describes two scanlines of video and the audio samples
+ * that go with them. With the delta codec, each chunk looks like this:
+ *
+ * [ video length (16 bits) ][ coded video ops ][ audio samples ]
+ *
+ * The video length is the number of 16-bit words of coded video data
+ * which follow. Each scanline is coded as a series of ops, each of
+ * which is a 16-bit word containing an opcode in the upper two bits and
+ * a pixel count in the remaining bits:
+ *
+ * VID_OP_SKIP: pixels are unchanged from the previous frame
+ * VID_OP_RUN:  one pixel value follows, repeated <count> times
+ * VID_OP_LIT:  <count> literal pixel values follow
+ *
+ * Ops never span scanlines: a scanline is complete once the pixel
+ * counts add up to the frame width. The encoder guarantees that a
+ * coded scanline is never larger than a single literal op covering the
+ * whole line. The number of audio samples in each chunk is implied
+ * by the frame rate. All values are stored little-endian.
+ *
+ * The palette codec stores each pixel as an 8-bit index into a table of
+ * up to 256 RGB565 colors, which halves the size of every frame. Each
+ * frame starts with a 16-bit palette entry count, followed by that many
+ * colors. A count of 0 means the frame reuses the palette of the frame
+ * before it, which lets a group of frames share one palette. Every
+ * frame that carries a palette is a keyframe. Each chunk looks like
+ * this:
+ *
+ * [ 2 scanlines of 8-bit pixel indexes ][ audio samples ]
+ */
+
+#define VID_MAGIC0		'V'
+#define VID_MAGIC1		'I'
+#define VID_MAGIC2		'D'
+#define VID_VERSION		2
+
+#define VID_CODEC_RAW		0	/* Uncompressed, same as version 1 */
+#define VID_CODEC_DELTA		1	/* Skip/RLE/literal vs. last frame */
+#define VID_CODEC_PAL8		2	/* 8-bit indexes into a palette */
+#define VID_CODECS		3
+
+#define VID_PAL_MAX		256	/* Most colors in a palette */
+
+#define VID_OP_SKIP		0x0000
+#define VID_OP_RUN		0x4000
+#define VID_OP_LIT		0x8000
+#define VID_OP_MASK		0xC000
+#define VID_OP_COUNT		0x3FFF
+
+/*
+ * The frame size and audio rate fields were added after the first
+ * version 2 files were made. A value of 0 in any of them means the
+ * original defaults: 128x96 pixels with audio at DAC_SAMPLERATE.
+ * Supported frame sizes for full screen playback are 320x240, 160x120
+ * and 128x96, which are scaled up by 1, 2 and 2.5 times respectively.
+ * The audio rate must divide evenly by the number of scanline pairs per
+ * second so that each chunk carries a whole number of samples.
+ *
+ * Delta and palette coded files may also carry a seek index. If
+ * VID_FLAG_INDEX is set, every vh_keyint'th frame (starting with frame 0)
+ * is a keyframe that doesn't depend on the previous frame, and the file
+ * ends with a table of 32-bit file offsets, one for each keyframe,
+ * pointing at the first chunk of that frame. The table follows the last
+ * chunk, so its position can be worked out from the file size. Raw files
+ * don't need an index, since every frame is the same size.
+ */
+
+#define VID_FLAG_INDEX		0x01	/* Keyframe index at end of file */
+
+/*
+ * If VID_FLAG_ADPCM is set, the audio samples in each chunk are stored as
+ * a single IMA ADPCM block, laid out the same way as the blocks in ADPCM
+ * sound files (see dac_lld.h), but holding just one chunk's worth of
+ * samples.
+ */
+
+#define VID_FLAG_ADPCM		0x02	/* Audio is IMA ADPCM coded */
+
+typedef struct vid_header {
+	uint8_t		vh_magic[3];	/* 'V', 'I', 'D' */
+	uint8_t		vh_version;	/* VID_VERSION */
+	uint8_t		vh_codec;	/* VID_CODEC_xxx */
+	uint8_t		vh_fps;		/* Frames per second */
+	uint16_t	vh_frames;	/* Total number of frames */
+	uint16_t	vh_width;	/* Frame width in pixels */
+	uint16_t	vh_height;	/* Frame height in pixels */
+	uint16_t	vh_rate;	/* Audio sample rate in Hz */
+	uint8_t		vh_keyint;	/* Keyframe interval in frames */
+	uint8_t		vh_flags;	/* VID_FLAG_xxx */
+} VID_HEADER;
+
+/*
+ * Playback statistics for the most recent video. The reader thread
+ * and the renderer each count the number of times they had to wait on
+ * the other: if the renderer keeps waiting for data, the SD card is the
+ * bottleneck, and if the reader keeps waiting for a free buffer, then
+ * decoding and drawing are. The sync counters show how often the video
+ * had to be dropped or held back to stay in step with the audio.
+ */
+
+typedef struct vid_stats {
+	uint32_t	vs_ticks;	/* Playback time in system ticks */
+	uint32_t	vs_chunks;	/* Scanline pair chunks played */
+	uint32_t	vs_frames;	/* Complete frames played */
+	uint32_t	vs_bytes;	/* Bytes read from the file */
+	uint32_t	vs_underruns;	/* Renderer waited for a full buffer */
+	uint32_t	vs_stalls;	/* Reader waited for an empty buffer */
+	uint32_t	vs_fills;	/* Buffers handed to the renderer */
+	uint32_t	vs_occsum;	/* Sum of full buffers seen per fill */
+	uint8_t		vs_occmin;	/* Fewest full buffers seen */
+	uint8_t		vs_occmax;	/* Most full buffers seen */
+	uint8_t		vs_bufs;	/* Number of read-ahead buffers */
+	uint8_t		vs_fps;		/* Frame rate from the file */
+	uint8_t		vs_codec;	/* VID_CODEC_xxx from the file */
+	uint32_t	vs_pos;		/* Frame where playback stopped */
+	uint32_t	vs_seeks;	/* Seeks done during playback */
+	uint64_t	vs_blitcyc;	/* CPU cycles spent drawing */
+	uint64_t	vs_dmacyc;	/* Cycles of that waiting for DMA */
+	uint32_t	vs_dropped;	/* Chunks not drawn to catch up */
+	uint32_t	vs_held;	/* Chunks held back for the audio */
+	uint32_t	vs_late;	/* Times the audio ran dry */
+} VID_STATS;
+
+extern VID_STATS videoStats;
+
+/*
+ * Achieved frame rate of the last video played with each codec, so that
+ * the 8-bit palette codec can be compared against the 16-bit ones.
+ */
+
+typedef struct vid_codec_stats {
+	uint32_t	vc_fps;		/* Achieved frames per second x 100 */
+	uint32_t	vc_fpsenc;	/* Encoded frames per second */
+	uint32_t	vc_bpf;		/* Bytes read per frame */
+} VID_CODEC_STATS;
+
+extern VID_CODEC_STATS videoCodecStats[VID_CODECS];
+
+extern int videoCheck (char *);
 extern int videoWinPlay (char *, int, int);
+extern int videoWinPlayAt (char *, int, int, uint32_t);
 extern int videoPlay (char *);
 
 #endif /* _VIDEO_LLD_H_ */
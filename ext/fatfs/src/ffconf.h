@@ -46,7 +46,7 @@
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
-#define	_USE_FASTSEEK		0
+#define	_USE_FASTSEEK		1
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
@@ -11,6 +11,18 @@
 extern "C" {
 #endif
 
+/*---------------------------------------*/
+/* Read statistics                       */
+
+typedef struct mmc_stats {
+	DWORD	ms_reads;	/* Calls to mmc_disk_read() */
+	DWORD	ms_cmds;	/* Multiple block read commands sent */
+	DWORD	ms_sectors;	/* Sectors read */
+	DWORD	ms_ticks;	/* System ticks spent reading */
+} MMC_STATS;
+
+extern MMC_STATS mmcStats;
+
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
 
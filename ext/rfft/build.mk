@@ -0,0 +1,4 @@
+RFFTSRC += \
+           $(RFFT)/rfft.c \
+
+RFFTINC += $(RFFT)
@@ -0,0 +1,338 @@
+/*-
+ * Copyright (c) 2017
+ *      Bill Paul <wpaul@windriver.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Bill Paul.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Bill Paul AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL Bill Paul OR THE VOICES IN HIS HEAD
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module computes the spectrum of a block of real samples, such as
+ * the audio the music player is playing or the samples from a
+ * microphone. The usual trick for real input is used: the N real samples
+ * are treated as N/2 complex ones, with the even samples as the real
+ * parts and the odd samples as the imaginary parts, which is how they're
+ * laid out in memory anyway. A complex FFT of half the size is run on
+ * them, and a final split step pulls the spectra of the even and odd
+ * samples apart and combines them into the spectrum of the whole block.
+ * This takes about half the work of running a complex FFT over the real
+ * samples with the imaginary parts set to zero, and half the memory.
+ *
+ * Everything is done with 16-bit fixed point samples and 32-bit
+ * arithmetic, since the Cortex-M0+ has no FPU. Each pass of the FFT
+ * halves its results, which scales the output by 1/N overall and keeps
+ * anything from overflowing. The twiddle factors come from a quarter wave
+ * sine table and the bit reversed indexes from another table, both in
+ * flash, so nothing has to be worked out at run time.
+ */
+
+#include <stdint.h>
+
+#include "rfft.h"
+
+/* Half of the largest transform, which is the largest complex FFT we run */
+
+#define RFFT_HALF_LOG2		(RFFT_LOG2_MAX - 1)
+
+/*
+ * sin(2 * pi * k / RFFT_MAX) for a quarter of a cycle, in 1.15 fixed
+ * point. The cosine and the rest of the first half cycle, which is all
+ * the FFT needs, follow from symmetry.
+ */
+
+static const int16_t rfft_sin[(RFFT_MAX / 4) + 1] = {
+	    0,   402,   804,  1206,  1608,  2009,  2410,  2811,
+	 3212,  3612,  4011,  4410,  4808,  5205,  5602,  5998,
+	 6393,  6786,  7179,  7571,  7962,  8351,  8739,  9126,
+	 9512,  9896, 10278, 10659, 11039, 11417, 11793, 12167,
+	12539, 12910, 13279, 13645, 14010, 14372, 14732, 15090,
+	15446, 15800, 16151, 16499, 16846, 17189, 17530, 17869,
+	18204, 18537, 18868, 19195, 19519, 19841, 20159, 20475,
+	20787, 21096, 21403, 21705, 22005, 22301, 22594, 22884,
+	23170, 23452, 23731, 24007, 24279, 24547, 24811, 25072,
+	25329, 25582, 25832, 26077, 26319, 26556, 26790, 27019,
+	27245, 27466, 27683, 27896, 28105, 28310, 28510, 28706,
+	28898, 29085, 29268, 29447, 29621, 29791, 29956, 30117,
+	30273, 30424, 30571, 30714, 30852, 30985, 31113, 31237,
+	31356, 31470, 31580, 31685, 31785, 31880, 31971, 32057,
+	32137, 32213, 32285, 32351, 32412, 32469, 32521, 32567,
+	32609, 32646, 32678, 32705, 32728, 32745, 32757, 32765,
+	32767
+};
+
+/* Each 8-bit index with its bits in reverse order */
+
+static const uint8_t rfft_rev[1 << RFFT_HALF_LOG2] = {
+	  0, 128,  64, 192,  32, 160,  96, 224,  16, 144,  80, 208,
+	 48, 176, 112, 240,   8, 136,  72, 200,  40, 168, 104, 232,
+	 24, 152,  88, 216,  56, 184, 120, 248,   4, 132,  68, 196,
+	 36, 164, 100, 228,  20, 148,  84, 212,  52, 180, 116, 244,
+	 12, 140,  76, 204,  44, 172, 108, 236,  28, 156,  92, 220,
+	 60, 188, 124, 252,   2, 130,  66, 194,  34, 162,  98, 226,
+	 18, 146,  82, 210,  50, 178, 114, 242,  10, 138,  74, 202,
+	 42, 170, 106, 234,  26, 154,  90, 218,  58, 186, 122, 250,
+	  6, 134,  70, 198,  38, 166, 102, 230,  22, 150,  86, 214,
+	 54, 182, 118, 246,  14, 142,  78, 206,  46, 174, 110, 238,
+	 30, 158,  94, 222,  62, 190, 126, 254,   1, 129,  65, 193,
+	 33, 161,  97, 225,  17, 145,  81, 209,  49, 177, 113, 241,
+	  9, 137,  73, 201,  41, 169, 105, 233,  25, 153,  89, 217,
+	 57, 185, 121, 249,   5, 133,  69, 197,  37, 165, 101, 229,
+	 21, 149,  85, 213,  53, 181, 117, 245,  13, 141,  77, 205,
+	 45, 173, 109, 237,  29, 157,  93, 221,  61, 189, 125, 253,
+	  3, 131,  67, 195,  35, 163,  99, 227,  19, 147,  83, 211,
+	 51, 179, 115, 243,  11, 139,  75, 203,  43, 171, 107, 235,
+	 27, 155,  91, 219,  59, 187, 123, 251,   7, 135,  71, 199,
+	 39, 167, 103, 231,  23, 151,  87, 215,  55, 183, 119, 247,
+	 15, 143,  79, 207,  47, 175, 111, 239,  31, 159,  95, 223,
+	 63, 191, 127, 255
+};
+
+/******************************************************************************
+*
+* rfftTwiddle - look up a twiddle factor
+*
+* This function returns the cosine and sine of 2 * pi * <j> / RFFT_MAX,
+* for 0 <= <j> < RFFT_MAX / 2, via <c> and <s>.
+*
+* RETURNS: N/A
+*/
+
+static inline void
+rfftTwiddle (unsigned int j, int32_t * c, int32_t * s)
+{
+	if (j <= RFFT_MAX / 4) {
+		*c = rfft_sin[(RFFT_MAX / 4) - j];
+		*s = rfft_sin[j];
+	} else {
+		*c = -rfft_sin[j - (RFFT_MAX / 4)];
+		*s = rfft_sin[(RFFT_MAX / 2) - j];
+	}
+
+	return;
+}
+
+/******************************************************************************
+*
+* rfftComplex - run a complex FFT
+*
+* This function transforms the 1 << <m> complex samples in <z>, stored as
+* pairs of real and imaginary parts, in place. It's a radix 2 decimation
+* in time FFT, so the samples are first put in bit reversed order. Each
+* pass halves its results, so the output is scaled by 1 / (1 << <m>).
+*
+* RETURNS: N/A
+*/
+
+static void
+rfftComplex (int16_t * z, int m)
+{
+	int16_t * a;
+	int16_t * b;
+	int32_t wr;
+	int32_t wi;
+	int32_t tr;
+	int32_t ti;
+	int32_t ar;
+	int32_t ai;
+	unsigned int n;
+	unsigned int span;
+	unsigned int step;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	int16_t t;
+
+	n = 1 << m;
+
+	for (i = 0; i < n; i++) {
+		j = rfft_rev[i] >> (RFFT_HALF_LOG2 - m);
+		if (j <= i)
+			continue;
+		t = z[i * 2];
+		z[i * 2] = z[j * 2];
+		z[j * 2] = t;
+		t = z[(i * 2) + 1];
+		z[(i * 2) + 1] = z[(j * 2) + 1];
+		z[(j * 2) + 1] = t;
+	}
+
+	for (span = 1; span < n; span <<= 1) {
+		step = RFFT_MAX / (span * 2);
+		for (k = 0; k < span; k++) {
+			rfftTwiddle (k * step, &wr, &wi);
+			for (i = k; i < n; i += span * 2) {
+				a = &z[i * 2];
+				b = &z[(i + span) * 2];
+
+				/* t = b * (cos - j sin) */
+
+				tr = ((wr * b[0]) + (wi * b[1]) + 0x4000) >> 15;
+				ti = ((wr * b[1]) - (wi * b[0]) + 0x4000) >> 15;
+
+				ar = a[0];
+				ai = a[1];
+				a[0] = (ar + tr + 1) >> 1;
+				a[1] = (ai + ti + 1) >> 1;
+				b[0] = (ar - tr + 1) >> 1;
+				b[1] = (ai - ti + 1) >> 1;
+			}
+		}
+	}
+
+	return;
+}
+
+/******************************************************************************
+*
+* rfft - compute the spectrum of a block of real samples
+*
+* This function transforms the 1 << <m> real samples in <x> in place. The
+* layout of the result is described in rfft.h.
+*
+* With Z the FFT of the samples taken as complex pairs, and M = N / 2, the
+* split step works out each pair of bins k and M - k from Z[k] and
+* Z[M - k]:
+*
+*	E = (Z[k] + conj(Z[M - k])) / 2	spectrum of the even samples
+*	O = -j (Z[k] - conj(Z[M - k])) / 2	spectrum of the odd samples
+*	X[k] = E + W^k O
+*	X[M - k] = conj(E - W^k O)
+*
+* where W = exp(-2 * pi * j / N).
+*
+* RETURNS: 0, or -1 if <m> is out of range
+*/
+
+int
+rfft (int16_t * x, int m)
+{
+	int16_t * a;
+	int16_t * b;
+	int32_t er;
+	int32_t ei;
+	int32_t or;
+	int32_t oi;
+	int32_t wr;
+	int32_t wi;
+	int32_t tr;
+	int32_t ti;
+	int32_t r;
+	unsigned int half;
+	unsigned int step;
+	unsigned int k;
+
+	if (m < RFFT_LOG2_MIN || m > RFFT_LOG2_MAX)
+		return (-1);
+
+	half = 1 << (m - 1);
+	rfftComplex (x, m - 1);
+
+	/*
+	 * Z is scaled by 1/M, and we want X scaled by 1/N, so there's one
+	 * more halving to do. Bin 0 and bin M only depend on Z[0].
+	 */
+
+	r = x[0];
+	x[0] = (r + x[1] + 1) >> 1;
+	x[1] = (r - x[1] + 1) >> 1;
+
+	step = RFFT_MAX >> m;
+
+	for (k = 1; k <= half / 2; k++) {
+		a = &x[k * 2];
+		b = &x[(half - k) * 2];
+
+		er = (a[0] + b[0]) >> 1;
+		ei = (a[1] - b[1]) >> 1;
+		or = (a[1] + b[1]) >> 1;
+		oi = (b[0] - a[0]) >> 1;
+
+		rfftTwiddle (k * step, &wr, &wi);
+
+		/* t = O * (cos - j sin) */
+
+		tr = ((wr * or) + (wi * oi) + 0x4000) >> 15;
+		ti = ((wr * oi) - (wi * or) + 0x4000) >> 15;
+
+		/* When k == M / 2, a and b are the same bin: a wins. */
+
+		b[0] = (er - tr + 1) >> 1;
+		b[1] = (ti - ei + 1) >> 1;
+		a[0] = (er + tr + 1) >> 1;
+		a[1] = (ei + ti + 1) >> 1;
+	}
+
+	return (0);
+}
+
+/******************************************************************************
+*
+* rfftMag - approximate the magnitude of each bin
+*
+* This function fills <mag> with the magnitudes of the first N / 2 bins of
+* the spectrum in <x>, as left by rfft() for 1 << <m> samples. Square
+* roots are too slow for this, so each magnitude is estimated from the
+* larger and smaller of the absolute values of its real and imaginary
+* parts, as the larger of max + 5/32 min and 27/32 max + 71/128 min. This
+* is within about 1.2% of the true magnitude. The Nyquist bin is left
+* out.
+*
+* RETURNS: N/A
+*/
+
+void
+rfftMag (const int16_t * x, uint16_t * mag, int m)
+{
+	int32_t hi;
+	int32_t lo;
+	int32_t t;
+	unsigned int n;
+	unsigned int k;
+
+	n = 1 << (m - 1);
+
+	mag[0] = x[0] < 0 ? -x[0] : x[0];
+
+	for (k = 1; k < n; k++) {
+		hi = x[k * 2];
+		lo = x[(k * 2) + 1];
+		if (hi < 0)
+			hi = -hi;
+		if (lo < 0)
+			lo = -lo;
+		if (lo > hi) {
+			t = hi;
+			hi = lo;
+			lo = t;
+		}
+		t = hi + ((lo * 5) >> 5);
+		hi = ((hi * 27) >> 5) + ((lo * 71) >> 7);
+		mag[k] = hi > t ? hi : t;
+	}
+
+	return;
+}
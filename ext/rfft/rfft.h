@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2017
+ *      Bill Paul <wpaul@windriver.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Bill Paul.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Bill Paul AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL Bill Paul OR THE VOICES IN HIS HEAD
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RFFT_H_
+#define _RFFT_H_
+
+#include <stdint.h>
+
+/*
+ * Transform sizes supported by rfft(), as powers of two: 4 to 512 points.
+ */
+
+#define RFFT_LOG2_MIN		2
+#define RFFT_LOG2_MAX		9
+#define RFFT_MAX		(1 << RFFT_LOG2_MAX)
+
+/*
+ * rfft() replaces its input of N real samples with the first half of
+ * their spectrum, in the same N 16-bit words:
+ *
+ * x[0]			real part of bin 0 (DC)
+ * x[1]			real part of bin N/2 (the Nyquist frequency)
+ * x[2k], x[2k + 1]	real and imaginary parts of bin k, 0 < k < N/2
+ *
+ * The other half of the spectrum of a real signal is just the complex
+ * conjugate of this half, so there's no need to compute it. The results
+ * are scaled by 1/N, the same as fix_fft(), so they can't overflow, and
+ * a full scale sine wave comes out with a magnitude of about 16384.
+ */
+
+extern int rfft (int16_t * x, int m);
+extern void rfftMag (const int16_t * x, uint16_t * mag, int m);
+
+#endif /* _RFFT_H_ */
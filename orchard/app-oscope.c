@@ -6,8 +6,10 @@
 #include <string.h>
 #include <stdlib.h>
 
-#include "fixmath.h"
-#include "fix16_fft.h"
+#include "rfft.h"
+
+// log2(MIC_SAMPLE_DEPTH), for the FFT
+#define MIC_SAMPLE_LOG2 7
 
 static int mode = 0;
 
@@ -89,16 +91,25 @@ static void redraw_ui(uint8_t *samples) {
   coord_t height;
   uint8_t i;
   uint8_t scale;
-  fix16_t real[MIC_SAMPLE_DEPTH];
-  fix16_t imag[MIC_SAMPLE_DEPTH];
+  int16_t fft[MIC_SAMPLE_DEPTH];
+  uint16_t mag[MIC_SAMPLE_DEPTH / 2];
+  uint16_t m;
 
   agc( samples );
   
-  if ( mode ) {
-    fix16_fft(samples, real, imag, MIC_SAMPLE_DEPTH);
+  if ( mode && samples != NULL ) {
+    // the spectrum of real samples is symmetric, so the FFT only gives us
+    // the first half: draw each bin two samples wide to fill the screen
+    for( i = 0; i < MIC_SAMPLE_DEPTH; i++ )
+      fft[i] = ((int16_t)samples[i] - 128) << 7;
+
+    rfft(fft, MIC_SAMPLE_LOG2);
+    rfftMag(fft, mag, MIC_SAMPLE_LOG2);
+
+    // a full scale sine wave comes out at about 8192
     for( i = 0; i < MIC_SAMPLE_DEPTH; i++ ) {
-      samples[i] = fix16_to_int( fix16_sqrt(fix16_sadd(fix16_mul(real[i],real[i]),
-						       fix16_mul(imag[i],imag[i]))) );
+      m = mag[i / 2] >> 5;
+      samples[i] = m > 255 ? 255 : m;
     }
     
     agc_fft(samples);
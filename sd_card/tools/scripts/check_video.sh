@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# SPQR/Ides of March Asset Build System
+#
+# Round trip test for the video encoder, run by "make check" in tools/.
+#
+# For each codec, audio format and frame size below, vidcheck writes a
+# synthetic clip, videnc encodes it and viddec decodes the result again.
+# The decoded frames must match the clip exactly, less the first frame,
+# which the encoder drops. The clip only uses 216 colors, so this holds
+# for the palette codec too. PCM audio must also match exactly. ADPCM
+# is lossy, so the RMS difference between its samples and the originals
+# only has to be within ADPCM_TOL, out of a tone with an amplitude of
+# 1500. viddec also checks the seek index, so each clip is long enough
+# to have more than one keyframe.
+#
+# vidbuild shares its encoder (vidcore.c) with videnc, but it needs
+# ffmpeg and sox to read a clip, so it isn't run here.
+#
+
+TOOLS=`dirname $0`/../bin
+FRAMES=80
+ADPCM_TOL=128
+
+DIR=`mktemp -d` || exit 1
+trap 'rm -rf "$DIR"' 0
+
+fail=0
+
+# check name codec audio WxH fps rate
+check () {
+	W=${4%x*}
+	H=${4#*x}
+	FSIZE=`expr $W \* $H \* 2`
+
+	if [ "$3" = adpcm ]; then
+		ENCAUDIO=-A
+	else
+		ENCAUDIO=
+	fi
+
+	${TOOLS}/vidcheck gen -g $4 -n ${FRAMES} -r $5 -a $6 \
+	    "$DIR/in.bin" "$DIR/in.raw" &&
+	${TOOLS}/videnc -c $2 ${ENCAUDIO} -r $5 -g $4 -a $6 -k 64 \
+	    "$DIR/in.bin" "$DIR/in.raw" "$DIR/out.vid" > /dev/null &&
+	${TOOLS}/viddec "$DIR/out.vid" "$DIR/out.bin" "$DIR/out.raw" \
+	    > /dev/null
+
+	if [ $? -ne 0 ]; then
+		echo "$1: FAILED to encode or decode"
+		fail=`expr $fail + 1`
+		return
+	fi
+
+	if [ `wc -c < "$DIR/out.bin"` -ne `expr $FSIZE \* \( $FRAMES - 1 \)` ]; then
+		echo "$1: FAILED, wrong number of frames decoded"
+		fail=`expr $fail + 1`
+		return
+	fi
+
+	if ! tail -c +`expr $FSIZE + 1` "$DIR/in.bin" |
+	    cmp -s - "$DIR/out.bin"; then
+		echo "$1: FAILED, decoded frames differ"
+		fail=`expr $fail + 1`
+		return
+	fi
+
+	if [ "$3" = adpcm ]; then
+		${TOOLS}/vidcheck cmp -t ${ADPCM_TOL} "$DIR/in.raw" \
+		    "$DIR/out.raw" > /dev/null
+	else
+		cmp -s -n `wc -c < "$DIR/out.raw"` "$DIR/in.raw" \
+		    "$DIR/out.raw" && [ -s "$DIR/out.raw" ]
+	fi
+
+	if [ $? -ne 0 ]; then
+		echo "$1: FAILED, decoded audio differs"
+		fail=`expr $fail + 1`
+		return
+	fi
+
+	echo "$1: ok"
+}
+
+check delta-pcm delta pcm 128x96 8 9216
+check delta-adpcm delta adpcm 128x96 12 9216
+check pal8-pcm pal8 pcm 160x120 8 7680
+check pal8-adpcm pal8 adpcm 128x96 8 9216
+
+echo "$fail of 4 video checks failed"
+
+[ $fail -eq 0 ]
@@ -6,41 +6,62 @@
 # John Adams <jna@retina.net> @netik
 # Bill Paul <wpaul@windriver.com>
 #
-# Script to convert a video file into a collection of frames and
-# an audio sample file.
+# Script to convert a video file into a version 2 video file for the
+# badge.
 #
 # Usage is:
-# encode_video.sh file.mp4 destination/directory/path
+# encode_video.sh file.mp4 destination/directory/path [fps [WxH [rate [codec [audio]]]]]
 #
 # Required utilities:
 # ffmpeg
 # sox
 #
-# The destination directory must already exist
 # The video will have an absolute resolution of 128x96 pixels and
-# a frame rate of 8 frames per second. These values have been chosen
-# to coincide will with the audio sample rate of 9216Hz. The video
-# and audio will be synchronized as the video and audio data
-# will ultimately be merged back together into a single file.
+# a default frame rate of 8 frames per second. These values have been
+# chosen to coincide will with the audio sample rate of 9216Hz.
+#
+# The encoding itself is done by tools/bin/vidbuild in a single pass:
+# it reads the frames and audio samples straight from ffmpeg and sox
+# and writes the .vid file as it goes, with no intermediate files. The
+# output is named after the input file, cut down to an 8.3 name (for
+# example, "My Clip (1).mp4" becomes myclip1.vid), and is only rebuilt
+# if the input or the settings have changed since the last run.
+#
+# The output is a delta coded version 2 file, which requires a lot less
+# SD card bandwidth than the raw format, so higher frame rates are
+# possible. The audio samples are split evenly across the 48 scanline
+# pairs in each frame, so the frame rate must divide evenly into 192
+# (9216 / 48) and be at least 8: 8, 12, 16 and 24 all work.
+#
+# A different frame size and audio sample rate can also be given. The
+# badge can play 320x240, 160x120 and 128x96 video full screen. The audio
+# rate must divide evenly by the number of scanline pairs played each
+# second (fps * height / 2), with at most 48 samples per pair. For
+# example, 160x120 at 8 frames per second works with 7680Hz audio.
+#
+# The codec can be delta (the default) or pal8. The pal8 codec stores
+# 8 bits per pixel using a palette chosen for each group of 64 frames,
+# which halves the size of every frame at some cost in color accuracy.
+#
+# The audio can be adpcm (the default) or pcm. ADPCM stores each sample
+# in 4 bits instead of 16, which takes a big bite out of the size of
+# every chunk.
+#
+# The encoded file is decoded again afterwards to make sure the encoder
+# produced a file the player can parse. The encoder's output is checked
+# bit for bit against synthetic clips by "make check" in tools/.
 #
 
-rm -f $2/video.bin
-
-# Convert video to raw rgb565 pixel frames at 8 frames/sec
-ffmpeg -i "$1" -r 8 -s 128x96 -f rawvideo -pix_fmt rgb565 $2/video.bin
-
-# Extract audio
-ffmpeg -i "$1" -ac 1 -ar 9216 $2/sample.wav
-
-# Convert WAV to to raw unsigned 16 bit samples, boost gain a little
-sox $2/sample.wav $2/sample.u16 contrast 80
-
-# Finally, convert 16-bit audio samples to 12-bit samples for DAC
-mv $2/sample.u16 $2/sample.raw
-./bin/snd16to12 $2/sample.raw
+FPS=${3:-8}
+SIZE=${4:-128x96}
+RATE=${5:-9216}
+CODEC=${6:-delta}
+AUDIO=${7:-adpcm}
 
-rm -f $2/sample.wav
+TOOLS=`dirname $0`/../bin
 
-./bin/videomerge $2/video.bin $2/sample.raw $2/video.vid
+${TOOLS}/vidbuild -c ${CODEC} -p ${AUDIO} -r ${FPS} -g ${SIZE} -a ${RATE} -k 64 -o "$2" "$1" || exit 1
 
-rm -f $2/video.bin $2/sample.raw
+# Check that the encoded video decodes cleanly.
+NAME=`basename "$1" | sed -e 's/\..*//' -e 's/[^A-Za-z0-9]//g' | tr A-Z a-z | cut -c1-8`
+${TOOLS}/viddec "$2/${NAME:-v}.vid" /dev/null /dev/null || exit 1
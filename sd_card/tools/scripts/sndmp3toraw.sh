@@ -8,13 +8,21 @@
 #
 # sndmp3toraw.sh
 #
-# Convert mp3 to 8Khz audio, then downconvert to 12bits for our DAC
+# Convert mp3 to 9216Hz audio, then encode it as 4-bit ADPCM for our DAC.
+# sndenc checks the encoded file and fails if it sounds too far off.
+#
+# A different sample rate can be given as the second argument, in which
+# case the file is stored at that rate and the badge resamples it as it
+# plays. Rates below 9216Hz save space on the SD card.
 #
 
 prefix="`echo $1 | cut -d . -f 1`"
+rate=${2:-9216}
 
 echo "$prefix"
-sox $1 $prefix.u16 channels 1 rate 9216 contrast 80
+sox $1 $prefix.u16 channels 1 rate $rate contrast 80
 
-mv $prefix.u16 $prefix.raw
-tools/bin/snd16to12 $prefix.raw
+tools/bin/sndenc -r $rate $prefix.u16 $prefix.raw
+status=$?
+rm -f $prefix.u16
+exit $status
@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+/*
+ * This program takes a file containing 16-bit unsigned audio samples
+ * and converts them into a sound file for the DAC in the Freescale KW01
+ * chip. Unfortunately, audio utilities tend to support resolutions such
+ * as 8, 16, 24 or 32 bits, but not 12, which is what the DAC wants.
+ *
+ * With -c pcm, the output is a headerless file of 12-bit samples stored
+ * 16 bits per sample, the same as the old snd16to12 utility produced.
+ * This is also the input format expected by videnc and videomerge.
+ *
+ * The input is taken to be at the DAC's own rate of 9216Hz, unless
+ * another rate is given with -r. The badge converts other rates as it
+ * plays, so sounds don't have to be resampled here first. The rate is
+ * stored in the header, so a PCM file at another rate gets one too.
+ *
+ * With -c adpcm (the default), the output starts with a 12 byte header
+ * and the samples are stored as 4-bit IMA ADPCM, in blocks of 192
+ * samples (one DAC playback buffer). Each block starts with the decoder
+ * state: a 16-bit predictor and the step index, followed by a pad byte.
+ * The samples follow two to a byte, low nibble first.
+ *
+ * After writing an ADPCM file, we read it back and decode it the same
+ * way the badge does, and compare the result to the 12-bit samples we
+ * would have written with -c pcm. The signal to noise ratio and largest
+ * error are reported, and if the SNR is below the limit given with -t
+ * (20dB by default), we complain and exit with an error, so that a bad
+ * encoder or decoder change gets caught when the assets are built.
+ *
+ * Usage: sndenc [-c pcm|adpcm] [-r rate] [-t min SNR] input.u16 output.raw
+ */
+
+#define SAMPLE_RATE		9216
+#define SAMPLE_RATE_MIN		1000	/* Lowest rate the badge plays */
+#define SAMPLE_CHUNK		1024
+
+#define DAC_VERSION		1
+#define DAC_CODEC_PCM		0
+#define DAC_CODEC_ADPCM		1
+
+#define ADPCM_SAMPLES		192
+#define ADPCM_HDR		4
+#define ADPCM_BLOCK		(ADPCM_HDR + (ADPCM_SAMPLES / 2))
+
+static const int16_t adpcm_steps[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t adpcm_index[8] = {
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static void
+put16 (uint8_t * p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+	return;
+}
+
+/*
+ * Convert a 16-bit unsigned sample to 12 bits, with rounding.
+ */
+
+static uint16_t
+to12 (uint16_t s)
+{
+	return (s >= 0xFFF8 ? 0xFFF : (s + 8) >> 4);
+}
+
+/*
+ * Apply one nibble to the decoder state. The encoder and decoder must
+ * track each other exactly, so both use this.
+ */
+
+static void
+adpcm_step (int32_t * pred, int * index, uint8_t n)
+{
+	int32_t diff;
+	int step;
+
+	step = adpcm_steps[*index];
+	diff = step >> 3;
+	if (n & 4)
+		diff += step;
+	if (n & 2)
+		diff += step >> 1;
+	if (n & 1)
+		diff += step >> 2;
+
+	if (n & 8) {
+		*pred -= diff;
+		if (*pred < -32768)
+			*pred = -32768;
+	} else {
+		*pred += diff;
+		if (*pred > 32767)
+			*pred = 32767;
+	}
+
+	*index += adpcm_index[n & 7];
+	if (*index < 0)
+		*index = 0;
+	else if (*index > 88)
+		*index = 88;
+
+	return;
+}
+
+/*
+ * Encode <cnt> 16-bit signed samples into an ADPCM block at <blk>,
+ * starting with the step index <*index>. The predictor starts at the
+ * first sample. On return, <*index> is the step index at the end of the
+ * block. Returns the sum of the squared coding errors.
+ */
+
+static double
+adpcm_encode (int16_t * s, int cnt, uint8_t * blk, int * index)
+{
+	double err;
+	int32_t pred;
+	int32_t diff;
+	int step;
+	uint8_t n;
+	int i;
+
+	pred = s[0];
+	put16 (blk, (uint16_t)pred);
+	blk[2] = *index;
+	blk[3] = 0;
+
+	memset (blk + ADPCM_HDR, 0, (cnt + 1) / 2);
+	err = 0;
+
+	for (i = 0; i < cnt; i++) {
+		diff = s[i] - pred;
+		n = 0;
+		if (diff < 0) {
+			n = 8;
+			diff = -diff;
+		}
+		step = adpcm_steps[*index];
+		if (diff >= step) {
+			n |= 4;
+			diff -= step;
+		}
+		step >>= 1;
+		if (diff >= step) {
+			n |= 2;
+			diff -= step;
+		}
+		step >>= 1;
+		if (diff >= step)
+			n |= 1;
+
+		adpcm_step (&pred, index, n);
+		err += (double)(s[i] - pred) * (s[i] - pred);
+
+		if (i & 1)
+			blk[ADPCM_HDR + (i / 2)] |= n << 4;
+		else
+			blk[ADPCM_HDR + (i / 2)] = n;
+	}
+
+	return (err);
+}
+
+/*
+ * Encode a block, picking the starting step index that gives the least
+ * error. Normally the index carried over from the previous block is the
+ * best choice, but trying them all means the first block and blocks
+ * after a sudden change in volume don't have to wait for the step size
+ * to catch up. Returns the size of the block in bytes.
+ */
+
+static int
+adpcm_block (int16_t * s, int cnt, uint8_t * blk, int * index)
+{
+	double best;
+	double err;
+	int bestidx;
+	int idx;
+	int i;
+
+	best = -1;
+	bestidx = *index;
+
+	for (i = 0; i <= 88; i++) {
+		idx = i;
+		err = adpcm_encode (s, cnt, blk, &idx);
+		if (best < 0 || err < best ||
+		    (err == best && i == *index)) {
+			best = err;
+			bestidx = i;
+		}
+	}
+
+	*index = bestidx;
+	adpcm_encode (s, cnt, blk, index);
+
+	return (ADPCM_HDR + (cnt + 1) / 2);
+}
+
+/*
+ * Decode the ADPCM block at <blk> into <cnt> 12-bit samples, exactly
+ * like dacAdpcmDecode() on the badge.
+ */
+
+static void
+adpcm_decode (uint8_t * blk, uint16_t * p, int cnt)
+{
+	int32_t pred;
+	int index;
+	uint8_t n;
+	int i;
+
+	pred = (int16_t)(blk[0] | (blk[1] << 8));
+	index = blk[2];
+	if (index > 88)
+		index = 88;
+
+	for (i = 0; i < cnt; i++) {
+		n = blk[ADPCM_HDR + (i / 2)];
+		if (i & 1)
+			n >>= 4;
+		adpcm_step (&pred, &index, n & 0xF);
+		p[i] = (pred + 32768) >> 4;
+	}
+
+	return;
+}
+
+static void
+usage (char * prog)
+{
+	fprintf (stderr, "\nUsage: %s [-c pcm|adpcm] [-r rate] "
+	    "[-t min SNR] input.u16 output.raw\n\n", prog);
+	exit (1);
+}
+
+/*
+ * Read back an ADPCM file and compare it against the original samples.
+ */
+
+static int
+verify (FILE * in, char * name, double minsnr)
+{
+	FILE * fp;
+	uint16_t samples[ADPCM_SAMPLES];
+	uint16_t dec[ADPCM_SAMPLES];
+	uint8_t blk[ADPCM_BLOCK];
+	uint8_t hdr[12];
+	uint32_t total;
+	uint32_t n;
+	double sig;
+	double err;
+	double snr;
+	double mean;
+	double sum;
+	int maxerr;
+	size_t cnt;
+	size_t br;
+	int d;
+	size_t i;
+
+	fp = fopen (name, "r");
+
+	if (fp == NULL) {
+		fprintf (stderr, "[%s]: ", name);
+		perror ("file open failed");
+		return (-1);
+	}
+
+	if (fread (hdr, sizeof(hdr), 1, fp) != 1) {
+		fprintf (stderr, "[%s]: short file\n", name);
+		fclose (fp);
+		return (-1);
+	}
+
+	total = hdr[8] | (hdr[9] << 8) | (hdr[10] << 16) |
+	    ((uint32_t)hdr[11] << 24);
+
+	/* First pass: find the mean, so DC doesn't count as signal. */
+
+	rewind (in);
+	sum = 0;
+	n = 0;
+	while ((cnt = fread (samples, sizeof(uint16_t), ADPCM_SAMPLES,
+	    in)) != 0) {
+		for (i = 0; i < cnt; i++)
+			sum += to12 (samples[i]);
+		n += cnt;
+	}
+	mean = n ? sum / n : 0;
+
+	rewind (in);
+	sig = err = 0;
+	maxerr = 0;
+	n = 0;
+
+	while ((cnt = fread (samples, sizeof(uint16_t), ADPCM_SAMPLES,
+	    in)) != 0) {
+		br = fread (blk, 1, ADPCM_HDR + (cnt + 1) / 2, fp);
+		if (br != ADPCM_HDR + (cnt + 1) / 2)
+			break;
+		adpcm_decode (blk, dec, cnt);
+		for (i = 0; i < cnt; i++) {
+			d = (int)dec[i] - to12 (samples[i]);
+			err += (double)d * d;
+			sig += (to12 (samples[i]) - mean) *
+			    (to12 (samples[i]) - mean);
+			if (abs (d) > maxerr)
+				maxerr = abs (d);
+		}
+		n += cnt;
+	}
+
+	if (n != total || fgetc (fp) != EOF) {
+		fprintf (stderr, "[%s]: expected %u samples, got %u\n",
+		    name, total, n);
+		fclose (fp);
+		return (-1);
+	}
+
+	fclose (fp);
+
+	if (err == 0)
+		snr = 99.0;
+	else if (sig == 0)
+		snr = 0.0;
+	else
+		snr = 10.0 * log10 (sig / err);
+
+	printf ("%u samples, SNR %.1f dB, max error %d\n", n, snr, maxerr);
+
+	if (n != 0 && sig != 0 && snr < minsnr) {
+		fprintf (stderr, "[%s]: SNR %.1f dB is below %.1f dB\n",
+		    name, snr, minsnr);
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+main (int argc, char * argv[])
+{
+	FILE * in;
+	FILE * out;
+	uint16_t samples[SAMPLE_CHUNK];
+	int16_t s16[ADPCM_SAMPLES];
+	uint8_t blk[ADPCM_BLOCK];
+	uint8_t hdr[12];
+	uint32_t total;
+	double minsnr;
+	size_t cnt;
+	size_t i;
+	long rate;
+	int codec;
+	int index;
+	int ch;
+
+	codec = DAC_CODEC_ADPCM;
+	minsnr = 20.0;
+	rate = SAMPLE_RATE;
+
+	while ((ch = getopt (argc, argv, "c:r:t:")) != -1) {
+		switch (ch) {
+		case 'c':
+			if (strcmp (optarg, "pcm") == 0)
+				codec = DAC_CODEC_PCM;
+			else if (strcmp (optarg, "adpcm") == 0)
+				codec = DAC_CODEC_ADPCM;
+			else
+				usage (argv[0]);
+			break;
+		case 'r':
+			rate = strtol (optarg, NULL, 10);
+			if (rate < SAMPLE_RATE_MIN || rate > 0xFFFF)
+				usage (argv[0]);
+			break;
+		case 't':
+			minsnr = atof (optarg);
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 2)
+		usage (argv[-optind]);
+
+	in = fopen (argv[0], "r");
+
+	if (in == NULL) {
+		fprintf (stderr, "[%s]: ", argv[0]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	out = fopen (argv[1], "w");
+
+	if (out == NULL) {
+		fprintf (stderr, "[%s]: ", argv[1]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	if (codec == DAC_CODEC_PCM) {
+		if (rate != SAMPLE_RATE) {
+			memset (hdr, 0, sizeof(hdr));
+			hdr[0] = 'D';
+			hdr[1] = 'A';
+			hdr[2] = 'C';
+			hdr[3] = DAC_VERSION;
+			hdr[4] = DAC_CODEC_PCM;
+			put16 (hdr + 6, rate);
+			fwrite (hdr, sizeof(hdr), 1, out);
+		}
+		total = 0;
+		while ((cnt = fread (samples, sizeof(uint16_t),
+		    SAMPLE_CHUNK, in)) != 0) {
+			for (i = 0; i < cnt; i++)
+				samples[i] = to12 (samples[i]);
+			fwrite (samples, sizeof(uint16_t), cnt, out);
+			total += cnt;
+		}
+		if (rate != SAMPLE_RATE) {
+			put16 (hdr + 8, total & 0xFFFF);
+			put16 (hdr + 10, total >> 16);
+			fseek (out, 0, SEEK_SET);
+			fwrite (hdr, sizeof(hdr), 1, out);
+		}
+		fclose (in);
+		fclose (out);
+		exit (0);
+	}
+
+	/* Write a placeholder header, we fill in the sample count later. */
+
+	memset (hdr, 0, sizeof(hdr));
+	fwrite (hdr, sizeof(hdr), 1, out);
+
+	total = 0;
+	index = 0;
+
+	while ((cnt = fread (samples, sizeof(uint16_t), ADPCM_SAMPLES,
+	    in)) != 0) {
+		for (i = 0; i < cnt; i++)
+			s16[i] = (int16_t)(samples[i] - 32768);
+		fwrite (blk, adpcm_block (s16, cnt, blk, &index), 1, out);
+		total += cnt;
+	}
+
+	hdr[0] = 'D';
+	hdr[1] = 'A';
+	hdr[2] = 'C';
+	hdr[3] = DAC_VERSION;
+	hdr[4] = DAC_CODEC_ADPCM;
+	put16 (hdr + 6, rate);
+	put16 (hdr + 8, total & 0xFFFF);
+	put16 (hdr + 10, total >> 16);
+
+	fseek (out, 0, SEEK_SET);
+	fwrite (hdr, sizeof(hdr), 1, out);
+	fclose (out);
+
+	if (verify (in, argv[1], minsnr) != 0)
+		exit (1);
+
+	fclose (in);
+
+	exit (0);
+}
@@ -0,0 +1,558 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "vidcore.h"
+
+/*
+ * This program turns one or more video clips into version 2 video files
+ * for the badge in a single pass. It replaces the old encode_video.sh
+ * pipeline, which wrote out all the raw frames and audio samples for a
+ * clip, converted the samples to 12 bits, merged the two with videnc and
+ * then read everything back in again to check it.
+ *
+ * Instead, for each clip we run ffmpeg twice, once to decode the video
+ * into RGB565 frames and once (with sox) to decode the audio into 16-bit
+ * unsigned samples, and read both streams straight from the pipes. Each
+ * frame and the samples that go with it are converted and handed to the
+ * encoder in vidcore.c as soon as they arrive, so nothing but the output
+ * file ever touches the disk. Each clip is encoded in its own thread.
+ *
+ * The output goes into the given directory, named after the clip: the
+ * letters and digits in its name, lowercased and cut down to 8 characters
+ * to fit the FAT filesystem on the badge, plus .vid. Next to it we keep a
+ * .hash file holding a hash of the clip and the encoding settings; if the
+ * hash still matches on the next run, the clip is skipped. Use -f to
+ * encode everything anyway.
+ *
+ * As with videnc, we drop the first video frame to keep the audio and
+ * video in sync.
+ *
+ * Usage: vidbuild [-c delta|pal8] [-r fps] [-g WxH] [-a rate]
+ *	[-p pcm|adpcm] [-k keyframe interval] [-f] -o outdir clip ...
+ */
+
+#define NAME_MAX83		8
+#define AUDIO_PAD		1	/* Seconds of silence after the audio */
+
+typedef struct vid_clip {
+	char *		vc_in;		/* Source clip */
+	char		vc_name[NAME_MAX83 + 5];
+	char *		vc_out;		/* Output .vid path */
+	char *		vc_hashfile;	/* Output .hash path */
+	uint64_t	vc_hash;
+	VID_ENC		vc_enc;
+	pthread_t	vc_thread;
+	int		vc_skip;
+	int		vc_err;
+} VID_CLIP;
+
+static VID_ENC settings;
+
+static void
+usage (char * prog)
+{
+	fprintf (stderr, "\nUsage: %s [-c delta|pal8] [-r fps] [-g WxH] "
+	    "[-a rate] [-p pcm|adpcm] [-k keyframe interval] [-f] "
+	    "-o outdir clip ...\n\n", prog);
+	exit (1);
+}
+
+/*
+ * Convert a 16-bit unsigned sample to 12 bits, with rounding. This
+ * matches what sndenc does.
+ */
+
+static uint16_t
+to12 (uint16_t s)
+{
+	return (s >= 0xFFF8 ? 0xFFF : (s + 8) >> 4);
+}
+
+/*
+ * 64-bit FNV-1a hash, used to tell whether a clip has changed since it
+ * was last encoded.
+ */
+
+static uint64_t
+fnv1a (uint64_t h, const uint8_t * p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001B3ULL;
+	}
+
+	return (h);
+}
+
+static int
+clip_hash (VID_CLIP * vc)
+{
+	uint8_t buf[65536];
+	char opts[128];
+	FILE * f;
+	uint64_t h;
+	size_t n;
+
+	f = fopen (vc->vc_in, "r");
+
+	if (f == NULL) {
+		fprintf (stderr, "[%s]: ", vc->vc_in);
+		perror ("file open failed");
+		return (-1);
+	}
+
+	h = 0xCBF29CE484222325ULL;
+	while ((n = fread (buf, 1, sizeof(buf), f)) > 0)
+		h = fnv1a (h, buf, n);
+	fclose (f);
+
+	snprintf (opts, sizeof(opts), "%d %d %dx%d %d %d %d %d",
+	    settings.ve_codec, settings.ve_fps, settings.ve_width,
+	    settings.ve_height, settings.ve_rate, settings.ve_keyint,
+	    settings.ve_minskip, settings.ve_adpcm);
+	vc->vc_hash = fnv1a (h, (uint8_t *)opts, strlen (opts));
+
+	return (0);
+}
+
+/*
+ * Check whether the clip's output is up to date.
+ */
+
+static int
+clip_current (VID_CLIP * vc)
+{
+	struct stat st;
+	unsigned long long h;
+	FILE * f;
+	int r;
+
+	if (stat (vc->vc_out, &st) != 0)
+		return (0);
+
+	f = fopen (vc->vc_hashfile, "r");
+	if (f == NULL)
+		return (0);
+	r = fscanf (f, "%llx", &h);
+	fclose (f);
+
+	return (r == 1 && h == vc->vc_hash);
+}
+
+/*
+ * Quote a string for the shell, so clips with spaces, quotes or
+ * parentheses in their names don't confuse popen().
+ */
+
+static char *
+shell_quote (const char * s)
+{
+	char * q;
+	char * p;
+
+	q = malloc ((strlen (s) * 4) + 3);
+	if (q == NULL)
+		return (NULL);
+
+	p = q;
+	*p++ = '\'';
+	for (; *s != '\0'; s++) {
+		if (*s == '\'') {
+			memcpy (p, "'\\''", 4);
+			p += 4;
+		} else
+			*p++ = *s;
+	}
+	*p++ = '\'';
+	*p = '\0';
+
+	return (q);
+}
+
+static void *
+clip_encode (void * arg)
+{
+	VID_CLIP * vc = arg;
+	VID_ENC * ve = &vc->vc_enc;
+	char cmd[1024];
+	char * tmp;
+	char * in;
+	FILE * video;
+	FILE * audio;
+	FILE * out;
+	FILE * f;
+	uint16_t * frame;
+	uint16_t * samples;
+	size_t fsize;
+	size_t nsamp;
+	size_t i;
+	int r;
+
+	vc->vc_err = 1;
+	video = NULL;
+	audio = NULL;
+	out = NULL;
+	frame = NULL;
+	samples = NULL;
+
+	in = shell_quote (vc->vc_in);
+	tmp = malloc (strlen (vc->vc_out) + 5);
+
+	if (in == NULL || tmp == NULL) {
+		fprintf (stderr, "out of memory\n");
+		goto done;
+	}
+
+	sprintf (tmp, "%s.tmp", vc->vc_out);
+	out = fopen (tmp, "w");
+
+	if (out == NULL) {
+		fprintf (stderr, "[%s]: ", tmp);
+		perror ("file open failed");
+		goto done;
+	}
+
+	if (vidEncStart (ve, out) != 0)
+		goto done;
+
+	fsize = ve->ve_width * ve->ve_height * sizeof(uint16_t);
+	nsamp = ve->ve_pairs * ve->ve_spc;
+	frame = malloc (fsize);
+	samples = malloc (nsamp * sizeof(uint16_t));
+
+	if (frame == NULL || samples == NULL) {
+		fprintf (stderr, "out of memory\n");
+		goto done;
+	}
+
+	snprintf (cmd, sizeof(cmd), "ffmpeg -v error -nostdin -i %s "
+	    "-r %d -s %dx%d -f rawvideo -pix_fmt rgb565le -", in,
+	    ve->ve_fps, ve->ve_width, ve->ve_height);
+	video = popen (cmd, "r");
+
+	/*
+	 * Boost the gain a little on the way through sox. The audio
+	 * track often ends a little before the last frame, so sox also
+	 * pads it out with AUDIO_PAD seconds of silence. If it still runs
+	 * out before the video, something went wrong decoding it.
+	 */
+
+	snprintf (cmd, sizeof(cmd), "ffmpeg -v error -nostdin -i %s "
+	    "-ac 1 -ar %d -f wav - | sox -t wav - -t raw -e unsigned-integer "
+	    "-b 16 -L - contrast 80 pad 0 %d", in, ve->ve_rate, AUDIO_PAD);
+	audio = popen (cmd, "r");
+
+	if (video == NULL || audio == NULL) {
+		fprintf (stderr, "[%s]: ", vc->vc_in);
+		perror ("decoder start failed");
+		goto done;
+	}
+
+	/* Hack: skip the first frame. */
+
+	fread (frame, fsize, 1, video);
+
+	while (fread (frame, fsize, 1, video) == 1) {
+		if (fread (samples, sizeof(uint16_t), nsamp, audio) != nsamp) {
+			fprintf (stderr, "[%s]: audio ended before the "
+			    "video\n", vc->vc_in);
+			goto done;
+		}
+		for (i = 0; i < nsamp; i++)
+			samples[i] = to12 (samples[i]);
+		if (vidEncFrame (ve, frame, samples) != 0) {
+			fprintf (stderr, "[%s]: too many frames\n",
+			    vc->vc_in);
+			goto done;
+		}
+	}
+
+	/*
+	 * Read whatever audio is left so sox can exit normally, then
+	 * make sure both decoders did. A decoder that failed partway
+	 * through would otherwise just look like the end of the clip.
+	 */
+
+	while (fread (samples, sizeof(uint16_t), nsamp, audio) == nsamp)
+		;
+
+	r = pclose (video);
+	video = NULL;
+	if (r != 0) {
+		fprintf (stderr, "[%s]: video decoder failed\n", vc->vc_in);
+		goto done;
+	}
+
+	r = pclose (audio);
+	audio = NULL;
+	if (r != 0) {
+		fprintf (stderr, "[%s]: audio decoder failed\n", vc->vc_in);
+		goto done;
+	}
+
+	if (vidEncFinish (ve) != 0) {
+		fprintf (stderr, "[%s]: ", tmp);
+		perror ("write failed");
+		goto done;
+	}
+
+	if (ve->ve_frames == 0) {
+		fprintf (stderr, "[%s]: no frames decoded\n", vc->vc_in);
+		goto done;
+	}
+
+	fclose (out);
+	out = NULL;
+
+	if (rename (tmp, vc->vc_out) != 0) {
+		fprintf (stderr, "[%s]: ", vc->vc_out);
+		perror ("rename failed");
+		unlink (tmp);
+		goto done;
+	}
+
+	f = fopen (vc->vc_hashfile, "w");
+	if (f != NULL) {
+		fprintf (f, "%016llx\n", (unsigned long long)vc->vc_hash);
+		fclose (f);
+	}
+
+	vc->vc_err = 0;
+
+done:
+	if (video != NULL)
+		pclose (video);
+	if (audio != NULL)
+		pclose (audio);
+	if (out != NULL) {
+		fclose (out);
+		unlink (tmp);
+	}
+	vidEncFree (ve);
+	free (in);
+	free (tmp);
+	free (frame);
+	free (samples);
+
+	return (NULL);
+}
+
+/*
+ * Work out the 8.3 output name for a clip.
+ */
+
+static void
+clip_name (VID_CLIP * vc)
+{
+	const char * base;
+	const char * p;
+	int n;
+
+	base = strrchr (vc->vc_in, '/');
+	base = (base == NULL) ? vc->vc_in : base + 1;
+
+	n = 0;
+	for (p = base; *p != '\0' && *p != '.' && n < NAME_MAX83; p++) {
+		if (isalnum ((unsigned char)*p))
+			vc->vc_name[n++] = tolower ((unsigned char)*p);
+	}
+
+	if (n == 0)
+		vc->vc_name[n++] = 'v';
+
+	strcpy (vc->vc_name + n, ".vid");
+
+	return;
+}
+
+int
+main (int argc, char * argv[])
+{
+	VID_CLIP * clips;
+	VID_CLIP * vc;
+	char * outdir;
+	FILE * nul;
+	int force;
+	int nclips;
+	int errs;
+	int ch;
+	int i;
+	int j;
+
+	memset (&settings, 0, sizeof(settings));
+	settings.ve_codec = VID_CODEC_DELTA;
+	settings.ve_fps = 8;
+	settings.ve_width = FRAME_WIDTH;
+	settings.ve_height = FRAME_HEIGHT;
+	settings.ve_rate = SAMPLE_RATE;
+	settings.ve_keyint = 64;
+	settings.ve_minskip = 4;
+	settings.ve_adpcm = 1;
+	outdir = NULL;
+	force = 0;
+
+	while ((ch = getopt (argc, argv, "c:r:g:a:p:k:fo:")) != -1) {
+		switch (ch) {
+		case 'c':
+			if (strcmp (optarg, "delta") == 0)
+				settings.ve_codec = VID_CODEC_DELTA;
+			else if (strcmp (optarg, "pal8") == 0)
+				settings.ve_codec = VID_CODEC_PAL8;
+			else
+				usage (argv[0]);
+			break;
+		case 'r':
+			settings.ve_fps = atoi (optarg);
+			break;
+		case 'g':
+			if (sscanf (optarg, "%dx%d", &settings.ve_width,
+			    &settings.ve_height) != 2)
+				usage (argv[0]);
+			break;
+		case 'a':
+			settings.ve_rate = atoi (optarg);
+			break;
+		case 'p':
+			if (strcmp (optarg, "pcm") == 0)
+				settings.ve_adpcm = 0;
+			else if (strcmp (optarg, "adpcm") == 0)
+				settings.ve_adpcm = 1;
+			else
+				usage (argv[0]);
+			break;
+		case 'k':
+			settings.ve_keyint = atoi (optarg);
+			break;
+		case 'f':
+			force = 1;
+			break;
+		case 'o':
+			outdir = optarg;
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1 || outdir == NULL)
+		usage (argv[-optind]);
+
+	if (mkdir (outdir, 0755) != 0 && access (outdir, W_OK) != 0) {
+		fprintf (stderr, "[%s]: ", outdir);
+		perror ("can't create output directory");
+		exit (1);
+	}
+
+	nclips = argc;
+	clips = calloc (nclips, sizeof(VID_CLIP));
+
+	if (clips == NULL) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+
+	/*
+	 * Check the settings once up front, with a throwaway encoder
+	 * writing to /dev/null, so we don't get the same complaint from
+	 * every thread.
+	 */
+
+	nul = fopen ("/dev/null", "w");
+	if (nul == NULL || vidEncStart (&settings, nul) != 0)
+		exit (1);
+	vidEncFree (&settings);
+	fclose (nul);
+
+	errs = 0;
+
+	for (i = 0; i < nclips; i++) {
+		vc = &clips[i];
+		vc->vc_in = argv[i];
+		clip_name (vc);
+
+		for (j = 0; j < i; j++) {
+			if (strcmp (clips[j].vc_name, vc->vc_name) == 0) {
+				fprintf (stderr, "[%s]: output name %s is "
+				    "already used by %s\n", vc->vc_in,
+				    vc->vc_name, clips[j].vc_in);
+				exit (1);
+			}
+		}
+
+		vc->vc_out = malloc (strlen (outdir) + sizeof(vc->vc_name) + 1);
+		vc->vc_hashfile = malloc (strlen (outdir) +
+		    sizeof(vc->vc_name) + 2);
+
+		if (vc->vc_out == NULL || vc->vc_hashfile == NULL) {
+			fprintf (stderr, "out of memory\n");
+			exit (1);
+		}
+
+		sprintf (vc->vc_out, "%s/%s", outdir, vc->vc_name);
+		sprintf (vc->vc_hashfile, "%s/%.*s.hash", outdir,
+		    (int)strlen (vc->vc_name) - 4, vc->vc_name);
+	}
+
+	/* Now work out which clips need encoding and start them. */
+
+	for (i = 0; i < nclips; i++) {
+		vc = &clips[i];
+
+		if (clip_hash (vc) != 0) {
+			vc->vc_skip = 1;
+			errs++;
+			continue;
+		}
+
+		if (!force && clip_current (vc)) {
+			printf ("%s: %s is up to date\n", vc->vc_in,
+			    vc->vc_name);
+			vc->vc_skip = 1;
+			continue;
+		}
+
+		vc->vc_enc = settings;
+		if (pthread_create (&vc->vc_thread, NULL,
+		    clip_encode, vc) != 0) {
+			fprintf (stderr, "[%s]: thread create failed\n",
+			    vc->vc_in);
+			vc->vc_skip = 1;
+			errs++;
+		}
+	}
+
+	for (i = 0; i < nclips; i++) {
+		vc = &clips[i];
+		if (vc->vc_skip)
+			continue;
+		pthread_join (vc->vc_thread, NULL);
+		if (vc->vc_err) {
+			errs++;
+			continue;
+		}
+		printf ("%s: %s, %d frames at %d fps, %lu bytes/frame "
+		    "average, %lu max\n", vc->vc_in, vc->vc_name,
+		    vc->vc_enc.ve_frames, vc->vc_enc.ve_fps,
+		    vc->vc_enc.ve_total / vc->vc_enc.ve_frames,
+		    vc->vc_enc.ve_maxfbytes);
+	}
+
+	for (i = 0; i < nclips; i++) {
+		free (clips[i].vc_out);
+		free (clips[i].vc_hashfile);
+	}
+	free (clips);
+
+	exit (errs ? 1 : 0);
+}
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+/*
+ * This program helps check_video.sh test the video encoder and decoder
+ * against each other. It has two jobs:
+ *
+ * "gen" writes a synthetic clip in the form videnc takes as input: a
+ * file of RGB565 frames and a file of 12-bit audio samples stored 16
+ * bits per sample. Each frame has a still background, a solid box that
+ * moves across it and a striped band that scrolls, so the delta coder
+ * has skips, runs and literals to code, and every eighth frame is the
+ * same as the one before. All the colors come from a 6x6x6 color cube,
+ * so the palette codec can represent them exactly. The audio is a tone
+ * sweeping from 200Hz up to 2kHz.
+ *
+ * "cmp" compares two files of 16-bit samples, such as the audio given
+ * to videnc and the audio viddec decoded, and fails if the RMS of the
+ * differences between them is more than the given tolerance. This is
+ * for the ADPCM audio, which is lossy and can fall well behind a steep
+ * change for a few samples, so a limit on each sample wouldn't work.
+ * Everything else should compare exactly with cmp(1). The second file
+ * may be shorter than the first, since the encoder only uses as much
+ * audio as there is video to go with it.
+ *
+ * Usage: vidcheck gen [-g WxH] [-n frames] [-r fps] [-a rate] video audio
+ *        vidcheck cmp [-t tolerance] expected actual
+ */
+
+#define FRAME_WIDTH		128
+#define FRAME_HEIGHT		96
+#define SAMPLE_RATE		9216
+#define CUBE			6
+#define BOX_SIZE		16
+#define BAND_SIZE		8
+#define STILL_EVERY		8
+
+static void
+usage (char * prog)
+{
+	fprintf (stderr, "\nUsage: %s gen [-g WxH] [-n frames] [-r fps] "
+	    "[-a rate] video audio\n       %s cmp [-t tolerance] expected "
+	    "actual\n\n", prog, prog);
+	exit (1);
+}
+
+/*
+ * The RGB565 value for entry <i> of the color cube.
+ */
+
+static uint16_t
+cube (int i)
+{
+	int r;
+	int g;
+	int b;
+
+	i %= CUBE * CUBE * CUBE;
+	r = i / (CUBE * CUBE);
+	g = (i / CUBE) % CUBE;
+	b = i % CUBE;
+
+	return (((r * 31 / (CUBE - 1)) << 11) |
+	    ((g * 63 / (CUBE - 1)) << 5) | (b * 31 / (CUBE - 1)));
+}
+
+static int
+gen (int argc, char * argv[])
+{
+	FILE * video;
+	FILE * audio;
+	uint16_t * frame;
+	uint16_t s;
+	double phase;
+	double hz;
+	long nsamp;
+	long i;
+	int width;
+	int height;
+	int frames;
+	int fps;
+	int rate;
+	int bx;
+	int by;
+	int ch;
+	int f;
+	int x;
+	int y;
+
+	width = FRAME_WIDTH;
+	height = FRAME_HEIGHT;
+	frames = 80;
+	fps = 8;
+	rate = SAMPLE_RATE;
+
+	while ((ch = getopt (argc, argv, "g:n:r:a:")) != -1) {
+		switch (ch) {
+		case 'g':
+			if (sscanf (optarg, "%dx%d", &width, &height) != 2)
+				usage (argv[-1]);
+			break;
+		case 'n':
+			frames = atoi (optarg);
+			break;
+		case 'r':
+			fps = atoi (optarg);
+			break;
+		case 'a':
+			rate = atoi (optarg);
+			break;
+		default:
+			usage (argv[-1]);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 2 || width < BOX_SIZE || height < BOX_SIZE ||
+	    frames < 1 || fps < 1 || rate < 1)
+		usage (argv[-optind - 1]);
+
+	video = fopen (argv[0], "w");
+
+	if (video == NULL) {
+		fprintf (stderr, "[%s]: ", argv[0]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	audio = fopen (argv[1], "w");
+
+	if (audio == NULL) {
+		fprintf (stderr, "[%s]: ", argv[1]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	frame = malloc (width * height * sizeof(uint16_t));
+
+	if (frame == NULL) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+
+	for (f = 0; f < frames; f++) {
+		/* Every so often, repeat the frame before. */
+
+		if (f != 0 && (f % STILL_EVERY) == 0) {
+			fwrite (frame, width * height * sizeof(uint16_t), 1,
+			    video);
+			continue;
+		}
+
+		for (y = 0; y < height; y++) {
+			for (x = 0; x < width; x++) {
+				if (y >= height / 2 &&
+				    y < height / 2 + BAND_SIZE)
+					s = cube (x + f * 3);
+				else
+					s = cube ((x / 8) + (y / 8) * 7);
+				frame[y * width + x] = s;
+			}
+		}
+
+		bx = (f * 5) % (width - BOX_SIZE);
+		by = (f * 3) % (height - BOX_SIZE);
+		for (y = by; y < by + BOX_SIZE; y++) {
+			for (x = bx; x < bx + BOX_SIZE; x++)
+				frame[y * width + x] = cube (f);
+		}
+
+		fwrite (frame, width * height * sizeof(uint16_t), 1, video);
+	}
+
+	nsamp = ((long)frames * rate) / fps;
+	phase = 0;
+	for (i = 0; i < nsamp; i++) {
+		hz = 200.0 + (1800.0 * i) / nsamp;
+		phase += 2 * M_PI * hz / rate;
+		s = 2048 + (int)(1500 * sin (phase));
+		fwrite (&s, sizeof(s), 1, audio);
+	}
+
+	free (frame);
+
+	if (fclose (video) != 0 || fclose (audio) != 0) {
+		perror ("write failed");
+		exit (1);
+	}
+
+	return (0);
+}
+
+static int
+cmp (int argc, char * argv[])
+{
+	FILE * expected;
+	FILE * actual;
+	uint16_t e;
+	uint16_t a;
+	double sum;
+	double rms;
+	long n;
+	int tol;
+	int max;
+	int d;
+	int ch;
+
+	tol = 0;
+
+	while ((ch = getopt (argc, argv, "t:")) != -1) {
+		switch (ch) {
+		case 't':
+			tol = atoi (optarg);
+			break;
+		default:
+			usage (argv[-1]);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 2)
+		usage (argv[-optind - 1]);
+
+	expected = fopen (argv[0], "r");
+
+	if (expected == NULL) {
+		fprintf (stderr, "[%s]: ", argv[0]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	actual = fopen (argv[1], "r");
+
+	if (actual == NULL) {
+		fprintf (stderr, "[%s]: ", argv[1]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	n = 0;
+	sum = 0;
+	max = 0;
+	while (fread (&a, sizeof(a), 1, actual) == 1) {
+		if (fread (&e, sizeof(e), 1, expected) != 1) {
+			fprintf (stderr, "[%s]: longer than %s\n", argv[1],
+			    argv[0]);
+			exit (1);
+		}
+		d = abs ((int)a - (int)e);
+		if (d > max)
+			max = d;
+		sum += (double)d * d;
+		n++;
+	}
+
+	fclose (expected);
+	fclose (actual);
+
+	if (n == 0) {
+		fprintf (stderr, "[%s]: no samples\n", argv[1]);
+		exit (1);
+	}
+
+	rms = sqrt (sum / n);
+	printf ("%ld samples, RMS difference %.1f, largest %d\n", n, rms,
+	    max);
+
+	if (rms > tol) {
+		fprintf (stderr, "[%s]: RMS difference %.1f is more than %d\n",
+		    argv[1], rms, tol);
+		exit (1);
+	}
+
+	return (0);
+}
+
+int
+main (int argc, char * argv[])
+{
+	if (argc < 2)
+		usage (argv[0]);
+
+	if (strcmp (argv[1], "gen") == 0)
+		exit (gen (argc - 1, argv + 1));
+	if (strcmp (argv[1], "cmp") == 0)
+		exit (cmp (argc - 1, argv + 1));
+
+	usage (argv[0]);
+
+	return (1);
+}
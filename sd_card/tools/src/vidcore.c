@@ -0,0 +1,845 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vidcore.h"
+
+/*
+ * This is the version 2 video encoder used by videnc and vidbuild. It
+ * takes frames in 16-bit RGB565 pixel format, each along with the 12-bit
+ * audio samples (stored 16 bits per sample) that play during it, and
+ * writes a version 2 video file for playback on the Kinetis KW01 using
+ * our video player. By default the frames are 128x96 and the audio is
+ * sampled at 9216Hz, but other frame sizes and rates can be selected.
+ * The player can fill the screen with 320x240, 160x120 or 128x96 frames.
+ *
+ * The output starts with a 16 byte header, followed by one chunk for
+ * each pair of scanlines. Each scanline is delta coded against the same
+ * scanline in the previous frame as a series of ops:
+ *
+ * SKIP n:	n pixels are unchanged from the previous frame
+ * RUN n, p:	pixel p repeated n times
+ * LIT n, ...:	n literal pixels
+ *
+ * Each op is a 16-bit word with the opcode in the top two bits and the
+ * pixel count in the rest. The coded video data for both scanlines is
+ * preceeded by its length in 16-bit words and followed by the audio
+ * samples that go with it. The number of samples per chunk depends on
+ * the frame rate and size: for 128x96 frames and 9216Hz audio it's 24 at
+ * 8 frames per second, 12 at 16 frames per second, and so on. The audio
+ * sample rate must divide evenly by the number of scanline pairs played
+ * each second.
+ *
+ * Every so often (and always for the first frame) we emit a keyframe,
+ * which is coded without any skip ops, so that it doesn't depend on what
+ * was on the screen before. Skips shorter than a few pixels aren't worth
+ * it, since the player has to reprogram the display window every time it
+ * skips over something, so short unchanged stretches are coded as part
+ * of the surrounding runs or literals instead.
+ *
+ * If a keyframe interval is given, we also append a seek index to the
+ * end of the file: a 32-bit file offset for the first chunk of each
+ * keyframe. The player uses this to skip forward and back, and to resume
+ * playback partway through a file.
+ *
+ * With the palette codec, the video is stored differently: each pixel
+ * becomes an 8-bit index into a palette of up to 256 colors. The frames
+ * are taken in groups of keyframe interval frames (or one at a time if
+ * no interval is given), and each group gets its own palette, chosen
+ * using the median cut algorithm over all the pixels in the group. Each
+ * pixel is then mapped to the closest palette color. The first frame of
+ * each group carries the palette and is indexed as a keyframe; the rest
+ * reuse it.
+ *
+ * The audio samples in each chunk can also be stored as a block of IMA
+ * ADPCM instead, laid out the same way as the blocks in sound files made
+ * by sndenc: the decoder state followed by 4-bit samples. Each chunk's
+ * block starts from the chunk's first sample, so chunks can still be
+ * decoded independently after a seek.
+ */
+
+#define VID_OP_SKIP		0x0000
+#define VID_OP_RUN		0x4000
+#define VID_OP_LIT		0x8000
+
+#define MIN_RUN			3
+
+#define ADPCM_HDR		4
+
+/* Worst case: one op word per pixel, plus a pixel per run. */
+
+#define LINE_MAXOPS		(MAX_WIDTH * 2)
+
+static const int16_t adpcm_steps[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t adpcm_index[8] = {
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static void
+put16 (uint8_t * p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+	return;
+}
+
+static void
+put32 (uint8_t * p, uint32_t v)
+{
+	put16 (p, v & 0xFFFF);
+	put16 (p + 2, v >> 16);
+	return;
+}
+
+/*
+ * Return the length of the run of identical pixels starting at
+ * position <p> in <cur>.
+ */
+
+static int
+runlen (VID_ENC * ve, uint16_t * cur, int p)
+{
+	int i;
+
+	for (i = p + 1; i < ve->ve_width; i++) {
+		if (cur[i] != cur[p])
+			break;
+	}
+
+	return (i - p);
+}
+
+/*
+ * Return the length of the run of unchanged pixels starting at
+ * position <p>, or 0 if there is no previous frame to compare with.
+ */
+
+static int
+skiplen (VID_ENC * ve, uint16_t * cur, uint16_t * prev, int p)
+{
+	int i;
+
+	if (prev == NULL)
+		return (0);
+
+	for (i = p; i < ve->ve_width; i++) {
+		if (cur[i] != prev[i])
+			break;
+	}
+
+	return (i - p);
+}
+
+/*
+ * Code a single scanline. The ops are written to <ops> and the
+ * number of 16-bit words used is returned. If <prev> is NULL, this
+ * is a keyframe and no skips are allowed.
+ */
+
+static int
+encode_line (VID_ENC * ve, uint16_t * cur, uint16_t * prev, uint16_t * ops)
+{
+	int width;
+	int lit;
+	int len;
+	int n;
+	int p;
+
+	width = ve->ve_width;
+	len = 0;
+	lit = -1;
+	p = 0;
+
+	while (p < width) {
+		n = skiplen (ve, cur, prev, p);
+		if (n >= ve->ve_minskip || (n && p + n == width)) {
+			if (lit != -1) {
+				ops[lit] |= VID_OP_LIT;
+				lit = -1;
+			}
+			ops[len++] = VID_OP_SKIP | n;
+			p += n;
+			continue;
+		}
+
+		n = runlen (ve, cur, p);
+		if (n >= MIN_RUN) {
+			if (lit != -1) {
+				ops[lit] |= VID_OP_LIT;
+				lit = -1;
+			}
+			ops[len++] = VID_OP_RUN | n;
+			ops[len++] = cur[p];
+			p += n;
+			continue;
+		}
+
+		/* Start or extend a literal. */
+
+		if (lit == -1) {
+			lit = len++;
+			ops[lit] = 0;
+		}
+		ops[lit]++;
+		ops[len++] = cur[p];
+		p++;
+	}
+
+	if (lit != -1)
+		ops[lit] |= VID_OP_LIT;
+
+	/* Never do worse than coding the whole line as a literal. */
+
+	if (len > width + 1) {
+		ops[0] = VID_OP_LIT | width;
+		memcpy (ops + 1, cur, width * sizeof(uint16_t));
+		len = width + 1;
+	}
+
+	return (len);
+}
+
+/*
+ * Palette quantization. We use the median cut algorithm: start with a
+ * single box holding every distinct color, then keep splitting the box
+ * with the widest range of values along any one axis at the median
+ * pixel along that axis, until we have as many boxes as palette entries.
+ * Each palette entry is the average of the pixels in its box.
+ */
+
+#define R8(c)		((((c) >> 8) & 0xF8) | (((c) >> 13) & 0x7))
+#define G8(c)		((((c) >> 3) & 0xFC) | (((c) >> 9) & 0x3))
+#define B8(c)		((((c) << 3) & 0xF8) | (((c) >> 2) & 0x7))
+
+typedef struct pal_box {
+	int		lo;	/* First color in box */
+	int		hi;	/* One past the last color in box */
+	int		axis;	/* Widest axis */
+	int		range;	/* Range along widest axis */
+} PAL_BOX;
+
+static int
+axisval (uint16_t c, int axis)
+{
+	if (axis == 0)
+		return (R8(c));
+	if (axis == 1)
+		return (G8(c));
+	return (B8(c));
+}
+
+/*
+ * Sort <n> colors along one axis. There are only 256 possible values
+ * along each axis, so a counting sort does the job without needing any
+ * shared state, unlike qsort().
+ */
+
+static void
+sort_axis (VID_ENC * ve, uint16_t * colors, int n, int axis)
+{
+	int count[257];
+	int i;
+
+	memset (count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+		count[axisval (colors[i], axis) + 1]++;
+	for (i = 1; i < 257; i++)
+		count[i] += count[i - 1];
+	for (i = 0; i < n; i++)
+		ve->ve_sort[count[axisval (colors[i], axis)]++] = colors[i];
+	memcpy (colors, ve->ve_sort, n * sizeof(uint16_t));
+
+	return;
+}
+
+static void
+box_measure (VID_ENC * ve, PAL_BOX * b)
+{
+	int min[3] = { 255, 255, 255 };
+	int max[3] = { 0, 0, 0 };
+	int a;
+	int v;
+	int i;
+
+	for (i = b->lo; i < b->hi; i++) {
+		for (a = 0; a < 3; a++) {
+			v = axisval (ve->ve_colors[i], a);
+			if (v < min[a])
+				min[a] = v;
+			if (v > max[a])
+				max[a] = v;
+		}
+	}
+
+	b->axis = 0;
+	for (a = 1; a < 3; a++) {
+		if (max[a] - min[a] > max[b->axis] - min[b->axis])
+			b->axis = a;
+	}
+	b->range = max[b->axis] - min[b->axis];
+
+	return;
+}
+
+/*
+ * Build a palette for the <npix> pixels in <pix>. The palette is written
+ * to <pal>, and the encoder's color map is filled in with the palette
+ * index to use for each RGB565 value that appears in the pixels. Returns
+ * the number of palette entries used.
+ */
+
+static int
+quantize (VID_ENC * ve, uint16_t * pix, long npix, uint16_t * pal)
+{
+	PAL_BOX box[PAL_COLORS];
+	uint32_t * hist;
+	uint16_t * colors;
+	uint64_t sum[3];
+	uint64_t n;
+	uint64_t half;
+	long dist;
+	long best;
+	long d;
+	int ncolors;
+	int nbox;
+	int b;
+	int i;
+	int j;
+
+	hist = ve->ve_hist;
+	colors = ve->ve_colors;
+
+	memset (hist, 0, 65536 * sizeof(uint32_t));
+	for (i = 0; i < npix; i++)
+		hist[pix[i]]++;
+
+	ncolors = 0;
+	for (i = 0; i < 65536; i++) {
+		if (hist[i])
+			colors[ncolors++] = i;
+	}
+
+	box[0].lo = 0;
+	box[0].hi = ncolors;
+	box_measure (ve, &box[0]);
+	nbox = 1;
+
+	while (nbox < PAL_COLORS) {
+		/* Find the widest box that can still be split. */
+
+		b = -1;
+		for (i = 0; i < nbox; i++) {
+			if (box[i].hi - box[i].lo < 2)
+				continue;
+			if (b == -1 || box[i].range > box[b].range)
+				b = i;
+		}
+
+		if (b == -1)
+			break;
+
+		/* Sort it along that axis and split at the median pixel. */
+
+		sort_axis (ve, colors + box[b].lo, box[b].hi - box[b].lo,
+		    box[b].axis);
+
+		n = 0;
+		for (i = box[b].lo; i < box[b].hi; i++)
+			n += hist[colors[i]];
+
+		half = 0;
+		for (i = box[b].lo; i < box[b].hi - 2; i++) {
+			half += hist[colors[i]];
+			if (half * 2 >= n)
+				break;
+		}
+
+		box[nbox].lo = i + 1;
+		box[nbox].hi = box[b].hi;
+		box[b].hi = i + 1;
+		box_measure (ve, &box[b]);
+		box_measure (ve, &box[nbox]);
+		nbox++;
+	}
+
+	for (b = 0; b < nbox; b++) {
+		sum[0] = sum[1] = sum[2] = 0;
+		n = 0;
+		for (i = box[b].lo; i < box[b].hi; i++) {
+			sum[0] += (uint64_t)R8(colors[i]) * hist[colors[i]];
+			sum[1] += (uint64_t)G8(colors[i]) * hist[colors[i]];
+			sum[2] += (uint64_t)B8(colors[i]) * hist[colors[i]];
+			n += hist[colors[i]];
+		}
+		pal[b] = (((sum[0] / n) & 0xF8) << 8) |
+		    (((sum[1] / n) & 0xFC) << 3) | ((sum[2] / n) >> 3);
+	}
+
+	/* Map each color to the closest palette entry. */
+
+	for (i = 0; i < ncolors; i++) {
+		best = -1;
+		for (j = 0; j < nbox; j++) {
+			d = R8(colors[i]) - R8(pal[j]);
+			dist = d * d;
+			d = G8(colors[i]) - G8(pal[j]);
+			dist += d * d;
+			d = B8(colors[i]) - B8(pal[j]);
+			dist += d * d;
+			if (best == -1 || dist < best) {
+				best = dist;
+				ve->ve_map[colors[i]] = j;
+			}
+		}
+	}
+
+	return (nbox);
+}
+
+/*
+ * Code one chunk's worth of 12-bit samples as an IMA ADPCM block. This
+ * works the same way as the encoder in sndenc, but on 12-bit input:
+ * the samples are scaled up to 16-bit signed values, which the badge
+ * scales back down after decoding. The step index carries over from
+ * the previous chunk. Returns the size of the block in bytes.
+ */
+
+static int
+adpcm_encode (VID_ENC * ve, uint16_t * samples, int cnt, uint8_t * blk)
+{
+	int32_t pred;
+	int32_t diff;
+	int32_t vp;
+	int step;
+	uint8_t n;
+	int i;
+
+	pred = ((int32_t)samples[0] - 2048) * 16;
+	put16 (blk, (uint16_t)pred);
+	blk[2] = ve->ve_idx;
+	blk[3] = 0;
+
+	for (i = 0; i < cnt; i++) {
+		diff = ((int32_t)samples[i] - 2048) * 16 - pred;
+		n = 0;
+		if (diff < 0) {
+			n = 8;
+			diff = -diff;
+		}
+		step = adpcm_steps[ve->ve_idx];
+		vp = step >> 3;
+		if (diff >= step) {
+			n |= 4;
+			diff -= step;
+			vp += step;
+		}
+		step >>= 1;
+		if (diff >= step) {
+			n |= 2;
+			diff -= step;
+			vp += step;
+		}
+		step >>= 1;
+		if (diff >= step) {
+			n |= 1;
+			vp += step;
+		}
+
+		if (n & 8) {
+			pred -= vp;
+			if (pred < -32768)
+				pred = -32768;
+		} else {
+			pred += vp;
+			if (pred > 32767)
+				pred = 32767;
+		}
+
+		ve->ve_idx += adpcm_index[n & 7];
+		if (ve->ve_idx < 0)
+			ve->ve_idx = 0;
+		else if (ve->ve_idx > 88)
+			ve->ve_idx = 88;
+
+		if (i & 1)
+			blk[ADPCM_HDR + (i / 2)] |= n << 4;
+		else
+			blk[ADPCM_HDR + (i / 2)] = n;
+	}
+
+	return (ADPCM_HDR + (cnt + 1) / 2);
+}
+
+/*
+ * Write one chunk's worth of audio samples. Returns the number of
+ * bytes written.
+ */
+
+static int
+put_samples (VID_ENC * ve, uint16_t * samples)
+{
+	uint8_t blk[ADPCM_HDR + MAX_SAMPLES / 2];
+	uint8_t w[2];
+	int i;
+
+	if (ve->ve_adpcm) {
+		i = adpcm_encode (ve, samples, ve->ve_spc, blk);
+		fwrite (blk, i, 1, ve->ve_out);
+		return (i);
+	}
+
+	for (i = 0; i < ve->ve_spc; i++) {
+		put16 (w, samples[i]);
+		fwrite (w, sizeof(w), 1, ve->ve_out);
+	}
+
+	return (ve->ve_spc * sizeof(uint16_t));
+}
+
+static void
+frame_done (VID_ENC * ve, unsigned long fbytes)
+{
+	if (fbytes > ve->ve_maxfbytes)
+		ve->ve_maxfbytes = fbytes;
+	ve->ve_total += fbytes;
+	ve->ve_frames++;
+
+	return;
+}
+
+/*
+ * Delta code the frame in slot (frames & 1), against the frame in the
+ * other slot unless this is a keyframe.
+ */
+
+static void
+encode_delta (VID_ENC * ve)
+{
+	uint16_t ops[LINE_MAXOPS * LINE_RATE];
+	uint16_t * cur;
+	uint16_t * prev;
+	unsigned long fbytes;
+	uint8_t w[2];
+	int size;
+	int len;
+	int i;
+	int l;
+
+	size = ve->ve_width * ve->ve_height;
+	cur = ve->ve_frame + ((ve->ve_frames & 1) * size);
+
+	if (ve->ve_frames == 0 ||
+	    (ve->ve_keyint && (ve->ve_frames % ve->ve_keyint) == 0)) {
+		prev = NULL;
+		ve->ve_keys[ve->ve_nkeys++] = ftell (ve->ve_out);
+	} else
+		prev = ve->ve_frame + (((ve->ve_frames & 1) ^ 1) * size);
+
+	fbytes = 0;
+
+	for (l = 0; l < ve->ve_height; l += LINE_RATE) {
+		len = 0;
+		for (i = 0; i < LINE_RATE; i++)
+			len += encode_line (ve, cur + ((l + i) * ve->ve_width),
+			    prev == NULL ? NULL :
+			    prev + ((l + i) * ve->ve_width), ops + len);
+
+		put16 (w, len);
+		fwrite (w, sizeof(uint16_t), 1, ve->ve_out);
+		for (i = 0; i < len; i++) {
+			put16 (w, ops[i]);
+			fwrite (w, sizeof(uint16_t), 1, ve->ve_out);
+		}
+
+		fbytes += (len + 1) * sizeof(uint16_t);
+		fbytes += put_samples (ve, ve->ve_samples +
+		    ((l / LINE_RATE) * ve->ve_spc));
+	}
+
+	frame_done (ve, fbytes);
+
+	return;
+}
+
+/*
+ * Palette code the <n> frames buffered so far as one group.
+ */
+
+static void
+encode_pal8 (VID_ENC * ve, int n)
+{
+	uint16_t pal[PAL_COLORS];
+	uint8_t idx[MAX_WIDTH * LINE_RATE];
+	unsigned long fbytes;
+	uint16_t * cur;
+	uint8_t w[2];
+	int size;
+	int npal;
+	int i;
+	int j;
+	int l;
+
+	size = ve->ve_width * ve->ve_height;
+	npal = quantize (ve, ve->ve_frame, (long)n * size, pal);
+
+	for (j = 0; j < n; j++) {
+		cur = ve->ve_frame + (j * size);
+
+		/* Only the first frame in the group has a palette. */
+
+		if (j == 0) {
+			ve->ve_keys[ve->ve_nkeys++] = ftell (ve->ve_out);
+			put16 (w, npal);
+			fwrite (w, sizeof(uint16_t), 1, ve->ve_out);
+			for (i = 0; i < npal; i++) {
+				put16 (w, pal[i]);
+				fwrite (w, sizeof(uint16_t), 1, ve->ve_out);
+			}
+			fbytes = (npal + 1) * sizeof(uint16_t);
+		} else {
+			put16 (w, 0);
+			fwrite (w, sizeof(uint16_t), 1, ve->ve_out);
+			fbytes = sizeof(uint16_t);
+		}
+
+		for (l = 0; l < ve->ve_height; l += LINE_RATE) {
+			for (i = 0; i < ve->ve_width * LINE_RATE; i++)
+				idx[i] = ve->ve_map[cur[(l * ve->ve_width) +
+				    i]];
+			fwrite (idx, ve->ve_width * LINE_RATE, 1, ve->ve_out);
+			fbytes += ve->ve_width * LINE_RATE;
+			fbytes += put_samples (ve, ve->ve_samples +
+			    (j * ve->ve_pairs * ve->ve_spc) +
+			    ((l / LINE_RATE) * ve->ve_spc));
+		}
+
+		frame_done (ve, fbytes);
+	}
+
+	return;
+}
+
+/*
+ * Check the encoding parameters in <ve>, allocate the encoder state and
+ * write a placeholder header to <out>. Returns 0 on success, or -1 after
+ * printing a message if the parameters are bad.
+ */
+
+int
+vidEncStart (VID_ENC * ve, FILE * out)
+{
+	uint8_t hdr[16];
+	int nbuf;
+
+	if (ve->ve_width <= 0 || ve->ve_width > MAX_WIDTH ||
+	    ve->ve_height <= 0 || ve->ve_height % LINE_RATE) {
+		fprintf (stderr, "unsupported frame size %dx%d\n",
+		    ve->ve_width, ve->ve_height);
+		return (-1);
+	}
+
+	if (ve->ve_rate < MIN_RATE || ve->ve_rate > MAX_RATE) {
+		fprintf (stderr, "unsupported sample rate %d\n", ve->ve_rate);
+		return (-1);
+	}
+
+	ve->ve_pairs = ve->ve_height / LINE_RATE;
+
+	if (ve->ve_fps <= 0 || ve->ve_fps > 255 ||
+	    ve->ve_rate % (ve->ve_fps * ve->ve_pairs) ||
+	    ve->ve_rate / (ve->ve_fps * ve->ve_pairs) > MAX_SAMPLES) {
+		fprintf (stderr, "unsupported frame rate %d for %dx%d "
+		    "at %dHz\n", ve->ve_fps, ve->ve_width, ve->ve_height,
+		    ve->ve_rate);
+		return (-1);
+	}
+
+	if (ve->ve_keyint < 0 || ve->ve_keyint > 255) {
+		fprintf (stderr, "keyframe interval must be 0 to 255\n");
+		return (-1);
+	}
+
+	if (ve->ve_minskip < 1)
+		ve->ve_minskip = 1;
+
+	/*
+	 * Palette coded files always have an index, since every
+	 * palette group starts with a keyframe.
+	 */
+
+	if (ve->ve_codec == VID_CODEC_PAL8 && ve->ve_keyint == 0)
+		ve->ve_keyint = 1;
+
+	ve->ve_group = ve->ve_keyint;
+	nbuf = (ve->ve_codec == VID_CODEC_PAL8) ? ve->ve_group : 2;
+
+	ve->ve_spc = ve->ve_rate / (ve->ve_fps * ve->ve_pairs);
+	ve->ve_out = out;
+	ve->ve_have = 0;
+	ve->ve_nkeys = 0;
+	ve->ve_frames = 0;
+	ve->ve_idx = 0;
+	ve->ve_total = 0;
+	ve->ve_maxfbytes = 0;
+
+	ve->ve_frame = malloc (ve->ve_width * ve->ve_height *
+	    sizeof(uint16_t) * nbuf);
+	ve->ve_samples = malloc (ve->ve_pairs * ve->ve_spc *
+	    sizeof(uint16_t) * nbuf);
+	ve->ve_keys = malloc ((ve->ve_keyint ? 0xFFFF / ve->ve_keyint + 1 : 1) *
+	    sizeof(uint32_t));
+	ve->ve_hist = NULL;
+	ve->ve_colors = NULL;
+	ve->ve_sort = NULL;
+	ve->ve_map = NULL;
+
+	if (ve->ve_codec == VID_CODEC_PAL8) {
+		ve->ve_hist = malloc (65536 * sizeof(uint32_t));
+		ve->ve_colors = malloc (65536 * sizeof(uint16_t));
+		ve->ve_sort = malloc (65536 * sizeof(uint16_t));
+		ve->ve_map = malloc (65536);
+	}
+
+	if (ve->ve_frame == NULL || ve->ve_samples == NULL ||
+	    ve->ve_keys == NULL || (ve->ve_codec == VID_CODEC_PAL8 &&
+	    (ve->ve_hist == NULL || ve->ve_colors == NULL ||
+	    ve->ve_sort == NULL || ve->ve_map == NULL))) {
+		fprintf (stderr, "out of memory\n");
+		vidEncFree (ve);
+		return (-1);
+	}
+
+	/* Write a placeholder header, we fill in the frame count later. */
+
+	memset (hdr, 0, sizeof(hdr));
+	fwrite (hdr, sizeof(hdr), 1, out);
+
+	return (0);
+}
+
+/*
+ * Encode one frame, given its pixels and the samples for each of its
+ * scanline pairs. Palette coded frames are buffered until a whole group
+ * has been collected. Returns 1 if the file can't hold any more frames,
+ * otherwise 0.
+ */
+
+int
+vidEncFrame (VID_ENC * ve, uint16_t * frame, uint16_t * samples)
+{
+	size_t fsize;
+	size_t ssize;
+	int slot;
+
+	if (ve->ve_frames + ve->ve_have >= 0xFFFF)
+		return (1);
+
+	fsize = ve->ve_width * ve->ve_height * sizeof(uint16_t);
+	ssize = ve->ve_pairs * ve->ve_spc * sizeof(uint16_t);
+
+	if (ve->ve_codec == VID_CODEC_DELTA) {
+		slot = ve->ve_frames & 1;
+		memcpy ((uint8_t *)ve->ve_frame + (slot * fsize), frame, fsize);
+		memcpy (ve->ve_samples, samples, ssize);
+		encode_delta (ve);
+		return (0);
+	}
+
+	slot = ve->ve_have++;
+	memcpy ((uint8_t *)ve->ve_frame + (slot * fsize), frame, fsize);
+	memcpy ((uint8_t *)ve->ve_samples + (slot * ssize), samples, ssize);
+
+	if (ve->ve_have == ve->ve_group) {
+		encode_pal8 (ve, ve->ve_have);
+		ve->ve_have = 0;
+	}
+
+	return (0);
+}
+
+/*
+ * Code any frames still buffered, then append the seek index and go
+ * back and write the real header. The output file is left open. Returns
+ * 0 on success or -1 if the output couldn't be written.
+ */
+
+int
+vidEncFinish (VID_ENC * ve)
+{
+	uint8_t hdr[16];
+	uint8_t w[4];
+	int i;
+
+	if (ve->ve_have) {
+		encode_pal8 (ve, ve->ve_have);
+		ve->ve_have = 0;
+	}
+
+	/* Append the seek index. */
+
+	if (ve->ve_keyint) {
+		for (i = 0; i < ve->ve_nkeys; i++) {
+			put32 (w, ve->ve_keys[i]);
+			fwrite (w, sizeof(uint32_t), 1, ve->ve_out);
+		}
+	}
+
+	/* Now go back and write the real header. */
+
+	memset (hdr, 0, sizeof(hdr));
+	hdr[0] = 'V';
+	hdr[1] = 'I';
+	hdr[2] = 'D';
+	hdr[3] = VID_VERSION;
+	hdr[4] = ve->ve_codec;
+	hdr[5] = ve->ve_fps;
+	put16 (hdr + 6, ve->ve_frames);
+	put16 (hdr + 8, ve->ve_width);
+	put16 (hdr + 10, ve->ve_height);
+	put16 (hdr + 12, ve->ve_rate);
+	if (ve->ve_keyint) {
+		hdr[14] = ve->ve_keyint;
+		hdr[15] = VID_FLAG_INDEX;
+	}
+	if (ve->ve_adpcm)
+		hdr[15] |= VID_FLAG_ADPCM;
+
+	fseek (ve->ve_out, 0, SEEK_SET);
+	fwrite (hdr, sizeof(hdr), 1, ve->ve_out);
+	fflush (ve->ve_out);
+
+	return (ferror (ve->ve_out) ? -1 : 0);
+}
+
+void
+vidEncFree (VID_ENC * ve)
+{
+	free (ve->ve_frame);
+	free (ve->ve_samples);
+	free (ve->ve_keys);
+	free (ve->ve_hist);
+	free (ve->ve_colors);
+	free (ve->ve_sort);
+	free (ve->ve_map);
+	ve->ve_frame = NULL;
+	ve->ve_samples = NULL;
+	ve->ve_keys = NULL;
+	ve->ve_hist = NULL;
+	ve->ve_colors = NULL;
+	ve->ve_sort = NULL;
+	ve->ve_map = NULL;
+
+	return;
+}
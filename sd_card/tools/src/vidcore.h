@@ -0,0 +1,65 @@
+#ifndef _VIDCORE_H_
+#define _VIDCORE_H_
+
+/*
+ * Video encoder shared by videnc and vidbuild. All of the encoder state
+ * lives in a VID_ENC, so several clips can be encoded at once from
+ * different threads.
+ */
+
+#define FRAME_WIDTH		128
+#define FRAME_HEIGHT		96
+#define MAX_WIDTH		320
+#define LINE_RATE		2
+#define SAMPLE_RATE		9216
+#define MIN_RATE		4000
+#define MAX_RATE		16000
+#define MAX_SAMPLES		48
+
+#define VID_VERSION		2
+#define VID_CODEC_DELTA		1
+#define VID_CODEC_PAL8		2
+#define VID_FLAG_INDEX		0x01
+#define VID_FLAG_ADPCM		0x02
+
+#define PAL_COLORS		256
+
+typedef struct vid_enc {
+	/* Filled in by the caller */
+	int		ve_codec;	/* VID_CODEC_xxx */
+	int		ve_fps;		/* Frames per second */
+	int		ve_width;	/* Frame size */
+	int		ve_height;
+	int		ve_rate;	/* Audio sample rate */
+	int		ve_keyint;	/* Keyframe interval, 0 for none */
+	int		ve_minskip;	/* Shortest skip worth coding */
+	int		ve_adpcm;	/* Code the audio as IMA ADPCM */
+
+	/* Worked out by vidEncStart() */
+	int		ve_pairs;	/* Scanline pairs per frame */
+	int		ve_spc;		/* Audio samples per pair */
+
+	/* Encoder state */
+	FILE *		ve_out;
+	uint16_t *	ve_frame;
+	uint16_t *	ve_samples;
+	uint32_t *	ve_keys;
+	uint32_t *	ve_hist;
+	uint16_t *	ve_colors;
+	uint16_t *	ve_sort;
+	uint8_t *	ve_map;
+	int		ve_group;
+	int		ve_have;
+	int		ve_nkeys;
+	int		ve_frames;
+	int		ve_idx;
+	unsigned long	ve_total;
+	unsigned long	ve_maxfbytes;
+} VID_ENC;
+
+extern int vidEncStart (VID_ENC *, FILE *);
+extern int vidEncFrame (VID_ENC *, uint16_t *, uint16_t *);
+extern int vidEncFinish (VID_ENC *);
+extern void vidEncFree (VID_ENC *);
+
+#endif /* _VIDCORE_H_ */
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * This program decodes a version 2 video file produced by videnc back
+ * into its raw video and audio streams: a file of sequential RGB565
+ * frames and a file of 12-bit audio samples stored 16 bits per sample.
+ * The frame size and sample rate are taken from the header, defaulting
+ * to 128x96 and 9216Hz if they aren't set. It follows the same rules as the decoder in the badge video
+ * player, except that it keeps a copy of the previous frame in memory
+ * instead of relying on the display to remember it.
+ *
+ * ADPCM coded audio is decoded back to 12-bit samples. Like the palette
+ * codec, it's lossy, so the audio won't match the original exactly.
+ *
+ * Palette coded files are expanded back to RGB565 through their palettes.
+ * Since the palette codec is lossy, the result won't match the original
+ * frames exactly, but it shows what the badge will display.
+ *
+ * If the file has a seek index, we also check that each entry points at
+ * the right frame, and that the keyframes really don't depend on the
+ * frames before them.
+ *
+ * The output should be bit-for-bit identical to the input given to videnc
+ * (minus the first video frame, which videnc drops), so check_video.sh
+ * ("make check") uses this to check the encoder output with cmp(1). It's also handy for
+ * looking at an encoded file with ffplay.
+ *
+ * Usage: viddec input.vid video.bin audio.raw
+ */
+
+#define FRAME_WIDTH		128
+#define FRAME_HEIGHT		96
+#define MAX_WIDTH		320
+#define LINE_RATE		2
+#define SAMPLE_RATE		9216
+#define MAX_SAMPLES		48
+
+#define VID_VERSION		2
+#define VID_CODEC_RAW		0
+#define VID_CODEC_DELTA		1
+#define VID_CODEC_PAL8		2
+#define PAL_COLORS		256
+#define VID_FLAG_INDEX		0x01
+#define VID_FLAG_ADPCM		0x02
+#define ADPCM_HDR		4
+
+#define VID_OP_SKIP		0x0000
+#define VID_OP_RUN		0x4000
+#define VID_OP_LIT		0x8000
+#define VID_OP_MASK		0xC000
+#define VID_OP_COUNT		0x3FFF
+
+static int width;
+static int height;
+
+static const int16_t adpcm_steps[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t adpcm_index[8] = {
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+/*
+ * Decode an IMA ADPCM audio block, the same way as the badge does.
+ */
+
+static void
+adpcm_decode (uint8_t * blk, uint16_t * p, int cnt)
+{
+	int32_t pred;
+	int32_t diff;
+	int index;
+	int step;
+	uint8_t n;
+	int i;
+
+	pred = (int16_t)(blk[0] | (blk[1] << 8));
+	index = blk[2];
+	if (index > 88)
+		index = 88;
+
+	for (i = 0; i < cnt; i++) {
+		n = blk[ADPCM_HDR + (i / 2)];
+		if (i & 1)
+			n >>= 4;
+		step = adpcm_steps[index];
+		diff = step >> 3;
+		if (n & 4)
+			diff += step;
+		if (n & 2)
+			diff += step >> 1;
+		if (n & 1)
+			diff += step >> 2;
+		if (n & 8) {
+			pred -= diff;
+			if (pred < -32768)
+				pred = -32768;
+		} else {
+			pred += diff;
+			if (pred > 32767)
+				pred = 32767;
+		}
+		index += adpcm_index[n & 7];
+		if (index < 0)
+			index = 0;
+		else if (index > 88)
+			index = 88;
+		p[i] = (pred + 32768) >> 4;
+	}
+
+	return;
+}
+
+static int
+get16 (FILE * fp, uint16_t * v)
+{
+	uint8_t b[2];
+
+	if (fread (b, sizeof(b), 1, fp) != 1)
+		return (-1);
+
+	*v = b[0] | (b[1] << 8);
+
+	return (0);
+}
+
+/*
+ * Decode the ops for one scanline into <line>. Returns the number of
+ * words consumed, or -1 if the coded data is bad. Keyframes, flagged
+ * by <key>, must not contain any skips.
+ */
+
+static int
+decode_line (uint16_t * op, int len, uint16_t * line, int key)
+{
+	int used;
+	int cnt;
+	int p;
+	int i;
+
+	used = 0;
+	p = 0;
+
+	while (p < width) {
+		if (used >= len)
+			return (-1);
+
+		cnt = op[used] & VID_OP_COUNT;
+		if (cnt == 0 || p + cnt > width)
+			return (-1);
+
+		switch (op[used] & VID_OP_MASK) {
+		case VID_OP_SKIP:
+			if (key)
+				return (-1);
+			used++;
+			break;
+		case VID_OP_RUN:
+			if (used + 1 >= len)
+				return (-1);
+			for (i = 0; i < cnt; i++)
+				line[p + i] = op[used + 1];
+			used += 2;
+			break;
+		case VID_OP_LIT:
+			if (used + cnt >= len)
+				return (-1);
+			memcpy (line + p, op + used + 1,
+			    cnt * sizeof(uint16_t));
+			used += cnt + 1;
+			break;
+		default:
+			return (-1);
+		}
+
+		p += cnt;
+	}
+
+	return (used);
+}
+
+int
+main (int argc, char * argv[])
+{
+	FILE * in;
+	FILE * audio;
+	FILE * video;
+	uint16_t * frame;
+	uint16_t ops[(MAX_WIDTH + 1) * LINE_RATE];
+	uint16_t samples[MAX_SAMPLES];
+	uint8_t blk[ADPCM_HDR + MAX_SAMPLES / 2];
+	uint16_t pal[PAL_COLORS];
+	uint8_t * idx;
+	uint8_t hdr[16];
+	uint16_t len;
+	uint32_t * keys;
+	uint32_t ofs;
+	size_t fsize;
+	int keyint;
+	int nkeys;
+	int key;
+	int frames;
+	int codec;
+	int rate;
+	int spc;
+	int used;
+	int i;
+	int l;
+
+	if (argc != 4) {
+		fprintf (stderr, "\nUsage: %s input.vid video.bin "
+		    "audio.raw\n\n", argv[0]);
+		exit (1);
+	}
+
+	in = fopen (argv[1], "r");
+
+	if (in == NULL) {
+		fprintf (stderr, "[%s]: ", argv[1]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	if (fread (hdr, sizeof(hdr), 1, in) != 1 || hdr[0] != 'V' ||
+	    hdr[1] != 'I' || hdr[2] != 'D' || hdr[3] != VID_VERSION) {
+		fprintf (stderr, "[%s]: not a version 2 video file\n", argv[1]);
+		exit (1);
+	}
+
+	codec = hdr[4];
+	if (codec > VID_CODEC_PAL8) {
+		fprintf (stderr, "[%s]: unknown codec %d\n", argv[1], codec);
+		exit (1);
+	}
+	width = hdr[8] | (hdr[9] << 8);
+	height = hdr[10] | (hdr[11] << 8);
+	rate = hdr[12] | (hdr[13] << 8);
+	if (width == 0)
+		width = FRAME_WIDTH;
+	if (height == 0)
+		height = FRAME_HEIGHT;
+	if (rate == 0)
+		rate = SAMPLE_RATE;
+
+	if (width > MAX_WIDTH || height % LINE_RATE) {
+		fprintf (stderr, "[%s]: bad frame size %dx%d\n", argv[1],
+		    width, height);
+		exit (1);
+	}
+
+	if (hdr[5] == 0 || rate % (hdr[5] * (height / LINE_RATE))) {
+		fprintf (stderr, "[%s]: bad frame rate %d\n", argv[1], hdr[5]);
+		exit (1);
+	}
+	spc = rate / (hdr[5] * (height / LINE_RATE));
+	if (spc > MAX_SAMPLES) {
+		fprintf (stderr, "[%s]: bad frame rate %d\n", argv[1], hdr[5]);
+		exit (1);
+	}
+
+	video = fopen (argv[2], "w");
+
+	if (video == NULL) {
+		fprintf (stderr, "[%s]: ", argv[2]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	audio = fopen (argv[3], "w");
+
+	if (audio == NULL) {
+		fprintf (stderr, "[%s]: ", argv[3]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	fsize = width * height * sizeof(uint16_t);
+	frame = calloc (1, fsize);
+
+	if (frame == NULL) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+
+	keyint = 0;
+	if (codec != VID_CODEC_RAW && hdr[15] & VID_FLAG_INDEX)
+		keyint = hdr[14];
+	keys = malloc ((keyint ? 0xFFFF / keyint + 1 : 1) * sizeof(uint32_t));
+
+	if (keys == NULL) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+
+	frames = 0;
+	nkeys = 0;
+	idx = (uint8_t *)ops;
+
+	while (1) {
+		/*
+		 * With a seek index, the frame count tells us where
+		 * the video ends and the index begins.
+		 */
+
+		if (keyint && frames == (hdr[6] | (hdr[7] << 8)))
+			goto done;
+
+		key = 0;
+		if (keyint && (frames % keyint) == 0) {
+			keys[nkeys++] = ftell (in);
+			key = 1;
+		}
+
+		/*
+		 * Palette coded frames start with a palette, which may
+		 * be empty if the frame reuses the last one. Keyframes
+		 * and the first frame must have a palette.
+		 */
+
+		if (codec == VID_CODEC_PAL8) {
+			if (get16 (in, &len) != 0)
+				goto done;
+			if (len > PAL_COLORS || (len == 0 &&
+			    (key || frames == 0)))
+				goto bad;
+			for (i = 0; i < len; i++) {
+				if (get16 (in, &pal[i]) != 0)
+					goto done;
+			}
+		}
+
+		for (l = 0; l < height; l += LINE_RATE) {
+			if (codec == VID_CODEC_PAL8) {
+				if (fread (idx, width * LINE_RATE, 1, in) != 1)
+					goto done;
+				len = 0;
+			} else if (codec == VID_CODEC_RAW)
+				len = width * LINE_RATE;
+			else if (get16 (in, &len) != 0)
+				goto done;
+
+			if (len > (width + 1) * LINE_RATE)
+				goto bad;
+
+			for (i = 0; i < len; i++) {
+				if (get16 (in, &ops[i]) != 0)
+					goto done;
+			}
+
+			if (hdr[15] & VID_FLAG_ADPCM) {
+				if (fread (blk, ADPCM_HDR + (spc + 1) / 2,
+				    1, in) != 1)
+					goto done;
+				adpcm_decode (blk, samples, spc);
+			} else {
+				for (i = 0; i < spc; i++) {
+					if (get16 (in, &samples[i]) != 0)
+						goto done;
+				}
+			}
+
+			if (codec == VID_CODEC_PAL8) {
+				for (i = 0; i < width * LINE_RATE; i++)
+					frame[(l * width) + i] = pal[idx[i]];
+			} else if (codec == VID_CODEC_RAW) {
+				memcpy (frame + (l * width), ops,
+				    len * sizeof(uint16_t));
+			} else {
+				used = decode_line (ops, len,
+				    frame + (l * width), key);
+				if (used == -1)
+					goto bad;
+				if (decode_line (ops + used, len - used,
+				    frame + ((l + 1) * width), key) == -1)
+					goto bad;
+			}
+
+			fwrite (samples, sizeof(uint16_t), spc, audio);
+		}
+
+		fwrite (frame, fsize, 1, video);
+		frames++;
+	}
+
+bad:
+	fprintf (stderr, "[%s]: corrupt data in frame %d\n", argv[1], frames);
+	exit (1);
+
+done:
+	for (i = 0; i < nkeys; i++) {
+		if (get16 (in, &len) != 0)
+			break;
+		ofs = len;
+		if (get16 (in, &len) != 0)
+			break;
+		ofs |= (uint32_t)len << 16;
+		if (ofs != keys[i])
+			break;
+	}
+
+	if (i != nkeys || fgetc (in) != EOF) {
+		fprintf (stderr, "[%s]: bad seek index\n", argv[1]);
+		exit (1);
+	}
+
+	fclose (in);
+	fclose (video);
+	fclose (audio);
+	free (frame);
+	free (keys);
+
+	if (frames != (hdr[6] | (hdr[7] << 8))) {
+		fprintf (stderr, "[%s]: expected %d frames, got %d\n", argv[1],
+		    hdr[6] | (hdr[7] << 8), frames);
+		exit (1);
+	}
+
+	exit(0);
+}
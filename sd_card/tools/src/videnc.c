@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vidcore.h"
+
+/*
+ * This program merges a video and audio stream together into a version 2
+ * video file for playback on the Kinetis KW01 using our video player. The
+ * input streams are the same as for videomerge: a file containing
+ * sequential frames in 16-bit RGB565 pixel format, and a file containing
+ * 12-bit audio samples stored 16 bits per sample. By default the frames
+ * are 128x96 and the audio is sampled at 9216Hz, but other frame sizes
+ * and rates can be selected with -g and -a.
+ *
+ * The file format and the encoder itself are described in vidcore.c.
+ * With -c pal8 the video is stored using the palette codec, and with -A
+ * the audio is stored as IMA ADPCM.
+ *
+ * As with videomerge, we drop the first video frame to keep the audio
+ * and video in sync.
+ *
+ * Usage: videnc [-c delta|pal8] [-r fps] [-g WxH] [-a rate] [-A]
+ *	[-k keyframe interval] [-s min skip] video audio out
+ */
+
+static void
+usage (char * prog)
+{
+	fprintf (stderr, "\nUsage: %s [-c delta|pal8] [-r fps] [-g WxH] "
+	    "[-a rate] [-A] [-k keyframe interval] [-s min skip] video "
+	    "audio output\n\n", prog);
+	exit (1);
+}
+
+int
+main (int argc, char * argv[])
+{
+	VID_ENC ve;
+	FILE * audio;
+	FILE * video;
+	FILE * out;
+	uint16_t * frame;
+	uint16_t * samples;
+	size_t fsize;
+	int ch;
+
+	memset (&ve, 0, sizeof(ve));
+	ve.ve_codec = VID_CODEC_DELTA;
+	ve.ve_fps = 8;
+	ve.ve_width = FRAME_WIDTH;
+	ve.ve_height = FRAME_HEIGHT;
+	ve.ve_rate = SAMPLE_RATE;
+	ve.ve_minskip = 4;
+
+	while ((ch = getopt (argc, argv, "c:r:g:a:Ak:s:")) != -1) {
+		switch (ch) {
+		case 'c':
+			if (strcmp (optarg, "delta") == 0)
+				ve.ve_codec = VID_CODEC_DELTA;
+			else if (strcmp (optarg, "pal8") == 0)
+				ve.ve_codec = VID_CODEC_PAL8;
+			else
+				usage (argv[0]);
+			break;
+		case 'r':
+			ve.ve_fps = atoi (optarg);
+			break;
+		case 'g':
+			if (sscanf (optarg, "%dx%d", &ve.ve_width,
+			    &ve.ve_height) != 2)
+				usage (argv[0]);
+			break;
+		case 'a':
+			ve.ve_rate = atoi (optarg);
+			break;
+		case 'A':
+			ve.ve_adpcm = 1;
+			break;
+		case 'k':
+			ve.ve_keyint = atoi (optarg);
+			break;
+		case 's':
+			ve.ve_minskip = atoi (optarg);
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 3)
+		usage (argv[-optind]);
+
+	video = fopen (argv[0], "r");
+
+	if (video == NULL) {
+		fprintf (stderr, "[%s]: ", argv[0]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	audio = fopen (argv[1], "r");
+
+        if (audio == NULL) {
+		fprintf (stderr, "[%s]: ", argv[1]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	out = fopen (argv[2], "w");
+
+	if (out == NULL) {
+		fprintf (stderr, "[%s]: ", argv[2]);
+		perror ("file open failed");
+		exit (1);
+	}
+
+	if (vidEncStart (&ve, out) != 0)
+		exit (1);
+
+	fsize = ve.ve_width * ve.ve_height * sizeof(uint16_t);
+	frame = malloc (fsize);
+	samples = malloc (ve.ve_pairs * ve.ve_spc * sizeof(uint16_t));
+
+	if (frame == NULL || samples == NULL) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+
+	/* Hack: skip the first frame. */
+
+	fread (frame, fsize, 1, video);
+
+	while (fread (frame, fsize, 1, video) == 1) {
+		if (fread (samples, ve.ve_spc * sizeof(uint16_t),
+		    ve.ve_pairs, audio) != (size_t)ve.ve_pairs)
+			break;
+		if (vidEncFrame (&ve, frame, samples) != 0)
+			break;
+	}
+
+	if (vidEncFinish (&ve) != 0) {
+		fprintf (stderr, "[%s]: ", argv[2]);
+		perror ("write failed");
+		exit (1);
+	}
+
+	fclose (video);
+	fclose (audio);
+	fclose (out);
+
+	free (frame);
+	free (samples);
+	vidEncFree (&ve);
+
+	if (ve.ve_frames) {
+		printf ("%d frames at %d fps, %lu bytes/frame average, "
+		    "%lu max, %lu raw\n", ve.ve_frames, ve.ve_fps,
+		    ve.ve_total / ve.ve_frames, ve.ve_maxfbytes,
+		    (unsigned long)(ve.ve_width * ve.ve_height +
+		    ve.ve_pairs * ve.ve_spc) * sizeof(uint16_t));
+	}
+
+	exit(0);
+}